@@ -0,0 +1 @@
+SmokeBatch.exe -Size:64 -Steps:300 -Output:. -Interval:30 -FrameWidth:800 -FrameHeight:600
@@ -0,0 +1 @@
+SmokeBench.exe -Sizes:32,64,128,256 -Json:SmokeBench.json
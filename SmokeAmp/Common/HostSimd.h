@@ -0,0 +1,78 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86	1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#else
+#define SIMD_X86	0
+#endif
+
+// Instruction sets of the vectorized host kernels, in increasing order
+enum SimdLevel : uint8_t
+{
+	SIMD_SCALAR,				// Per-cell code, on any CPU
+	SIMD_AVX2,					// 8 cells per instruction
+	SIMD_AVX512					// 16 cells per instruction (AVX-512F)
+};
+
+static inline const char *SimdLevelName(const SimdLevel level)
+{
+	static const char *const szNames[] = { "scalar", "avx2", "avx512" };
+
+	return szNames[level];
+}
+
+//--------------------------------------------------------------------------------------
+// The widest level the CPU and the OS both support: CPUID reports the instructions,
+// and XGETBV whether the OS saves the YMM and ZMM registers across context switches.
+//--------------------------------------------------------------------------------------
+
+static inline SimdLevel DetectSimdLevel()
+{
+#if SIMD_X86
+	uint32_t aInfo[4] = {};
+	const auto cpuid = [&aInfo](const uint32_t uLeaf, const uint32_t uSubLeaf)
+	{
+#ifdef _MSC_VER
+		__cpuidex(reinterpret_cast<int*>(aInfo), static_cast<int>(uLeaf), static_cast<int>(uSubLeaf));
+#else
+		__cpuid_count(uLeaf, uSubLeaf, aInfo[0], aInfo[1], aInfo[2], aInfo[3]);
+#endif
+	};
+
+	cpuid(0, 0);
+	if (aInfo[0] < 7) return SIMD_SCALAR;
+
+	// OSXSAVE and AVX
+	cpuid(1, 0);
+	if ((aInfo[2] & (1u << 27)) == 0 || (aInfo[2] & (1u << 28)) == 0) return SIMD_SCALAR;
+
+#ifdef _MSC_VER
+	const auto uXCR0 = static_cast<uint64_t>(_xgetbv(0));
+#else
+	uint32_t uLow, uHigh;
+	__asm__ volatile("xgetbv" : "=a"(uLow), "=d"(uHigh) : "c"(0));
+	const auto uXCR0 = (static_cast<uint64_t>(uHigh) << 32) | uLow;
+#endif
+	if ((uXCR0 & 0x06) != 0x06) return SIMD_SCALAR;				// XMM and YMM state
+
+	cpuid(7, 0);
+	const auto bAVX2 = (aInfo[1] & (1u << 5)) != 0;
+	const auto bAVX512F = (aInfo[1] & (1u << 16)) != 0;
+	if (bAVX512F && (uXCR0 & 0xe6) == 0xe6) return SIMD_AVX512;	// Opmask and ZMM state too
+
+	return bAVX2 ? SIMD_AVX2 : SIMD_SCALAR;
+#else
+	return SIMD_SCALAR;
+#endif
+}
@@ -0,0 +1,170 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Trace.h"
+
+//--------------------------------------------------------------------------------------
+// Persistent worker threads, the host counterpart of an accelerator view.
+// ParallelFor splits a range (typically the slabs of a grid) into chunks that the
+// workers and the calling thread consume until the whole range is done.
+//--------------------------------------------------------------------------------------
+
+class HostThreadPool
+{
+public:
+	HostThreadPool(const uint32_t uNumThreads = 0);
+	~HostThreadPool();
+
+	HostThreadPool(const HostThreadPool &) = delete;
+	HostThreadPool &operator=(const HostThreadPool &) = delete;
+
+	template<typename F>
+	void ParallelFor(const int32_t iBegin, const int32_t iEnd, const F &func);
+
+	uint32_t GetNumThreads() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+
+protected:
+	void dispatch(const std::function<void(uint32_t)> &task, const uint32_t uNumTasks);
+	void runTasks();
+	void worker();
+
+	std::vector<std::thread>				m_threads;
+	std::mutex								m_mutex;
+	std::condition_variable					m_cvTask;
+	std::condition_variable					m_cvDone;
+
+	const std::function<void(uint32_t)>		*m_pTask;
+	uint32_t								m_uNumTasks;
+	std::atomic<uint32_t>					m_uNextTask;
+	std::atomic<uint32_t>					m_uDoneTasks;
+	uint32_t								m_uActive;
+	uint64_t								m_uGeneration;
+	bool									m_bQuit;
+};
+
+using upHostThreadPool = std::unique_ptr<HostThreadPool>;
+using spHostThreadPool = std::shared_ptr<HostThreadPool>;
+
+inline HostThreadPool::HostThreadPool(const uint32_t uNumThreads) :
+	m_pTask(nullptr),
+	m_uNumTasks(0),
+	m_uNextTask(0),
+	m_uDoneTasks(0),
+	m_uActive(0),
+	m_uGeneration(0),
+	m_bQuit(false)
+{
+	auto uCount = uNumThreads > 0 ? uNumThreads : std::thread::hardware_concurrency();
+	uCount = uCount > 1 ? uCount : 1;
+
+	// The calling thread takes part in every dispatch
+	m_threads.reserve(uCount - 1);
+	for (auto i = 1u; i < uCount; ++i) m_threads.emplace_back(&HostThreadPool::worker, this);
+}
+
+inline HostThreadPool::~HostThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bQuit = true;
+	}
+	m_cvTask.notify_all();
+
+	for (auto &thread : m_threads) thread.join();
+}
+
+template<typename F>
+inline void HostThreadPool::ParallelFor(const int32_t iBegin, const int32_t iEnd, const F &func)
+{
+	if (iEnd <= iBegin) return;
+
+	const auto uRange = static_cast<uint32_t>(iEnd - iBegin);
+	const auto uNumTasks = (std::min)(uRange, GetNumThreads() * 4);
+
+	if (uNumTasks <= 1 || m_threads.empty())
+	{
+		for (auto i = iBegin; i < iEnd; ++i) func(i);
+		return;
+	}
+
+	const std::function<void(uint32_t)> task = [&](const uint32_t uTask)
+	{
+		const auto iChunkBegin = iBegin + static_cast<int32_t>(uint64_t(uRange) * uTask / uNumTasks);
+		const auto iChunkEnd = iBegin + static_cast<int32_t>(uint64_t(uRange) * (uTask + 1) / uNumTasks);
+		for (auto i = iChunkBegin; i < iChunkEnd; ++i) func(i);
+	};
+
+	dispatch(task, uNumTasks);
+}
+
+inline void HostThreadPool::dispatch(const std::function<void(uint32_t)> &task, const uint32_t uNumTasks)
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// A worker woken late for the previous dispatch must leave before the counters are reset
+		m_cvDone.wait(lock, [this]() { return m_uActive == 0; });
+
+		m_pTask = &task;
+		m_uNumTasks = uNumTasks;
+		m_uNextTask = 0;
+		m_uDoneTasks = 0;
+		++m_uGeneration;
+	}
+	m_cvTask.notify_all();
+
+	runTasks();
+
+	// Stragglers show up as the time the caller spends here
+	TRACE_SCOPE("HostThreadPool::wait");
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cvDone.wait(lock, [this]() { return m_uDoneTasks == m_uNumTasks; });
+	m_pTask = nullptr;
+}
+
+inline void HostThreadPool::runTasks()
+{
+	TRACE_SCOPE("HostThreadPool::runTasks");
+
+	for (auto uTask = m_uNextTask++; uTask < m_uNumTasks; uTask = m_uNextTask++)
+	{
+		(*m_pTask)(uTask);
+
+		if (++m_uDoneTasks == m_uNumTasks)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_cvDone.notify_all();
+		}
+	}
+}
+
+inline void HostThreadPool::worker()
+{
+	auto uGeneration = 0ull;
+
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cvTask.wait(lock, [&]() { return m_bQuit || m_uGeneration != uGeneration; });
+		if (m_bQuit) return;
+
+		uGeneration = m_uGeneration;
+		++m_uActive;
+		lock.unlock();
+
+		runTasks();
+
+		lock.lock();
+		if (--m_uActive == 0) m_cvDone.notify_all();
+	}
+}
@@ -0,0 +1,138 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//--------------------------------------------------------------------------------------
+// Read-only memory mapping of a whole file. The pages are brought in on first touch,
+// so a reader only pays for the parts it looks at.
+//--------------------------------------------------------------------------------------
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool Open(const char *szFileName);
+	void Close();
+
+	const uint8_t *GetData() const { return m_pData; }
+	uint64_t GetSize() const { return m_uSize; }
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+protected:
+#ifdef _WIN32
+	HANDLE			m_hFile;
+	HANDLE			m_hMapping;
+#else
+	int				m_iFile;
+#endif
+	const uint8_t	*m_pData;
+	uint64_t		m_uSize;
+};
+
+#ifdef _WIN32
+
+inline MappedFile::MappedFile() :
+	m_hFile(INVALID_HANDLE_VALUE),
+	m_hMapping(nullptr),
+	m_pData(nullptr),
+	m_uSize(0)
+{
+}
+
+inline bool MappedFile::Open(const char *szFileName)
+{
+	Close();
+
+	m_hFile = CreateFileA(szFileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (m_hFile == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart <= 0) return Close(), false;
+	m_uSize = static_cast<uint64_t>(size.QuadPart);
+
+	m_hMapping = CreateFileMappingA(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!m_hMapping) return Close(), false;
+
+	m_pData = static_cast<const uint8_t*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_pData) return Close(), false;
+
+	return true;
+}
+
+inline void MappedFile::Close()
+{
+	if (m_pData) UnmapViewOfFile(m_pData);
+	if (m_hMapping) CloseHandle(m_hMapping);
+	if (m_hFile != INVALID_HANDLE_VALUE) CloseHandle(m_hFile);
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = nullptr;
+	m_pData = nullptr;
+	m_uSize = 0;
+}
+
+#else
+
+inline MappedFile::MappedFile() :
+	m_iFile(-1),
+	m_pData(nullptr),
+	m_uSize(0)
+{
+}
+
+inline bool MappedFile::Open(const char *szFileName)
+{
+	Close();
+
+	m_iFile = open(szFileName, O_RDONLY);
+	if (m_iFile < 0) return false;
+
+	struct stat status;
+	if (fstat(m_iFile, &status) != 0 || status.st_size <= 0) return Close(), false;
+	m_uSize = static_cast<uint64_t>(status.st_size);
+
+	const auto pData = mmap(nullptr, m_uSize, PROT_READ, MAP_SHARED, m_iFile, 0);
+	if (pData == MAP_FAILED) return Close(), false;
+	m_pData = static_cast<const uint8_t*>(pData);
+
+	return true;
+}
+
+inline void MappedFile::Close()
+{
+	if (m_pData) munmap(const_cast<uint8_t*>(m_pData), m_uSize);
+	if (m_iFile >= 0) close(m_iFile);
+	m_iFile = -1;
+	m_pData = nullptr;
+	m_uSize = 0;
+}
+
+#endif
+
+inline MappedFile::~MappedFile()
+{
+	Close();
+}
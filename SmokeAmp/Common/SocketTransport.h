@@ -0,0 +1,277 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include "Transport.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+using SocketHandle = SOCKET;
+#define SOCKET_NONE		INVALID_SOCKET
+#define CloseSocket		closesocket
+#define SEND_FLAGS		0
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+using SocketHandle = int;
+#define SOCKET_NONE		-1
+#define CloseSocket		close
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS		MSG_NOSIGNAL
+#else
+#define SEND_FLAGS		0
+#endif
+#endif
+
+//--------------------------------------------------------------------------------------
+// One stream socket per pair of ranks. Each rank listens on its own endpoint, which is
+// "host:port" for TCP between nodes or a file path for a Unix-domain socket on one
+// machine. Connect() dials every lower rank (retrying until the timeout while the peer
+// starts up) and accepts every higher one, so all ranks take the same endpoint list.
+//--------------------------------------------------------------------------------------
+
+class SocketTransport : public Transport
+{
+public:
+	SocketTransport(const uint32_t uRank, const std::vector<std::string> &endpoints);
+	virtual ~SocketTransport();
+
+	bool Connect(const uint32_t uTimeout = 60000);
+
+	bool Send(const uint32_t uPeer, const void *pData, const size_t uSize) override;
+	bool Receive(const uint32_t uPeer, void *pData, const size_t uSize) override;
+
+protected:
+	struct Address
+	{
+		sockaddr_storage	addr;
+		socklen_t			uLength;
+		int					iFamily;
+	};
+
+	bool resolve(const std::string &endpoint, const bool bPassive, Address &address) const;
+	bool listen();
+	SocketHandle dial(const Address &address, const uint32_t uTimeout) const;
+	static bool sendAll(const SocketHandle socket, const void *pData, const size_t uSize);
+	static bool receiveAll(const SocketHandle socket, void *pData, const size_t uSize);
+	static void setNoDelay(const SocketHandle socket, const int iFamily);
+
+	std::vector<std::string>	m_endpoints;
+	std::vector<SocketHandle>	m_sockets;
+	SocketHandle				m_listener;
+	int							m_iFamily;
+	bool						m_bUnlink;
+};
+
+inline SocketTransport::SocketTransport(const uint32_t uRank, const std::vector<std::string> &endpoints) :
+	Transport(uRank, static_cast<uint32_t>(endpoints.size())),
+	m_endpoints(endpoints),
+	m_sockets(endpoints.size(), SOCKET_NONE),
+	m_listener(SOCKET_NONE),
+	m_iFamily(AF_UNSPEC),
+	m_bUnlink(false)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+}
+
+inline SocketTransport::~SocketTransport()
+{
+	for (const auto &socket : m_sockets)
+		if (socket != SOCKET_NONE) CloseSocket(socket);
+	if (m_listener != SOCKET_NONE) CloseSocket(m_listener);
+	if (m_bUnlink) remove(m_endpoints[m_uRank].c_str());
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+inline bool SocketTransport::Connect(const uint32_t uTimeout)
+{
+	// Listen before dialing, so that the higher ranks can queue up in the backlog
+	if (m_uRank + 1 < m_uNumRanks && !listen()) return false;
+
+	for (auto i = 0u; i < m_uRank; ++i)
+	{
+		auto address = Address();
+		if (!resolve(m_endpoints[i], false, address)) return false;
+		m_sockets[i] = dial(address, uTimeout);
+		if (m_sockets[i] == SOCKET_NONE) return false;
+
+		// Introduce ourselves: the listener cannot tell the ranks apart otherwise
+		if (!Send(i, &m_uRank, sizeof(m_uRank))) return false;
+	}
+
+	for (auto i = m_uRank + 1; i < m_uNumRanks; ++i)
+	{
+		const auto socket = accept(m_listener, nullptr, nullptr);
+		if (socket == SOCKET_NONE) return false;
+
+		auto uPeer = m_uNumRanks;
+		if (!receiveAll(socket, &uPeer, sizeof(uPeer)) || uPeer <= m_uRank || uPeer >= m_uNumRanks ||
+			m_sockets[uPeer] != SOCKET_NONE)
+		{
+			CloseSocket(socket);
+
+			return false;
+		}
+		setNoDelay(socket, m_iFamily);
+		m_sockets[uPeer] = socket;
+	}
+
+	return true;
+}
+
+inline bool SocketTransport::Send(const uint32_t uPeer, const void *pData, const size_t uSize)
+{
+	return sendAll(m_sockets[uPeer], pData, uSize);
+}
+
+inline bool SocketTransport::Receive(const uint32_t uPeer, void *pData, const size_t uSize)
+{
+	return receiveAll(m_sockets[uPeer], pData, uSize);
+}
+
+inline bool SocketTransport::sendAll(const SocketHandle socket, const void *pData, const size_t uSize)
+{
+	auto pBytes = static_cast<const char*>(pData);
+	for (auto uLeft = uSize; uLeft > 0;)
+	{
+		const auto iChunk = static_cast<int>((std::min)(uLeft, size_t(1) << 30));
+		const auto iSent = send(socket, pBytes, iChunk, SEND_FLAGS);
+		if (iSent <= 0) return false;
+		pBytes += iSent;
+		uLeft -= iSent;
+	}
+
+	return true;
+}
+
+inline bool SocketTransport::receiveAll(const SocketHandle socket, void *pData, const size_t uSize)
+{
+	auto pBytes = static_cast<char*>(pData);
+	for (auto uLeft = uSize; uLeft > 0;)
+	{
+		const auto iChunk = static_cast<int>((std::min)(uLeft, size_t(1) << 30));
+		const auto iReceived = recv(socket, pBytes, iChunk, 0);
+		if (iReceived <= 0) return false;
+		pBytes += iReceived;
+		uLeft -= iReceived;
+	}
+
+	return true;
+}
+
+inline bool SocketTransport::resolve(const std::string &endpoint, const bool bPassive, Address &address) const
+{
+	// A trailing ":port" without path separators is TCP; anything else names a socket file
+	const auto uColon = endpoint.rfind(':');
+	const auto bTCP = uColon != std::string::npos && uColon + 1 < endpoint.size() &&
+		endpoint.find_first_of("/\\") == std::string::npos &&
+		endpoint.find_first_not_of("0123456789", uColon + 1) == std::string::npos;
+
+	memset(&address, 0, sizeof(address));
+	if (!bTCP)
+	{
+		auto &addrUnix = reinterpret_cast<sockaddr_un&>(address.addr);
+		if (endpoint.empty() || endpoint.size() >= sizeof(addrUnix.sun_path)) return false;
+		addrUnix.sun_family = AF_UNIX;
+		memcpy(addrUnix.sun_path, endpoint.c_str(), endpoint.size());
+		address.uLength = static_cast<socklen_t>(sizeof(addrUnix));
+		address.iFamily = AF_UNIX;
+
+		return true;
+	}
+
+	const auto host = endpoint.substr(0, uColon);
+	const auto port = endpoint.substr(uColon + 1);
+
+	// IPv4 only; the own endpoint listens on every interface, its host part is for the peers
+	auto hints = addrinfo();
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = bPassive ? AI_PASSIVE : 0;
+
+	addrinfo *pResult = nullptr;
+	if (getaddrinfo(bPassive || host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &pResult) != 0 ||
+		!pResult) return false;
+
+	memcpy(&address.addr, pResult->ai_addr, pResult->ai_addrlen);
+	address.uLength = static_cast<socklen_t>(pResult->ai_addrlen);
+	address.iFamily = pResult->ai_family;
+	freeaddrinfo(pResult);
+
+	return true;
+}
+
+inline bool SocketTransport::listen()
+{
+	auto address = Address();
+	if (!resolve(m_endpoints[m_uRank], true, address)) return false;
+
+	m_listener = socket(address.iFamily, SOCK_STREAM, 0);
+	if (m_listener == SOCKET_NONE) return false;
+	m_iFamily = address.iFamily;
+
+	if (address.iFamily == AF_UNIX)
+	{
+		// A stale socket file of an earlier run would fail the bind
+		remove(m_endpoints[m_uRank].c_str());
+		m_bUnlink = true;
+	}
+	else
+	{
+		const int iReuse = 1;
+		setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&iReuse), sizeof(iReuse));
+	}
+
+	return bind(m_listener, reinterpret_cast<const sockaddr*>(&address.addr), address.uLength) == 0 &&
+		::listen(m_listener, static_cast<int>(m_uNumRanks)) == 0;
+}
+
+inline SocketHandle SocketTransport::dial(const Address &address, const uint32_t uTimeout) const
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(uTimeout);
+
+	// The peer may not be listening yet
+	for (;;)
+	{
+		const auto socket = ::socket(address.iFamily, SOCK_STREAM, 0);
+		if (socket == SOCKET_NONE) return SOCKET_NONE;
+
+		if (connect(socket, reinterpret_cast<const sockaddr*>(&address.addr), address.uLength) == 0)
+		{
+			setNoDelay(socket, address.iFamily);
+
+			return socket;
+		}
+		CloseSocket(socket);
+
+		if (std::chrono::steady_clock::now() >= deadline) return SOCKET_NONE;
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	}
+}
+
+inline void SocketTransport::setNoDelay(const SocketHandle socket, const int iFamily)
+{
+	// Reductions send a few bytes each and wait for the answer
+	if (iFamily == AF_UNIX) return;
+
+	const int iNoDelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&iNoDelay), sizeof(iNoDelay));
+}
@@ -0,0 +1,283 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------------
+// Scoped timing markers, dumped as Chrome/Perfetto trace-event JSON.
+// Every thread records into its own ring buffer without locking; the oldest events are
+// overwritten once a buffer is full. While disabled, a marker costs one relaxed load.
+// Define _NO_TRACE_ to compile the markers out altogether.
+//--------------------------------------------------------------------------------------
+
+#define TRACE_CAPACITY	16384	// Events per thread, a power of 2
+
+struct TraceEvent
+{
+	const char				*szName;	// Static string
+	uint64_t				uBegin;		// Nanoseconds since the trace epoch
+	uint64_t				uEnd;
+};
+
+struct TraceSlot
+{
+	std::atomic<uint64_t>	uSeq;		// 1 + the index of the event held, 0 while being written
+	TraceEvent				event;
+};
+
+class TraceBuffer
+{
+public:
+	TraceBuffer(const uint32_t uThreadId);
+
+	void Record(const char *szName, const uint64_t uBegin, const uint64_t uEnd);
+	uint32_t Read(std::vector<TraceEvent> &events) const;
+
+	uint32_t GetThreadId() const { return m_uThreadId; }
+
+protected:
+	std::unique_ptr<TraceSlot[]>	m_slots;
+	std::atomic<uint64_t>			m_uHead;
+	uint32_t						m_uThreadId;
+};
+
+class Trace
+{
+public:
+	static void Enable(const bool bEnable) { instance().m_bEnabled.store(bEnable, std::memory_order_relaxed); }
+	static bool IsEnabled() { return instance().m_bEnabled.load(std::memory_order_relaxed); }
+
+	// Waits for the accelerator at the end of each synchronized marker, so that the
+	// marker covers the kernels it queued rather than just their submission
+	static void SetSynchronous(const bool bSync) { instance().m_bSync.store(bSync, std::memory_order_relaxed); }
+	static bool IsSynchronous() { return instance().m_bSync.load(std::memory_order_relaxed); }
+
+	static uint64_t Now();
+	static void Record(const char *szName, const uint64_t uBegin, const uint64_t uEnd);
+	static bool Dump(const char *szFileName);
+	static void DumpAtExit(const char *szFileName);
+
+protected:
+	Trace();
+	~Trace();
+
+	static Trace &instance();
+
+	std::atomic<bool>							m_bEnabled;
+	std::atomic<bool>							m_bSync;
+	std::chrono::steady_clock::time_point		m_epoch;
+
+	std::mutex									m_mutex;
+	std::vector<std::unique_ptr<TraceBuffer>>	m_buffers;
+	std::string									m_exitFileName;
+};
+
+class TraceScope
+{
+public:
+	TraceScope(const char *szName) :
+		m_szName(Trace::IsEnabled() ? szName : nullptr), m_uBegin(m_szName ? Trace::Now() : 0) {}
+	~TraceScope() { if (m_szName) Trace::Record(m_szName, m_uBegin, Trace::Now()); }
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+protected:
+	const char		*m_szName;
+	uint64_t		m_uBegin;
+};
+
+// A marker around accelerator work; wait() runs only in the synchronous mode
+template<typename F>
+class TraceScopeWait
+{
+public:
+	TraceScopeWait(const char *szName, const F &wait) :
+		m_wait(wait), m_szName(Trace::IsEnabled() ? szName : nullptr), m_uBegin(m_szName ? Trace::Now() : 0) {}
+	~TraceScopeWait()
+	{
+		if (!m_szName) return;
+		if (Trace::IsSynchronous()) m_wait();
+		Trace::Record(m_szName, m_uBegin, Trace::Now());
+	}
+
+	TraceScopeWait(const TraceScopeWait &) = delete;
+	TraceScopeWait &operator=(const TraceScopeWait &) = delete;
+
+protected:
+	const F			&m_wait;
+	const char		*m_szName;
+	uint64_t		m_uBegin;
+};
+
+#define TRACE_JOIN(a, b)	a##b
+#define TRACE_NAME(a, b)	TRACE_JOIN(a, b)
+
+#ifdef _NO_TRACE_
+#define TRACE_SCOPE(szName)
+#define TRACE_SCOPE_SYNC(szName, acclView)
+#else
+#define TRACE_SCOPE(szName) \
+	const TraceScope TRACE_NAME(traceScope, __LINE__)(szName)
+#define TRACE_SCOPE_SYNC(szName, acclView) \
+	const auto TRACE_NAME(traceWait, __LINE__) = [&]() { (acclView).wait(); }; \
+	const TraceScopeWait<decltype(TRACE_NAME(traceWait, __LINE__))> \
+		TRACE_NAME(traceScope, __LINE__)(szName, TRACE_NAME(traceWait, __LINE__))
+#endif
+
+//--------------------------------------------------------------------------------------
+// TraceBuffer
+//--------------------------------------------------------------------------------------
+
+inline TraceBuffer::TraceBuffer(const uint32_t uThreadId) :
+	m_slots(new TraceSlot[TRACE_CAPACITY]),
+	m_uHead(0),
+	m_uThreadId(uThreadId)
+{
+	for (auto i = 0u; i < TRACE_CAPACITY; ++i) m_slots[i].uSeq.store(0, std::memory_order_relaxed);
+}
+
+// Single producer: only the owning thread writes
+inline void TraceBuffer::Record(const char *szName, const uint64_t uBegin, const uint64_t uEnd)
+{
+	const auto uHead = m_uHead.load(std::memory_order_relaxed);
+	auto &slot = m_slots[uHead & (TRACE_CAPACITY - 1)];
+
+	// Invalidate the slot first, so that a concurrent dump skips it rather than mixing events
+	slot.uSeq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.event.szName = szName;
+	slot.event.uBegin = uBegin;
+	slot.event.uEnd = uEnd;
+	slot.uSeq.store(uHead + 1, std::memory_order_release);
+
+	m_uHead.store(uHead + 1, std::memory_order_release);
+}
+
+// Copies out the events still held, oldest first; returns how many were lost to wrapping
+inline uint32_t TraceBuffer::Read(std::vector<TraceEvent> &events) const
+{
+	const auto uHead = m_uHead.load(std::memory_order_acquire);
+	const auto uTail = uHead > TRACE_CAPACITY ? uHead - TRACE_CAPACITY : 0;
+
+	for (auto i = uTail; i < uHead; ++i)
+	{
+		const auto &slot = m_slots[i & (TRACE_CAPACITY - 1)];
+		const auto uSeq = slot.uSeq.load(std::memory_order_acquire);
+		const auto event = slot.event;
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// Skip the slots overwritten while reading
+		if (uSeq != i + 1 || slot.uSeq.load(std::memory_order_relaxed) != uSeq) continue;
+		events.push_back(event);
+	}
+
+	return static_cast<uint32_t>(uTail);
+}
+
+//--------------------------------------------------------------------------------------
+// Trace
+//--------------------------------------------------------------------------------------
+
+inline Trace::Trace() :
+	m_bEnabled(false),
+	m_bSync(false),
+	m_epoch(std::chrono::steady_clock::now())
+{
+}
+
+inline Trace::~Trace()
+{
+	if (!m_exitFileName.empty()) Dump(m_exitFileName.c_str());
+}
+
+inline Trace &Trace::instance()
+{
+	static Trace trace;
+
+	return trace;
+}
+
+inline uint64_t Trace::Now()
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - instance().m_epoch).count());
+}
+
+inline void Trace::Record(const char *szName, const uint64_t uBegin, const uint64_t uEnd)
+{
+	// The buffers are owned by the trace, so that they outlive their threads until the dump
+	thread_local TraceBuffer *pBuffer = nullptr;
+	if (!pBuffer)
+	{
+		auto &trace = instance();
+		std::lock_guard<std::mutex> lock(trace.m_mutex);
+		trace.m_buffers.emplace_back(new TraceBuffer(static_cast<uint32_t>(trace.m_buffers.size())));
+		pBuffer = trace.m_buffers.back().get();
+	}
+
+	pBuffer->Record(szName, uBegin, uEnd);
+}
+
+inline bool Trace::Dump(const char *szFileName)
+{
+	auto &trace = instance();
+	std::ofstream file(szFileName);
+	if (!file) return false;
+
+	std::lock_guard<std::mutex> lock(trace.m_mutex);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	char szLine[256];
+	auto szSeparator = "\n";
+	std::vector<TraceEvent> events;
+	for (const auto &pBuffer : trace.m_buffers)
+	{
+		events.clear();
+		const auto uLost = pBuffer->Read(events);
+		const auto uThreadId = pBuffer->GetThreadId();
+
+		snprintf(szLine, sizeof(szLine), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+			"\"args\":{\"name\":\"Thread %u\"}}", szSeparator, uThreadId, uThreadId);
+		file << szLine;
+		szSeparator = ",\n";
+
+		if (uLost > 0)
+		{
+			snprintf(szLine, sizeof(szLine), ",\n{\"name\":\"overwritten\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,"
+				"\"tid\":%u,\"ts\":0,\"args\":{\"events\":%u}}", uThreadId, uLost);
+			file << szLine;
+		}
+
+		for (const auto &event : events)
+		{
+			snprintf(szLine, sizeof(szLine), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+				"\"ts\":%.3f,\"dur\":%.3f}", event.szName, uThreadId, event.uBegin * 1e-3,
+				(event.uEnd - event.uBegin) * 1e-3);
+			file << szLine;
+		}
+	}
+
+	file << "\n]}\n";
+	file.close();
+
+	return !file.fail();
+}
+
+inline void Trace::DumpAtExit(const char *szFileName)
+{
+	auto &trace = instance();
+	std::lock_guard<std::mutex> lock(trace.m_mutex);
+	trace.m_exitFileName = szFileName ? szFileName : "";
+}
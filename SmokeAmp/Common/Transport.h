@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//--------------------------------------------------------------------------------------
+// Point-to-point messages between the ranks of a distributed simulation. Messages from
+// one rank to another arrive in the order they were sent, and every Receive takes one
+// Send of the same size. Receive blocks until the message is there; Send may block
+// until the peer receives it, so the callers order their exchanges to avoid cycles.
+// Failures (a peer gone, a size mismatch) are reported and leave the transport unusable.
+//--------------------------------------------------------------------------------------
+
+class Transport
+{
+public:
+	Transport(const uint32_t uRank, const uint32_t uNumRanks) :
+		m_uRank(uRank), m_uNumRanks(uNumRanks) {}
+	virtual ~Transport() {}
+
+	virtual bool Send(const uint32_t uPeer, const void *pData, const size_t uSize) = 0;
+	virtual bool Receive(const uint32_t uPeer, void *pData, const size_t uSize) = 0;
+
+	// Rank 0's data reaches every rank
+	bool Broadcast(void *pData, const size_t uSize);
+	bool Barrier();
+
+	uint32_t GetRank() const { return m_uRank; }
+	uint32_t GetNumRanks() const { return m_uNumRanks; }
+
+protected:
+	uint32_t	m_uRank;
+	uint32_t	m_uNumRanks;
+};
+
+using upTransport = std::unique_ptr<Transport>;
+using spTransport = std::shared_ptr<Transport>;
+
+inline bool Transport::Broadcast(void *pData, const size_t uSize)
+{
+	if (m_uRank > 0) return Receive(0, pData, uSize);
+
+	for (auto i = 1u; i < m_uNumRanks; ++i)
+		if (!Send(i, pData, uSize)) return false;
+
+	return true;
+}
+
+inline bool Transport::Barrier()
+{
+	// Everyone checks in with rank 0, which then lets everyone go
+	auto uToken = m_uRank;
+	if (m_uRank > 0 && !Send(0, &uToken, sizeof(uToken))) return false;
+	for (auto i = 1u; m_uRank == 0 && i < m_uNumRanks; ++i)
+		if (!Receive(i, &uToken, sizeof(uToken))) return false;
+
+	return Broadcast(&uToken, sizeof(uToken));
+}
+
+//--------------------------------------------------------------------------------------
+// Ranks running as threads of one process, e.g. to test a decomposition on one machine.
+// The hub holds a queue per ordered pair of ranks; sending copies into it and never
+// blocks.
+//--------------------------------------------------------------------------------------
+
+class SharedMemoryHub
+{
+public:
+	SharedMemoryHub(const uint32_t uNumRanks);
+
+	void Post(const uint32_t uFrom, const uint32_t uTo, const void *pData, const size_t uSize);
+	bool Take(const uint32_t uFrom, const uint32_t uTo, void *pData, const size_t uSize);
+
+	uint32_t GetNumRanks() const { return m_uNumRanks; }
+
+protected:
+	struct Mailbox
+	{
+		std::mutex							mutex;
+		std::condition_variable				cvMessage;
+		std::deque<std::vector<uint8_t>>	messages;
+	};
+
+	uint32_t								m_uNumRanks;
+	std::vector<std::unique_ptr<Mailbox>>	m_mailboxes;		// [uFrom * m_uNumRanks + uTo]
+};
+
+class SharedMemoryTransport : public Transport
+{
+public:
+	SharedMemoryTransport(SharedMemoryHub &hub, const uint32_t uRank) :
+		Transport(uRank, hub.GetNumRanks()), m_hub(hub) {}
+
+	bool Send(const uint32_t uPeer, const void *pData, const size_t uSize) override
+	{
+		m_hub.Post(m_uRank, uPeer, pData, uSize);
+
+		return true;
+	}
+
+	bool Receive(const uint32_t uPeer, void *pData, const size_t uSize) override
+	{
+		return m_hub.Take(uPeer, m_uRank, pData, uSize);
+	}
+
+protected:
+	SharedMemoryHub		&m_hub;
+};
+
+inline SharedMemoryHub::SharedMemoryHub(const uint32_t uNumRanks) :
+	m_uNumRanks(uNumRanks)
+{
+	m_mailboxes.resize(uNumRanks * uNumRanks);
+	for (auto &pMailbox : m_mailboxes) pMailbox = std::make_unique<Mailbox>();
+}
+
+inline void SharedMemoryHub::Post(const uint32_t uFrom, const uint32_t uTo, const void *pData, const size_t uSize)
+{
+	auto &mailbox = *m_mailboxes[uFrom * m_uNumRanks + uTo];
+	const auto pBytes = static_cast<const uint8_t*>(pData);
+	{
+		std::lock_guard<std::mutex> lock(mailbox.mutex);
+		mailbox.messages.emplace_back(pBytes, pBytes + uSize);
+	}
+	mailbox.cvMessage.notify_one();
+}
+
+inline bool SharedMemoryHub::Take(const uint32_t uFrom, const uint32_t uTo, void *pData, const size_t uSize)
+{
+	auto &mailbox = *m_mailboxes[uFrom * m_uNumRanks + uTo];
+	std::unique_lock<std::mutex> lock(mailbox.mutex);
+	mailbox.cvMessage.wait(lock, [&mailbox]() { return !mailbox.messages.empty(); });
+
+	const auto message = std::move(mailbox.messages.front());
+	mailbox.messages.pop_front();
+	lock.unlock();
+
+	if (message.size() != uSize) return false;
+	if (uSize > 0) memcpy(pData, message.data(), uSize);
+
+	return true;
+}
@@ -0,0 +1,167 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Trace.h"
+
+//--------------------------------------------------------------------------------------
+// Rotates a fixed set of readback buffers between a producer and a few writer threads.
+// The producer acquires a free buffer, fills it (or starts filling it) and submits a
+// job; a writer runs the job, typically waiting for the copy and serializing the buffer,
+// and then returns the buffer. The producer only waits when every buffer is in flight,
+// which is counted as a stall.
+//--------------------------------------------------------------------------------------
+
+struct WriterStats
+{
+	uint64_t	uSubmitted;
+	uint64_t	uWritten;
+	uint64_t	uFailed;
+	double		fStallTime;		// Milliseconds the producer waited for a free buffer
+};
+
+class WriterPool
+{
+public:
+	WriterPool(const uint32_t uNumBuffers = 3, const uint32_t uNumWriters = 2);
+	~WriterPool();
+
+	WriterPool(const WriterPool &) = delete;
+	WriterPool &operator=(const WriterPool &) = delete;
+
+	uint32_t Acquire();
+	// The job returns whether it succeeded; the buffer is free again once it has run
+	void Submit(const uint32_t uBuffer, const std::function<bool()> &job);
+	void Flush();
+
+	uint32_t GetNumBuffers() const { return m_uNumBuffers; }
+	WriterStats GetStats();
+
+protected:
+	struct Job
+	{
+		uint32_t				uBuffer;
+		std::function<bool()>	job;
+	};
+
+	void writer();
+
+	uint32_t					m_uNumBuffers;
+	std::vector<std::thread>	m_threads;
+	std::mutex					m_mutex;
+	std::condition_variable		m_cvJob;
+	std::condition_variable		m_cvFree;
+
+	std::vector<uint32_t>		m_freeBuffers;
+	std::deque<Job>				m_jobs;
+	WriterStats					m_stats;
+	bool						m_bQuit;
+};
+
+using upWriterPool = std::unique_ptr<WriterPool>;
+using spWriterPool = std::shared_ptr<WriterPool>;
+
+inline WriterPool::WriterPool(const uint32_t uNumBuffers, const uint32_t uNumWriters) :
+	m_uNumBuffers(uNumBuffers > 1 ? uNumBuffers : 1),
+	m_stats(),
+	m_bQuit(false)
+{
+	// Handed out in order, so that the buffers rotate
+	for (auto i = m_uNumBuffers; i > 0; --i) m_freeBuffers.push_back(i - 1);
+
+	const auto uCount = uNumWriters > 1 ? uNumWriters : 1;
+	m_threads.reserve(uCount);
+	for (auto i = 0u; i < uCount; ++i) m_threads.emplace_back(&WriterPool::writer, this);
+}
+
+inline WriterPool::~WriterPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bQuit = true;
+	}
+	m_cvJob.notify_all();
+
+	for (auto &thread : m_threads) thread.join();
+}
+
+inline uint32_t WriterPool::Acquire()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (m_freeBuffers.empty())
+	{
+		TRACE_SCOPE("WriterPool::stall");
+		const auto tStart = std::chrono::steady_clock::now();
+		m_cvFree.wait(lock, [this]() { return !m_freeBuffers.empty(); });
+		m_stats.fStallTime += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+	}
+
+	const auto uBuffer = m_freeBuffers.back();
+	m_freeBuffers.pop_back();
+
+	return uBuffer;
+}
+
+inline void WriterPool::Submit(const uint32_t uBuffer, const std::function<bool()> &job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back({ uBuffer, job });
+		++m_stats.uSubmitted;
+	}
+	m_cvJob.notify_one();
+}
+
+// Waits until every submitted job has run
+inline void WriterPool::Flush()
+{
+	TRACE_SCOPE("WriterPool::Flush");
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cvFree.wait(lock, [this]() { return m_freeBuffers.size() == m_uNumBuffers; });
+}
+
+inline WriterStats WriterPool::GetStats()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	return m_stats;
+}
+
+inline void WriterPool::writer()
+{
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cvJob.wait(lock, [this]() { return m_bQuit || !m_jobs.empty(); });
+
+		// Drain the queue before quitting, so that nothing submitted is lost
+		if (m_jobs.empty()) return;
+		auto job = std::move(m_jobs.front());
+		m_jobs.pop_front();
+		lock.unlock();
+
+		auto bWritten = false;
+		{
+			TRACE_SCOPE("WriterPool::write");
+			bWritten = job.job();
+		}
+
+		lock.lock();
+		if (bWritten) ++m_stats.uWritten;
+		else ++m_stats.uFailed;
+		m_freeBuffers.push_back(job.uBuffer);
+		lock.unlock();
+		m_cvFree.notify_all();
+	}
+}
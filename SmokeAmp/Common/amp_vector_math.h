@@ -122,3 +122,45 @@ static inline float4 mul(cfloat4 &v, cfloat4x4 &m) restrict(amp, cpu)
 {
 	return v.x * m.r[0] + v.y * m.r[1] + v.z * m.r[2] + v.w * m.r[3];
 }
+
+// Inverse by Gauss-Jordan elimination with partial pivoting
+static inline float4x4 inverse(cfloat4x4 &m)
+{
+	float a[4][8];
+	for (auto i = 0; i < 4; ++i)
+	{
+		const float aRow[] = { m.r[i].x, m.r[i].y, m.r[i].z, m.r[i].w };
+		for (auto j = 0; j < 4; ++j)
+		{
+			a[i][j] = aRow[j];
+			a[i][j + 4] = i == j ? 1.0f : 0.0f;
+		}
+	}
+
+	for (auto c = 0; c < 4; ++c)
+	{
+		auto p = c;
+		for (auto i = c + 1; i < 4; ++i)
+			if ((a[i][c] < 0.0f ? -a[i][c] : a[i][c]) > (a[p][c] < 0.0f ? -a[p][c] : a[p][c])) p = i;
+		for (auto j = 0; j < 8; ++j)
+		{
+			const auto f = a[c][j];
+			a[c][j] = a[p][j];
+			a[p][j] = f;
+		}
+
+		const auto fInv = 1.0f / a[c][c];
+		for (auto j = 0; j < 8; ++j) a[c][j] *= fInv;
+		for (auto i = 0; i < 4; ++i)
+		{
+			if (i == c) continue;
+			const auto f = a[i][c];
+			for (auto j = 0; j < 8; ++j) a[i][j] -= f * a[c][j];
+		}
+	}
+
+	float4x4 mInv;
+	for (auto i = 0; i < 4; ++i) mInv.r[i] = float4(a[i][4], a[i][5], a[i][6], a[i][7]);
+
+	return mInv;
+}
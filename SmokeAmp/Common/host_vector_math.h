@@ -0,0 +1,259 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+//--------------------------------------------------------------------------------------
+// Short vector types of the host backend, standing in for concurrency::graphics
+// where C++ AMP is unavailable. Never include together with XSDXType.h.
+//--------------------------------------------------------------------------------------
+
+struct float2
+{
+	float x, y;
+
+	float2() : x(0.0f), y(0.0f) {}
+	explicit float2(const float v) : x(v), y(v) {}
+	float2(const float fx, const float fy) : x(fx), y(fy) {}
+};
+
+struct float3
+{
+	float x, y, z;
+
+	float3() : x(0.0f), y(0.0f), z(0.0f) {}
+	explicit float3(const float v) : x(v), y(v), z(v) {}
+	float3(const float fx, const float fy, const float fz) : x(fx), y(fy), z(fz) {}
+
+	float3 &operator+=(const float3 &v) { x += v.x; y += v.y; z += v.z; return *this; }
+	float3 &operator-=(const float3 &v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+	float3 &operator*=(const float s) { x *= s; y *= s; z *= s; return *this; }
+};
+
+struct float4
+{
+	float x, y, z, w;
+
+	float4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+	explicit float4(const float v) : x(v), y(v), z(v), w(v) {}
+	float4(const float fx, const float fy, const float fz, const float fw) : x(fx), y(fy), z(fz), w(fw) {}
+
+	float3 xyz() const { return float3(x, y, z); }
+
+	float4 &operator+=(const float4 &v) { x += v.x; y += v.y; z += v.z; w += v.w; return *this; }
+	float4 &operator-=(const float4 &v) { x -= v.x; y -= v.y; z -= v.z; w -= v.w; return *this; }
+	float4 &operator*=(const float s) { x *= s; y *= s; z *= s; w *= s; return *this; }
+};
+
+struct int2
+{
+	int32_t x, y;
+
+	int2() : x(0), y(0) {}
+	int2(const int32_t ix, const int32_t iy) : x(ix), y(iy) {}
+};
+
+struct int3
+{
+	int32_t x, y, z;
+
+	int3() : x(0), y(0), z(0) {}
+	int3(const int32_t ix, const int32_t iy, const int32_t iz) : x(ix), y(iy), z(iz) {}
+};
+
+struct uint3
+{
+	uint32_t x, y, z;
+
+	uint3() : x(0), y(0), z(0) {}
+	uint3(const uint32_t ux, const uint32_t uy, const uint32_t uz) : x(ux), y(uy), z(uz) {}
+};
+
+// Normalized 8-bit-per-channel color, saturated on construction like concurrency::graphics::unorm_4
+struct unorm4
+{
+	float x, y, z, w;
+
+	unorm4() : x(0.0f), y(0.0f), z(0.0f), w(0.0f) {}
+	unorm4(const float fx, const float fy, const float fz, const float fw) :
+		x(std::min(std::max(fx, 0.0f), 1.0f)), y(std::min(std::max(fy, 0.0f), 1.0f)),
+		z(std::min(std::max(fz, 0.0f), 1.0f)), w(std::min(std::max(fw, 0.0f), 1.0f)) {}
+};
+
+struct float4x4
+{
+	float4 r[4];
+};
+
+using cfloat = const float;
+using cfloat2 = const float2;
+using cfloat3 = const float3;
+using cfloat4 = const float4;
+using cfloat4x4 = const float4x4;
+
+using uint = uint32_t;
+using cuint = const uint;
+using cuint3 = const uint3;
+
+using cint = const int;
+using cint2 = const int2;
+using cint3 = const int3;
+
+using cunorm4 = const unorm4;
+
+//--------------------------------------------------------------------------------------
+// Arithmetic
+//--------------------------------------------------------------------------------------
+
+static inline float2 operator+(cfloat2 &v1, cfloat2 &v2) { return float2(v1.x + v2.x, v1.y + v2.y); }
+static inline float2 operator-(cfloat2 &v1, cfloat2 &v2) { return float2(v1.x - v2.x, v1.y - v2.y); }
+static inline float2 operator*(cfloat2 &v1, cfloat2 &v2) { return float2(v1.x * v2.x, v1.y * v2.y); }
+static inline float2 operator*(cfloat2 &v, cfloat s) { return float2(v.x * s, v.y * s); }
+static inline float2 operator*(cfloat s, cfloat2 &v) { return v * s; }
+
+static inline float3 operator-(cfloat3 &v) { return float3(-v.x, -v.y, -v.z); }
+static inline float3 operator+(cfloat3 &v1, cfloat3 &v2) { return float3(v1.x + v2.x, v1.y + v2.y, v1.z + v2.z); }
+static inline float3 operator-(cfloat3 &v1, cfloat3 &v2) { return float3(v1.x - v2.x, v1.y - v2.y, v1.z - v2.z); }
+static inline float3 operator*(cfloat3 &v1, cfloat3 &v2) { return float3(v1.x * v2.x, v1.y * v2.y, v1.z * v2.z); }
+static inline float3 operator/(cfloat3 &v1, cfloat3 &v2) { return float3(v1.x / v2.x, v1.y / v2.y, v1.z / v2.z); }
+static inline float3 operator+(cfloat3 &v, cfloat s) { return float3(v.x + s, v.y + s, v.z + s); }
+static inline float3 operator-(cfloat3 &v, cfloat s) { return float3(v.x - s, v.y - s, v.z - s); }
+static inline float3 operator*(cfloat3 &v, cfloat s) { return float3(v.x * s, v.y * s, v.z * s); }
+static inline float3 operator*(cfloat s, cfloat3 &v) { return v * s; }
+static inline float3 operator/(cfloat3 &v, cfloat s) { return float3(v.x / s, v.y / s, v.z / s); }
+static inline float3 operator/(cfloat s, cfloat3 &v) { return float3(s / v.x, s / v.y, s / v.z); }
+
+static inline float4 operator-(cfloat4 &v) { return float4(-v.x, -v.y, -v.z, -v.w); }
+static inline float4 operator+(cfloat4 &v1, cfloat4 &v2) { return float4(v1.x + v2.x, v1.y + v2.y, v1.z + v2.z, v1.w + v2.w); }
+static inline float4 operator-(cfloat4 &v1, cfloat4 &v2) { return float4(v1.x - v2.x, v1.y - v2.y, v1.z - v2.z, v1.w - v2.w); }
+static inline float4 operator*(cfloat4 &v1, cfloat4 &v2) { return float4(v1.x * v2.x, v1.y * v2.y, v1.z * v2.z, v1.w * v2.w); }
+static inline float4 operator*(cfloat4 &v, cfloat s) { return float4(v.x * s, v.y * s, v.z * s, v.w * s); }
+static inline float4 operator*(cfloat s, cfloat4 &v) { return v * s; }
+static inline float4 operator/(cfloat4 &v, cfloat s) { return float4(v.x / s, v.y / s, v.z / s, v.w / s); }
+
+//--------------------------------------------------------------------------------------
+// Functions, matching Common\amp_vector_math.h
+//--------------------------------------------------------------------------------------
+
+static inline float dot(cfloat2 &v1, cfloat2 &v2)
+{
+	return v1.x * v2.x + v1.y * v2.y;
+}
+
+static inline float dot(cfloat3 &v1, cfloat3 &v2)
+{
+	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+}
+
+static inline float dot(cfloat4 &v1, cfloat4 &v2)
+{
+	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z + v1.w * v2.w;
+}
+
+static inline float3 cross(cfloat3 &v1, cfloat3 &v2)
+{
+	return float3(v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x);
+}
+
+static inline float3 floor(cfloat3 &v)
+{
+	return float3(std::floor(v.x), std::floor(v.y), std::floor(v.z));
+}
+
+template<typename T>
+static inline float length(const T &v)
+{
+	return std::sqrt(dot(v, v));
+}
+
+template<typename T>
+static inline T normalize(const T &v)
+{
+	return v * (1.0f / std::sqrt(dot(v, v)));
+}
+
+template<typename T>
+static inline T lerp(const T &v1, const T &v2, cfloat a)
+{
+	return (1.0f - a) * v1 + a * v2;
+}
+
+static inline float lerp(cfloat f1, cfloat f2, cfloat a)
+{
+	return (1.0f - a) * f1 + a * f2;
+}
+
+static inline float clamp(cfloat f, cfloat fMin, cfloat fMax)
+{
+	return std::min(std::max(f, fMin), fMax);
+}
+
+static inline float saturate(cfloat f)
+{
+	return clamp(f, 0.0f, 1.0f);
+}
+
+static inline float4 mul(cfloat4x4 &m, cfloat4 &v)
+{
+	return float4(dot(m.r[0], v), dot(m.r[1], v), dot(m.r[2], v), dot(m.r[3], v));
+}
+
+static inline float4 mul(cfloat4 &v, cfloat4x4 &m)
+{
+	return v.x * m.r[0] + v.y * m.r[1] + v.z * m.r[2] + v.w * m.r[3];
+}
+
+static inline float4x4 mul(cfloat4x4 &m1, cfloat4x4 &m2)
+{
+	float4x4 m;
+	for (auto i = 0; i < 4; ++i) m.r[i] = mul(m1.r[i], m2);
+
+	return m;
+}
+
+// Inverse by Gauss-Jordan elimination with partial pivoting
+static inline float4x4 inverse(cfloat4x4 &m)
+{
+	float a[4][8];
+	for (auto i = 0; i < 4; ++i)
+	{
+		const float aRow[] = { m.r[i].x, m.r[i].y, m.r[i].z, m.r[i].w };
+		for (auto j = 0; j < 4; ++j)
+		{
+			a[i][j] = aRow[j];
+			a[i][j + 4] = i == j ? 1.0f : 0.0f;
+		}
+	}
+
+	for (auto c = 0; c < 4; ++c)
+	{
+		auto p = c;
+		for (auto i = c + 1; i < 4; ++i)
+			if ((a[i][c] < 0.0f ? -a[i][c] : a[i][c]) > (a[p][c] < 0.0f ? -a[p][c] : a[p][c])) p = i;
+		for (auto j = 0; j < 8; ++j)
+		{
+			const auto f = a[c][j];
+			a[c][j] = a[p][j];
+			a[p][j] = f;
+		}
+
+		const auto fInv = 1.0f / a[c][c];
+		for (auto j = 0; j < 8; ++j) a[c][j] *= fInv;
+		for (auto i = 0; i < 4; ++i)
+		{
+			if (i == c) continue;
+			const auto f = a[i][c];
+			for (auto j = 0; j < 8; ++j) a[i][j] -= f * a[c][j];
+		}
+	}
+
+	float4x4 mInv;
+	for (auto i = 0; i < 4; ++i) mInv.r[i] = float4(a[i][4], a[i][5], a[i][6], a[i][7]);
+
+	return mInv;
+}
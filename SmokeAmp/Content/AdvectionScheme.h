@@ -0,0 +1,15 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+// Advection options shared by AmpFluid3D and HostFluid3D
+enum AdvectionScheme : uint8_t
+{
+	ADVECT_SEMI_LAGRANGIAN,		// Single backward trace, first-order and diffusive
+	ADVECT_MACCORMACK,			// Forward trace corrected by half the backward error, 2 passes
+	ADVECT_BFECC				// Back-and-forth error compensation, 3 passes
+};
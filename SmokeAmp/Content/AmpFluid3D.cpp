@@ -4,10 +4,19 @@
 
 #include "AmpFluid3D.h"
 
-#define NUM_SAMPLES			128
+#define MAX_SAMPLES			512
+#define SAMPLE_RATE			1.0f	// View samples per texel
 #define NUM_LIGHT_SAMPLES	32
 #define ABSORPTION			1.0f
 #define ZERO_THRESHOLD		0.01f
+#define IMPULSE_RADIUS		0.032f
+#define TEMPORAL_SAMPLE_RATE	0.25f	// Fraction of the view samples marched per frame in the temporal mode
+#define TEMPORAL_BLEND		0.1f	// Weight of the current frame against the history
+#define TEMPORAL_GAMMA		1.0f	// Width of the history clamp in standard deviations
+#define UPSAMPLE_EPSILON	0.05f	// Ray-bound difference (local units) at which an upsampling tap halves its weight
+
+#define LIGHT_VOLUME_SCALE	2		// Density texels per transmittance texel along each axis
+#define LIGHT_SWEEP_TILE	32		// Threads along each axis of the one tile sweeping the light volume
 //#define ONE_THRESHOLD		0.999f
 
 using namespace concurrency;
@@ -25,92 +34,923 @@ inline float3 ScreenToLocal(cfloat3 &vLoc, cfloat4x4 &mScreenToLocal) restrict(a
 	return vPos.xyz / vPos.w;
 }
 
-// Compute start point of the ray
-inline bool ComputeStartPoint(float3 &vPos, cfloat3 vRayDir) restrict(amp)
+// Compute entry and exit distances of the ray on the volume slab
+inline bool ComputeRayBounds(cfloat3 &vPos, cfloat3 &vRayDir, float &fNear, float &fFar) restrict(amp)
 {
-	if (fabs(vPos.x) <= 1.0 && fabs(vPos.y) <= 1.0 && fabs(vPos.z) <= 1.0) return true;
+	cfloat aPos[3] = { vPos.x, vPos.y, vPos.z };
+	cfloat aRayDir[3] = { vRayDir.x, vRayDir.y, vRayDir.z };
+
+	// The ray starts on the near plane, so nothing behind it counts
+	fNear = 0.0f;
+	fFar = FLT_MAX;
+
+	for (uint i = 0; i < 3; ++i)
+	{
+		if (aRayDir[i] == 0.0f)
+		{
+			if (fabs(aPos[i]) > 1.0f) return false;
+			continue;
+		}
+
+		const auto u0 = (-1.0f - aPos[i]) / aRayDir[i];
+		const auto u1 = (1.0f - aPos[i]) / aRayDir[i];
+		fNear = fmax(fNear, fmin(u0, u1));
+		fFar = fmin(fFar, fmax(u0, u1));
+	}
+
+	return fNear < fFar;
+}
+
+// Transmittance along the light ray from vPos
+inline float LightTransmittance(const AmpTexture3DView<float> &tvDensityRO, cfloat3 &vPos, cfloat3 &vLRStep,
+	cfloat fLStepScale) restrict(amp)
+{
+	auto fLRTrans = 1.0f;
+	auto vLRPos = vPos + vLRStep;
+
+	for (uint j = 0; j < NUM_LIGHT_SAMPLES; ++j)
+	{
+		if (fabs(vLRPos.x) > 1.0f || fabs(vLRPos.y) > 1.0f || fabs(vLRPos.z) > 1.0f) break;
+		const auto vTex = float3(0.5f, -0.5f, 0.5f) * vLRPos + 0.5f;
+
+		// Get a sample along light ray
+		cfloat fLRDens = fmin(tvDensityRO.sample(vTex), 16.0f);
+
+		// Attenuate ray-throughput along light direction
+		fLRTrans *= saturate(1.0f - ABSORPTION * fLStepScale * fLRDens);
+		if (fLRTrans < ZERO_THRESHOLD) break;
+
+		// Update position along light ray
+		vLRPos += vLRStep;
+	}
+
+	return fLRTrans;
+}
+
+// Cell on slice iSlice of axis a, at j and k along axes b and c
+inline AmpIndex3D SliceIndex(const int a, const int iSlice, const int b, const int j, const int c, const int k) restrict(amp)
+{
+	int aLoc[3];
+	aLoc[a] = iSlice;
+	aLoc[b] = j;
+	aLoc[c] = k;
+
+	return AmpIndex3D(aLoc[2], aLoc[1], aLoc[0]);
+}
+
+// Number of whole ray steps spent inside the largest empty macro-cell around vCell (texel
+// space), or 0 if the finest one is occupied; each pyramid level contains the one below
+inline uint EmptySteps(const AmpArray &aOccupancy, const OccupancyPyramid &pyramid,
+	cfloat3 &vCell, cfloat3 &vStep) restrict(amp)
+{
+	auto fSteps = 0.0f;
+	for (auto l = 0; l < pyramid.iNumLevels; ++l)
+	{
+		const auto fSize = (float)(OCCUPANCY_CELL << l);
+		const auto x = direct3d::clamp((int)(vCell.x / fSize), 0, pyramid.iDims[l][0] - 1);
+		const auto y = direct3d::clamp((int)(vCell.y / fSize), 0, pyramid.iDims[l][1] - 1);
+		const auto z = direct3d::clamp((int)(vCell.z / fSize), 0, pyramid.iDims[l][2] - 1);
+		if (aOccupancy[pyramid.iOffsets[l] + (z * pyramid.iDims[l][1] + y) * pyramid.iDims[l][0] + x] > ZERO_THRESHOLD) break;
+
+		// Steps until the ray leaves the macro-cell
+		const auto vLo = float3((float)x, (float)y, (float)z) * fSize;
+		const auto vHi = vLo + fSize;
+		const auto vExit = float3(
+			vStep.x > 0.0f ? (vHi.x - vCell.x) / vStep.x : (vStep.x < 0.0f ? (vLo.x - vCell.x) / vStep.x : FLT_MAX),
+			vStep.y > 0.0f ? (vHi.y - vCell.y) / vStep.y : (vStep.y < 0.0f ? (vLo.y - vCell.y) / vStep.y : FLT_MAX),
+			vStep.z > 0.0f ? (vHi.z - vCell.z) / vStep.z : (vStep.z < 0.0f ? (vLo.z - vCell.z) / vStep.z : FLT_MAX));
+		fSteps = fmin(vExit.x, fmin(vExit.y, vExit.z));
+	}
+
+	return (uint)fmin(ceil(fSteps), (float)MAX_SAMPLES);
+}
+
+// March the view ray over [fNear, fFar] from vPos, with fJitter placing the samples within
+// each step; returns the in-scattered radiance, the transmittance and the opacity-weighted depth
+inline float3 MarchRay(const AmpTexture3DView<float> &tvDensityRO, const AmpTexture3DView<float> &tvTransmitRO,
+	const AmpArray &aOccupancy, const OccupancyPyramid &pyramid, cfloat3 &vSimSize, const bool bLightVolume,
+	const bool bExactExtinction, cfloat3 &vLocalSpaceLightPt, float3 vPos, cfloat3 &vRayDir, cfloat fNear, cfloat fFar,
+	cfloat fSampleRate, cfloat fJitter) restrict(amp)
+{
+	const auto fMaxDist = 2.0f * sqrt(3.0f);
+	const auto fLStepScale = fMaxDist / NUM_LIGHT_SAMPLES;
+
+	// Step count from the chord length in texels, so that the samples track the voxels
+	const auto fChord = fFar - fNear;
+	const auto fSamples = ceil(fChord * length(vRayDir * vSimSize * 0.5f) * fSampleRate);
+	const auto uNumSamples = (uint)clamp(fSamples, 1.0f, (float)MAX_SAMPLES);
+	const auto fStepScale = fChord / uNumSamples;
+
+	const auto vStep = vRayDir * fStepScale;
+	const auto vTexStep = float3(0.5f, -0.5f, 0.5f) * vStep;
+	vPos += vRayDir * (fNear + fJitter * fStepScale);
+
+#ifndef _POINT_LIGHT_
+	const auto vLRStep = normalize(vLocalSpaceLightPt) * fLStepScale;
+#endif
+
+	// Transmittance
+	float fTransmit = 1.0f;
+	// In-scattered radiance
+	float fScatter = 0.0f;
+	// Opacity-weighted depth along the ray
+	float fDepth = 0.0f;
+
+	for (uint i = 0; i < uNumSamples; ++i)
+	{
+		const auto vTex = float3(0.5f, -0.5f, 0.5f) * vPos + 0.5f;
+
+		// Leap over empty macro-cells in whole steps, so the samples keep their positions
+		const auto uSkip = direct3d::umin(EmptySteps(aOccupancy, pyramid, vTex * vSimSize, vTexStep * vSimSize), uNumSamples - i);
+		if (uSkip > 0)
+		{
+			for (auto k = 0u; k < uSkip; ++k) vPos += vStep;
+			i += uSkip - 1;
+			continue;
+		}
+
+		// Get a sample
+		const auto fDens = fmin(tvDensityRO.sample(vTex), 16.0f);
+
+		// Skip empty space
+		if (fDens > ZERO_THRESHOLD)
+		{
+			// Attenuate ray-throughput
+			const auto fScaledDens = fDens * fStepScale;
+			const auto fAttenuation = bExactExtinction ? exp(-fScaledDens * ABSORPTION) :
+				saturate(1.0f - fScaledDens * ABSORPTION);
+			const auto fOpacity = fTransmit * (1.0f - fAttenuation);
+			fDepth += (fNear + (i + fJitter) * fStepScale) * fOpacity;
+			fTransmit *= fAttenuation;
+			if (fTransmit < ZERO_THRESHOLD) break;
+
+			// Point light direction in texture space
+#ifdef _POINT_LIGHT_
+			const auto vLRStep = normalize(vLocalSpaceLightPt - vPos) * fLStepScale;
+#endif
+
+			// Sample light
+			const auto fLRTrans = bLightVolume ? tvTransmitRO.sample(vTex) :	// Transmittance along light ray
+				LightTransmittance(tvDensityRO, vPos, vLRStep, fLStepScale);
+
+			fScatter += bExactExtinction ? fLRTrans * fOpacity / ABSORPTION : fLRTrans * fTransmit * fScaledDens;
+		}
+
+		vPos += vStep;
+	}
+
+	//clip(ONE_THRESHOLD - fTransmit);
+
+	// Rays that stay clear are placed at the middle of the volume
+	fDepth = fTransmit < 1.0f ? fDepth / (1.0f - fTransmit) : 0.5f * (fNear + fFar);
+
+	return float3(fScatter, fTransmit, fDepth);
+}
+
+// Texel access to the checkpoint layout, where the components are consecutive scalars
+inline void StoreTexel(AmpArray &aDst, const int i, cfloat fValue) restrict(amp)
+{
+	aDst[i] = fValue;
+}
+
+inline void StoreTexel(AmpArray &aDst, const int i, cfloat4 &vValue) restrict(amp)
+{
+	aDst[i] = vValue.x;
+	aDst[i + 1] = vValue.y;
+	aDst[i + 2] = vValue.z;
+	aDst[i + 3] = vValue.w;
+}
+
+inline void LoadTexel(const AmpArray &aSrc, const int i, float &fValue) restrict(amp)
+{
+	fValue = aSrc[i];
+}
+
+inline void LoadTexel(const AmpArray &aSrc, const int i, float4 &vValue) restrict(amp)
+{
+	vValue = float4(aSrc[i], aSrc[i + 1], aSrc[i + 2], aSrc[i + 3]);
+}
+
+// Copies every brick of the field into the checkpoint layout, cells x-fastest
+template<typename T>
+static void GatherBricks(const AmpTexture3D<T> &txField, const BrickMap &bricks, vector<float> &bricked)
+{
+	const auto iGridX = static_cast<int>(bricks.GetGridX());
+	const auto iGridY = static_cast<int>(bricks.GetGridY());
+	const auto iNumBricks = static_cast<int>(bricks.GetNumBricks());
+	const auto iComponents = static_cast<int>(sizeof(T) / sizeof(float));
+
+	auto aBricked = AmpArray(iNumBricks * BRICK_CELLS * iComponents, txField.accelerator_view);
+	const auto tvFieldRO = AmpTexture3DView<T>(txField);
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per brick.
+		extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricked](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+	{
+		const auto iBrick = tidx.tile[0];
+		const auto idx = AmpIndex3D(iBrick / (iGridX * iGridY) * BRICK_SIZE, iBrick / iGridX % iGridY * BRICK_SIZE,
+			iBrick % iGridX * BRICK_SIZE) + tidx.local;
+		const auto iCell = iBrick * BRICK_CELLS + (tidx.local[0] * BRICK_SIZE + tidx.local[1]) * BRICK_SIZE + tidx.local[2];
+		StoreTexel(aBricked, iCell * iComponents, tvFieldRO.extent.contains(idx) ? tvFieldRO[idx] : T());
+	}
+	);
+
+	bricked.resize(aBricked.extent.size());
+	concurrency::copy(aBricked, bricked.begin());
+}
+
+// Clears the field and uploads the stored bricks of a mapped checkpoint into it
+template<typename T>
+static void ScatterBricks(const CheckpointReader &reader, const uint32_t uField, AmpTexture3D<T> &txField)
+{
+	const auto iNumBricks = static_cast<int>(reader.GetHeader().uNumBricks);
+	const auto iComponents = static_cast<int>(sizeof(T) / sizeof(float));
+	const auto tvFieldRW = AmpRWTexture3DView<T>(txField);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of field texels.
+		tvFieldRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex3D idx) restrict(amp)
+	{
+		tvFieldRW.set(idx, T());
+	}
+	);
+
+	if (iNumBricks <= 0) return;
+
+	// Straight from the mapped pages to the accelerator
+	const auto aBricks = AmpUintArray(iNumBricks, reader.GetBricks(), txField.accelerator_view);
+	const auto aBricked = AmpArray(iNumBricks * BRICK_CELLS * iComponents, reader.GetField(uField),
+		txField.accelerator_view);
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per stored brick.
+		extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricks, &aBricked](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+	{
+		const auto idx = BrickOrigin(aBricks[tidx.tile[0]]) + tidx.local;
+		if (!tvFieldRW.extent.contains(idx)) return;
+
+		const auto iCell = tidx.tile[0] * BRICK_CELLS + (tidx.local[0] * BRICK_SIZE + tidx.local[1]) * BRICK_SIZE +
+			tidx.local[2];
+		auto value = T();
+		LoadTexel(aBricked, iCell * iComponents, value);
+		tvFieldRW.set(idx, value);
+	}
+	);
+}
+
+// Visit every cell, or only the cells of the live bricks in sparse mode
+template<typename F>
+void AmpFluid3D::forEachCell(const concurrency::extent<3> &domain, const F &kernel)
+{
+	if (!m_bSparse) return parallel_for_each(domain, kernel);
+
+	const auto iNumBricks = static_cast<int>(m_bricks.GetActive().size());
+	if (iNumBricks <= 0) return;
+
+	const auto &aBricks = dref(m_pActiveBricks);
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per live brick.
+		extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricks](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+	{
+		const auto idx = BrickOrigin(aBricks[tidx.tile[0]]) + tidx.local;
+		if (domain.contains(idx)) kernel(idx);
+	}
+	);
+}
+
+AmpFluid3D::AmpFluid3D(const AmpAcclView &acclView) :
+	m_fPressTolerance(0.0f),
+	m_uPressMaxIteration(PRESS_ITERATION),
+	m_uPressCheckInterval(4),
+	m_pressureStats(),
+	m_bFusedStep(false),
+	m_advection(ADVECT_SEMI_LAGRANGIAN),
+	m_bSparse(false),
+	m_bLightVolume(false),
+	m_bLightDirty(true),
+	m_uRenderScale(1),
+	m_bExactExtinction(false),
+	m_bTemporal(false),
+	m_bHistoryValid(false),
+	m_uFrame(0),
+	m_acclView(acclView)
+{
+}
+
+void AmpFluid3D::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+{
+	const auto fWidth = static_cast<float>(iWidth);
+	const auto fHeight = static_cast<float>(iHeight);
+	const auto fDepth = static_cast<float>(iDepth);
+	m_vSimSize = float3(fWidth, fHeight, fDepth);
+
+	// Create 3D textures
+	m_pSrcDensity = make_unique<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
+	m_pDstDensity = make_unique<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
+	m_pTmpDensity = make_unique<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
+
+	m_diffuse.Init(iWidth, iHeight, iDepth, 16, m_acclView);
+	m_pressure.Init(iWidth, iHeight, iDepth, 32, m_acclView);
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+
+	// Brick bookkeeping for the sparse mode
+	m_bricks.Init(iWidth, iHeight, iDepth);
+	const auto iNumBricks = static_cast<int>(m_bricks.GetNumBricks());
+	m_pBrickStats = make_shared<AmpArray>(2 * iNumBricks, m_acclView);
+	m_pActiveBricks = make_shared<AmpUintArray>(iNumBricks, m_acclView);
+	m_pFreedBricks = make_shared<AmpUintArray>(iNumBricks, m_acclView);
+	if (m_bSparse) m_pressure.SetBricks(&m_bricks);
+
+	// Empty-space skipping for the ray march
+	m_occupancyPyramid = MakeOccupancyPyramid(iWidth, iHeight, iDepth);
+	const auto occupancy = vector<float>(m_occupancyPyramid.iNumCells, 0.0f);
+	m_pOccupancy = make_shared<AmpArray>(m_occupancyPyramid.iNumCells, occupancy.cbegin(), m_acclView);
+
+	// 32-bit so that the sweep can read and write it in place
+	m_pTransmittance = make_shared<AmpTexture3D<float>>((iDepth + LIGHT_VOLUME_SCALE - 1) / LIGHT_VOLUME_SCALE,
+		(iHeight + LIGHT_VOLUME_SCALE - 1) / LIGHT_VOLUME_SCALE, (iWidth + LIGHT_VOLUME_SCALE - 1) / LIGHT_VOLUME_SCALE,
+		32, m_acclView);
+	m_bLightDirty = true;
+}
+
+void AmpFluid3D::Simulate(cfloat fDeltaTime, cfloat4 vForceDens, cfloat3 vImLoc, const uint8_t uItVisc)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::Simulate", m_acclView);
+
+	if (m_bSparse) updateBricks(fDeltaTime, vForceDens, vImLoc);
+
+	// Viscosity has to run between advection and impulse, and the corrected schemes and the
+	// brick walk need whole-field passes, so they take the separate passes
+	if (m_bFusedStep && uItVisc == 0 && m_advection == ADVECT_SEMI_LAGRANGIAN && !m_bSparse)
+	{
+		advectFused(fDeltaTime, vForceDens, vImLoc);
+		project(fDeltaTime, false);
+	}
+	else
+	{
+		advect(fDeltaTime);
+		diffuse(uItVisc);
+		impulse(fDeltaTime, vForceDens, vImLoc);
+		project(fDeltaTime);
+	}
+
+	buildOccupancy();
+	m_bLightDirty = true;
+}
+
+void AmpFluid3D::SetPressureTolerance(cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval)
+{
+	// A non-positive tolerance restores the fixed iteration count
+	m_fPressTolerance = fTolerance;
+	m_uPressMaxIteration = uMaxIteration;
+	m_uPressCheckInterval = uCheckInterval;
+}
+
+void AmpFluid3D::SetFusedStep(const bool bFused)
+{
+	m_bFusedStep = bFused;
+}
+
+void AmpFluid3D::SetAdvection(const AdvectionScheme advection)
+{
+	m_advection = advection;
+}
+
+void AmpFluid3D::SetLightVolume(const bool bLightVolume)
+{
+	m_bLightVolume = bLightVolume;
+	m_bLightDirty = true;
+}
+
+void AmpFluid3D::SetSparse(const bool bSparse)
+{
+	// Restart from a fully live map; the next step frees and clears the empty bricks
+	if (bSparse && !m_bSparse && m_pSrcDensity)
+	{
+		const auto &domain = m_pSrcDensity->extent;
+		m_bricks.Init(domain[2], domain[1], domain[0]);
+	}
+	m_bSparse = bSparse;
+
+	// The divergence and the pressure solve follow the same bricks
+	m_pressure.SetBricks(bSparse ? &m_bricks : nullptr);
+}
+
+void AmpFluid3D::updateBricks(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::updateBricks", m_acclView);
+
+	const auto iNumBricks = static_cast<int>(m_bricks.GetNumBricks());
+	const auto iGridX = static_cast<int>(m_bricks.GetGridX());
+	const auto iGridY = static_cast<int>(m_bricks.GetGridY());
+	const auto iGridZ = static_cast<int>(m_bricks.GetGridZ());
+	const auto fMaxSize = max(m_vSimSize.x, max(m_vSimSize.y, m_vSimSize.z));
+
+	// Per-brick maxima of the density and the speed
+	{
+		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+		const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+		auto &aBrickStats = dref(m_pBrickStats);
+
+		parallel_for_each(
+			// Define the compute domain, which is one tile per brick.
+			extent<3>(iGridZ * BRICK_SIZE, iGridY * BRICK_SIZE, iGridX * BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+			// Define the code to run on each thread on the accelerator.
+			[=, &aBrickStats](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+		{
+			tile_static float fDens[BRICK_CELLS];
+			tile_static float fSpeed[BRICK_CELLS];
+
+			// Cells past the grid load as zero
+			const auto i = (tidx.local[0] * BRICK_SIZE + tidx.local[1]) * BRICK_SIZE + tidx.local[2];
+			fDens[i] = fabs(tvDensityRO[tidx.global]);
+			fSpeed[i] = length(tvVelocityRO[tidx.global].xyz);
+			tidx.barrier.wait();
+
+			for (auto iStride = BRICK_CELLS / 2; iStride > 0; iStride >>= 1)
+			{
+				if (i < iStride)
+				{
+					fDens[i] = fmax(fDens[i], fDens[i + iStride]);
+					fSpeed[i] = fmax(fSpeed[i], fSpeed[i + iStride]);
+				}
+				tidx.barrier.wait();
+			}
+
+			if (i == 0)
+			{
+				const auto iBrick = (tidx.tile[0] * iGridY + tidx.tile[1]) * iGridX + tidx.tile[2];
+				aBrickStats[2 * iBrick] = fDens[0];
+				aBrickStats[2 * iBrick + 1] = fSpeed[0];
+			}
+		}
+		);
+	}
+
+	// Smoke keeps a brick live; the speed sets how far it may spread in this step
+	vector<float> brickStats(2 * iNumBricks);
+	{
+		// Blocks until the queued kernels have run
+		TRACE_SCOPE("AmpFluid3D::readback");
+		concurrency::copy(dref(m_pBrickStats), brickStats.begin());
+	}
+	m_brickOccupancy.resize(iNumBricks);
+	m_brickReach.resize(iNumBricks);
+	for (auto i = 0; i < iNumBricks; ++i)
+	{
+		m_brickOccupancy[i] = brickStats[2 * i];
+		m_brickReach[i] = brickStats[2 * i + 1] * fDeltaTime * fMaxSize;
+	}
+	m_bricks.Mark(m_brickOccupancy, m_brickReach);
+
+	// Bricks about to receive the impulse, cut where its basis drops below the threshold
+	if (vForceDens.x != 0.0f || vForceDens.y != 0.0f || vForceDens.z != 0.0f)
+	{
+		const auto fRadius = 0.5f * IMPULSE_RADIUS * std::sqrt(-std::log(BRICK_THRESHOLD));
+		const auto vMin = floor((vImLoc - fRadius) * m_vSimSize);
+		const auto vMax = floor((vImLoc + fRadius) * m_vSimSize);
+		const int32_t iMin[] = { static_cast<int32_t>(vMin.x), static_cast<int32_t>(vMin.y), static_cast<int32_t>(vMin.z) };
+		const int32_t iMax[] = { static_cast<int32_t>(vMax.x), static_cast<int32_t>(vMax.y), static_cast<int32_t>(vMax.z) };
+		m_bricks.MarkCells(iMin, iMax);
+	}
+
+	m_bricks.Commit();
+
+	// Upload the live set
+	const auto &activeBricks = m_bricks.GetActive();
+	const auto &freedBricks = m_bricks.GetFreed();
+	const auto iNumFreed = static_cast<int>(freedBricks.size());
+	if (!activeBricks.empty()) concurrency::copy(activeBricks.cbegin(), activeBricks.cend(),
+		m_pActiveBricks->section(0, static_cast<int>(activeBricks.size())));
+	m_pressure.UpdateBricks();
+	if (iNumFreed <= 0) return;
+
+	// Clear the freed bricks in every buffer the kernels rotate through
+	concurrency::copy(freedBricks.cbegin(), freedBricks.cend(), m_pFreedBricks->section(0, iNumFreed));
+	auto pTmpVelocity = m_diffuse.GetTmp();
+	const auto tvVelocityRW = AmpRWTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+	const auto tvTmpVelRW = AmpRWTexture3DView<float4>(dref(pTmpVelocity));
+	const auto tvDensityRW = AmpRWTexture3DView<float>(dref(m_pSrcDensity));
+	const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
+	const auto tvTmpDenRW = AmpRWTexture3DView<float>(dref(m_pTmpDensity));
+	const auto &aBricks = dref(m_pFreedBricks);
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per freed brick.
+		extent<3>(iNumFreed * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricks](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+	{
+		const auto idx = BrickOrigin(aBricks[tidx.tile[0]]) + tidx.local;
+		if (!tvDensityRW.extent.contains(idx)) return;
+
+		const auto vZero = float4(0.0f, 0.0f, 0.0f, 0.0f);
+		tvVelocityRW.set(idx, vZero);
+		tvPhiVelRW.set(idx, vZero);
+		tvTmpVelRW.set(idx, vZero);
+		tvDensityRW.set(idx, 0.0f);
+		tvPhiDenRW.set(idx, 0.0f);
+		tvTmpDenRW.set(idx, 0.0f);
+	}
+	);
+}
+
+void AmpFluid3D::Render(upAmpTexture2D<unorm4> &pDst, const AmpTexture2DView<float> &tvDepthRO,
+	const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::Render", m_acclView);
+
+	// Light transmittance volume, refreshed when the density or the light has changed
+	if (m_bLightVolume) updateTransmittance(cbPerObj.m_vLocalSpaceLightPt.xyz, 2.0f * sqrt(3.0f) / NUM_LIGHT_SAMPLES);
+
+	const auto tvDstRW = AmpRWTexture2DView<unorm4>(dref(pDst));
+	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	const auto tvTransmitRO = AmpTexture3DView<float>(dref(m_pTransmittance));
+	const auto &aOccupancy = dref(m_pOccupancy);
+	const auto pyramid = m_occupancyPyramid;
+	const auto vSimSize = m_vSimSize;
+	const auto bLightVolume = m_bLightVolume;
+	const auto bExactExtinction = m_bExactExtinction;
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvDstRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aOccupancy](const AmpIndex2D idx) restrict(amp)
+	{
+		// Constant buffer immutable
+		const auto vLightRad = cbImmutable.m_vDirectional.xyz * cbImmutable.m_vDirectional.w;
+		const auto vAmbientRad = cbImmutable.m_vAmbient.xyz * cbImmutable.m_vAmbient.w;
+
+		// Constant buffer per object
+		const auto &vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz;
+		const auto &vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz;
+		const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+		//////////////////////////////////////////////////////////////////////////////////////////
+
+		const auto vLoc = float3((float)idx[1], (float)idx[0], 0.0f);
+
+		const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+		const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+		float fNear, fFar;
+		const auto bHit = ComputeRayBounds(vPos, vRayDir, fNear, fFar);
+
+		// Stop at the opaque scene; pixels whose geometry is in front of the volume stay clear
+		const auto vScenePt = ScreenToLocal(float3(vLoc.x, vLoc.y, tvDepthRO[idx]), mScreenToLocal);
+		fFar = fmin(fFar, dot(vScenePt - vPos, vRayDir));
+		if (!bHit || fFar <= fNear)
+		{
+			tvDstRW.set(idx, unorm4(0.0f, 0.0f, 0.0f, 0.0f));
+			return;
+		}
+
+		const auto vMarch = MarchRay(tvDensityRO, tvTransmitRO, aOccupancy, pyramid, vSimSize, bLightVolume,
+			bExactExtinction, vLocalSpaceLightPt, vPos, vRayDir, fNear, fFar, SAMPLE_RATE, 0.5f);
+
+		// Linear premultiplied color with the opacity in alpha, for Composite
+		const auto fOpacity = 1.0f - vMarch.y;
+		const auto vResult = (vMarch.x * vLightRad + vAmbientRad) * fOpacity;
+
+		tvDstRW.set(idx, unorm4(vResult.x, vResult.y, vResult.z, fOpacity));
+	}
+	);
+}
+
+void AmpFluid3D::Composite(upAmpTexture2D<unorm4> &pDst, const AmpTexture2D<unorm4> &txScene,
+	const AmpTexture2D<unorm4> &txLayer)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::Composite", m_acclView);
+
+	const auto tvDstRW = AmpRWTexture2DView<unorm4>(dref(pDst));
+	const auto tvSceneRO = AmpTexture2DView<unorm4>(txScene);
+	const auto tvLayerRO = AmpTexture2DView<unorm4>(txLayer);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvDstRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex2D idx) restrict(amp)
+	{
+		const auto vLayer = tvLayerRO[idx];
+		const auto vScene = tvSceneRO[idx];
+
+		// Blend over the scene in linear space, then encode as the plain overload does
+		const auto vSceneColor = float3(static_cast<float>(vScene.r), static_cast<float>(vScene.g),
+			static_cast<float>(vScene.b));
+		const auto vResult = float3(static_cast<float>(vLayer.r), static_cast<float>(vLayer.g),
+			static_cast<float>(vLayer.b)) + vSceneColor * vSceneColor * (1.0f - static_cast<float>(vLayer.a));
+
+		tvDstRW.set(idx, unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f));
+	}
+	);
+}
+
+void AmpFluid3D::Render(upAmpTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::Render", m_acclView);
+
+	// Light transmittance volume, refreshed when the density or the light has changed
+	if (m_bLightVolume) updateTransmittance(cbPerObj.m_vLocalSpaceLightPt.xyz, 2.0f * sqrt(3.0f) / NUM_LIGHT_SAMPLES);
+
+	// Temporal mode: a jittered fraction of the samples, accumulated over the frames
+	if (m_bTemporal)
+	{
+		marchTemporal(pDst->extent, cbImmutable, cbPerObj);
+		resolveTemporal(pDst, cbPerObj);
+
+		return;
+	}
+
+	// Reduced resolution: march into the intermediate target, then upsample
+	if (m_uRenderScale > 1)
+	{
+		marchLowRes(pDst->extent, cbPerObj);
+		upsample(pDst, cbImmutable, cbPerObj);
+
+		return;
+	}
+
+	const auto tvDstRW = AmpRWTexture2DView<unorm4>(dref(pDst));
+	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	const auto tvTransmitRO = AmpTexture3DView<float>(dref(m_pTransmittance));
+	const auto &aOccupancy = dref(m_pOccupancy);
+	const auto pyramid = m_occupancyPyramid;
+	const auto vSimSize = m_vSimSize;
+	const auto bLightVolume = m_bLightVolume;
+	const auto bExactExtinction = m_bExactExtinction;
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvDstRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aOccupancy](const AmpIndex2D idx) restrict(amp)
+	{
+		const auto vCornflowerBlue = float3(0.392156899f, 0.584313750f, 0.929411829f);
+		const auto vClear = vCornflowerBlue * vCornflowerBlue;
+
+		// Constant buffer immutable
+		const auto vLightRad = cbImmutable.m_vDirectional.xyz * cbImmutable.m_vDirectional.w;
+		const auto vAmbientRad = cbImmutable.m_vAmbient.xyz * cbImmutable.m_vAmbient.w;
+
+		// Constant buffer per object
+		const auto &vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz;
+		const auto &vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz;
+		const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+		//////////////////////////////////////////////////////////////////////////////////////////
+
+		const auto vLoc = float3((float)idx[1], (float)idx[0], 0.0f);
+
+		const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+		const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+		float fNear, fFar;
+		if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar)) return;
+
+		const auto vMarch = MarchRay(tvDensityRO, tvTransmitRO, aOccupancy, pyramid, vSimSize, bLightVolume,
+			bExactExtinction, vLocalSpaceLightPt, vPos, vRayDir, fNear, fFar, SAMPLE_RATE, 0.5f);
+
+		auto vResult = vMarch.x * vLightRad + vAmbientRad;
+		vResult = lerp(vResult, vClear, vMarch.y);
+
+		tvDstRW.set(idx, unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f));
+	}
+	);
+}
+
+void AmpFluid3D::SetRenderScale(const uint8_t uScale)
+{
+	m_uRenderScale = uScale > 1 ? uScale : 1;
+}
+
+void AmpFluid3D::SetExactExtinction(const bool bExact)
+{
+	m_bExactExtinction = bExact;
+	m_bHistoryValid = false;
+}
+
+void AmpFluid3D::SetTemporal(const bool bTemporal)
+{
+	m_bTemporal = bTemporal;
+	m_bHistoryValid = false;
+}
+
+bool AmpFluid3D::SaveCheckpoint(const char *szFileName, const uint64_t uStep, cfloat fDeltaTime) const
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::SaveCheckpoint", m_acclView);
+
+	auto pVelocity = m_pSrcVelocity;
+	auto pDensity = m_pSrcDensity;
+	auto pPressure = m_pressure.GetSrc();
+
+	vector<float> fields[NUM_CHECKPOINT_FIELDS];
+	GatherBricks(dref(pVelocity), m_bricks, fields[CHECKPOINT_VELOCITY]);
+	GatherBricks(dref(pDensity), m_bricks, fields[CHECKPOINT_DENSITY]);
+	GatherBricks(dref(pPressure), m_bricks, fields[CHECKPOINT_PRESSURE]);
+
+	const auto &fieldExtent = m_pSrcDensity->extent;
+
+	return WriteCheckpoint(szFileName, fieldExtent[2], fieldExtent[1], fieldExtent[0], uStep, fDeltaTime, fields);
+}
+
+bool AmpFluid3D::LoadCheckpoint(const char *szFileName, CheckpointHeader *pHeader)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::LoadCheckpoint", m_acclView);
+
+	CheckpointReader reader;
+	if (!reader.Open(szFileName)) return false;
+
+	// Take the size of the checkpoint
+	const auto &header = reader.GetHeader();
+	if (!m_pSrcDensity || m_pSrcDensity->extent != extent<3>(header.iDepth, header.iHeight, header.iWidth))
+		Init(header.iWidth, header.iHeight, header.iDepth);
+
+	// The arrays are uploaded before the reader unmaps the file
+	ScatterBricks(reader, CHECKPOINT_VELOCITY, dref(m_pSrcVelocity));
+	ScatterBricks(reader, CHECKPOINT_DENSITY, dref(m_pSrcDensity));
+	auto pPressure = m_pressure.GetSrc();
+	ScatterBricks(reader, CHECKPOINT_PRESSURE, dref(pPressure));
+
+	// Every brick goes live again, so the next step frees and clears the empty ones in all buffers
+	m_bricks.Init(header.iWidth, header.iHeight, header.iDepth);
+	buildOccupancy();
+	m_bLightDirty = true;
+	m_bHistoryValid = false;
+
+	if (pHeader) *pHeader = header;
+
+	return true;
+}
+
+void AmpFluid3D::marchLowRes(const concurrency::extent<2> &dstExtent, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::marchLowRes", m_acclView);
+
+	const auto uScale = m_uRenderScale;
+	const auto lowResExtent = extent<2>((dstExtent[0] + uScale - 1) / uScale, (dstExtent[1] + uScale - 1) / uScale);
+	if (!m_pLowRes || m_pLowRes->extent != lowResExtent)
+		m_pLowRes = make_shared<AmpTexture2D<float4>>(lowResExtent, 32, m_acclView);
+
+	const auto tvLowResRW = AmpRWTexture2DView<float4>(dref(m_pLowRes));
+	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	const auto tvTransmitRO = AmpTexture3DView<float>(dref(m_pTransmittance));
+	const auto &aOccupancy = dref(m_pOccupancy);
+	const auto pyramid = m_occupancyPyramid;
+	const auto vSimSize = m_vSimSize;
+	const auto bLightVolume = m_bLightVolume;
+	const auto bExactExtinction = m_bExactExtinction;
+	const auto fScale = static_cast<float>(uScale);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvLowResRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aOccupancy](const AmpIndex2D idx) restrict(amp)
+	{
+		// Constant buffer per object
+		const auto &vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz;
+		const auto &vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz;
+		const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+		// Ray through the center of the covered back-buffer pixels
+		const auto vLoc = float3((idx[1] + 0.5f) * fScale - 0.5f, (idx[0] + 0.5f) * fScale - 0.5f, 0.0f);
+
+		const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+		const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+		float fNear, fFar;
+		if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar))
+		{
+			tvLowResRW.set(idx, float4(0.0f, 1.0f, 0.0f, 0.0f));
+			return;
+		}
+
+		const auto vMarch = MarchRay(tvDensityRO, tvTransmitRO, aOccupancy, pyramid, vSimSize, bLightVolume,
+			bExactExtinction, vLocalSpaceLightPt, vPos, vRayDir, fNear, fFar, SAMPLE_RATE, 0.5f);
+
+		// Opacity-premultiplied radiance and transmittance interpolate linearly; the ray
+		// bounds guide the upsampling
+		tvLowResRW.set(idx, float4(vMarch.x * (1.0f - vMarch.y), vMarch.y, fNear, fFar));
+	}
+	);
+}
+
+void AmpFluid3D::upsample(upAmpTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::upsample", m_acclView);
+
+	const auto tvDstRW = AmpRWTexture2DView<unorm4>(dref(pDst));
+	const auto tvLowResRO = AmpTexture2DView<float4>(dref(m_pLowRes));
+	const auto fScale = static_cast<float>(m_uRenderScale);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvDstRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex2D idx) restrict(amp)
+	{
+		const auto vCornflowerBlue = float3(0.392156899f, 0.584313750f, 0.929411829f);
+		const auto vClear = vCornflowerBlue * vCornflowerBlue;
 
-	cfloat aPos[3] = { vPos.x, vPos.y, vPos.z };
-	cfloat aRayDir[3] = { vRayDir.x, vRayDir.y, vRayDir.z };
+		// Constant buffer immutable
+		const auto vLightRad = cbImmutable.m_vDirectional.xyz * cbImmutable.m_vDirectional.w;
+		const auto vAmbientRad = cbImmutable.m_vAmbient.xyz * cbImmutable.m_vAmbient.w;
 
-	//float U = asfloat(0x7f800000);	// INF
-	auto U = FLT_MAX;
-	auto bHit = false;
+		// Constant buffer per object
+		const auto &vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz;
+		const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
 
-	for (uint i = 0; i < 3; ++i)
-	{
-		const auto u = ((aRayDir[i] < 0.0f ? 1.0f : -1.0f) - aPos[i]) / aRayDir[i];
-		if (u < 0.0f) continue;
+		//////////////////////////////////////////////////////////////////////////////////////////
+
+		const auto vLoc = float3((float)idx[1], (float)idx[0], 0.0f);
 
-		const auto j = (i + 1) % 3, k = (i + 2) % 3;
-		if (fabs(aRayDir[j] * u + aPos[j]) > 1.0f) continue;
-		if (fabs(aRayDir[k] * u + aPos[k]) > 1.0f) continue;
-		if (u < U)
+		// The pixel's own ray bounds are cheap and exact
+		const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+		const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+		float fNear, fFar;
+		if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar)) return;
+
+		// Bilinear footprint on the low-resolution target
+		const auto iMaxX = tvLowResRO.extent[1] - 1, iMaxY = tvLowResRO.extent[0] - 1;
+		const auto fX = clamp((vLoc.x + 0.5f) / fScale - 0.5f, 0.0f, (float)iMaxX);
+		const auto fY = clamp((vLoc.y + 0.5f) / fScale - 0.5f, 0.0f, (float)iMaxY);
+		const auto x0 = (int)fX, y0 = (int)fY;
+		const int aX[] = { x0, direct3d::imin(x0 + 1, iMaxX) };
+		const int aY[] = { y0, direct3d::imin(y0 + 1, iMaxY) };
+		const float aWX[] = { 1.0f - (fX - x0), fX - x0 };
+		const float aWY[] = { 1.0f - (fY - y0), fY - y0 };
+
+		// Taps whose rays cross the volume differently lie across an edge and fade out
+		auto fWeight = 0.0f, fLit = 0.0f, fTransmit = 0.0f;
+		for (auto j = 0; j < 2; ++j)
 		{
-			U = u;
-			bHit = true;
+			for (auto i = 0; i < 2; ++i)
+			{
+				const auto vTap = tvLowResRO[AmpIndex2D(aY[j], aX[i])];
+				const auto fDiff = fabs(vTap.z - fNear) + fabs(vTap.w - fFar);
+				const auto fW = aWX[i] * aWY[j] * UPSAMPLE_EPSILON / (UPSAMPLE_EPSILON + fDiff);
+				fLit += fW * vTap.x;
+				fTransmit += fW * vTap.y;
+				fWeight += fW;
+			}
 		}
-	}
+		fLit /= fWeight;
+		fTransmit /= fWeight;
 
-	vPos += vRayDir * U;
-	vPos.x = clamp(vPos.x, -1.0f, 1.0f);
-	vPos.y = clamp(vPos.y, -1.0f, 1.0f);
-	vPos.z = clamp(vPos.z, -1.0f, 1.0f);
+		const auto vResult = fLit * vLightRad + (1.0f - fTransmit) * vAmbientRad + fTransmit * vClear;
 
-	return bHit;
-}
-
-AmpFluid3D::AmpFluid3D(const AmpAcclView &acclView) :
-	m_acclView(acclView)
-{
+		tvDstRW.set(idx, unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f));
+	}
+	);
 }
 
-void AmpFluid3D::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+void AmpFluid3D::marchTemporal(const concurrency::extent<2> &dstExtent, const CBImmutable &cbImmutable,
+	const CBPerObject &cbPerObj)
 {
-	const auto fWidth = static_cast<float>(iWidth);
-	const auto fHeight = static_cast<float>(iHeight);
-	const auto fDepth = static_cast<float>(iDepth);
-	m_vSimSize = float3(fWidth, fHeight, fDepth);
-
-	// Create 3D textures
-	m_pSrcDensity = make_unique<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
-	m_pDstDensity = make_unique<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
-#ifdef _MACCORMACK_
-	m_pTmpDensity = make_unique<AmpTexture<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
-#endif
-
-	m_diffuse.Init(iWidth, iHeight, iDepth, 16, m_acclView);
-	m_pressure.Init(iWidth, iHeight, iDepth, 32, m_acclView);
-	m_pSrcVelocity = m_diffuse.GetSrc();
-	m_pDstVelocity = m_diffuse.GetDst();
-}
+	TRACE_SCOPE_SYNC("AmpFluid3D::marchTemporal", m_acclView);
 
-void AmpFluid3D::Simulate(cfloat fDeltaTime, cfloat4 vForceDens, cfloat3 vImLoc, const uint8_t uItVisc)
-{
-	advect(fDeltaTime);
-	diffuse(uItVisc);
-	impulse(fDeltaTime, vForceDens, vImLoc);
-	project(fDeltaTime);
-}
+	if (!m_pCurrent || m_pCurrent->extent != dstExtent)
+	{
+		// History is sampled bilinearly, so it is kept at 16 bits for filtering support
+		m_pCurrent = make_shared<AmpTexture2D<float4>>(dstExtent, 32, m_acclView);
+		m_pHistory = make_shared<AmpTexture2D<float4>>(dstExtent, 16, m_acclView);
+		m_pPrevHistory = make_shared<AmpTexture2D<float4>>(dstExtent, 16, m_acclView);
+		m_bHistoryValid = false;
+	}
 
-void AmpFluid3D::Render(upAmpTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
-{
-	const auto tvDstRW = AmpRWTexture2DView<unorm4>(dref(pDst));
+	const auto tvCurrentRW = AmpRWTexture2DView<float4>(dref(m_pCurrent));
 	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	const auto tvTransmitRO = AmpTexture3DView<float>(dref(m_pTransmittance));
+	const auto &aOccupancy = dref(m_pOccupancy);
+	const auto pyramid = m_occupancyPyramid;
+	const auto vSimSize = m_vSimSize;
+	const auto bLightVolume = m_bLightVolume;
+	const auto bExactExtinction = m_bExactExtinction;
+
+	// Golden-ratio sequence over the frames, decorrelated across the pixels by
+	// interleaved gradient noise
+	const auto fFrameJitter = 0.5f + 0.618034f * static_cast<float>(m_uFrame % 1024);
 
 	parallel_for_each(
 		// Define the compute domain, which is the set of threads that are created.
-		tvDstRW.extent,
+		tvCurrentRW.extent,
 		// Define the code to run on each thread on the accelerator.
-		[=](const AmpIndex2D idx) restrict(amp)
+		[=, &aOccupancy](const AmpIndex2D idx) restrict(amp)
 	{
 		const auto vCornflowerBlue = float3(0.392156899f, 0.584313750f, 0.929411829f);
 		const auto vClear = vCornflowerBlue * vCornflowerBlue;
 
-		const auto fMaxDist = 2.0f * sqrt(3.0f);
-		const auto fStepScale = fMaxDist / NUM_SAMPLES;
-		const auto fLStepScale = fMaxDist / NUM_LIGHT_SAMPLES;
-
 		// Constant buffer immutable
 		const auto vLightRad = cbImmutable.m_vDirectional.xyz * cbImmutable.m_vDirectional.w;
 		const auto vAmbientRad = cbImmutable.m_vAmbient.xyz * cbImmutable.m_vAmbient.w;
@@ -124,101 +964,309 @@ void AmpFluid3D::Render(upAmpTexture2D<unorm4> &pDst, const CBImmutable &cbImmut
 
 		const auto vLoc = float3((float)idx[1], (float)idx[0], 0.0f);
 
-		auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+		const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
 		const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
-		if (!ComputeStartPoint(vPos, vRayDir)) return;
+		float fNear, fFar;
+		if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar))
+		{
+			tvCurrentRW.set(idx, float4(vClear.x, vClear.y, vClear.z, -1.0f));
+			return;
+		}
 
-		const auto vStep = vRayDir * fStepScale;
+		const auto fNoise = 52.9829189f * fmod(0.06711056f * vLoc.x + 0.00583715f * vLoc.y, 1.0f);
+		const auto fJitter = fmod(fFrameJitter + fNoise, 1.0f);
+		const auto vMarch = MarchRay(tvDensityRO, tvTransmitRO, aOccupancy, pyramid, vSimSize, bLightVolume,
+			bExactExtinction, vLocalSpaceLightPt, vPos, vRayDir, fNear, fFar, SAMPLE_RATE * TEMPORAL_SAMPLE_RATE, fJitter);
 
-#ifndef _POINT_LIGHT_
-		const auto vLRStep = normalize(vLocalSpaceLightPt) * fLStepScale;
-#endif
+		auto vResult = vMarch.x * vLightRad + vAmbientRad;
+		vResult = lerp(vResult, vClear, vMarch.y);
 
-		// Transmittance
-		float fTransmit = 1.0f;
-		// In-scattered radiance
-		float fScatter = 0.0f;
+		// The depth along the ray is kept for the reprojection
+		tvCurrentRW.set(idx, float4(vResult.x, vResult.y, vResult.z, vMarch.z));
+	}
+	);
+}
 
-		for (uint i = 0; i < NUM_SAMPLES; ++i)
-		{
-			if (fabs(vPos.x) > 1.0f || fabs(vPos.y) > 1.0f || fabs(vPos.z) > 1.0f) break;
-			auto vTex = float3(0.5f, -0.5f, 0.5f) * vPos + 0.5f;
+void AmpFluid3D::resolveTemporal(upAmpTexture2D<unorm4> &pDst, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::resolveTemporal", m_acclView);
+
+	const auto tvDstRW = AmpRWTexture2DView<unorm4>(dref(pDst));
+	const auto tvHistoryRW = AmpRWTexture2DView<float4>(dref(m_pHistory));
+	const auto tvPrevHistoryRO = AmpTexture2DView<float4>(dref(m_pPrevHistory));
+	const auto tvCurrentRO = AmpTexture2DView<float4>(dref(m_pCurrent));
+	const auto bHistoryValid = m_bHistoryValid;
+
+	// Local space to the previous frame's screen
+	const auto mPrevLocalToScreen = inverse(m_cbPrevPerObj.m_mScreenToLocal);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvDstRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex2D idx) restrict(amp)
+	{
+		// Constant buffer per object
+		const auto &vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz;
+		const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
 
-			// Get a sample
-			const auto fDens = fmin(tvDensityRO.sample(vTex), 16.0f);
+		const auto vCurrent = tvCurrentRO[idx];
+		const auto vColor = vCurrent.xyz;
+		if (vCurrent.w < 0.0f)
+		{
+			tvHistoryRW.set(idx, vCurrent);
+			return;
+		}
 
-			// Skip empty space
-			if (fDens > ZERO_THRESHOLD)
+		// Neighborhood statistics of the current frame
+		const auto iMaxX = tvCurrentRO.extent[1] - 1, iMaxY = tvCurrentRO.extent[0] - 1;
+		auto vMean = float3(0.0f, 0.0f, 0.0f), vMeanSq = float3(0.0f, 0.0f, 0.0f);
+		for (auto j = -1; j <= 1; ++j)
+		{
+			for (auto i = -1; i <= 1; ++i)
 			{
-				// Attenuate ray-throughput
-				const auto fScaledDens = fDens * fStepScale;
-				fTransmit *= saturate(1.0f - fScaledDens * ABSORPTION);
-				if (fTransmit < ZERO_THRESHOLD) break;
+				const auto vTap = tvCurrentRO[AmpIndex2D(direct3d::clamp(idx[0] + j, 0, iMaxY),
+					direct3d::clamp(idx[1] + i, 0, iMaxX))].xyz;
+				vMean += vTap;
+				vMeanSq += vTap * vTap;
+			}
+		}
+		vMean = vMean / 9.0f;
+		const auto vVar = vMeanSq / 9.0f - vMean * vMean;
+		const auto vSigma = float3(sqrt(fmax(vVar.x, 0.0f)), sqrt(fmax(vVar.y, 0.0f)), sqrt(fmax(vVar.z, 0.0f)));
 
-				// Point light direction in texture space
-#ifdef _POINT_LIGHT_
-				const auto vLRStep = normalize(vLocalSpaceLightPt - vPos) * fLStepScale;
-#endif
+		// Reproject the opacity-weighted point of the ray into the previous frame
+		const auto vLoc = float3((float)idx[1], (float)idx[0], 0.0f);
+		const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+		const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+		const auto vPoint = vPos + vRayDir * vCurrent.w;
+		const auto vPrev = mul(mPrevLocalToScreen, float4(vPoint.x, vPoint.y, vPoint.z, 1.0f));
+		const auto fPrevX = vPrev.x / vPrev.w, fPrevY = vPrev.y / vPrev.w;
+
+		auto vResult = vColor;
+		if (bHistoryValid && vPrev.w > 0.0f && fPrevX >= -0.5f && fPrevY >= -0.5f &&
+			fPrevX <= iMaxX + 0.5f && fPrevY <= iMaxY + 0.5f)
+		{
+			// Variance clipping rejects the history that the current frame cannot explain
+			const auto vTex = float2((fPrevX + 0.5f) / (iMaxX + 1), (fPrevY + 0.5f) / (iMaxY + 1));
+			const auto vLo = vMean - vSigma * TEMPORAL_GAMMA, vHi = vMean + vSigma * TEMPORAL_GAMMA;
+			auto vHistory = tvPrevHistoryRO.sample(vTex).xyz;
+			vHistory = float3(clamp(vHistory.x, vLo.x, vHi.x), clamp(vHistory.y, vLo.y, vHi.y),
+				clamp(vHistory.z, vLo.z, vHi.z));
+			vResult = lerp(vHistory, vColor, TEMPORAL_BLEND);
+		}
 
-				// Sample light
-				auto fLRTrans = 1.0f;	// Transmittance along light ray
-				auto vLRPos = vPos + vLRStep;
+		tvHistoryRW.set(idx, float4(vResult.x, vResult.y, vResult.z, vCurrent.w));
+		tvDstRW.set(idx, unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f));
+	}
+	);
 
-				for (uint j = 0; j < NUM_LIGHT_SAMPLES; ++j)
-				{
-					if (fabs(vLRPos.x) > 1.0f || fabs(vLRPos.y) > 1.0f || fabs(vLRPos.z) > 1.0f) break;
-					vTex = float3(0.5f, -0.5f, 0.5f) * vLRPos + 0.5f;
+	// Swap buffers
+	m_pHistory.swap(m_pPrevHistory);
+	m_cbPrevPerObj = cbPerObj;
+	m_bHistoryValid = true;
+	++m_uFrame;
+}
 
-					// Get a sample along light ray
-					cfloat fLRDens = fmin(tvDensityRO.sample(vTex), 16.0f);
+void AmpFluid3D::buildOccupancy()
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::buildOccupancy", m_acclView);
 
-					// Attenuate ray-throughput along light direction
-					fLRTrans *= saturate(1.0f - ABSORPTION * fLStepScale * fLRDens);
-					if (fLRTrans < ZERO_THRESHOLD) break;
+	const auto &pyramid = m_occupancyPyramid;
+	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	auto &aOccupancy = dref(m_pOccupancy);
 
-					// Update position along light ray
-					vLRPos += vLRStep;
+	// Level 0: maximum over each macro-cell and its one-texel border
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		extent<3>(pyramid.iDims[0][2], pyramid.iDims[0][1], pyramid.iDims[0][0]),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aOccupancy](const AmpIndex3D idx) restrict(amp)
+	{
+		const auto &domain = tvDensityRO.extent;
+		auto fMaxDens = 0.0f;
+		for (auto z = idx[0] * OCCUPANCY_CELL - 1; z <= (idx[0] + 1) * OCCUPANCY_CELL; ++z)
+			for (auto y = idx[1] * OCCUPANCY_CELL - 1; y <= (idx[1] + 1) * OCCUPANCY_CELL; ++y)
+				for (auto x = idx[2] * OCCUPANCY_CELL - 1; x <= (idx[2] + 1) * OCCUPANCY_CELL; ++x)
+				{
+					// Clamp like the sampler does
+					const auto vLoc = AmpIndex3D(direct3d::clamp(z, 0, domain[0] - 1),
+						direct3d::clamp(y, 0, domain[1] - 1), direct3d::clamp(x, 0, domain[2] - 1));
+					fMaxDens = fmax(fMaxDens, tvDensityRO[vLoc]);
 				}
 
-				fScatter += fLRTrans * fTransmit * fScaledDens;
-			}
+		aOccupancy[(idx[0] * pyramid.iDims[0][1] + idx[1]) * pyramid.iDims[0][0] + idx[2]] = fMaxDens;
+	}
+	);
+
+	// Coarser levels: maximum over the 2^3 children
+	for (auto l = 1; l < pyramid.iNumLevels; ++l)
+	{
+		parallel_for_each(
+			// Define the compute domain, which is the set of threads that are created.
+			extent<3>(pyramid.iDims[l][2], pyramid.iDims[l][1], pyramid.iDims[l][0]),
+			// Define the code to run on each thread on the accelerator.
+			[=, &aOccupancy](const AmpIndex3D idx) restrict(amp)
+		{
+			const auto &iDims = pyramid.iDims[l];
+			const auto &iFineDims = pyramid.iDims[l - 1];
+			const auto iFine = pyramid.iOffsets[l - 1];
 
-			vPos += vStep;
+			auto fMaxDens = 0.0f;
+			for (auto z = idx[0] * 2; z < direct3d::imin(idx[0] * 2 + 2, iFineDims[2]); ++z)
+				for (auto y = idx[1] * 2; y < direct3d::imin(idx[1] * 2 + 2, iFineDims[1]); ++y)
+					for (auto x = idx[2] * 2; x < direct3d::imin(idx[2] * 2 + 2, iFineDims[0]); ++x)
+						fMaxDens = fmax(fMaxDens, aOccupancy[iFine + (z * iFineDims[1] + y) * iFineDims[0] + x]);
+
+			aOccupancy[pyramid.iOffsets[l] + (idx[0] * iDims[1] + idx[1]) * iDims[0] + idx[2]] = fMaxDens;
 		}
+		);
+	}
+}
 
-		//clip(ONE_THRESHOLD - fTransmit);
+void AmpFluid3D::updateTransmittance(cfloat3 &vLightPt, cfloat fLStepScale)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::updateTransmittance", m_acclView);
 
-		auto vResult = fScatter * vLightRad + vAmbientRad;
-		vResult = lerp(vResult, vClear, fTransmit);
+	if (!m_bLightDirty && vLightPt.x == m_vLightPt.x && vLightPt.y == m_vLightPt.y &&
+		vLightPt.z == m_vLightPt.z) return;
+	m_bLightDirty = false;
+	m_vLightPt = vLightPt;
 
-		tvDstRW.set(idx, unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f));
+	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	const auto tvTransmitRW = AmpRWTexture3DView<float>(dref(m_pTransmittance));
+
+	// Sweep slice by slice away from the light along its dominant axis: each texel takes the
+	// transmittance on the previous slice where its light ray enters, attenuated over the step
+	// by the mean density of the cells the texel covers. The step is the distance between
+	// slices rather than fLStepScale. A single tile walks every slice in one dispatch, with a
+	// barrier between the slices.
+#ifndef _POINT_LIGHT_
+	static_cast<void>(fLStepScale);
+#endif
+	const int aExtent[] = { tvTransmitRW.extent[2], tvTransmitRW.extent[1], tvTransmitRW.extent[0] };
+	const int aDensExtent[] = { tvDensityRO.extent[2], tvDensityRO.extent[1], tvDensityRO.extent[0] };
+	const float aScale[] = { 0.5f * aExtent[0], -0.5f * aExtent[1], 0.5f * aExtent[2] };	// Texels per local unit
+	const float aLight[] = { vLightPt.x * aScale[0], vLightPt.y * aScale[1], vLightPt.z * aScale[2] };
+	const auto a = fabs(aLight[0]) >= fabs(aLight[1]) && fabs(aLight[0]) >= fabs(aLight[2]) ? 0 :
+		(fabs(aLight[1]) >= fabs(aLight[2]) ? 1 : 2);
+	const auto b = a > 0 ? 0 : 1, c = 3 - a - b;		// Rows run along the fastest axis left
+	const auto iToLight = aLight[a] > 0.0f ? 1 : -1;
+
+	const auto iExtentA = aExtent[a], iExtentB = aExtent[b], iExtentC = aExtent[c];
+	const auto iDensExtentA = aDensExtent[a], iDensExtentB = aDensExtent[b], iDensExtentC = aDensExtent[c];
+	const auto fUnitA = 1.0f / aScale[a], fUnitB = 1.0f / aScale[b], fUnitC = 1.0f / aScale[c];	// Local units per texel
+	const auto fLightA = aLight[a], fLightB = aLight[b], fLightC = aLight[c];
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		extent<2>(LIGHT_SWEEP_TILE, LIGHT_SWEEP_TILE).tile<LIGHT_SWEEP_TILE, LIGHT_SWEEP_TILE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=](const tiled_index<LIGHT_SWEEP_TILE, LIGHT_SWEEP_TILE> tidx) restrict(amp)
+	{
+		for (auto i = 0; i < iExtentA; ++i)
+		{
+			const auto iSlice = iToLight > 0 ? iExtentA - 1 - i : i;
+			const auto iPrev = iSlice + iToLight;
+			const auto bLit = iPrev < 0 || iPrev >= iExtentA;
+			const auto iA0 = direct3d::imin(iSlice * LIGHT_VOLUME_SCALE, iDensExtentA - 1);
+			const auto iA1 = direct3d::imin(iSlice * LIGHT_VOLUME_SCALE + 1, iDensExtentA - 1);
+
+			for (auto k = tidx.local[0]; k < iExtentC; k += LIGHT_SWEEP_TILE)
+			{
+				// Texels toward the light along the slice axis and across the rows, in the grid
+				// frame centered on the volume; only the step along the row varies within a row
+#ifdef _POINT_LIGHT_
+				const auto fDirA = fLightA - (iSlice + 0.5f - 0.5f * iExtentA);
+				const auto fDirC = fLightC - (k + 0.5f - 0.5f * iExtentC);
+#else
+				const auto fDirA = fLightA, fDirC = fLightC;
+#endif
+				// Step to the previous slice, and its squared length in local units but along the row
+				const auto fSlices = 1.0f / fabs(fDirA);
+				const auto fStepC = fDirC * fSlices;
+				const auto fSegmentAC = fUnitA * fUnitA + fStepC * fStepC * fUnitC * fUnitC;
+				const auto fC = k + fStepC;
+				const auto iC0 = direct3d::imin(k * LIGHT_VOLUME_SCALE, iDensExtentC - 1);
+				const auto iC1 = direct3d::imin(k * LIGHT_VOLUME_SCALE + 1, iDensExtentC - 1);
+
+				for (auto j = tidx.local[1]; j < iExtentB; j += LIGHT_SWEEP_TILE)
+				{
+					const auto iDst = SliceIndex(a, iSlice, b, j, c, k);
+					if (bLit)
+					{
+						tvTransmitRW.set(iDst, 1.0f);
+						continue;
+					}
+#ifdef _POINT_LIGHT_
+					if (fDirA * iToLight < 1.0f)
+					{
+						// The light lies within the previous slice, so no slice sees it first
+						float aLoc[3];
+						aLoc[a] = (iSlice + 0.5f - 0.5f * iExtentA) * fUnitA;
+						aLoc[b] = (j + 0.5f - 0.5f * iExtentB) * fUnitB;
+						aLoc[c] = (k + 0.5f - 0.5f * iExtentC) * fUnitC;
+						const auto vPos = float3(aLoc[0], aLoc[1], aLoc[2]);
+						tvTransmitRW.set(iDst, LightTransmittance(tvDensityRO, vPos,
+							normalize(vLightPt - vPos) * fLStepScale, fLStepScale));
+						continue;
+					}
+
+					const auto fStepB = (fLightB - (j + 0.5f - 0.5f * iExtentB)) * fSlices;
+#else
+					const auto fStepB = fLightB * fSlices;
+#endif
+					const auto fSegment = sqrt(fSegmentAC + fStepB * fStepB * fUnitB * fUnitB);
+
+					// Bilinear transmittance where the ray enters, clamped to the grid
+					const auto fB = j + fStepB;
+					const auto fFloorB = floor(fB), fFloorC = floor(fC);
+					const auto fFracB = fB - fFloorB, fFracC = fC - fFloorC;
+					const auto j0 = direct3d::clamp((int)fFloorB, 0, iExtentB - 1);
+					const auto j1 = direct3d::clamp((int)fFloorB + 1, 0, iExtentB - 1);
+					const auto k0 = direct3d::clamp((int)fFloorC, 0, iExtentC - 1);
+					const auto k1 = direct3d::clamp((int)fFloorC + 1, 0, iExtentC - 1);
+					const auto fLRTrans = lerp(
+						lerp(tvTransmitRW[SliceIndex(a, iPrev, b, j0, c, k0)], tvTransmitRW[SliceIndex(a, iPrev, b, j1, c, k0)], fFracB),
+						lerp(tvTransmitRW[SliceIndex(a, iPrev, b, j0, c, k1)], tvTransmitRW[SliceIndex(a, iPrev, b, j1, c, k1)], fFracB),
+						fFracC);
+
+					// Mean density of the cells under the texel
+					const auto iB0 = direct3d::imin(j * LIGHT_VOLUME_SCALE, iDensExtentB - 1);
+					const auto iB1 = direct3d::imin(j * LIGHT_VOLUME_SCALE + 1, iDensExtentB - 1);
+					const auto fLRDens = fmin(0.125f * (
+						tvDensityRO[SliceIndex(a, iA0, b, iB0, c, iC0)] + tvDensityRO[SliceIndex(a, iA0, b, iB1, c, iC0)] +
+						tvDensityRO[SliceIndex(a, iA0, b, iB0, c, iC1)] + tvDensityRO[SliceIndex(a, iA0, b, iB1, c, iC1)] +
+						tvDensityRO[SliceIndex(a, iA1, b, iB0, c, iC0)] + tvDensityRO[SliceIndex(a, iA1, b, iB1, c, iC0)] +
+						tvDensityRO[SliceIndex(a, iA1, b, iB0, c, iC1)] + tvDensityRO[SliceIndex(a, iA1, b, iB1, c, iC1)]),
+						16.0f);
+
+					tvTransmitRW.set(iDst, fLRTrans * saturate(1.0f - ABSORPTION * fSegment * fLRDens));
+				}
+			}
+
+			// The next slice reads this one
+			tidx.barrier.wait_with_global_memory_fence();
+		}
 	}
 	);
 }
 
 void AmpFluid3D::advect(cfloat fDeltaTime)
 {
-	auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
-	advect(fDeltaTime, tvVelocityRO);
-
-#ifdef _MACCORMACK_
-	m_pDiffuse->SwapTextures(true);
-	m_pDstVelocity = m_pDiffuse->GetDst();
-	pSrcVelocity = m_pDiffuse->GetTmp()->GetSRV();
-	m_pTmpDensity.swap(m_pDstDensity);
-	advect(-fDeltaTime, pSrcVelocity);
+	TRACE_SCOPE_SYNC("AmpFluid3D::advect", m_acclView);
 
-	macCormack(fDeltaTime, pSrcVelocity);
-#endif
+	if (m_advection == ADVECT_SEMI_LAGRANGIAN)
+	{
+		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+		advect(fDeltaTime, tvVelocityRO);
+	}
+	else advectCorrected(fDeltaTime);
 }
 
 void AmpFluid3D::advect(cfloat fDeltaTime, const AmpTexture3DView<float4> &tvVelocityRO)
 {
-#ifdef _MACCORMACK_
-	static const auto fDecay = 1.0f;
-#else
 	static const auto fDecay = 0.996f;
-#endif
 
 	const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
 	const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
@@ -227,7 +1275,7 @@ void AmpFluid3D::advect(cfloat fDeltaTime, const AmpTexture3DView<float4> &tvVel
 
 	const auto vTexel = 1.0f / m_vSimSize;
 
-	parallel_for_each(
+	forEachCell(
 		// Define the compute domain, which is the set of threads that are created.
 		tvPhiVelRW.extent,
 		// Define the code to run on each thread on the accelerator.
@@ -252,8 +1300,114 @@ void AmpFluid3D::advect(cfloat fDeltaTime, const AmpTexture3DView<float4> &tvVel
 	m_pSrcDensity.swap(m_pDstDensity);
 }
 
+void AmpFluid3D::advectCorrected(cfloat fDeltaTime)
+{
+	static const auto fDecay = 0.996f;
+
+	const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPhiVelNRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPhiDenNRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+	auto pPhiVelTmp = m_diffuse.GetTmp();
+
+	const auto vTexel = 1.0f / m_vSimSize;
+
+	{
+		const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+		const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
+
+		// Forward pass: semi-Lagrangian prediction without decay
+		forEachCell(
+			// Define the compute domain, which is the set of threads that are created.
+			tvPhiVelRW.extent,
+			// Define the code to run on each thread on the accelerator.
+			[=](const AmpIndex3D idx) restrict(amp)
+		{
+			const auto vLoc = float3((float)idx[2], (float)idx[1], (float)idx[0]);
+			const auto vTex = (vLoc + 0.5f) * vTexel - tvVelocityRO[idx].xyz * fDeltaTime;
+
+			tvPhiVelRW.set(idx, tvPhiVelNRO.sample(vTex));
+			tvPhiDenRW.set(idx, tvPhiDenNRO.sample(vTex));
+		}
+		);
+	}
+
+	// Backward pass: trace the prediction forward again and take half of the round-trip error.
+	// MacCormack applies it to the prediction and limits here; BFECC applies it to the source.
+	const auto bMacCormack = m_advection == ADVECT_MACCORMACK;
+	{
+		const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(pPhiVelTmp));
+		const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pTmpDensity));
+		const auto tvPhiVelHatRO = AmpTexture3DView<float4>(dref(m_pDstVelocity));
+		const auto tvPhiDenHatRO = AmpTexture3DView<float>(dref(m_pDstDensity));
+
+		forEachCell(
+			// Define the compute domain, which is the set of threads that are created.
+			tvPhiVelRW.extent,
+			// Define the code to run on each thread on the accelerator.
+			[=](const AmpIndex3D idx) restrict(amp)
+		{
+			const auto vLoc = float3((float)idx[2], (float)idx[1], (float)idx[0]);
+			const auto vU = tvVelocityRO[idx].xyz * fDeltaTime;
+			const auto vTex = (vLoc + 0.5f) * vTexel;
+
+			const auto vVelErr = 0.5f * (tvPhiVelNRO[idx] - tvPhiVelHatRO.sample(vTex + vU));
+			const auto fDenErr = 0.5f * (tvPhiDenNRO[idx] - tvPhiDenHatRO.sample(vTex + vU));
+
+			if (bMacCormack)
+			{
+				tvPhiVelRW.set(idx, ClampToStencil3D(tvPhiVelNRO, vTex - vU, tvPhiVelHatRO[idx] + vVelErr));
+				tvPhiDenRW.set(idx, ClampToStencil3D(tvPhiDenNRO, vTex - vU, tvPhiDenHatRO[idx] + fDenErr) * fDecay);
+			}
+			else
+			{
+				tvPhiVelRW.set(idx, tvPhiVelNRO[idx] + vVelErr);
+				tvPhiDenRW.set(idx, tvPhiDenNRO[idx] + fDenErr);
+			}
+		}
+		);
+	}
+
+	if (bMacCormack)
+	{
+		// Swap buffers: the corrected fields become the sources
+		m_diffuse.SwapTextures(true);
+		m_pTmpDensity.swap(m_pDstDensity);
+	}
+	else
+	{
+		// BFECC: advect the compensated source with the original velocity, limited
+		// by the uncompensated source
+		const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+		const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
+		const auto tvPhiVelBarRO = AmpTexture3DView<float4>(dref(pPhiVelTmp));
+		const auto tvPhiDenBarRO = AmpTexture3DView<float>(dref(m_pTmpDensity));
+
+		forEachCell(
+			// Define the compute domain, which is the set of threads that are created.
+			tvPhiVelRW.extent,
+			// Define the code to run on each thread on the accelerator.
+			[=](const AmpIndex3D idx) restrict(amp)
+		{
+			const auto vLoc = float3((float)idx[2], (float)idx[1], (float)idx[0]);
+			const auto vTex = (vLoc + 0.5f) * vTexel - tvVelocityRO[idx].xyz * fDeltaTime;
+
+			tvPhiVelRW.set(idx, ClampToStencil3D(tvPhiVelNRO, vTex, tvPhiVelBarRO.sample(vTex)));
+			tvPhiDenRW.set(idx, ClampToStencil3D(tvPhiDenNRO, vTex, tvPhiDenBarRO.sample(vTex)) * fDecay);
+		}
+		);
+	}
+
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
 void AmpFluid3D::diffuse(const uint8_t uIteration)
 {
+	TRACE_SCOPE_SYNC("AmpFluid3D::diffuse", m_acclView);
+
 	if (uIteration > 0)
 	{
 		m_diffuse.SolvePoisson(uIteration);
@@ -264,6 +1418,8 @@ void AmpFluid3D::diffuse(const uint8_t uIteration)
 
 void AmpFluid3D::impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
 {
+	TRACE_SCOPE_SYNC("AmpFluid3D::impulse", m_acclView);
+
 	const auto tvVelocityRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
 	const auto tvDensityRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
 	const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
@@ -271,7 +1427,7 @@ void AmpFluid3D::impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc
 
 	const auto vTexel = 1.0f / m_vSimSize;
 
-	parallel_for_each(
+	forEachCell(
 		// Define the compute domain, which is the set of threads that are created.
 		tvVelocityRW.extent,
 		// Define the code to run on each thread on the accelerator.
@@ -279,7 +1435,7 @@ void AmpFluid3D::impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc
 	{
 		const auto vLoc = float3((float)idx[2], (float)idx[1], (float)idx[0]);
 		const auto vTex = vLoc * vTexel;
-		const auto fBasis = Gaussian3D(vTex - vImLoc, 0.032f);
+		const auto fBasis = Gaussian3D(vTex - vImLoc, IMPULSE_RADIUS);
 
 		const auto fDens = length(vForceDens.xyz) * vForceDens.w;
 		const auto vForce = vForceDens.xyz * fBasis;
@@ -298,64 +1454,124 @@ void AmpFluid3D::impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc
 	m_pSrcDensity.swap(m_pDstDensity);
 }
 
-void AmpFluid3D::project(cfloat fDeltaTime)
+void AmpFluid3D::advectFused(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
 {
-	{
-		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
-		m_pressure.ComputeDivergence(tvVelocityRO);
-		m_pressure.SolvePoisson(cfloat2(-1.0f, 6.0f));
-	}
+	TRACE_SCOPE_SYNC("AmpFluid3D::advectFused", m_acclView);
 
-	bound();
+	static const auto fDecay = 0.996f;
+
+	const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+	const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
+	const auto tvDivergenceRW = AmpRWTexture3DView<float>(dref(m_pressure.GetDst()));
+	const auto tvPhiVelRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPhiDenRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+
+	const auto vTexel = 1.0f / m_vSimSize;
 
-	// Projection
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvPhiVelRW.extent.tile<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z>(),
+		// Define the code to run on each thread on the accelerator.
+		[=](const tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> t_idx) restrict(amp)
 	{
-		auto txPressure = m_pressure.GetSrc();
-		const auto tvVelocityRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
-		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
-		const auto tvPressureRO = AmpTexture3DView<float>(dref(txPressure));
+		// Updated velocities of the tile and a one-cell halo, for the divergence
+		tile_static float fVelocity[THREAD_BLOCK_Z + 2][THREAD_BLOCK_Y + 2][THREAD_BLOCK_X + 2][3];
 
-		parallel_for_each(
-			// Define the compute domain, which is the set of threads that are created.
-			tvVelocityRW.extent,
-			// Define the code to run on each thread on the accelerator.
-			[=](const AmpIndex3D idx) restrict(amp)
+		const auto iRegionX = THREAD_BLOCK_X + 2, iRegionY = THREAD_BLOCK_Y + 2;
+		const auto iNumCells = iRegionX * iRegionY * (THREAD_BLOCK_Z + 2);
+		const auto iThread = (t_idx.local[0] * THREAD_BLOCK_Y + t_idx.local[1]) * THREAD_BLOCK_X + t_idx.local[2];
+		const auto fDens = length(vForceDens.xyz) * vForceDens.w;
+
+		for (auto i = iThread; i < iNumCells; i += THREAD_BLOCK_X * THREAD_BLOCK_Y * THREAD_BLOCK_Z)
 		{
-			// Project the velocity onto its divergence-free component
-			const auto vVelocity = tvVelocityRO[idx].xyz - Gradient3D(tvPressureRO, idx) / REST_DENS;
-			tvVelocityRW.set(idx, float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f));
+			const auto z = i / (iRegionX * iRegionY), y = (i / iRegionX) % iRegionY, x = i % iRegionX;
+			const auto idx = AmpIndex3D(t_idx.tile_origin[0] + z - 1, t_idx.tile_origin[1] + y - 1,
+				t_idx.tile_origin[2] + x - 1);
+
+			// Cells outside the grid read as zero, as in Divergence3D
+			auto vVelocity = float3(0.0f, 0.0f, 0.0f);
+			if (tvPhiVelRW.extent.contains(idx))
+			{
+				const auto vLoc = float3((float)idx[2], (float)idx[1], (float)idx[0]);
+
+				// Velocity tracing
+				const auto vU = tvPhiVelRO[idx].xyz;
+				const auto vTex = (vLoc + 0.5f) * vTexel - vU * fDeltaTime;
+
+				// Impulse
+				const auto fBasis = Gaussian3D(vLoc * vTexel - vImLoc, IMPULSE_RADIUS);
+				const auto vForce = vForceDens.xyz * fBasis;
+				vVelocity = tvPhiVelRO.sample(vTex).xyz + vForce * fDeltaTime;
+
+				// Only the tile's own cells are written
+				if (x > 0 && y > 0 && z > 0 && x <= THREAD_BLOCK_X && y <= THREAD_BLOCK_Y && z <= THREAD_BLOCK_Z)
+				{
+					tvPhiVelRW.set(idx, float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f));
+					tvPhiDenRW.set(idx, tvPhiDenRO.sample(vTex) * fDecay + fDens * fBasis);
+				}
+			}
+
+			fVelocity[z][y][x][0] = vVelocity.x;
+			fVelocity[z][y][x][1] = vVelocity.y;
+			fVelocity[z][y][x][2] = vVelocity.z;
 		}
-		);
+		t_idx.barrier.wait_with_tile_static_memory_fence();
+
+		// Take central differences of neighboring values
+		const auto x = t_idx.local[2] + 1, y = t_idx.local[1] + 1, z = t_idx.local[0] + 1;
+		const auto fDivergence = 0.5f * (fVelocity[z][y][x + 1][0] - fVelocity[z][y][x - 1][0] +
+			fVelocity[z][y + 1][x][1] - fVelocity[z][y - 1][x][1] +
+			fVelocity[z + 1][y][x][2] - fVelocity[z - 1][y][x][2]);
+		tvDivergenceRW.set(t_idx.global, fDivergence);
+	}
+	);
 
-		// Swap buffers
-		m_diffuse.SwapTextures();
-		m_pSrcVelocity = m_diffuse.GetSrc();
-		m_pDstVelocity = m_diffuse.GetDst();
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+	m_pSrcDensity.swap(m_pDstDensity);
+	m_pressure.SwapTextures();
+}
+
+void AmpFluid3D::project(cfloat fDeltaTime, const bool bDivergence)
+{
+	TRACE_SCOPE_SYNC("AmpFluid3D::project", m_acclView);
+
+	{
+		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+		if (bDivergence) m_pressure.ComputeDivergence(tvVelocityRO);
+		if (m_fPressTolerance > 0.0f) m_pressureStats = m_pressure.SolvePoisson(cfloat2(-1.0f, 6.0f),
+			m_fPressTolerance, m_uPressMaxIteration, m_uPressCheckInterval);
+		else m_pressure.SolvePoisson(cfloat2(-1.0f, 6.0f));
 	}
 
-	bound();
+	subtractGradient();
 
-#ifdef _ADVECT_PRESSURE_
-	// Temporal optimization
+	// Temporal optimization: carry the pressure along to seed the next solve
+	if (m_pressure.GetWarmStart() == WARM_START_ADVECTED)
 	{
-		const auto tvVelocityRO = AmpTextureView<float4>(dref(m_pTxVelocity));
+		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
 		m_pressure.Advect(fDeltaTime, tvVelocityRO);
 	}
-#endif
 }
 
-void AmpFluid3D::bound()
+void AmpFluid3D::subtractGradient()
 {
+	TRACE_SCOPE_SYNC("AmpFluid3D::subtractGradient", m_acclView);
+
+	auto txPressure = m_pressure.GetSrc();
 	const auto tvVelocityRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
 	const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPressureRO = AmpTexture3DView<float>(dref(txPressure));
 
-	parallel_for_each(
+	forEachCell(
 		// Define the compute domain, which is the set of threads that are created.
 		tvVelocityRW.extent,
 		// Define the code to run on each thread on the accelerator.
 		[=](const AmpIndex3D idx) restrict(amp)
 	{
-		// Current location
+		// Cells on the domain faces mirror their inward neighbor with the opposite sign
 		const auto vMax = int3(tvVelocityRW.extent[2], tvVelocityRW.extent[1], tvVelocityRW.extent[0]) - 1;
 		auto vLoc = idx;
 
@@ -369,9 +1585,10 @@ void AmpFluid3D::bound()
 		vLoc[1] += vOffset.y;
 		vLoc[2] += vOffset.x;
 
-		if (vOffset.x || vOffset.y || vOffset.z)
-			tvVelocityRW.set(idx, -tvVelocityRO[vLoc]);
-		else tvVelocityRW.set(idx, tvVelocityRO[idx]);
+		// Project the velocity onto its divergence-free component
+		auto vVelocity = tvVelocityRO[vLoc].xyz - Gradient3D(tvPressureRO, vLoc) / REST_DENS;
+		if (vOffset.x || vOffset.y || vOffset.z) vVelocity = -vVelocity;
+		tvVelocityRW.set(idx, float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f));
 	}
 	);
 
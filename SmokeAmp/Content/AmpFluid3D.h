@@ -5,6 +5,10 @@
 #pragma once
 
 #include "AmpPoisson3D.h"
+#include "AdvectionScheme.h"
+#include "Checkpoint.h"
+#include "BrickMap.h"
+#include "OccupancyPyramid.h"
 
 #define VISC_ITERATION	0
 
@@ -38,20 +42,58 @@ public:
 		cfloat3 vImLoc = float3(0.0f, 0.0f, 0.0f),
 		const uint8_t uItVisc = VISC_ITERATION
 		);
-	void Render(upAmpTexture2D<unorm4> &pDst, const AmpTexture3DView<float> &tvDepthRO,
+	// tvDepthRO holds the scene's hardware depth, i.e. the screen-space z of m_mScreenToLocal.
+	// pDst gets the volume as a layer: linear premultiplied color with the opacity in alpha,
+	// and zero where the scene or nothing is in front; always at full resolution.
+	void Render(upAmpTexture2D<unorm4> &pDst, const AmpTexture2DView<float> &tvDepthRO,
 		const CBImmutable &cbImmutable, const CBPerObject &cbPerObj);
 	void Render(upAmpTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable,
 		const CBPerObject &cbPerObj);
+	// Blends a layer of the depth overload over txScene into pDst; the scene and the result
+	// are stored, as the plain overload writes them, as the square root of linear color
+	void Composite(upAmpTexture2D<unorm4> &pDst, const AmpTexture2D<unorm4> &txScene,
+		const AmpTexture2D<unorm4> &txLayer);
+	void SetPressureTolerance(cfloat fTolerance, const uint32_t uMaxIteration = PRESS_ITERATION,
+		const uint32_t uCheckInterval = 4);
+	void SetFusedStep(const bool bFused);
+	void SetAdvection(const AdvectionScheme advection);
+	void SetSparse(const bool bSparse);
+	void SetLightVolume(const bool bLightVolume);
+	void SetRenderScale(const uint8_t uScale);
+	// Exponential extinction per step instead of the linear default; it does not depend on
+	// the step size, so the temporal mode's sparser steps converge to the full-rate image
+	void SetExactExtinction(const bool bExact);
+	void SetTemporal(const bool bTemporal);
+	// Velocity, density and pressure; loading takes the size of the checkpoint
+	bool SaveCheckpoint(const char *szFileName, const uint64_t uStep, cfloat fDeltaTime) const;
+	bool LoadCheckpoint(const char *szFileName, CheckpointHeader *pHeader = nullptr);
 
+	const spAmpTexture3D<float4> &GetVelocity() const { return m_pSrcVelocity; }
+	const spAmpTexture3D<float> &GetDensity() const { return m_pSrcDensity; }
+	AmpPoisson3D<float> &GetPressure() { return m_pressure; }
+	const PoissonStats &GetPressureStats() const { return m_pressureStats; }
+	const BrickMap &GetBricks() const { return m_bricks; }
 	const AmpAcclView &GetAcceleratorView() const { return m_acclView; }
 
 protected:
 	void advect(cfloat fDeltaTime);
 	void advect(cfloat fDeltaTime, const AmpTexture3DView<float4> &tvVelocityRO);
+	void advectCorrected(cfloat fDeltaTime);
 	void diffuse(const uint8_t uIteration);
 	void impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
-	void project(cfloat fDeltaTime);
-	void bound();
+	void advectFused(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
+	void project(cfloat fDeltaTime, const bool bDivergence = true);
+	void subtractGradient();
+	void updateBricks(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
+	void buildOccupancy();
+	void updateTransmittance(cfloat3 &vLightPt, cfloat fLStepScale);
+	void marchLowRes(const concurrency::extent<2> &dstExtent, const CBPerObject &cbPerObj);
+	void upsample(upAmpTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj);
+	void marchTemporal(const concurrency::extent<2> &dstExtent, const CBImmutable &cbImmutable,
+		const CBPerObject &cbPerObj);
+	void resolveTemporal(upAmpTexture2D<unorm4> &pDst, const CBPerObject &cbPerObj);
+	template<typename F>
+	void forEachCell(const concurrency::extent<3> &domain, const F &kernel);
 
 	spAmpTexture3D<float4>			m_pSrcVelocity;
 	spAmpTexture3D<float4>			m_pDstVelocity;
@@ -64,6 +106,49 @@ protected:
 	AmpPoisson3D<float4>			m_diffuse;
 	AmpPoisson3D<float>				m_pressure;
 
+	float							m_fPressTolerance;
+	uint32_t						m_uPressMaxIteration;
+	uint32_t						m_uPressCheckInterval;
+	PoissonStats					m_pressureStats;
+
+	bool							m_bFusedStep;
+	AdvectionScheme					m_advection;
+
+	// Sparse mode: kernels only visit the live bricks
+	bool							m_bSparse;
+	BrickMap						m_bricks;
+	std::vector<float>				m_brickOccupancy;
+	std::vector<float>				m_brickReach;
+	spAmpArray						m_pBrickStats;
+	spAmpUintArray					m_pActiveBricks;
+	spAmpUintArray					m_pFreedBricks;
+
+	// Max-density pyramid for empty-space skipping in Render
+	OccupancyPyramid				m_occupancyPyramid;
+	spAmpArray						m_pOccupancy;
+
+	// Light transmittance volume, replacing the per-sample shadow rays when enabled
+	bool							m_bLightVolume;
+	bool							m_bLightDirty;
+	float3							m_vLightPt;
+	spAmpTexture3D<float>			m_pTransmittance;
+
+	// Reduced-resolution rendering: premultiplied radiance, transmittance and ray bounds
+	uint8_t							m_uRenderScale;
+	spAmpTexture2D<float4>			m_pLowRes;
+
+	// Extinction model of the view rays
+	bool							m_bExactExtinction;
+
+	// Temporal mode: linear color and ray depth of this frame, and the accumulated history
+	bool							m_bTemporal;
+	bool							m_bHistoryValid;
+	uint32_t						m_uFrame;
+	CBPerObject						m_cbPrevPerObj;
+	spAmpTexture2D<float4>			m_pCurrent;
+	spAmpTexture2D<float4>			m_pHistory;
+	spAmpTexture2D<float4>			m_pPrevHistory;
+
 	AmpAcclView						m_acclView;
 };
 
@@ -0,0 +1,282 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include "AmpFluid3DBatch.h"
+
+#define IMPULSE_RADIUS		0.032f
+
+using namespace concurrency;
+using namespace concurrency::direct3d;
+using namespace concurrency::fast_math;
+using namespace concurrency::graphics;
+using namespace std;
+
+// texture_view::sample on the box of an instance. Clamping the coordinate to the centers of
+// its edge texels gives clamp addressing on its own faces, since the linear filter weights
+// the texels across a face by zero there.
+template<typename T>
+inline T SampleInstance(const AmpTexture3DView<T> &tvSrc, const BatchInstance &instance, cfloat3 &vTex) restrict(amp)
+{
+	const auto vSize = float3(float(instance.iWidth), float(instance.iHeight), float(instance.iDepth));
+	const auto vPos = vTex * vSize - 0.5f;
+	const auto vClamped = float3
+	(
+		fmin(fmax(vPos.x, 0.0f), vSize.x - 1.0f),
+		fmin(fmax(vPos.y, 0.0f), vSize.y - 1.0f),
+		fmin(fmax(vPos.z, 0.0f), vSize.z - 1.0f) + float(instance.iOrigin)
+	);
+	const auto vAtlas = float3(float(tvSrc.extent[2]), float(tvSrc.extent[1]), float(tvSrc.extent[0]));
+
+	return tvSrc.sample((vClamped + 0.5f) / vAtlas);
+}
+
+// Visit every cell of every instance with one tile per brick; the gaps and the padding
+// are left untouched
+template<typename F>
+void AmpFluid3DBatch::forEachCell(const F &kernel)
+{
+	const auto iNumBricks = static_cast<int>(m_layout.GetBricks().size());
+	if (iNumBricks <= 0) return;
+
+	// Upload the time steps and emitters of this step
+	if (m_bInstancesDirty)
+	{
+		const auto &instances = m_layout.GetInstances();
+		concurrency::copy(instances.cbegin(), instances.cend(), dref(m_pInstances));
+		m_bInstancesDirty = false;
+	}
+
+	const auto &aBricks = dref(m_pBricks);
+	const auto &aSlices = dref(m_pSlices);
+	const auto &aInstances = dref(m_pInstances);
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per brick of the instances.
+		extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricks, &aSlices, &aInstances](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+	{
+		const auto idx = BrickOrigin(aBricks[tidx.tile[0]]) + tidx.local;
+		const auto iInstance = aSlices[idx[0]];
+		if (iInstance == BATCH_NONE) return;
+
+		const auto instance = aInstances[iInstance];
+		if (idx[2] < instance.iWidth && idx[1] < instance.iHeight) kernel(idx, instance);
+	}
+	);
+}
+
+AmpFluid3DBatch::AmpFluid3DBatch(const AmpAcclView &acclView) :
+	m_bInstancesDirty(true),
+	m_acclView(acclView)
+{
+}
+
+uint32_t AmpFluid3DBatch::AddInstance(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+{
+	return m_layout.Add(iWidth, iHeight, iDepth);
+}
+
+void AmpFluid3DBatch::Init()
+{
+	m_layout.Commit();
+	const auto iWidth = m_layout.GetWidth();
+	const auto iHeight = m_layout.GetHeight();
+	const auto iDepth = m_layout.GetDepth();
+
+	// Create the atlas textures, with the precisions of AmpFluid3D
+	m_pSrcVelocity = make_shared<AmpTexture3D<float4>>(iDepth, iHeight, iWidth, 16, m_acclView);
+	m_pDstVelocity = make_shared<AmpTexture3D<float4>>(iDepth, iHeight, iWidth, 16, m_acclView);
+	m_pSrcDensity = make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
+	m_pDstDensity = make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 16, m_acclView);
+	m_pPressure = make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, m_acclView);
+	m_pDivergence = make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, m_acclView);
+
+	// Layout tables
+	const auto &instances = m_layout.GetInstances();
+	const auto &slices = m_layout.GetSlices();
+	const auto &bricks = m_layout.GetBricks();
+	m_pInstances = instances.empty() ? nullptr : make_shared<AmpBatchArray>(static_cast<int>(instances.size()),
+		instances.cbegin(), instances.cend(), m_acclView);
+	m_pSlices = slices.empty() ? nullptr : make_shared<AmpIntArray>(static_cast<int>(slices.size()),
+		slices.cbegin(), slices.cend(), m_acclView);
+	m_pBricks = bricks.empty() ? nullptr : make_shared<AmpUintArray>(static_cast<int>(bricks.size()),
+		bricks.cbegin(), bricks.cend(), m_acclView);
+	m_bInstancesDirty = false;
+}
+
+void AmpFluid3DBatch::SetInstance(const uint32_t i, cfloat fDeltaTime, cfloat4 vForceDens, cfloat3 vImLoc)
+{
+	const float vForceDensArray[] = { vForceDens.x, vForceDens.y, vForceDens.z, vForceDens.w };
+	const float vImLocArray[] = { vImLoc.x, vImLoc.y, vImLoc.z };
+	m_layout.SetStep(i, fDeltaTime, vForceDensArray, vImLocArray);
+	m_bInstancesDirty = true;
+}
+
+void AmpFluid3DBatch::Simulate()
+{
+	TRACE_SCOPE_SYNC("AmpFluid3DBatch::Simulate", m_acclView);
+
+	advect();
+	impulse();
+	project();
+}
+
+void AmpFluid3DBatch::advect()
+{
+	TRACE_SCOPE_SYNC("AmpFluid3DBatch::advect", m_acclView);
+
+	static const auto fDecay = 0.996f;
+
+	const auto tvPhiVelRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+	const auto tvPhiDenRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
+	const auto tvPhiVelRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPhiDenRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+
+	forEachCell([=](const AmpIndex3D idx, const BatchInstance &instance) restrict(amp)
+	{
+		const auto vLoc = float3((float)idx[2], (float)idx[1], (float)(idx[0] - instance.iOrigin));
+		const auto vTexel = 1.0f / float3(float(instance.iWidth), float(instance.iHeight), float(instance.iDepth));
+
+		// Velocity tracing
+		const auto vU = tvPhiVelRO[idx].xyz;
+		const auto vTex = (vLoc + 0.5f) * vTexel - vU * instance.fDeltaTime;
+
+		// Update velocity and density
+		tvPhiVelRW.set(idx, SampleInstance(tvPhiVelRO, instance, vTex));
+		tvPhiDenRW.set(idx, SampleInstance(tvPhiDenRO, instance, vTex) * fDecay);
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void AmpFluid3DBatch::impulse()
+{
+	TRACE_SCOPE_SYNC("AmpFluid3DBatch::impulse", m_acclView);
+
+	const auto tvVelocityRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+	const auto tvDensityRW = AmpRWTexture3DView<float>(dref(m_pDstDensity));
+	const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvDensityRO = AmpTexture3DView<float>(dref(m_pSrcDensity));
+
+	forEachCell([=](const AmpIndex3D idx, const BatchInstance &instance) restrict(amp)
+	{
+		const auto vForceDens = float4(instance.fForceX, instance.fForceY, instance.fForceZ, instance.fDensity);
+		const auto vImLoc = float3(instance.fImLocX, instance.fImLocY, instance.fImLocZ);
+		const auto vLoc = float3((float)idx[2], (float)idx[1], (float)(idx[0] - instance.iOrigin));
+		const auto vTexel = 1.0f / float3(float(instance.iWidth), float(instance.iHeight), float(instance.iDepth));
+		const auto vTex = vLoc * vTexel;
+		const auto fBasis = Gaussian3D(vTex - vImLoc, IMPULSE_RADIUS);
+
+		const auto fDens = length(vForceDens.xyz) * vForceDens.w;
+		const auto vForce = vForceDens.xyz * fBasis;
+
+		const auto vVelocity = tvVelocityRO[idx].xyz + vForce * instance.fDeltaTime;
+
+		tvVelocityRW.set(idx, float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f));
+		tvDensityRW.set(idx, tvDensityRO[idx] + fDens * fBasis);
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void AmpFluid3DBatch::project()
+{
+	TRACE_SCOPE_SYNC("AmpFluid3DBatch::project", m_acclView);
+
+	{
+		const auto tvDivergenceRW = AmpRWTexture3DView<float>(dref(m_pDivergence));
+		const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+
+		forEachCell([=](const AmpIndex3D idx, const BatchInstance &) restrict(amp)
+		{
+			tvDivergenceRW.set(idx, Divergence3D(tvVelocityRO, idx));
+		});
+	}
+
+	const auto iNumBricks = static_cast<int>(m_layout.GetBricks().size());
+	if (iNumBricks > 0)
+	{
+		const auto tvPressureRW = AmpRWTexture3DView<float>(dref(m_pPressure));
+		const auto tvDivergenceRO = AmpTexture3DView<float>(dref(m_pDivergence));
+		const auto &aBricks = dref(m_pBricks);
+		const auto &aSlices = dref(m_pSlices);
+		const auto &aInstances = dref(m_pInstances);
+
+		parallel_for_each(
+			// Define the compute domain, which is one tile per brick of the instances.
+			extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+			// Define the code to run on each thread on the accelerator.
+			[=, &aBricks, &aSlices, &aInstances](const tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> tidx) restrict(amp)
+		{
+			const auto idx = BrickOrigin(aBricks[tidx.tile[0]]) + tidx.local;
+			const auto iInstance = aSlices[idx[0]];
+			auto bInside = iInstance != BATCH_NONE;
+			if (bInside)
+			{
+				const auto instance = aInstances[iInstance];
+				bInside = idx[2] < instance.iWidth && idx[1] < instance.iHeight;
+			}
+
+			// Unordered Gauss-Seidel iteration, in place on the pressure of the last step;
+			// the gaps stay zero, so no instance sees another
+			for (auto i = 0; i < PRESS_ITERATION; ++i)
+			{
+				if (bInside)
+				{
+					auto fq = -tvDivergenceRO[idx];
+					fq += tvPressureRW(idx[0], idx[1], idx[2] - 1);
+					fq += tvPressureRW(idx[0], idx[1], idx[2] + 1);
+					fq += tvPressureRW(idx[0], idx[1] - 1, idx[2]);
+					fq += tvPressureRW(idx[0], idx[1] + 1, idx[2]);
+					fq += tvPressureRW(idx[0] - 1, idx[1], idx[2]);
+					fq += tvPressureRW(idx[0] + 1, idx[1], idx[2]);
+					tvPressureRW.set(idx, fq / 6.0f);
+				}
+				tidx.barrier.wait_with_global_memory_fence();
+			}
+		}
+		);
+	}
+
+	subtractGradient();
+}
+
+void AmpFluid3DBatch::subtractGradient()
+{
+	TRACE_SCOPE_SYNC("AmpFluid3DBatch::subtractGradient", m_acclView);
+
+	const auto tvVelocityRW = AmpRWTexture3DView<float4>(dref(m_pDstVelocity));
+	const auto tvVelocityRO = AmpTexture3DView<float4>(dref(m_pSrcVelocity));
+	const auto tvPressureRO = AmpTexture3DView<float>(dref(m_pPressure));
+
+	forEachCell([=](const AmpIndex3D idx, const BatchInstance &instance) restrict(amp)
+	{
+		// Cells on the instance faces mirror their inward neighbor with the opposite sign
+		const auto iZ = idx[0] - instance.iOrigin;
+		auto vLoc = idx;
+
+		const int3 vOffset =
+		{
+			vLoc[2] >= instance.iWidth - 1 ? -1 : (vLoc[2] <= 0 ? 1 : 0),
+			vLoc[1] >= instance.iHeight - 1 ? -1 : (vLoc[1] <= 0 ? 1 : 0),
+			iZ >= instance.iDepth - 1 ? -1 : (iZ <= 0 ? 1 : 0)
+		};
+		vLoc[0] += vOffset.z;
+		vLoc[1] += vOffset.y;
+		vLoc[2] += vOffset.x;
+
+		// Project the velocity onto its divergence-free component
+		auto vVelocity = tvVelocityRO[vLoc].xyz - Gradient3D(tvPressureRO, vLoc) / REST_DENS;
+		if (vOffset.x || vOffset.y || vOffset.z) vVelocity = -vVelocity;
+		tvVelocityRW.set(idx, float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f));
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+}
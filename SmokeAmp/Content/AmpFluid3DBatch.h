@@ -0,0 +1,71 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "AmpPoisson3D.h"
+#include "BatchLayout.h"
+
+using AmpIntArray = concurrency::array<int32_t, 1>;
+using spAmpIntArray = std::shared_ptr<AmpIntArray>;
+using AmpBatchArray = concurrency::array<BatchInstance, 1>;
+using spAmpBatchArray = std::shared_ptr<AmpBatchArray>;
+
+//--------------------------------------------------------------------------------------
+// Many small AmpFluid3D simulations in one atlas (see BatchLayout). A step issues each
+// kernel once for every instance, with one tile per brick of the instances, instead of
+// one dispatch per kernel and instance; on grids of 32 cubed the launches would cost
+// more than the work. Each instance has its own size, time step and emitter, and follows
+// the default path of AmpFluid3D: semi-Lagrangian advection, impulse, and a fixed
+// PRESS_ITERATION Gauss-Seidel pressure solve warm-started from the last step.
+//--------------------------------------------------------------------------------------
+
+class AmpFluid3DBatch
+{
+public:
+	AmpFluid3DBatch(const AmpAcclView &acclView);
+
+	// Instances are added before Init, which packs them and clears every field
+	uint32_t AddInstance(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth);
+	void Init();
+	void SetInstance(
+		const uint32_t i,
+		cfloat fDeltaTime,
+		cfloat4 vForceDens = float4(0.0f, 0.0f, 0.0f, 0.0f),
+		cfloat3 vImLoc = float3(0.0f, 0.0f, 0.0f)
+		);
+	void Simulate();
+
+	// The atlas; an instance occupies GetLayout().GetInstance(i)
+	const spAmpTexture3D<float4> &GetVelocity() const { return m_pSrcVelocity; }
+	const spAmpTexture3D<float> &GetDensity() const { return m_pSrcDensity; }
+	const BatchLayout &GetLayout() const { return m_layout; }
+	const AmpAcclView &GetAcceleratorView() const { return m_acclView; }
+
+protected:
+	void advect();
+	void impulse();
+	void project();
+	void subtractGradient();
+	template<typename F>
+	void forEachCell(const F &kernel);
+
+	spAmpTexture3D<float4>			m_pSrcVelocity;
+	spAmpTexture3D<float4>			m_pDstVelocity;
+	spAmpTexture3D<float>			m_pSrcDensity;
+	spAmpTexture3D<float>			m_pDstDensity;
+	spAmpTexture3D<float>			m_pPressure;
+	spAmpTexture3D<float>			m_pDivergence;
+
+	BatchLayout						m_layout;
+	bool							m_bInstancesDirty;
+	spAmpBatchArray					m_pInstances;
+	spAmpIntArray					m_pSlices;
+	spAmpUintArray					m_pBricks;
+
+	AmpAcclView						m_acclView;
+};
+
+using upAmpFluid3DBatch = std::unique_ptr<AmpFluid3DBatch>;
+using spAmpFluid3DBatch = std::shared_ptr<AmpFluid3DBatch>;
@@ -4,10 +4,25 @@
 
 #pragma once
 
+#include <chrono>
 #include "XSDXType.h"
+#include "Common\Trace.h"
 #include "FieldMath.h"
+#include "PoissonSolver.h"
+#include "BrickMap.h"
 
 using AmpAcclView = concurrency::accelerator_view;
+using AmpArray = concurrency::array<float, 1>;
+using spAmpArray = std::shared_ptr<AmpArray>;
+using AmpUintArray = concurrency::array<uint32_t, 1>;
+using spAmpUintArray = std::shared_ptr<AmpUintArray>;
+
+// First cell of a packed brick
+inline AmpIndex3D BrickOrigin(const uint32_t uBrick) restrict(amp)
+{
+	return AmpIndex3D((uBrick >> 2 * BRICK_BITS) * BRICK_SIZE, ((uBrick >> BRICK_BITS) & BRICK_MASK) * BRICK_SIZE,
+		(uBrick & BRICK_MASK) * BRICK_SIZE);
+}
 
 template<typename T>
 class AmpPoisson3D
@@ -21,10 +36,25 @@ public:
 	template<typename U>
 	void ComputeDivergence(const AmpTexture3DView<U> &tvSource);
 	void SolvePoisson(cfloat2 &vf, const uint8_t uIteration = 1);
+	PoissonStats SolvePoisson(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+		const uint32_t uCheckInterval = 4);
 	template<typename U>
 	void Advect(cfloat fDeltaTime, const AmpTexture3DView<U> &tvSource);
 	void SwapTextures(const bool bUnknown = false);
 
+	void SetSolver(const PoissonSolver solver);
+	void SetMultigrid(const uint8_t uNumLevels, const MultigridCycle cycle = MULTIGRID_V_CYCLE,
+		const uint8_t uNumSmooth = 2);
+	void SetPreconditioner(const PCGPreconditioner preconditioner);
+	void SetTolerance(cfloat fTolerance);
+	void SetWarmStart(const WarmStart warmStart);
+	// Sparse mode: the finest grid only visits the live bricks of pBricks and treats the others
+	// as lying outside the grid; nullptr for the whole grid. UpdateBricks() follows each commit.
+	void SetBricks(const BrickMap *pBricks);
+	void UpdateBricks();
+
+	WarmStart GetWarmStart() const { return m_warmStart; }
+
 	const spAmpTexture3D<T>	&GetSrc() const { return m_pSrcKnown; }
 	const spAmpTexture3D<T>	&GetDst() const { return m_pDstUnknown; }
 	const spAmpTexture3D<T>	&GetTmp() const { return m_pSrcUnknown; }
@@ -32,13 +62,80 @@ public:
 protected:
 	static float gaussSeidel(const AmpRWTexture3DView<float> &tvUnknownRW, const AmpTexture3DView<float> &tvKnownRO,
 		cfloat2 &vf, const AmpIndex3D &idx) restrict(amp);
+	static float residual(const AmpTexture3DView<float> &tvUnknownRO, const AmpTexture3DView<float> &tvKnownRO,
+		cfloat3 &vf, cfloat3 &vHighGhost, const AmpIndex3D &idx) restrict(amp);
+	static float diagonal(const concurrency::extent<3> &extent, cfloat3 &vf, cfloat3 &vHighGhost,
+		const AmpIndex3D &idx) restrict(amp);
+	static float ghostFactor(const uint8_t uLevel);
+	static float ghostFactor(const uint8_t uLevel, cfloat fDistance);
+	float3 highGhost(const uint8_t uLevel) const;
+	static bool isLive(const AmpUintArray &aFlags, cint3 &vBrickGrid, const AmpIndex3D &idx) restrict(amp);
+	int3 brickGrid() const;
+	template<typename F>
+	void forEachCell(const concurrency::extent<3> &domain, const F &kernel);
+	template<typename F>
+	void forEachTile(const concurrency::extent<3> &domain, const F &kernel);
+	void gaussSeidel(cfloat2 &vf, const uint32_t uIteration);
 	void jacobi(cfloat2 &vf);
+	void redBlack(cfloat2 &vf, const uint32_t uSweeps);
+
+	void initSolver();
+	void initGuess();
+	void multigrid(cfloat3 &vf, const uint8_t uLevel, const MultigridCycle cycle);
+	void smooth(cfloat3 &vf, const uint8_t uLevel, const uint8_t uIteration);
+	void restrictResidual(cfloat3 &vf, const uint8_t uLevel);
+	void prolongate(const uint8_t uLevel);
+
+	PoissonStats pcg(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration, const uint32_t uCheckInterval);
+	void precondition(cfloat2 &vf);
+
+	double dotProduct(const AmpTexture3DView<float> &tvA, const AmpTexture3DView<float> &tvB);
+	double residualNorm(cfloat3 &vf);
+	double rhsNorm(cfloat2 &vf);
+	template<typename F>
+	double reduce(const F &func);
+
+	struct MultigridLevel
+	{
+		spAmpTexture3D<T>	pKnown;
+		spAmpTexture3D<T>	pUnknown;
+		spAmpTexture3D<T>	pTmp;
+		float3				vHighGhost;	// Ghost factors of the faces at the far end of each axis
+	};
 
 	spAmpTexture3D<T>	m_pSrcKnown;
 	spAmpTexture3D<T>	m_pSrcUnknown;
 	spAmpTexture3D<T>	m_pDstUnknown;
 
 	float3				m_vSimSize;
+
+	PoissonSolver		m_solver;
+	MultigridCycle		m_mgCycle;
+	uint8_t				m_uMGLevels;
+	uint8_t				m_uMGSmooth;
+
+	// Coarse levels only; level 0 is the finest grid held above
+	std::vector<MultigridLevel>	m_mgLevels;
+
+	WarmStart			m_warmStart;
+
+	PCGPreconditioner	m_preconditioner;
+	float				m_fTolerance;
+
+	// Conjugate gradient workspace: residual, search direction, and a scratch field shared by
+	// the operator product and the preconditioned residual
+	spAmpTexture3D<T>	m_pResidual;
+	spAmpTexture3D<T>	m_pDirection;
+	spAmpTexture3D<T>	m_pScratch;
+
+	// Per-tile partial sums of the reductions
+	spAmpArray			m_pPartialSums;
+
+	// Sparse mode: the live set of the finest grid, with its list and flags on the accelerator
+	const BrickMap		*m_pBricks;
+	spAmpUintArray		m_pActiveBricks;
+	spAmpUintArray		m_pBrickFlags;
+	spAmpUintArray		m_pFreedBricks;
 };
 
 #include "AmpPoisson3D.inl"
@@ -10,9 +10,100 @@
 
 #define PRESS_ITERATION	48
 
+#define MG_COARSE_ITERATION	16
+#define MG_MIN_SIZE			4
+#define JACOBI_WEIGHT		(6.0f / 7.0f)
+
+#define PCG_TOLERANCE		1e-3f
+
+#define RB_SWEEPS			2
+#define RB_HALO				(2 * RB_SWEEPS)
+#define RB_REGION			(THREAD_BLOCK_X + 2 * RB_HALO)
+
+// The tiles of the Gauss-Seidel, red-black and reduction kernels are whole bricks
+static_assert(THREAD_BLOCK_X == BRICK_SIZE && THREAD_BLOCK_Y == BRICK_SIZE && THREAD_BLOCK_Z == BRICK_SIZE,
+	"The sparse mode walks the bricks as thread blocks");
+
+template<typename T>
+inline AmpPoisson3D<T>::AmpPoisson3D() :
+	m_solver(POISSON_GAUSS_SEIDEL),
+	m_mgCycle(MULTIGRID_V_CYCLE),
+	m_uMGLevels(8),
+	m_uMGSmooth(2),
+	m_warmStart(WARM_START_PREVIOUS),
+	m_preconditioner(PCG_JACOBI),
+	m_fTolerance(PCG_TOLERANCE),
+	m_pBricks(nullptr)
+{
+}
+
 template<typename T>
-inline AmpPoisson3D<T>::AmpPoisson3D()
+inline void AmpPoisson3D<T>::initSolver()
+{
+	// Red-black, multigrid and PCG only serve the scalar pressure solve
+}
+
+template<>
+inline void AmpPoisson3D<float>::initSolver()
 {
+	m_mgLevels.clear();
+	m_pResidual = m_pDirection = m_pScratch = nullptr;
+	if (!m_pSrcKnown) return;
+
+	auto acclView = m_pSrcKnown->get_accelerator_view();
+	auto iWidth = static_cast<int32_t>(m_vSimSize.x);
+	auto iHeight = static_cast<int32_t>(m_vSimSize.y);
+	auto iDepth = static_cast<int32_t>(m_vSimSize.z);
+
+	// Tile sums of the residual and dot-product reductions
+	const auto iNumTiles = (iWidth / THREAD_BLOCK_X) * (iHeight / THREAD_BLOCK_Y) * (iDepth / THREAD_BLOCK_Z);
+	m_pPartialSums = std::make_shared<AmpArray>(iNumTiles, acclView);
+
+	// The live set of the sparse mode; the kernels take the flags by reference, so the dense
+	// mode keeps a stand-in
+	const auto iNumBricks = m_pBricks ? static_cast<int>(m_pBricks->GetNumBricks()) : 1;
+	m_pBrickFlags = std::make_shared<AmpUintArray>(iNumBricks, acclView);
+	m_pActiveBricks = m_pBricks ? std::make_shared<AmpUintArray>(iNumBricks, acclView) : nullptr;
+	m_pFreedBricks = m_pBricks ? std::make_shared<AmpUintArray>(iNumBricks, acclView) : nullptr;
+	if (m_solver == POISSON_GAUSS_SEIDEL) return;
+
+	if (m_solver == POISSON_PCG)
+	{
+		m_pResidual = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+		m_pDirection = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+		m_pScratch = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+
+		return;
+	}
+
+	// Ping-pong partner of the finest unknown for the red-black and smoother passes
+	if (!m_pSrcUnknown) m_pSrcUnknown = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+
+	if (m_solver != POISSON_MULTIGRID) return;
+
+	// Halve the grid per level until a dimension gets too small to coarsen
+	for (auto i = 1ui8; i < m_uMGLevels; ++i)
+	{
+		if (iWidth < MG_MIN_SIZE || iHeight < MG_MIN_SIZE || iDepth < MG_MIN_SIZE) break;
+		iWidth = (iWidth + 1) / 2;
+		iHeight = (iHeight + 1) / 2;
+		iDepth = (iDepth + 1) / 2;
+
+		// Odd sizes round the coarse grid up, which moves its last center toward the fine
+		// grid's far boundary, or past it
+		const auto distance = [i](cfloat fSize, const int32_t iSize)
+		{
+			return fSize + 0.5f - static_cast<float>(1 << i) * (static_cast<float>(iSize) - 0.5f);
+		};
+
+		auto level = MultigridLevel();
+		level.pKnown = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+		level.pUnknown = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+		level.pTmp = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, 32, acclView);
+		level.vHighGhost = float3(ghostFactor(i, distance(m_vSimSize.x, iWidth)),
+			ghostFactor(i, distance(m_vSimSize.y, iHeight)), ghostFactor(i, distance(m_vSimSize.z, iDepth)));
+		m_mgLevels.push_back(level);
+	}
 }
 
 template<typename T>
@@ -39,6 +130,8 @@ inline void AmpPoisson3D<float>::Init(const int32_t iWidth, const int32_t iHeigh
 	m_pSrcKnown = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, vData.data(), uByteWidth, bitWidth, acclView);
 	m_pDstUnknown = std::make_shared<AmpTexture3D<float>>(iDepth, iHeight, iWidth, bitWidth, acclView);
 	m_pSrcUnknown = nullptr;
+
+	initSolver();
 }
 
 template<typename T>
@@ -66,9 +159,11 @@ template<typename T>
 template<typename U>
 inline void AmpPoisson3D<T>::ComputeDivergence(const AmpTexture3DView<U> &tvSource)
 {
+	TRACE_SCOPE_SYNC("AmpPoisson3D::ComputeDivergence", m_pDstUnknown->get_accelerator_view());
+
 	const auto tvDstRW = AmpRWTexture3DView<T>(dref(m_pDstUnknown));
 
-	parallel_for_each(
+	forEachCell(
 		// Define the compute domain, which is the set of threads that are created.
 		tvDstRW.extent,
 		// Define the code to run on each thread on the accelerator.
@@ -85,28 +180,44 @@ inline void AmpPoisson3D<T>::ComputeDivergence(const AmpTexture3DView<U> &tvSour
 template<>
 inline void AmpPoisson3D<float>::SolvePoisson(cfloat2 &vf, const uint8_t uIteration)
 {
-	const auto tvUnknownRW = AmpRWTexture3DView<float>(*m_pDstUnknown);
-	const auto tvKnownRO = AmpTexture3DView<float>(*m_pSrcKnown);
+	TRACE_SCOPE_SYNC("AmpPoisson3D::SolvePoisson", m_pDstUnknown->get_accelerator_view());
 
-	parallel_for_each(
-		// Define the compute domain, which is the set of threads that are created.
-		tvUnknownRW.extent.tile<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z>(),
-		// Define the code to run on each thread on the accelerator.
-		[=](const concurrency::tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> t_idx) restrict(amp)
+	initGuess();
+
+	if (m_solver == POISSON_MULTIGRID)
 	{
-		const auto &idx = t_idx.global;
+		// Each iteration is one full cycle
+		for (auto i = 0ui8; i < uIteration; ++i) multigrid(float3(vf.x, vf.y, 0.0f), 0, m_mgCycle);
 
-		// Unordered Gauss-Seidel iteration
-		for (concurrency::graphics::uint i = 0; i < PRESS_ITERATION; ++i)
-		{
-			const auto fPressPrev = tvUnknownRW[idx];
-			const auto fPress = gaussSeidel(tvUnknownRW, tvKnownRO, vf, idx);
+		// Swap buffers
+		SwapTextures();
 
-			tvUnknownRW.set(idx, fPress);
-			t_idx.barrier.wait_with_global_memory_fence();
-		}
+		return;
 	}
-	);
+
+	if (m_solver == POISSON_PCG)
+	{
+		// Runs until the relative residual drops below the tolerance
+		pcg(vf, m_fTolerance, PRESS_ITERATION, 1);
+
+		// Swap buffers
+		SwapTextures();
+
+		return;
+	}
+
+	if (m_solver == POISSON_RED_BLACK)
+	{
+		// Each dispatch advances RB_SWEEPS full sweeps
+		for (auto i = 0; i < PRESS_ITERATION; i += RB_SWEEPS) redBlack(vf, RB_SWEEPS);
+
+		// Swap buffers
+		SwapTextures();
+
+		return;
+	}
+
+	gaussSeidel(vf, PRESS_ITERATION);
 
 	// Swap buffers
 	SwapTextures();
@@ -115,32 +226,94 @@ inline void AmpPoisson3D<float>::SolvePoisson(cfloat2 &vf, const uint8_t uIterat
 template<typename T>
 inline void AmpPoisson3D<T>::SolvePoisson(cfloat2 &vf, const uint8_t uIteration)
 {
+	TRACE_SCOPE_SYNC("AmpPoisson3D::SolvePoisson", m_pDstUnknown->get_accelerator_view());
+
 	for (auto i = 0ui8; i < uIteration; ++i) jacobi(vf);
 
 	// Swap buffers
 	SwapTextures();
 }
 
+template<>
+inline PoissonStats AmpPoisson3D<float>::SolvePoisson(cfloat2 &vf, cfloat fTolerance,
+	const uint32_t uMaxIteration, const uint32_t uCheckInterval)
+{
+	TRACE_SCOPE_SYNC("AmpPoisson3D::SolvePoisson", m_pDstUnknown->get_accelerator_view());
+
+	const auto start = std::chrono::steady_clock::now();
+	initGuess();
+
+	const auto uInterval = (std::max)(uCheckInterval, 1u);
+	auto stats = PoissonStats();
+
+	if (m_solver == POISSON_PCG) stats = pcg(vf, fTolerance, uMaxIteration, uInterval);
+	else
+	{
+		const auto vfResidual = float3(vf.x, vf.y, 0.0f);
+		const auto fNorm = rhsNorm(vf);
+
+		// Relax in chunks of uInterval iterations, checking the residual in between
+		stats.fResidual = static_cast<float>(residualNorm(vfResidual) / fNorm);
+		while (stats.uIterations < uMaxIteration && stats.fResidual > fTolerance)
+		{
+			const auto uIteration = (std::min)(uInterval, uMaxIteration - stats.uIterations);
+			switch (m_solver)
+			{
+			case POISSON_MULTIGRID:
+				for (auto i = 0u; i < uIteration; ++i) multigrid(vfResidual, 0, m_mgCycle);
+				stats.uIterations += uIteration;
+				break;
+			case POISSON_RED_BLACK:
+				// The last dispatch of a chunk stops at the budget, as the halo covers fewer sweeps
+				for (auto i = 0u; i < uIteration; i += RB_SWEEPS)
+				{
+					const auto uSweeps = (std::min)(static_cast<uint32_t>(RB_SWEEPS), uIteration - i);
+					redBlack(vf, uSweeps);
+					stats.uIterations += uSweeps;
+				}
+				break;
+			default:
+				gaussSeidel(vf, uIteration);
+				stats.uIterations += uIteration;
+			}
+
+			stats.fResidual = static_cast<float>(residualNorm(vfResidual) / fNorm);
+		}
+	}
+
+	// Include the queued kernels in the timing
+	m_pDstUnknown->get_accelerator_view().wait();
+	stats.bConverged = stats.fResidual <= fTolerance;
+	stats.fTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Swap buffers
+	SwapTextures();
+
+	return stats;
+}
+
 template<typename T>
 template<typename U>
 inline void AmpPoisson3D<T>::Advect(cfloat fDeltaTime, const AmpTexture3DView<U>& tvSource)
 {
+	TRACE_SCOPE_SYNC("AmpPoisson3D::Advect", m_pDstUnknown->get_accelerator_view());
+
 	const auto tvUnknownRW = AmpRWTexture3DView<T>(dref(m_pDstUnknown));
 	const auto tvknownRO = AmpTexture3DView<T>(dref(m_pSrcKnown));
 
 	const auto vTexel = 1.0f / m_vSimSize;
 
-	parallel_for_each(
+	forEachCell(
 		// Define the compute domain, which is the set of threads that are created.
 		tvUnknownRW.extent,
 		// Define the code to run on each thread on the accelerator.
-		[=](const AmpIndex idx) restrict(amp)
+		[=](const AmpIndex3D idx) restrict(amp)
 	{
 		const auto vLoc = float3((float)idx[2], (float)idx[1], (float)idx[0]);
 
 		// Velocity tracing
 		const auto vU = tvSource[idx].xyz;
-		const auto vTex = (vLoc + 0.5f) * vTexel - vU;
+		const auto vTex = (vLoc + 0.5f) * vTexel - vU * fDeltaTime;
 
 		// Update
 		tvUnknownRW.set(idx, tvknownRO.sample(vTex));
@@ -158,6 +331,108 @@ inline void AmpPoisson3D<T>::SwapTextures(const bool bUnknown)
 	else m_pSrcKnown.swap(m_pDstUnknown);
 }
 
+template<typename T>
+inline void AmpPoisson3D<T>::SetSolver(const PoissonSolver solver)
+{
+	m_solver = solver;
+	initSolver();
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::SetMultigrid(const uint8_t uNumLevels, const MultigridCycle cycle,
+	const uint8_t uNumSmooth)
+{
+	m_uMGLevels = uNumLevels;
+	m_mgCycle = cycle;
+	m_uMGSmooth = uNumSmooth;
+	initSolver();
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::SetPreconditioner(const PCGPreconditioner preconditioner)
+{
+	m_preconditioner = preconditioner;
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::SetTolerance(cfloat fTolerance)
+{
+	m_fTolerance = fTolerance;
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::SetWarmStart(const WarmStart warmStart)
+{
+	m_warmStart = warmStart;
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::SetBricks(const BrickMap *pBricks)
+{
+	m_pBricks = pBricks;
+	initSolver();
+	UpdateBricks();
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::UpdateBricks()
+{
+	// Nothing to upload to before Init()
+	if (!m_pBricks || !m_pActiveBricks) return;
+
+	// Upload the live set
+	const auto &activeBricks = m_pBricks->GetActive();
+	const auto &freedBricks = m_pBricks->GetFreed();
+	const auto &brickFlags = m_pBricks->GetFlags();
+	const auto iNumFreed = static_cast<int>(freedBricks.size());
+	if (!activeBricks.empty()) concurrency::copy(activeBricks.cbegin(), activeBricks.cend(),
+		m_pActiveBricks->section(0, static_cast<int>(activeBricks.size())));
+	concurrency::copy(brickFlags.cbegin(), brickFlags.cend(), *m_pBrickFlags);
+	if (iNumFreed <= 0) return;
+
+	// Clear the freed bricks in the finest-grid buffers, so they read as zero like the cells
+	// beyond the grid
+	concurrency::copy(freedBricks.cbegin(), freedBricks.cend(), m_pFreedBricks->section(0, iNumFreed));
+	const spAmpTexture3D<T> buffers[] = { m_pSrcKnown, m_pSrcUnknown, m_pDstUnknown, m_pResidual, m_pDirection, m_pScratch };
+	const auto &aBricks = *m_pFreedBricks;
+	for (const auto &pBuffer : buffers)
+	{
+		if (!pBuffer) continue;
+
+		const auto tvBufferRW = AmpRWTexture3DView<T>(*pBuffer);
+
+		parallel_for_each(
+			// Define the compute domain, which is one tile per freed brick.
+			concurrency::extent<3>(iNumFreed * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+			// Define the code to run on each thread on the accelerator.
+			[=, &aBricks](const concurrency::tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> t_idx) restrict(amp)
+		{
+			const auto idx = BrickOrigin(aBricks[t_idx.tile[0]]) + t_idx.local;
+			if (tvBufferRW.extent.contains(idx)) tvBufferRW.set(idx, T());
+		}
+		);
+	}
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::initGuess()
+{
+	// The unknown holds the previous (possibly advected) solution after ComputeDivergence
+	if (m_warmStart != WARM_START_NONE) return;
+
+	const auto tvUnknownRW = AmpRWTexture3DView<T>(*m_pDstUnknown);
+
+	forEachCell(
+		// Define the compute domain, which is the set of threads that are created.
+		tvUnknownRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex3D idx) restrict(amp)
+	{
+		tvUnknownRW.set(idx, 0.0f);
+	}
+	);
+}
+
 template<typename T>
 inline float AmpPoisson3D<T>::gaussSeidel(const AmpRWTexture3DView<float> &tvUnknownRW,
 	const AmpTexture3DView<float> &tvKnownRO, cfloat2 & vf, const AmpIndex3D &idx) restrict(amp)
@@ -201,3 +476,589 @@ inline void AmpPoisson3D<T>::jacobi(cfloat2 &vf)
 	// Swap buffers
 	m_pSrcUnknown.swap(m_pDstUnknown);
 }
+
+template<typename T>
+inline void AmpPoisson3D<T>::gaussSeidel(cfloat2 &vf, const uint32_t uIteration)
+{
+	const auto tvUnknownRW = AmpRWTexture3DView<float>(*m_pDstUnknown);
+	const auto tvKnownRO = AmpTexture3DView<float>(*m_pSrcKnown);
+
+	forEachTile(
+		// Define the compute domain, which is the set of threads that are created.
+		tvUnknownRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const concurrency::tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> &t_idx,
+			const AmpIndex3D &vTileOrigin, const int) restrict(amp)
+	{
+		const auto idx = vTileOrigin + t_idx.local;
+
+		// Unordered Gauss-Seidel iteration
+		for (auto i = 0u; i < uIteration; ++i)
+		{
+			const auto fPressPrev = tvUnknownRW[idx];
+			const auto fPress = gaussSeidel(tvUnknownRW, tvKnownRO, vf, idx);
+
+			tvUnknownRW.set(idx, fPress);
+			t_idx.barrier.wait_with_global_memory_fence();
+		}
+	}
+	);
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::redBlack(cfloat2 &vf, const uint32_t uSweeps)
+{
+	const auto tvUnknownRW = AmpRWTexture3DView<float>(*m_pSrcUnknown);
+	const auto tvUnknownRO = AmpTexture3DView<float>(*m_pDstUnknown);
+	const auto tvKnownRO = AmpTexture3DView<float>(*m_pSrcKnown);
+	const auto &aFlags = *m_pBrickFlags;
+	const auto vBrickGrid = brickGrid();
+	const auto iNumPasses = 2 * static_cast<int>(uSweeps);
+
+	forEachTile(
+		// Define the compute domain, which is the set of threads that are created.
+		tvUnknownRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aFlags](const concurrency::tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> &t_idx,
+			const AmpIndex3D &vTileOrigin, const int) restrict(amp)
+	{
+		// The tile plus a halo of one cell per half-sweep: the stale halo can only spoil
+		// one more layer per half-sweep, so the centre stays exact after all of them. In
+		// sparse mode the tiles are the live bricks, and the halo cells of others stay at zero.
+		tile_static float fRegion[RB_REGION][RB_REGION][RB_REGION];
+
+		const auto &extent = tvUnknownRW.extent;
+		const auto vOrigin = AmpIndex3D(vTileOrigin[0] - RB_HALO, vTileOrigin[1] - RB_HALO, vTileOrigin[2] - RB_HALO);
+		const auto iThread = (t_idx.local[0] * THREAD_BLOCK_Y + t_idx.local[1]) * THREAD_BLOCK_X + t_idx.local[2];
+		const auto iNumThreads = THREAD_BLOCK_X * THREAD_BLOCK_Y * THREAD_BLOCK_Z;
+		const auto iNumCells = RB_REGION * RB_REGION * RB_REGION;
+
+		// Load the region; cells outside the grid read as zero
+		for (auto i = iThread; i < iNumCells; i += iNumThreads)
+		{
+			const auto z = i / (RB_REGION * RB_REGION), y = (i / RB_REGION) % RB_REGION, x = i % RB_REGION;
+			fRegion[z][y][x] = tvUnknownRO(vOrigin[0] + z, vOrigin[1] + y, vOrigin[2] + x);
+		}
+		t_idx.barrier.wait_with_tile_static_memory_fence();
+
+		// Each half-sweep updates one colour from the other, so no cell is read while it is written
+		for (auto iPass = 0; iPass < iNumPasses; ++iPass)
+		{
+			for (auto i = iThread; i < iNumCells; i += iNumThreads)
+			{
+				const auto z = i / (RB_REGION * RB_REGION), y = (i / RB_REGION) % RB_REGION, x = i % RB_REGION;
+				const auto idx = AmpIndex3D(vOrigin[0] + z, vOrigin[1] + y, vOrigin[2] + x);
+				if (((idx[0] + idx[1] + idx[2]) & 1) != (iPass & 1)) continue;
+				if (z < 1 || y < 1 || x < 1 || z > RB_REGION - 2 || y > RB_REGION - 2 || x > RB_REGION - 2) continue;
+				if (!extent.contains(idx) || !isLive(aFlags, vBrickGrid, idx)) continue;
+
+				auto fq = vf.x * tvKnownRO[idx];
+				fq += fRegion[z][y][x - 1];
+				fq += fRegion[z][y][x + 1];
+				fq += fRegion[z][y - 1][x];
+				fq += fRegion[z][y + 1][x];
+				fq += fRegion[z - 1][y][x];
+				fq += fRegion[z + 1][y][x];
+				fRegion[z][y][x] = fq / vf.y;
+			}
+			t_idx.barrier.wait_with_tile_static_memory_fence();
+		}
+
+		const auto &vLocal = t_idx.local;
+		tvUnknownRW.set(vTileOrigin + vLocal, fRegion[vLocal[0] + RB_HALO][vLocal[1] + RB_HALO][vLocal[2] + RB_HALO]);
+	}
+	);
+
+	// Swap buffers
+	m_pSrcUnknown.swap(m_pDstUnknown);
+}
+
+template<typename T>
+inline float AmpPoisson3D<T>::residual(const AmpTexture3DView<float> &tvUnknownRO,
+	const AmpTexture3DView<float> &tvKnownRO, cfloat3 &vf, cfloat3 &vHighGhost, const AmpIndex3D &idx) restrict(amp)
+{
+	auto fq = vf.x * tvKnownRO[idx];
+	fq += tvUnknownRO(idx[0], idx[1], idx[2] - 1);
+	fq += tvUnknownRO(idx[0], idx[1], idx[2] + 1);
+	fq += tvUnknownRO(idx[0], idx[1] - 1, idx[2]);
+	fq += tvUnknownRO(idx[0], idx[1] + 1, idx[2]);
+	fq += tvUnknownRO(idx[0] - 1, idx[1], idx[2]);
+	fq += tvUnknownRO(idx[0] + 1, idx[1], idx[2]);
+
+	return fq - diagonal(tvUnknownRO.extent, vf, vHighGhost, idx) * tvUnknownRO[idx];
+}
+
+template<typename T>
+inline float AmpPoisson3D<T>::diagonal(const concurrency::extent<3> &extent, cfloat3 &vf,
+	cfloat3 &vHighGhost, const AmpIndex3D &idx) restrict(amp)
+{
+	// Faces on the domain boundary see the ghost value vf.z * u, or vHighGhost * u at the
+	// far end of each axis, instead of zero
+	auto fBound = 0.0f;
+	fBound += idx[2] <= 0 ? 1.0f : 0.0f;
+	fBound += idx[1] <= 0 ? 1.0f : 0.0f;
+	fBound += idx[0] <= 0 ? 1.0f : 0.0f;
+
+	auto fHighBound = 0.0f;
+	fHighBound += idx[2] >= extent[2] - 1 ? vHighGhost.x : 0.0f;
+	fHighBound += idx[1] >= extent[1] - 1 ? vHighGhost.y : 0.0f;
+	fHighBound += idx[0] >= extent[0] - 1 ? vHighGhost.z : 0.0f;
+
+	return vf.y - vf.z * fBound - fHighBound;
+}
+
+template<typename T>
+inline float AmpPoisson3D<T>::ghostFactor(const uint8_t uLevel)
+{
+	// The first coarse center is half a coarse cell in, the zero half a fine cell out
+	return ghostFactor(uLevel, 0.5f * (static_cast<float>(1 << uLevel) + 1.0f));
+}
+
+template<typename T>
+inline float AmpPoisson3D<T>::ghostFactor(const uint8_t uLevel, cfloat fDistance)
+{
+	// The fine grid is zero one fine cell beyond its outermost centers. Coarse level l places
+	// its ghost value one coarse cell out, so extrapolate linearly to keep the zero in place;
+	// fDistance is the zero's from the outermost coarse center, in fine cells. A center at or
+	// past the zero would turn the extrapolation around, so it keeps half a fine cell.
+	const auto fScale = static_cast<float>(1 << uLevel);
+
+	return 1.0f - fScale / (std::max)(fDistance, 0.5f);
+}
+
+template<typename T>
+inline float3 AmpPoisson3D<T>::highGhost(const uint8_t uLevel) const
+{
+	// The finest grid is zero right beyond its faces
+	return uLevel > 0 ? m_mgLevels[uLevel - 1].vHighGhost : float3(0.0f, 0.0f, 0.0f);
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::multigrid(cfloat3 &vf, const uint8_t uLevel, const MultigridCycle cycle)
+{
+	// Coarsest level: relax until the remaining error is resolved
+	if (uLevel >= m_mgLevels.size())
+	{
+		smooth(vf, uLevel, MG_COARSE_ITERATION);
+		return;
+	}
+
+	// Pre-smoothing, then hand the residual down
+	smooth(vf, uLevel, m_uMGSmooth);
+	restrictResidual(vf, uLevel);
+
+	// The coarse operator keeps the 7-point stencil; its diagonal excess scales with the
+	// squared grid spacing, and the residual is rescaled by the restriction
+	const auto uCoarse = static_cast<uint8_t>(uLevel + 1);
+	const auto vfCoarse = float3(1.0f, 6.0f + 4.0f * (vf.y - 6.0f), ghostFactor(uCoarse));
+	switch (cycle)
+	{
+	case MULTIGRID_W_CYCLE:
+		multigrid(vfCoarse, uCoarse, MULTIGRID_W_CYCLE);
+		multigrid(vfCoarse, uCoarse, MULTIGRID_W_CYCLE);
+		break;
+	case MULTIGRID_F_CYCLE:
+		multigrid(vfCoarse, uCoarse, MULTIGRID_F_CYCLE);
+		multigrid(vfCoarse, uCoarse, MULTIGRID_V_CYCLE);
+		break;
+	default:
+		multigrid(vfCoarse, uCoarse, MULTIGRID_V_CYCLE);
+	}
+
+	// Coarse-grid correction and post-smoothing
+	prolongate(uLevel);
+	smooth(vf, uLevel, m_uMGSmooth);
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::smooth(cfloat3 &vf, const uint8_t uLevel, const uint8_t uIteration)
+{
+	auto &pUnknown = uLevel > 0 ? m_mgLevels[uLevel - 1].pUnknown : m_pDstUnknown;
+	auto &pTmp = uLevel > 0 ? m_mgLevels[uLevel - 1].pTmp : m_pSrcUnknown;
+	const auto tvKnownRO = AmpTexture3DView<T>(uLevel > 0 ? *m_mgLevels[uLevel - 1].pKnown : *m_pSrcKnown);
+	const auto vHighGhost = highGhost(uLevel);
+
+	for (auto i = 0ui8; i < uIteration; ++i)
+	{
+		const auto tvUnknownRW = AmpRWTexture3DView<T>(*pTmp);
+		const auto tvUnknownRO = AmpTexture3DView<T>(*pUnknown);
+		const auto kernel = [=](const AmpIndex3D idx) restrict(amp)
+		{
+			// Weighted Jacobi damps the high frequencies for the coarse grids
+			const auto fUnknown = tvUnknownRO[idx];
+			const auto fResidual = residual(tvUnknownRO, tvKnownRO, vf, vHighGhost, idx);
+			const auto fDiagonal = diagonal(tvUnknownRO.extent, vf, vHighGhost, idx);
+
+			tvUnknownRW.set(idx, fUnknown + JACOBI_WEIGHT * fResidual / fDiagonal);
+		};
+
+		// Only the finest grid is sparse
+		if (uLevel > 0) parallel_for_each(tvUnknownRW.extent, kernel);
+		else forEachCell(tvUnknownRW.extent, kernel);
+
+		// Swap buffers
+		pUnknown.swap(pTmp);
+	}
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::restrictResidual(cfloat3 &vf, const uint8_t uLevel)
+{
+	auto &coarse = m_mgLevels[uLevel];
+	const auto tvUnknownRO = AmpTexture3DView<T>(uLevel > 0 ? *m_mgLevels[uLevel - 1].pUnknown : *m_pDstUnknown);
+	const auto tvKnownRO = AmpTexture3DView<T>(uLevel > 0 ? *m_mgLevels[uLevel - 1].pKnown : *m_pSrcKnown);
+	const auto tvCoarseKnownRW = AmpRWTexture3DView<T>(*coarse.pKnown);
+	const auto tvCoarseUnknownRW = AmpRWTexture3DView<T>(*coarse.pUnknown);
+	const auto vHighGhost = highGhost(uLevel);
+	const auto &aFlags = *m_pBrickFlags;
+	const auto vBrickGrid = uLevel > 0 ? int3(0, 0, 0) : brickGrid();
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of threads that are created.
+		tvCoarseKnownRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aFlags](const AmpIndex3D idx) restrict(amp)
+	{
+		// Average the residuals of the (up to) 8 fine children; the children in dead bricks
+		// hold the zero of the boundary, so they count with no residual
+		auto fResidual = 0.0f;
+		auto fCount = 0.0f;
+		for (auto i = 0; i < 8; ++i)
+		{
+			const auto vLoc = AmpIndex3D(idx[0] * 2 + (i >> 2), idx[1] * 2 + ((i >> 1) & 1), idx[2] * 2 + (i & 1));
+			if (!tvUnknownRO.extent.contains(vLoc)) continue;
+
+			if (isLive(aFlags, vBrickGrid, vLoc)) fResidual += residual(tvUnknownRO, tvKnownRO, vf, vHighGhost, vLoc);
+			fCount += 1.0f;
+		}
+
+		// Rescale to the coarse grid spacing and start the correction from zero
+		tvCoarseKnownRW.set(idx, 4.0f * fResidual / fCount);
+		tvCoarseUnknownRW.set(idx, 0.0f);
+	}
+	);
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::prolongate(const uint8_t uLevel)
+{
+	const auto tvUnknownRW = AmpRWTexture3DView<T>(uLevel > 0 ? *m_mgLevels[uLevel - 1].pUnknown : *m_pDstUnknown);
+	const auto tvCoarseRO = AmpTexture3DView<T>(*m_mgLevels[uLevel].pUnknown);
+	const auto fGhost = ghostFactor(uLevel + 1);
+	const auto vHighGhost = m_mgLevels[uLevel].vHighGhost;
+	const auto kernel = [=](const AmpIndex3D idx) restrict(amp)
+	{
+		// Trilinear interpolation of the coarse correction at the fine cell center,
+		// taking the same ghost values as the coarse operator beyond the boundary
+		const auto vPos = (float3((float)idx[2], (float)idx[1], (float)idx[0]) + 0.5f) * 0.5f - 0.5f;
+		const auto vBase = floor(vPos);
+		const auto vFrac = vPos - vBase;
+		const auto vLo = int3((int)vBase.x, (int)vBase.y, (int)vBase.z);
+		const auto &extent = tvCoarseRO.extent;
+
+		auto fCorrection = 0.0f;
+		for (auto i = 0; i < 8; ++i)
+		{
+			auto vTap = int3(vLo.x + (i & 1), vLo.y + ((i >> 1) & 1), vLo.z + (i >> 2));
+			auto fWeight = ((i & 1) ? vFrac.x : 1.0f - vFrac.x) * (((i >> 1) & 1) ? vFrac.y : 1.0f - vFrac.y) *
+				((i >> 2) ? vFrac.z : 1.0f - vFrac.z);
+			if (vTap.x < 0) fWeight *= fGhost;
+			else if (vTap.x >= extent[2]) fWeight *= vHighGhost.x;
+			if (vTap.y < 0) fWeight *= fGhost;
+			else if (vTap.y >= extent[1]) fWeight *= vHighGhost.y;
+			if (vTap.z < 0) fWeight *= fGhost;
+			else if (vTap.z >= extent[0]) fWeight *= vHighGhost.z;
+			vTap.x = concurrency::direct3d::clamp(vTap.x, 0, extent[2] - 1);
+			vTap.y = concurrency::direct3d::clamp(vTap.y, 0, extent[1] - 1);
+			vTap.z = concurrency::direct3d::clamp(vTap.z, 0, extent[0] - 1);
+			fCorrection += fWeight * tvCoarseRO(vTap.z, vTap.y, vTap.x);
+		}
+
+		tvUnknownRW.set(idx, tvUnknownRW[idx] + fCorrection);
+	};
+
+	// Only the finest grid is sparse
+	if (uLevel > 0) parallel_for_each(tvUnknownRW.extent, kernel);
+	else forEachCell(tvUnknownRW.extent, kernel);
+}
+
+template<typename T>
+inline PoissonStats AmpPoisson3D<T>::pcg(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval)
+{
+	const auto tvUnknownRW = AmpRWTexture3DView<float>(*m_pDstUnknown);
+	const auto tvResidualRW = AmpRWTexture3DView<float>(*m_pResidual);
+	const auto tvDirectionRW = AmpRWTexture3DView<float>(*m_pDirection);
+	const auto tvScratchRW = AmpRWTexture3DView<float>(*m_pScratch);
+	const auto tvUnknownRO = AmpTexture3DView<float>(*m_pDstUnknown);
+	const auto tvResidualRO = AmpTexture3DView<float>(*m_pResidual);
+	const auto tvDirectionRO = AmpTexture3DView<float>(*m_pDirection);
+	const auto tvScratchRO = AmpTexture3DView<float>(*m_pScratch);
+	const auto tvKnownRO = AmpTexture3DView<float>(*m_pSrcKnown);
+	const auto vfResidual = float3(vf.x, vf.y, 0.0f);
+	const auto vHighGhost = highGhost(0);
+	const auto fNorm = rhsNorm(vf);
+	auto stats = PoissonStats();
+
+	// Start from the current unknown
+	forEachCell(
+		// Define the compute domain, which is the set of threads that are created.
+		tvResidualRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex3D idx) restrict(amp)
+	{
+		tvResidualRW.set(idx, residual(tvUnknownRO, tvKnownRO, vfResidual, vHighGhost, idx));
+	}
+	);
+	stats.fResidual = static_cast<float>(std::sqrt(dotProduct(tvResidualRO, tvResidualRO)) / fNorm);
+	if (stats.fResidual <= fTolerance) return stats;
+
+	precondition(vf);
+	m_pScratch->copy_to(*m_pDirection);
+	auto fRZ = dotProduct(tvResidualRO, tvScratchRO);
+
+	while (stats.uIterations < uMaxIteration)
+	{
+		// Operator product q = A p, with zero beyond the boundary
+		forEachCell(
+			// Define the compute domain, which is the set of threads that are created.
+			tvScratchRW.extent,
+			// Define the code to run on each thread on the accelerator.
+			[=](const AmpIndex3D idx) restrict(amp)
+		{
+			auto fq = vf.y * tvDirectionRO[idx];
+			fq -= tvDirectionRO(idx[0], idx[1], idx[2] - 1);
+			fq -= tvDirectionRO(idx[0], idx[1], idx[2] + 1);
+			fq -= tvDirectionRO(idx[0], idx[1] - 1, idx[2]);
+			fq -= tvDirectionRO(idx[0], idx[1] + 1, idx[2]);
+			fq -= tvDirectionRO(idx[0] - 1, idx[1], idx[2]);
+			fq -= tvDirectionRO(idx[0] + 1, idx[1], idx[2]);
+
+			tvScratchRW.set(idx, fq);
+		}
+		);
+
+		// The direction vanished: the residual is as small as float precision allows, though
+		// the last check may have been intervals ago
+		const auto fPQ = dotProduct(tvDirectionRO, tvScratchRO);
+		if (fPQ <= 0.0)
+		{
+			stats.fResidual = static_cast<float>(std::sqrt(dotProduct(tvResidualRO, tvResidualRO)) / fNorm);
+			break;
+		}
+
+		const auto fAlpha = static_cast<float>(fRZ / fPQ);
+		forEachCell(
+			// Define the compute domain, which is the set of threads that are created.
+			tvUnknownRW.extent,
+			// Define the code to run on each thread on the accelerator.
+			[=](const AmpIndex3D idx) restrict(amp)
+		{
+			tvUnknownRW.set(idx, tvUnknownRW[idx] + fAlpha * tvDirectionRO[idx]);
+			tvResidualRW.set(idx, tvResidualRW[idx] - fAlpha * tvScratchRO[idx]);
+		}
+		);
+
+		// Early exit on the relative residual, checked every uCheckInterval iterations
+		if (++stats.uIterations % uCheckInterval == 0 || stats.uIterations >= uMaxIteration)
+		{
+			stats.fResidual = static_cast<float>(std::sqrt(dotProduct(tvResidualRO, tvResidualRO)) / fNorm);
+			if (stats.fResidual <= fTolerance) break;
+		}
+
+		precondition(vf);
+		const auto fRZNew = dotProduct(tvResidualRO, tvScratchRO);
+		const auto fBeta = static_cast<float>(fRZNew / fRZ);
+		fRZ = fRZNew;
+
+		forEachCell(
+			// Define the compute domain, which is the set of threads that are created.
+			tvDirectionRW.extent,
+			// Define the code to run on each thread on the accelerator.
+			[=](const AmpIndex3D idx) restrict(amp)
+		{
+			tvDirectionRW.set(idx, tvScratchRO[idx] + fBeta * tvDirectionRW[idx]);
+		}
+		);
+	}
+
+	return stats;
+}
+
+template<typename T>
+inline void AmpPoisson3D<T>::precondition(cfloat2 &vf)
+{
+	const auto tvScratchRW = AmpRWTexture3DView<float>(*m_pScratch);
+	const auto tvResidualRO = AmpTexture3DView<float>(*m_pResidual);
+
+	// The MIC(0) triangular solves are sequential by nature, so the accelerator always
+	// uses the Jacobi preconditioner; HostPoisson3D implements both.
+	forEachCell(
+		// Define the compute domain, which is the set of threads that are created.
+		tvScratchRW.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=](const AmpIndex3D idx) restrict(amp)
+	{
+		tvScratchRW.set(idx, tvResidualRO[idx] / vf.y);
+	}
+	);
+}
+
+template<typename T>
+inline double AmpPoisson3D<T>::dotProduct(const AmpTexture3DView<float> &tvA, const AmpTexture3DView<float> &tvB)
+{
+	return reduce([=](const AmpIndex3D &idx) restrict(amp) { return tvA[idx] * tvB[idx]; });
+}
+
+template<typename T>
+inline double AmpPoisson3D<T>::residualNorm(cfloat3 &vf)
+{
+	const auto tvUnknownRO = AmpTexture3DView<float>(*m_pDstUnknown);
+	const auto tvKnownRO = AmpTexture3DView<float>(*m_pSrcKnown);
+	const auto vHighGhost = highGhost(0);
+
+	return std::sqrt(reduce([=](const AmpIndex3D &idx) restrict(amp)
+	{
+		const auto fResidual = residual(tvUnknownRO, tvKnownRO, vf, vHighGhost, idx);
+		return fResidual * fResidual;
+	}));
+}
+
+template<typename T>
+inline double AmpPoisson3D<T>::rhsNorm(cfloat2 &vf)
+{
+	const auto tvKnownRO = AmpTexture3DView<float>(*m_pSrcKnown);
+
+	// Norm of vf.x * b; an empty right-hand side falls back to absolute residuals
+	const auto fNorm = std::abs(vf.x) * std::sqrt(dotProduct(tvKnownRO, tvKnownRO));
+
+	return fNorm > 0.0 ? fNorm : 1.0;
+}
+
+template<typename T>
+template<typename F>
+inline double AmpPoisson3D<T>::reduce(const F &func)
+{
+	auto &partialSums = *m_pPartialSums;
+	const auto &extent = m_pDstUnknown->extent;
+
+	forEachTile(
+		// Define the compute domain, which is the set of threads that are created.
+		extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &partialSums](const concurrency::tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> &t_idx,
+			const AmpIndex3D &vTileOrigin, const int iTile) restrict(amp)
+	{
+		const auto iNumThreads = THREAD_BLOCK_X * THREAD_BLOCK_Y * THREAD_BLOCK_Z;
+		tile_static float fSum[iNumThreads];
+
+		const auto iThread = (t_idx.local[0] * THREAD_BLOCK_Y + t_idx.local[1]) * THREAD_BLOCK_X + t_idx.local[2];
+		fSum[iThread] = func(vTileOrigin + t_idx.local);
+		t_idx.barrier.wait_with_tile_static_memory_fence();
+
+		// Tree reduction within the tile
+		for (auto iStride = iNumThreads / 2; iStride > 0; iStride >>= 1)
+		{
+			if (iThread < iStride) fSum[iThread] += fSum[iThread + iStride];
+			t_idx.barrier.wait_with_tile_static_memory_fence();
+		}
+
+		if (iThread == 0) partialSums[iTile] = fSum[0];
+	}
+	);
+
+	// Add the tile sums up in a fixed order on the host; in sparse mode the live bricks lead
+	const auto iNumTiles = m_pBricks ? static_cast<int>(m_pBricks->GetActive().size()) :
+		static_cast<int>(partialSums.extent.size());
+	auto vPartialSums = std::vector<float>(iNumTiles);
+	if (iNumTiles > 0)
+	{
+		// Blocks until the queued kernels have run
+		TRACE_SCOPE("AmpPoisson3D::readback");
+		concurrency::copy(partialSums.section(0, iNumTiles), vPartialSums.begin());
+	}
+
+	auto fSum = 0.0;
+	for (const auto &fPartial : vPartialSums) fSum += fPartial;
+
+	return fSum;
+}
+
+template<typename T>
+inline bool AmpPoisson3D<T>::isLive(const AmpUintArray &aFlags, cint3 &vBrickGrid, const AmpIndex3D &idx) restrict(amp)
+{
+	// A zero grid stands for the dense mode, where every cell is live
+	return vBrickGrid.x <= 0 || aFlags[((idx[0] / BRICK_SIZE) * vBrickGrid.y + idx[1] / BRICK_SIZE) * vBrickGrid.x +
+		idx[2] / BRICK_SIZE] != 0u;
+}
+
+template<typename T>
+inline int3 AmpPoisson3D<T>::brickGrid() const
+{
+	return m_pBricks ? int3(static_cast<int32_t>(m_pBricks->GetGridX()), static_cast<int32_t>(m_pBricks->GetGridY()),
+		static_cast<int32_t>(m_pBricks->GetGridZ())) : int3(0, 0, 0);
+}
+
+// Visit every cell of the finest grid, or only the cells of the live bricks in sparse mode
+template<typename T>
+template<typename F>
+inline void AmpPoisson3D<T>::forEachCell(const concurrency::extent<3> &domain, const F &kernel)
+{
+	if (!m_pBricks) return parallel_for_each(domain, kernel);
+
+	const auto iNumBricks = static_cast<int>(m_pBricks->GetActive().size());
+	if (iNumBricks <= 0) return;
+
+	const auto &aBricks = *m_pActiveBricks;
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per live brick.
+		concurrency::extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricks](const concurrency::tiled_index<BRICK_SIZE, BRICK_SIZE, BRICK_SIZE> t_idx) restrict(amp)
+	{
+		const auto idx = BrickOrigin(aBricks[t_idx.tile[0]]) + t_idx.local;
+		if (domain.contains(idx)) kernel(idx);
+	}
+	);
+}
+
+// The same per tile of the finest grid, kernel(t_idx, vTileOrigin, iTile): the tiles of the
+// grid, numbered slice by slice, or the live bricks in the order of the active list
+template<typename T>
+template<typename F>
+inline void AmpPoisson3D<T>::forEachTile(const concurrency::extent<3> &domain, const F &kernel)
+{
+	if (!m_pBricks)
+	{
+		const auto iTilesX = domain[2] / THREAD_BLOCK_X;
+		const auto iTilesY = domain[1] / THREAD_BLOCK_Y;
+
+		parallel_for_each(
+			// Define the compute domain, which is the set of threads that are created.
+			domain.tile<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z>(),
+			// Define the code to run on each thread on the accelerator.
+			[=](const concurrency::tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> t_idx) restrict(amp)
+		{
+			kernel(t_idx, t_idx.tile_origin, (t_idx.tile[0] * iTilesY + t_idx.tile[1]) * iTilesX + t_idx.tile[2]);
+		}
+		);
+
+		return;
+	}
+
+	const auto iNumBricks = static_cast<int>(m_pBricks->GetActive().size());
+	if (iNumBricks <= 0) return;
+
+	const auto &aBricks = *m_pActiveBricks;
+
+	parallel_for_each(
+		// Define the compute domain, which is one tile per live brick.
+		concurrency::extent<3>(iNumBricks * BRICK_SIZE, BRICK_SIZE, BRICK_SIZE).tile<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z>(),
+		// Define the code to run on each thread on the accelerator.
+		[=, &aBricks](const concurrency::tiled_index<THREAD_BLOCK_X, THREAD_BLOCK_Y, THREAD_BLOCK_Z> t_idx) restrict(amp)
+	{
+		kernel(t_idx, BrickOrigin(aBricks[t_idx.tile[0]]), t_idx.tile[0]);
+	}
+	);
+}
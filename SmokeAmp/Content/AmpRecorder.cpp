@@ -0,0 +1,136 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include "AmpRecorder.h"
+
+using namespace concurrency;
+using namespace concurrency::direct3d;
+using namespace concurrency::graphics;
+using namespace std;
+using namespace XSDX;
+
+// Texel packing of the device arrays: the scalars keep their bits
+inline void StoreTexel(AmpUintArray &aDst, const int i, cfloat fValue) restrict(amp)
+{
+	aDst[i] = asuint(fValue);
+}
+
+inline void StoreTexel(AmpUintArray &aDst, const int i, cfloat4 &vValue) restrict(amp)
+{
+	aDst[i] = asuint(vValue.x);
+	aDst[i + 1] = asuint(vValue.y);
+	aDst[i + 2] = asuint(vValue.z);
+	aDst[i + 3] = asuint(vValue.w);
+}
+
+AmpRecorder::AmpRecorder(const AmpAcclView &acclView, const uint32_t uNumBuffers, const uint32_t uNumWriters) :
+	m_acclView(acclView),
+	m_cpuView(accelerator(accelerator::cpu_accelerator).default_view),
+	m_buffers(uNumBuffers > 1 ? uNumBuffers : 1),
+	m_writers(uNumBuffers, uNumWriters)
+{
+}
+
+template<typename T>
+void AmpRecorder::recordField(const AmpTexture3D<T> &txField, const string &fileName)
+{
+	TRACE_SCOPE("AmpRecorder::Record");
+
+	const auto iComponents = static_cast<int>(sizeof(T) / sizeof(float));
+	const auto iSize = static_cast<int>(txField.extent.size()) * iComponents;
+	const auto uBuffer = acquire(iSize);
+	const auto tvFieldRO = AmpTexture3DView<T>(txField);
+	const auto iWidth = txField.extent[2];
+	const auto iHeight = txField.extent[1];
+	auto &aField = dref(m_buffers[uBuffer].pDevice);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of field texels.
+		tvFieldRO.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aField](const AmpIndex3D idx) restrict(amp)
+	{
+		// 16-bit fields are widened to float32
+		StoreTexel(aField, ((idx[0] * iHeight + idx[1]) * iWidth + idx[2]) * iComponents, tvFieldRO[idx]);
+	}
+	);
+
+	const auto uSize = sizeof(uint32_t) * iSize;
+	submit(uBuffer, iSize, [fileName, uSize](const uint32_t *pData)
+	{
+		return WriteRawFile(fileName, pData, uSize);
+	});
+}
+
+void AmpRecorder::Record(const AmpTexture3D<float> &txField, const string &fileName)
+{
+	recordField(txField, fileName);
+}
+
+void AmpRecorder::Record(const AmpTexture3D<float4> &txField, const string &fileName)
+{
+	recordField(txField, fileName);
+}
+
+void AmpRecorder::Record(const AmpTexture2D<unorm4> &txFrame, const string &fileName)
+{
+	TRACE_SCOPE("AmpRecorder::Record");
+
+	const auto iWidth = txFrame.extent[1];
+	const auto iHeight = txFrame.extent[0];
+	const auto uBuffer = acquire(iWidth * iHeight);
+	const auto tvFrameRO = AmpTexture2DView<unorm4>(txFrame);
+	auto &aPixels = dref(m_buffers[uBuffer].pDevice);
+
+	parallel_for_each(
+		// Define the compute domain, which is the set of frame pixels.
+		tvFrameRO.extent,
+		// Define the code to run on each thread on the accelerator.
+		[=, &aPixels](const AmpIndex2D idx) restrict(amp)
+	{
+		// Pack to RGBA8
+		const auto vColor = tvFrameRO[idx];
+		aPixels[idx[0] * iWidth + idx[1]] = static_cast<uint32_t>(static_cast<float>(vColor.r) * 255.0f + 0.5f) |
+			(static_cast<uint32_t>(static_cast<float>(vColor.g) * 255.0f + 0.5f) << 8) |
+			(static_cast<uint32_t>(static_cast<float>(vColor.b) * 255.0f + 0.5f) << 16) |
+			(static_cast<uint32_t>(static_cast<float>(vColor.a) * 255.0f + 0.5f) << 24);
+	}
+	);
+
+	submit(uBuffer, iWidth * iHeight, [fileName, iWidth, iHeight](const uint32_t *pPixels)
+	{
+		return WritePPMFile(fileName, pPixels, iWidth, iHeight);
+	});
+}
+
+// Returns a free buffer whose arrays hold at least iSize scalars
+uint32_t AmpRecorder::acquire(const int iSize)
+{
+	const auto uBuffer = m_writers.Acquire();
+	auto &buffer = m_buffers[uBuffer];
+
+	if (!buffer.pDevice || buffer.pDevice->extent[0] < iSize)
+	{
+		buffer.pDevice = make_shared<AmpUintArray>(iSize, m_acclView);
+		buffer.pStaging = make_shared<AmpUintArray>(iSize, m_cpuView, m_acclView);
+	}
+
+	return uBuffer;
+}
+
+// Starts the copy to the staging array, and leaves the wait for it to a writer
+void AmpRecorder::submit(const uint32_t uBuffer, const int iSize, const function<bool(const uint32_t*)> &write)
+{
+	// The arrays are only reallocated to grow, so copy just the part in use
+	auto &buffer = m_buffers[uBuffer];
+	buffer.copied = copy_async(buffer.pDevice->section(0, iSize), buffer.pStaging->section(0, iSize));
+
+	m_writers.Submit(uBuffer, [this, uBuffer, write]()
+	{
+		auto &buffer = m_buffers[uBuffer];
+		buffer.copied.get();
+
+		return write(buffer.pStaging->data());
+	});
+}
@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "XSDXType.h"
+#include "Common\WriterPool.h"
+#include "FieldMath.h"
+#include "RecordFormat.h"
+
+using AmpAcclView = concurrency::accelerator_view;
+using AmpUintArray = concurrency::array<uint32_t, 1>;
+using spAmpUintArray = std::shared_ptr<AmpUintArray>;
+
+//--------------------------------------------------------------------------------------
+// Records fields and frames without stalling the accelerator queue. Each Record queues
+// a kernel that packs the texture into a device array of one of the rotating buffers,
+// then an asynchronous copy into its staging array. The writer threads wait for the
+// copy and serialize the staging memory; the caller only waits when every buffer is
+// still in flight.
+//--------------------------------------------------------------------------------------
+
+class AmpRecorder
+{
+public:
+	AmpRecorder(const AmpAcclView &acclView, const uint32_t uNumBuffers = 3, const uint32_t uNumWriters = 2);
+
+	void Record(const AmpTexture3D<float> &txField, const std::string &fileName);
+	void Record(const AmpTexture3D<float4> &txField, const std::string &fileName);
+	void Record(const AmpTexture2D<unorm4> &txFrame, const std::string &fileName);
+	void Flush() { m_writers.Flush(); }
+
+	WriterStats GetStats() { return m_writers.GetStats(); }
+
+protected:
+	struct Buffer
+	{
+		spAmpUintArray						pDevice;
+		spAmpUintArray						pStaging;
+		concurrency::completion_future		copied;
+	};
+
+	uint32_t acquire(const int iSize);
+	void submit(const uint32_t uBuffer, const int iSize, const std::function<bool(const uint32_t*)> &write);
+	template<typename T>
+	void recordField(const AmpTexture3D<T> &txField, const std::string &fileName);
+
+	AmpAcclView						m_acclView;
+	AmpAcclView						m_cpuView;
+
+	// Declared before the writers, which finish with them on destruction
+	std::vector<Buffer>				m_buffers;
+	WriterPool						m_writers;
+};
+
+using upAmpRecorder = std::unique_ptr<AmpRecorder>;
+using spAmpRecorder = std::shared_ptr<AmpRecorder>;
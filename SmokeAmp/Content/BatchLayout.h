@@ -0,0 +1,150 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "BrickMap.h"
+
+#define BATCH_GAP		1		// Empty slices between neighboring instances
+#define BATCH_NONE		-1		// Slice table entry of a gap
+
+//--------------------------------------------------------------------------------------
+// Packs many small, independent simulations into one atlas grid, so that each stage of
+// a step runs once for all of them instead of once per instance. Instances are stacked
+// along z with an empty gap between neighbors. Cells outside every instance are never
+// written, so an instance reads zero across its faces exactly like a single grid reads
+// out of bounds. Like BrickMap, the tables keep to scalars so that the AMP and host
+// kernels can share them without sharing vector types.
+//--------------------------------------------------------------------------------------
+
+struct BatchInstance
+{
+	// Box in the atlas: the first iWidth x iHeight cells of slices [iOrigin, iOrigin + iDepth)
+	int32_t	iWidth;
+	int32_t	iHeight;
+	int32_t	iDepth;
+	int32_t	iOrigin;
+
+	// This step's time step, emitter force and density, and impulse location in [0, 1]^3
+	float	fDeltaTime;
+	float	fForceX;
+	float	fForceY;
+	float	fForceZ;
+	float	fDensity;
+	float	fImLocX;
+	float	fImLocY;
+	float	fImLocZ;
+};
+
+class BatchLayout
+{
+public:
+	BatchLayout() : m_iWidth(0), m_iHeight(0), m_iDepth(0), m_uNumCells(0) {}
+
+	// Appends an instance idle at zero force; returns its index
+	uint32_t Add(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+	{
+		auto instance = BatchInstance();
+		instance.iWidth = iWidth;
+		instance.iHeight = iHeight;
+		instance.iDepth = iDepth;
+		instance.iOrigin = m_instances.empty() ? 0 : m_instances.back().iOrigin + m_instances.back().iDepth + BATCH_GAP;
+		m_instances.push_back(instance);
+
+		return static_cast<uint32_t>(m_instances.size() - 1);
+	}
+
+	void Clear()
+	{
+		m_instances.clear();
+		Commit();
+	}
+
+	// Sizes the atlas to whole bricks and builds the slice and brick tables
+	void Commit()
+	{
+		auto iWidth = 0, iHeight = 0, iDepth = 0;
+		m_uNumCells = 0;
+		for (const auto &instance : m_instances)
+		{
+			iWidth = std::max(iWidth, instance.iWidth);
+			iHeight = std::max(iHeight, instance.iHeight);
+			iDepth = instance.iOrigin + instance.iDepth;
+			m_uNumCells += static_cast<uint64_t>(instance.iWidth) * instance.iHeight * instance.iDepth;
+		}
+		m_iWidth = roundUp(iWidth);
+		m_iHeight = roundUp(iHeight);
+		m_iDepth = roundUp(iDepth);
+
+		m_slices.assign(m_iDepth, BATCH_NONE);
+		for (auto i = 0u; i < m_instances.size(); ++i)
+		{
+			const auto &instance = m_instances[i];
+			std::fill_n(&m_slices[instance.iOrigin], instance.iDepth, static_cast<int32_t>(i));
+		}
+
+		// Every brick that overlaps an instance, so that dispatches skip the padding
+		m_bricks.clear();
+		for (auto z = 0; z < m_iDepth / BRICK_SIZE; ++z)
+		{
+			auto iBricksX = 0, iBricksY = 0;
+			for (auto k = z * BRICK_SIZE; k < (z + 1) * BRICK_SIZE; ++k)
+			{
+				if (m_slices[k] == BATCH_NONE) continue;
+				const auto &instance = m_instances[m_slices[k]];
+				iBricksX = std::max(iBricksX, roundUp(instance.iWidth) / BRICK_SIZE);
+				iBricksY = std::max(iBricksY, roundUp(instance.iHeight) / BRICK_SIZE);
+			}
+
+			for (auto y = 0; y < iBricksY; ++y)
+				for (auto x = 0; x < iBricksX; ++x)
+					m_bricks.push_back(BrickMap::Pack(x, y, z));
+		}
+	}
+
+	void SetStep(const uint32_t i, const float fDeltaTime, const float vForceDens[4], const float vImLoc[3])
+	{
+		auto &instance = m_instances[i];
+		instance.fDeltaTime = fDeltaTime;
+		instance.fForceX = vForceDens[0];
+		instance.fForceY = vForceDens[1];
+		instance.fForceZ = vForceDens[2];
+		instance.fDensity = vForceDens[3];
+		instance.fImLocX = vImLoc[0];
+		instance.fImLocY = vImLoc[1];
+		instance.fImLocZ = vImLoc[2];
+	}
+
+	int32_t GetWidth() const { return m_iWidth; }
+	int32_t GetHeight() const { return m_iHeight; }
+	int32_t GetDepth() const { return m_iDepth; }
+	uint32_t GetNumInstances() const { return static_cast<uint32_t>(m_instances.size()); }
+	// Cells inside the instances, excluding the gaps and the padding
+	uint64_t GetNumCells() const { return m_uNumCells; }
+
+	const BatchInstance &GetInstance(const uint32_t i) const { return m_instances[i]; }
+	const std::vector<BatchInstance> &GetInstances() const { return m_instances; }
+	// Instance of each atlas slice, or BATCH_NONE
+	const std::vector<int32_t> &GetSlices() const { return m_slices; }
+	// Packed as in BrickMap
+	const std::vector<uint32_t> &GetBricks() const { return m_bricks; }
+
+protected:
+	static int32_t roundUp(const int32_t i)
+	{
+		return (i + BRICK_SIZE - 1) / BRICK_SIZE * BRICK_SIZE;
+	}
+
+	int32_t						m_iWidth;
+	int32_t						m_iHeight;
+	int32_t						m_iDepth;
+	uint64_t					m_uNumCells;
+
+	std::vector<BatchInstance>	m_instances;
+	std::vector<int32_t>		m_slices;
+	std::vector<uint32_t>		m_bricks;
+};
@@ -0,0 +1,161 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#define BRICK_SIZE		8
+#define BRICK_CELLS		(BRICK_SIZE * BRICK_SIZE * BRICK_SIZE)
+#define BRICK_BITS		10
+#define BRICK_MASK		((1u << BRICK_BITS) - 1u)
+#define BRICK_THRESHOLD	1e-4f
+
+//--------------------------------------------------------------------------------------
+// Tracks which BRICK_SIZE^3 bricks of a grid are live. Bricks are packed as
+// x | y << BRICK_BITS | z << 2 * BRICK_BITS, so the AMP and host kernels can walk the
+// active list without sharing vector types. Bricks leaving the live set are reported
+// once in the freed list so that their cells can be cleared; inactive bricks are kept
+// at zero and never written.
+//--------------------------------------------------------------------------------------
+
+// Live bricks that follow each other along x, for the row kernels
+struct BrickRun
+{
+	uint32_t	uBrick;		// The first, packed
+	uint32_t	uLength;
+};
+
+class BrickMap
+{
+public:
+	BrickMap() : m_uGridX(0), m_uGridY(0), m_uGridZ(0) {}
+
+	void Init(const uint32_t uWidth, const uint32_t uHeight, const uint32_t uDepth)
+	{
+		m_uGridX = (uWidth + BRICK_SIZE - 1) / BRICK_SIZE;
+		m_uGridY = (uHeight + BRICK_SIZE - 1) / BRICK_SIZE;
+		m_uGridZ = (uDepth + BRICK_SIZE - 1) / BRICK_SIZE;
+
+		// Every brick starts live, so the first commit frees whatever the occupancy does not keep
+		m_flags.assign(GetNumBricks(), 1u);
+		m_seeds.assign(GetNumBricks(), 0u);
+		m_active.clear();
+		m_runs.clear();
+		m_freed.clear();
+	}
+
+	// Seeds the bricks whose occupancy exceeds the threshold. Each seed is dilated by the
+	// distance its contents may travel in the step (in cells), plus one brick for the stencils.
+	void Mark(const std::vector<float> &occupancy, const std::vector<float> &reach,
+		const float fThreshold = BRICK_THRESHOLD)
+	{
+		for (auto i = 0u; i < GetNumBricks(); ++i)
+		{
+			if (occupancy[i] <= fThreshold) continue;
+			const auto uRadius = static_cast<uint32_t>(std::ceil(reach[i] / BRICK_SIZE)) + 1u;
+			m_seeds[i] = std::max(m_seeds[i], uRadius + 1u);
+		}
+	}
+
+	// Seeds the bricks overlapping the cells [iMin, iMax], e.g. around a source
+	void MarkCells(const int32_t iMin[3], const int32_t iMax[3])
+	{
+		const uint32_t uGrid[] = { m_uGridX, m_uGridY, m_uGridZ };
+		uint32_t uLo[3], uHi[3];
+		for (auto i = 0u; i < 3; ++i)
+		{
+			const auto iLo = std::max(iMin[i], 0) / BRICK_SIZE;
+			const auto iHi = std::min(std::max(iMax[i], 0) / BRICK_SIZE, static_cast<int32_t>(uGrid[i]) - 1);
+			if (iLo > iHi) return;
+			uLo[i] = iLo;
+			uHi[i] = iHi;
+		}
+
+		for (auto z = uLo[2]; z <= uHi[2]; ++z)
+			for (auto y = uLo[1]; y <= uHi[1]; ++y)
+				for (auto x = uLo[0]; x <= uHi[0]; ++x)
+				{
+					auto &uSeed = m_seeds[index(x, y, z)];
+					uSeed = std::max(uSeed, 2u);
+				}
+	}
+
+	// Dilates the seeds, makes them the live set, and collects the bricks that went out
+	// of use. The seeds are reset for the next step.
+	void Commit()
+	{
+		// Scatter each seed over its radius
+		m_live.assign(GetNumBricks(), 0u);
+		for (auto z = 0u; z < m_uGridZ; ++z)
+			for (auto y = 0u; y < m_uGridY; ++y)
+				for (auto x = 0u; x < m_uGridX; ++x)
+				{
+					const auto uSeed = m_seeds[index(x, y, z)];
+					if (!uSeed) continue;
+
+					const auto uRadius = uSeed - 1u;
+					for (auto k = z > uRadius ? z - uRadius : 0u; k <= std::min(z + uRadius, m_uGridZ - 1u); ++k)
+						for (auto j = y > uRadius ? y - uRadius : 0u; j <= std::min(y + uRadius, m_uGridY - 1u); ++j)
+							for (auto i = x > uRadius ? x - uRadius : 0u; i <= std::min(x + uRadius, m_uGridX - 1u); ++i)
+								m_live[index(i, j, k)] = 1u;
+				}
+
+		m_active.clear();
+		m_runs.clear();
+		m_freed.clear();
+		for (auto z = 0u; z < m_uGridZ; ++z)
+			for (auto y = 0u; y < m_uGridY; ++y)
+				for (auto x = 0u; x < m_uGridX; ++x)
+				{
+					const auto i = index(x, y, z);
+					if (m_live[i])
+					{
+						m_active.push_back(Pack(x, y, z));
+						if (x > 0 && m_live[i - 1]) ++m_runs.back().uLength;
+						else m_runs.push_back({ Pack(x, y, z), 1u });
+					}
+					else if (m_flags[i]) m_freed.push_back(Pack(x, y, z));
+					m_flags[i] = m_live[i];
+				}
+
+		std::fill(m_seeds.begin(), m_seeds.end(), 0u);
+	}
+
+	static uint32_t Pack(const uint32_t x, const uint32_t y, const uint32_t z)
+	{
+		return x | (y << BRICK_BITS) | (z << 2 * BRICK_BITS);
+	}
+
+	uint32_t GetGridX() const { return m_uGridX; }
+	uint32_t GetGridY() const { return m_uGridY; }
+	uint32_t GetGridZ() const { return m_uGridZ; }
+	uint32_t GetNumBricks() const { return m_uGridX * m_uGridY * m_uGridZ; }
+	bool IsActive(const uint32_t x, const uint32_t y, const uint32_t z) const { return m_flags[index(x, y, z)] != 0u; }
+
+	const std::vector<uint32_t> &GetFlags() const { return m_flags; }
+	const std::vector<uint32_t> &GetActive() const { return m_active; }
+	const std::vector<BrickRun> &GetRuns() const { return m_runs; }
+	const std::vector<uint32_t> &GetFreed() const { return m_freed; }
+
+protected:
+	uint32_t index(const uint32_t x, const uint32_t y, const uint32_t z) const
+	{
+		return (z * m_uGridY + y) * m_uGridX + x;
+	}
+
+	uint32_t				m_uGridX;
+	uint32_t				m_uGridY;
+	uint32_t				m_uGridZ;
+
+	std::vector<uint32_t>	m_flags;
+	std::vector<uint32_t>	m_seeds;		// Dilation radius + 1, or 0 if not seeded
+	std::vector<uint32_t>	m_live;
+	std::vector<uint32_t>	m_active;
+	std::vector<BrickRun>	m_runs;
+	std::vector<uint32_t>	m_freed;
+};
@@ -0,0 +1,232 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "Common/MappedFile.h"
+#include "BrickMap.h"
+
+#define CHECKPOINT_MAGIC		"SMOKECKP"
+#define CHECKPOINT_VERSION		2
+#define CHECKPOINT_ALIGNMENT	4096	// Field data starts on a page boundary
+
+//--------------------------------------------------------------------------------------
+// Simulation checkpoint shared by AmpFluid3D and HostFluid3D. The file is a fixed header,
+// the packed coordinates (BrickMap::Pack) of the stored bricks, then per field one
+// page-aligned array of BRICK_CELLS texels per brick, cells x-fastest within a brick and
+// bricks in the order of the table. Bricks that are zero in every field are left out.
+// A reader maps the file and hands each field array to the device as it is; all values
+// are little-endian 32-bit. The header carries an FNV-1a hash of the whole file, taken
+// with the hash itself zero, so that a torn or damaged file is refused on load.
+//--------------------------------------------------------------------------------------
+
+enum CheckpointField : uint32_t
+{
+	CHECKPOINT_VELOCITY,	// float4 per cell
+	CHECKPOINT_DENSITY,		// float per cell
+	CHECKPOINT_PRESSURE,	// float per cell, the warm start of the next solve
+
+	NUM_CHECKPOINT_FIELDS
+};
+
+struct CheckpointHeader
+{
+	char		szMagic[8];
+	uint32_t	uVersion;
+	uint32_t	uHeaderSize;
+	int32_t		iWidth;
+	int32_t		iHeight;
+	int32_t		iDepth;
+	uint32_t	uPrecision;		// Bits per stored scalar
+	uint64_t	uStep;			// Steps simulated up to the checkpoint
+	float		fDeltaTime;		// Time step in use at the checkpoint
+	uint32_t	uBrickSize;
+	uint32_t	uNumBricks;		// Bricks stored
+	uint32_t	uChecksum;		// FNV-1a of the file with this field zero
+	uint64_t	uBrickOffset;	// File offset of the brick table
+	uint64_t	uFieldOffsets[NUM_CHECKPOINT_FIELDS];
+};
+
+static_assert(sizeof(CheckpointHeader) == 88, "The checkpoint header is part of the file format");
+
+inline uint32_t CheckpointComponents(const uint32_t uField)
+{
+	return uField == CHECKPOINT_VELOCITY ? 4 : 1;
+}
+
+inline uint32_t CheckpointHash(const void *pData, const uint64_t uSize, uint32_t uHash = 2166136261u)
+{
+	const auto pBytes = static_cast<const uint8_t*>(pData);
+	for (auto i = 0ull; i < uSize; ++i)
+	{
+		uHash ^= pBytes[i];
+		uHash *= 16777619u;
+	}
+
+	return uHash;
+}
+
+// The fields hold every brick of the grid in BrickMap order, as the reader lays them out,
+// with the cells beyond the grid edges zero
+inline bool WriteCheckpoint(const char *szFileName, const int32_t iWidth, const int32_t iHeight,
+	const int32_t iDepth, const uint64_t uStep, const float fDeltaTime,
+	const std::vector<float> (&fields)[NUM_CHECKPOINT_FIELDS])
+{
+	const auto uGridX = static_cast<uint32_t>((iWidth + BRICK_SIZE - 1) / BRICK_SIZE);
+	const auto uGridY = static_cast<uint32_t>((iHeight + BRICK_SIZE - 1) / BRICK_SIZE);
+	const auto uGridZ = static_cast<uint32_t>((iDepth + BRICK_SIZE - 1) / BRICK_SIZE);
+	const auto uNumBricks = uGridX * uGridY * uGridZ;
+
+	// Keep the bricks holding anything
+	std::vector<uint32_t> indices, bricks;
+	for (auto i = 0u; i < uNumBricks; ++i)
+	{
+		auto bKeep = false;
+		for (auto j = 0u; j < NUM_CHECKPOINT_FIELDS && !bKeep; ++j)
+		{
+			const auto uBrickSize = BRICK_CELLS * CheckpointComponents(j);
+			const auto pBrick = &fields[j][static_cast<size_t>(i) * uBrickSize];
+			for (auto k = 0u; k < uBrickSize && !bKeep; ++k) bKeep = pBrick[k] != 0.0f;
+		}
+		if (!bKeep) continue;
+
+		indices.push_back(i);
+		bricks.push_back(BrickMap::Pack(i % uGridX, (i / uGridX) % uGridY, i / (uGridX * uGridY)));
+	}
+
+	const auto align = [](const uint64_t uOffset)
+	{
+		return (uOffset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+	};
+
+	auto header = CheckpointHeader();
+	memcpy(header.szMagic, CHECKPOINT_MAGIC, sizeof(header.szMagic));
+	header.uVersion = CHECKPOINT_VERSION;
+	header.uHeaderSize = sizeof(CheckpointHeader);
+	header.iWidth = iWidth;
+	header.iHeight = iHeight;
+	header.iDepth = iDepth;
+	header.uPrecision = 32;
+	header.uStep = uStep;
+	header.fDeltaTime = fDeltaTime;
+	header.uBrickSize = BRICK_SIZE;
+	header.uNumBricks = static_cast<uint32_t>(bricks.size());
+	header.uBrickOffset = sizeof(CheckpointHeader);
+
+	auto uOffset = header.uBrickOffset + sizeof(uint32_t) * bricks.size();
+	for (auto i = 0u; i < NUM_CHECKPOINT_FIELDS; ++i)
+	{
+		header.uFieldOffsets[i] = align(uOffset);
+		uOffset = header.uFieldOffsets[i] + sizeof(float) * BRICK_CELLS * CheckpointComponents(i) * bricks.size();
+	}
+
+	std::ofstream file(szFileName, std::ios::binary);
+	if (!file) return false;
+
+	// Hash the bytes on their way out, and patch the hash into the header at the end
+	auto uHash = CheckpointHash(&header, sizeof(CheckpointHeader));
+	const auto write = [&](const void *pData, const uint64_t uSize)
+	{
+		uHash = CheckpointHash(pData, uSize, uHash);
+		file.write(static_cast<const char*>(pData), uSize);
+	};
+
+	const std::vector<char> padding(CHECKPOINT_ALIGNMENT, 0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(CheckpointHeader));
+	write(bricks.data(), sizeof(uint32_t) * bricks.size());
+	uOffset = header.uBrickOffset + sizeof(uint32_t) * bricks.size();
+	for (auto i = 0u; i < NUM_CHECKPOINT_FIELDS; ++i)
+	{
+		write(padding.data(), header.uFieldOffsets[i] - uOffset);
+
+		const auto uBrickSize = BRICK_CELLS * CheckpointComponents(i);
+		for (const auto &j : indices)
+			write(&fields[i][static_cast<size_t>(j) * uBrickSize], sizeof(float) * uBrickSize);
+		uOffset = header.uFieldOffsets[i] + sizeof(float) * uBrickSize * bricks.size();
+	}
+
+	header.uChecksum = uHash;
+	file.seekp(offsetof(CheckpointHeader, uChecksum));
+	file.write(reinterpret_cast<const char*>(&header.uChecksum), sizeof(header.uChecksum));
+	file.close();
+
+	return !file.fail();
+}
+
+class CheckpointReader
+{
+public:
+	CheckpointReader() : m_pHeader(nullptr) {}
+
+	// Maps the file and checks that it is a checkpoint this build can read
+	bool Open(const char *szFileName)
+	{
+		m_pHeader = nullptr;
+		if (!m_file.Open(szFileName)) return false;
+
+		const auto uSize = m_file.GetSize();
+		const auto pHeader = reinterpret_cast<const CheckpointHeader*>(m_file.GetData());
+		if (uSize < sizeof(CheckpointHeader) || memcmp(pHeader->szMagic, CHECKPOINT_MAGIC, sizeof(pHeader->szMagic)) ||
+			pHeader->uVersion != CHECKPOINT_VERSION || pHeader->uHeaderSize != sizeof(CheckpointHeader) ||
+			pHeader->uPrecision != 32 || pHeader->uBrickSize != BRICK_SIZE ||
+			pHeader->iWidth <= 0 || pHeader->iHeight <= 0 || pHeader->iDepth <= 0)
+			return false;
+
+		// Everything the header points at has to be inside the file
+		const auto uNumBricks = static_cast<uint64_t>(pHeader->uNumBricks);
+		if (pHeader->uBrickOffset % sizeof(uint32_t) || pHeader->uBrickOffset > uSize ||
+			uNumBricks > (uSize - pHeader->uBrickOffset) / sizeof(uint32_t))
+			return false;
+		for (auto i = 0u; i < NUM_CHECKPOINT_FIELDS; ++i)
+		{
+			const auto uFieldSize = sizeof(float) * BRICK_CELLS * CheckpointComponents(i) * uNumBricks;
+			if (pHeader->uFieldOffsets[i] % sizeof(float) || pHeader->uFieldOffsets[i] > uSize ||
+				uFieldSize > uSize - pHeader->uFieldOffsets[i])
+				return false;
+		}
+
+		// And every brick inside the grid
+		const auto uGridX = static_cast<uint32_t>((pHeader->iWidth + BRICK_SIZE - 1) / BRICK_SIZE);
+		const auto uGridY = static_cast<uint32_t>((pHeader->iHeight + BRICK_SIZE - 1) / BRICK_SIZE);
+		const auto uGridZ = static_cast<uint32_t>((pHeader->iDepth + BRICK_SIZE - 1) / BRICK_SIZE);
+		const auto pBricks = reinterpret_cast<const uint32_t*>(m_file.GetData() + pHeader->uBrickOffset);
+		for (auto i = 0u; i < uNumBricks; ++i)
+		{
+			const auto uBrick = pBricks[i];
+			if ((uBrick & BRICK_MASK) >= uGridX || ((uBrick >> BRICK_BITS) & BRICK_MASK) >= uGridY ||
+				(uBrick >> 2 * BRICK_BITS) >= uGridZ)
+				return false;
+		}
+
+		// And the content as it was written
+		auto header = *pHeader;
+		header.uChecksum = 0;
+		const auto uHash = CheckpointHash(&header, sizeof(CheckpointHeader));
+		if (CheckpointHash(m_file.GetData() + sizeof(CheckpointHeader), uSize - sizeof(CheckpointHeader), uHash) !=
+			pHeader->uChecksum)
+			return false;
+
+		m_pHeader = pHeader;
+
+		return true;
+	}
+
+	const CheckpointHeader &GetHeader() const { return *m_pHeader; }
+	const uint32_t *GetBricks() const
+	{
+		return reinterpret_cast<const uint32_t*>(m_file.GetData() + m_pHeader->uBrickOffset);
+	}
+	const float *GetField(const uint32_t uField) const
+	{
+		return reinterpret_cast<const float*>(m_file.GetData() + m_pHeader->uFieldOffsets[uField]);
+	}
+
+protected:
+	MappedFile					m_file;
+	const CheckpointHeader		*m_pHeader;
+};
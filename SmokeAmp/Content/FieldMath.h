@@ -77,3 +77,43 @@ static inline float Divergence3D(const AmpTexture3DView<float4> &tvSource, const
 	// Take central differences of neighboring values
 	return 0.5f * (fxR - fxL + fyD - fyU + fzB - fzF);
 }
+
+static inline float Minimum(cfloat fA, cfloat fB) restrict(amp) { return concurrency::fast_math::fmin(fA, fB); }
+static inline float Maximum(cfloat fA, cfloat fB) restrict(amp) { return concurrency::fast_math::fmax(fA, fB); }
+
+static inline float4 Minimum(cfloat4 &vA, cfloat4 &vB) restrict(amp)
+{
+	return float4(Minimum(vA.x, vB.x), Minimum(vA.y, vB.y), Minimum(vA.z, vB.z), Minimum(vA.w, vB.w));
+}
+
+static inline float4 Maximum(cfloat4 &vA, cfloat4 &vB) restrict(amp)
+{
+	return float4(Maximum(vA.x, vB.x), Maximum(vA.y, vB.y), Maximum(vA.z, vB.z), Maximum(vA.w, vB.w));
+}
+
+// Limit a higher-order advection result to the extrema of the 8 texels that
+// sample() interpolates at vTex, so that the correction cannot create new extrema
+template<typename T>
+static inline T ClampToStencil3D(const AmpTexture3DView<T> &tvSource, cfloat3 &vTex, const T &value) restrict(amp)
+{
+	const auto vSize = float3((float)tvSource.extent[2], (float)tvSource.extent[1], (float)tvSource.extent[0]);
+	const auto vBase = floor(vTex * vSize - 0.5f);
+	const auto iX = (int)vBase.x, iY = (int)vBase.y, iZ = (int)vBase.z;
+	const auto x0 = concurrency::direct3d::clamp(iX, 0, tvSource.extent[2] - 1);
+	const auto x1 = concurrency::direct3d::clamp(iX + 1, 0, tvSource.extent[2] - 1);
+	const auto y0 = concurrency::direct3d::clamp(iY, 0, tvSource.extent[1] - 1);
+	const auto y1 = concurrency::direct3d::clamp(iY + 1, 0, tvSource.extent[1] - 1);
+	const auto z0 = concurrency::direct3d::clamp(iZ, 0, tvSource.extent[0] - 1);
+	const auto z1 = concurrency::direct3d::clamp(iZ + 1, 0, tvSource.extent[0] - 1);
+
+	auto vMin = tvSource(z0, y0, x0);
+	T vMax = vMin;
+	for (auto i = 1; i < 8; ++i)
+	{
+		const auto vTexel = tvSource(i & 4 ? z1 : z0, i & 2 ? y1 : y0, i & 1 ? x1 : x0);
+		vMin = Minimum(vMin, vTexel);
+		vMax = Maximum(vMax, vTexel);
+	}
+
+	return Minimum(Maximum(value, vMin), vMax);
+}
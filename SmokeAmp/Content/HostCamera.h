@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HostFluid3D.h"
+
+//--------------------------------------------------------------------------------------
+// The default view of SmokeAmp.exe for the windowless tools: the volume scaled by
+// WORLD_SCALE, seen from 30 degrees up and 45 degrees around at a distance of 32.
+// fOrbit turns the eye further around the vertical axis, in radians.
+//--------------------------------------------------------------------------------------
+
+#define WORLD_SCALE	6.4f
+
+static inline HostFluid3D::CBPerObject DefaultCamera(const int32_t iWidth, const int32_t iHeight,
+	cfloat fOrbit = 0.0f)
+{
+	const auto fPi = 3.14159265f;
+	const auto fAngV = fPi / 6.0f, fAngH = fPi / 4.0f + fOrbit, fDist = 32.0f;
+	const auto fNear = 1.0f, fFar = 1000.0f;
+	const auto fRadius = fDist * std::cos(fAngV);
+	const auto vEyePt = float3(fRadius * std::cos(fAngH), fDist * std::sin(fAngV), -fRadius * std::sin(fAngH));
+	const auto vLightPt = float3(10.0f, 45.0f, -75.0f);
+
+	// Left-handed look-at the origin, in the column-vector convention of mul(float4x4, float4)
+	const auto vAxisZ = normalize(-vEyePt);
+	const auto vAxisX = normalize(cross(float3(0.0f, 1.0f, 0.0f), vAxisZ));
+	const auto vAxisY = cross(vAxisZ, vAxisX);
+	float4x4 mView;
+	mView.r[0] = float4(vAxisX.x, vAxisX.y, vAxisX.z, -dot(vAxisX, vEyePt));
+	mView.r[1] = float4(vAxisY.x, vAxisY.y, vAxisY.z, -dot(vAxisY, vEyePt));
+	mView.r[2] = float4(vAxisZ.x, vAxisZ.y, vAxisZ.z, -dot(vAxisZ, vEyePt));
+	mView.r[3] = float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	const auto fScaleY = 1.0f / std::tan(fPi / 8.0f);
+	const auto fScaleX = fScaleY * iHeight / iWidth;
+	float4x4 mProj;
+	mProj.r[0] = float4(fScaleX, 0.0f, 0.0f, 0.0f);
+	mProj.r[1] = float4(0.0f, fScaleY, 0.0f, 0.0f);
+	mProj.r[2] = float4(0.0f, 0.0f, fFar / (fFar - fNear), -fNear * fFar / (fFar - fNear));
+	mProj.r[3] = float4(0.0f, 0.0f, 1.0f, 0.0f);
+
+	float4x4 mWorld;
+	mWorld.r[0] = float4(WORLD_SCALE, 0.0f, 0.0f, 0.0f);
+	mWorld.r[1] = float4(0.0f, WORLD_SCALE, 0.0f, 0.0f);
+	mWorld.r[2] = float4(0.0f, 0.0f, WORLD_SCALE, 0.0f);
+	mWorld.r[3] = float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	float4x4 mToScreen;
+	mToScreen.r[0] = float4(0.5f * iWidth, 0.0f, 0.0f, 0.5f * iWidth);
+	mToScreen.r[1] = float4(0.0f, -0.5f * iHeight, 0.0f, 0.5f * iHeight);
+	mToScreen.r[2] = float4(0.0f, 0.0f, 1.0f, 0.0f);
+	mToScreen.r[3] = float4(0.0f, 0.0f, 0.0f, 1.0f);
+
+	HostFluid3D::CBPerObject cbPerObj;
+	const auto vLocalSpaceLightPt = vLightPt / WORLD_SCALE;
+	const auto vLocalSpaceEyePt = vEyePt / WORLD_SCALE;
+	cbPerObj.m_vLocalSpaceLightPt = float4(vLocalSpaceLightPt.x, vLocalSpaceLightPt.y, vLocalSpaceLightPt.z, 1.0f);
+	cbPerObj.m_vLocalSpaceEyePt = float4(vLocalSpaceEyePt.x, vLocalSpaceEyePt.y, vLocalSpaceEyePt.z, 1.0f);
+	cbPerObj.m_mScreenToLocal = inverse(mul(mToScreen, mul(mProj, mul(mView, mWorld))));
+
+	return cbPerObj;
+}
@@ -0,0 +1,100 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HostTexture.h"
+
+static inline float Gaussian3D(cfloat3 &vDisp, cfloat fRad)
+{
+	const auto fRadSq = fRad * fRad;
+
+	return std::exp(-4.0f * dot(vDisp, vDisp) / fRadSq);
+}
+
+// The emitter: force and density of a Gaussian of radius fRad around vImLoc, added to the cell
+// vLoc, which lies at vTex in the grid
+static inline void Impulse3D(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txDensity,
+	cfloat3 &vTex, cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc, cfloat fRad,
+	HostTexture3D<float4> &txVelocityDst, HostTexture3D<float> &txDensityDst, cint3 &vLoc)
+{
+	const auto fBasis = Gaussian3D(vTex - vImLoc, fRad);
+
+	const auto fDens = length(vForceDens.xyz()) * vForceDens.w;
+	const auto vForce = vForceDens.xyz() * fBasis;
+	const auto vVelocity = txVelocity(vLoc).xyz() + vForce * fDeltaTime;
+
+	txVelocityDst(vLoc) = float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f);
+	txDensityDst(vLoc) = txDensity(vLoc) + fDens * fBasis;
+}
+
+static inline float3 Gradient3D(const HostTexture3D<float> &txSource, cint3 &vLoc)
+{
+	// Get values from neighboring cells
+	const auto fxL = txSource.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+	const auto fxR = txSource.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+	const auto fyU = txSource.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+	const auto fyD = txSource.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+	const auto fzF = txSource.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+	const auto fzB = txSource.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+	// Compute the velocity's divergence using central differences
+	return 0.5f * float3(fxR - fxL, fyD - fyU, fzB - fzF);
+}
+
+static inline float Divergence3D(const HostTexture3D<float4> &txSource, cint3 &vLoc)
+{
+	// Get values from neighboring cells
+	const auto fxL = txSource.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z)).x;
+	const auto fxR = txSource.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z)).x;
+	const auto fyU = txSource.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z)).y;
+	const auto fyD = txSource.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z)).y;
+	const auto fzF = txSource.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1)).z;
+	const auto fzB = txSource.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1)).z;
+
+	// Take central differences of neighboring values
+	return 0.5f * (fxR - fxL + fyD - fyU + fzB - fzF);
+}
+
+static inline float Minimum(cfloat fA, cfloat fB) { return std::min(fA, fB); }
+static inline float Maximum(cfloat fA, cfloat fB) { return std::max(fA, fB); }
+
+static inline float4 Minimum(cfloat4 &vA, cfloat4 &vB)
+{
+	return float4(std::min(vA.x, vB.x), std::min(vA.y, vB.y), std::min(vA.z, vB.z), std::min(vA.w, vB.w));
+}
+
+static inline float4 Maximum(cfloat4 &vA, cfloat4 &vB)
+{
+	return float4(std::max(vA.x, vB.x), std::max(vA.y, vB.y), std::max(vA.z, vB.z), std::max(vA.w, vB.w));
+}
+
+// Limit a higher-order advection result to the extrema of the 8 texels that
+// Sample() interpolates at vTex, so that the correction cannot create new extrema
+template<typename T>
+static inline T ClampToStencil3D(const HostTexture3D<T> &txSource, cfloat3 &vTex, const T &value)
+{
+	const auto &vExtent = txSource.GetExtent();
+	const auto vBase = floor(vTex * float3(float(vExtent.x), float(vExtent.y), float(vExtent.z)) - 0.5f);
+	const auto clampLoc = [&vExtent](cint3 &vLoc)
+	{
+		return int3(std::min(std::max(vLoc.x, 0), vExtent.x - 1),
+			std::min(std::max(vLoc.y, 0), vExtent.y - 1),
+			std::min(std::max(vLoc.z, 0), vExtent.z - 1));
+	};
+	const auto vLoc0 = clampLoc(int3(int32_t(vBase.x), int32_t(vBase.y), int32_t(vBase.z)));
+	const auto vLoc1 = clampLoc(int3(int32_t(vBase.x) + 1, int32_t(vBase.y) + 1, int32_t(vBase.z) + 1));
+
+	auto vMin = txSource(vLoc0);
+	auto vMax = vMin;
+	for (auto i = 1; i < 8; ++i)
+	{
+		const auto &vTexel = txSource(int3(i & 1 ? vLoc1.x : vLoc0.x,
+			i & 2 ? vLoc1.y : vLoc0.y, i & 4 ? vLoc1.z : vLoc0.z));
+		vMin = Minimum(vMin, vTexel);
+		vMax = Maximum(vMax, vTexel);
+	}
+
+	return Minimum(Maximum(value, vMin), vMax);
+}
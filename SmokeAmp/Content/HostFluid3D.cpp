@@ -0,0 +1,1277 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include <cfloat>
+#include "HostFluid3D.h"
+
+#define MAX_SAMPLES			512
+#define SAMPLE_RATE			1.0f	// View samples per texel
+#define NUM_LIGHT_SAMPLES	32
+#define ABSORPTION			1.0f
+#define ZERO_THRESHOLD		0.01f
+#define IMPULSE_RADIUS		0.032f
+#define TEMPORAL_SAMPLE_RATE	0.25f	// Fraction of the view samples marched per frame in the temporal mode
+#define TEMPORAL_BLEND		0.1f	// Weight of the current frame against the history
+#define TEMPORAL_GAMMA		1.0f	// Width of the history clamp in standard deviations
+#define UPSAMPLE_EPSILON	0.05f	// Ray-bound difference (local units) at which an upsampling tap halves its weight
+
+#define LIGHT_VOLUME_SCALE	2		// Density texels per transmittance texel along each axis
+
+using namespace std;
+
+// Screen space to loacal space
+static inline float3 ScreenToLocal(cfloat3 &vLoc, cfloat4x4 &mScreenToLocal)
+{
+	const auto vPos = mul(mScreenToLocal, float4(vLoc.x, vLoc.y, vLoc.z, 1.0f));
+
+	return vPos.xyz() / vPos.w;
+}
+
+// Compute entry and exit distances of the ray on the volume slab
+static inline bool ComputeRayBounds(cfloat3 &vPos, cfloat3 &vRayDir, float &fNear, float &fFar)
+{
+	cfloat aPos[3] = { vPos.x, vPos.y, vPos.z };
+	cfloat aRayDir[3] = { vRayDir.x, vRayDir.y, vRayDir.z };
+
+	// The ray starts on the near plane, so nothing behind it counts
+	fNear = 0.0f;
+	fFar = FLT_MAX;
+
+	for (uint i = 0; i < 3; ++i)
+	{
+		if (aRayDir[i] == 0.0f)
+		{
+			if (fabs(aPos[i]) > 1.0f) return false;
+			continue;
+		}
+
+		const auto u0 = (-1.0f - aPos[i]) / aRayDir[i];
+		const auto u1 = (1.0f - aPos[i]) / aRayDir[i];
+		fNear = max(fNear, min(u0, u1));
+		fFar = min(fFar, max(u0, u1));
+	}
+
+	return fNear < fFar;
+}
+
+// Transmittance along the light ray from vPos
+static inline float LightTransmittance(const HostTexture3D<float> &txDensity, cfloat3 &vPos, cfloat3 &vLRStep,
+	cfloat fLStepScale)
+{
+	auto fLRTrans = 1.0f;
+	auto vLRPos = vPos + vLRStep;
+
+	for (uint j = 0; j < NUM_LIGHT_SAMPLES; ++j)
+	{
+		if (fabs(vLRPos.x) > 1.0f || fabs(vLRPos.y) > 1.0f || fabs(vLRPos.z) > 1.0f) break;
+		const auto vTex = float3(0.5f, -0.5f, 0.5f) * vLRPos + 0.5f;
+
+		// Get a sample along light ray
+		const auto fLRDens = fmin(txDensity.Sample(vTex), 16.0f);
+
+		// Attenuate ray-throughput along light direction
+		fLRTrans *= saturate(1.0f - ABSORPTION * fLStepScale * fLRDens);
+		if (fLRTrans < ZERO_THRESHOLD) break;
+
+		// Update position along light ray
+		vLRPos += vLRStep;
+	}
+
+	return fLRTrans;
+}
+
+// Copies every brick of the field into the checkpoint layout, cells x-fastest
+template<typename T>
+static void GatherBricks(HostThreadPool &threadPool, const HostTexture3D<T> &txField, vector<float> &bricked)
+{
+	const auto uComponents = static_cast<uint32_t>(sizeof(T) / sizeof(float));
+	const auto &vExtent = txField.GetExtent();
+	const auto iGridX = (vExtent.x + BRICK_SIZE - 1) / BRICK_SIZE;
+	const auto iGridY = (vExtent.y + BRICK_SIZE - 1) / BRICK_SIZE;
+	const auto iGridZ = (vExtent.z + BRICK_SIZE - 1) / BRICK_SIZE;
+	bricked.assign(static_cast<size_t>(iGridX) * iGridY * iGridZ * BRICK_CELLS * uComponents, 0.0f);
+
+	threadPool.ParallelFor(0, iGridX * iGridY * iGridZ, [&](const int32_t i)
+	{
+		const auto vOrigin = int3(i % iGridX * BRICK_SIZE, (i / iGridX) % iGridY * BRICK_SIZE,
+			i / (iGridX * iGridY) * BRICK_SIZE);
+		const auto pBrick = &bricked[static_cast<size_t>(i) * BRICK_CELLS * uComponents];
+		for (auto z = 0; z < BRICK_SIZE && vOrigin.z + z < vExtent.z; ++z)
+			for (auto y = 0; y < BRICK_SIZE && vOrigin.y + y < vExtent.y; ++y)
+				for (auto x = 0; x < BRICK_SIZE && vOrigin.x + x < vExtent.x; ++x)
+					memcpy(&pBrick[((z * BRICK_SIZE + y) * BRICK_SIZE + x) * uComponents],
+						&txField(int3(vOrigin.x + x, vOrigin.y + y, vOrigin.z + z)), sizeof(T));
+	});
+}
+
+// Clears the field and copies the stored bricks of a mapped checkpoint into it
+template<typename T>
+static void ScatterBricks(HostThreadPool &threadPool, const CheckpointReader &reader, const uint32_t uField,
+	HostTexture3D<T> &txField)
+{
+	const auto uComponents = static_cast<uint32_t>(sizeof(T) / sizeof(float));
+	const auto &vExtent = txField.GetExtent();
+	const auto pBricks = reader.GetBricks();
+	const auto pData = reader.GetField(uField);
+	txField.Fill(T());
+
+	threadPool.ParallelFor(0, static_cast<int32_t>(reader.GetHeader().uNumBricks), [&](const int32_t i)
+	{
+		const auto vOrigin = BrickOrigin(pBricks[i]);
+		const auto pBrick = &pData[static_cast<size_t>(i) * BRICK_CELLS * uComponents];
+		for (auto z = 0; z < BRICK_SIZE && vOrigin.z + z < vExtent.z; ++z)
+			for (auto y = 0; y < BRICK_SIZE && vOrigin.y + y < vExtent.y; ++y)
+				for (auto x = 0; x < BRICK_SIZE && vOrigin.x + x < vExtent.x; ++x)
+					memcpy(static_cast<void*>(&txField(int3(vOrigin.x + x, vOrigin.y + y, vOrigin.z + z))),
+						&pBrick[((z * BRICK_SIZE + y) * BRICK_SIZE + x) * uComponents], sizeof(T));
+	});
+}
+
+// Visit every cell, or only the cells of the live bricks in sparse mode
+template<typename F>
+void HostFluid3D::forEachCell(cint3 &vExtent, const F &func)
+{
+	if (m_bSparse) ParallelForEachBrick(m_threadPool, vExtent, m_bricks.GetActive(), func);
+	else ParallelForEach(m_threadPool, vExtent, func);
+}
+
+// The same over rows along x for the row kernels, func(vLoc, iWidth): whole rows, or the
+// rows of the live bricks
+template<typename F>
+void HostFluid3D::forEachRow(cint3 &vExtent, const F &func)
+{
+	if (m_bSparse) ParallelForEachBrickRow(m_threadPool, vExtent, m_bricks.GetRuns(), func);
+	else ParallelForEachRow(m_threadPool, vExtent, func);
+}
+
+HostFluid3D::HostFluid3D(HostThreadPool &threadPool) :
+	m_fPressTolerance(0.0f),
+	m_uPressMaxIteration(PRESS_ITERATION),
+	m_uPressCheckInterval(4),
+	m_pressureStats(),
+	m_bFusedStep(false),
+	m_advection(ADVECT_SEMI_LAGRANGIAN),
+	m_bSparse(false),
+	m_bLightVolume(false),
+	m_bLightDirty(true),
+	m_uRenderScale(1),
+	m_bExactExtinction(false),
+	m_bTemporal(false),
+	m_bHistoryValid(false),
+	m_uFrame(0),
+	m_threadPool(threadPool)
+{
+}
+
+void HostFluid3D::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+{
+	const auto fWidth = static_cast<float>(iWidth);
+	const auto fHeight = static_cast<float>(iHeight);
+	const auto fDepth = static_cast<float>(iDepth);
+	m_vSimSize = float3(fWidth, fHeight, fDepth);
+
+	// Create 3D textures
+	m_pSrcDensity = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pDstDensity = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pTmpDensity = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+
+	m_diffuse.Init(iWidth, iHeight, iDepth, m_threadPool);
+	m_pressure.Init(iWidth, iHeight, iDepth, m_threadPool);
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+
+	m_bricks.Init(iWidth, iHeight, iDepth);
+
+	m_occupancyPyramid = MakeOccupancyPyramid(iWidth, iHeight, iDepth);
+	m_occupancy.assign(m_occupancyPyramid.iNumCells, 0.0f);
+
+	m_pTransmittance = make_shared<HostTexture3D<float>>((iDepth + LIGHT_VOLUME_SCALE - 1) / LIGHT_VOLUME_SCALE,
+		(iHeight + LIGHT_VOLUME_SCALE - 1) / LIGHT_VOLUME_SCALE, (iWidth + LIGHT_VOLUME_SCALE - 1) / LIGHT_VOLUME_SCALE);
+	m_bLightDirty = true;
+}
+
+void HostFluid3D::Simulate(cfloat fDeltaTime, cfloat4 vForceDens, cfloat3 vImLoc, const uint8_t uItVisc)
+{
+	TRACE_SCOPE("HostFluid3D::Simulate");
+
+	if (m_bSparse) updateBricks(fDeltaTime, vForceDens, vImLoc);
+
+	// Viscosity has to run between advection and impulse, and the corrected schemes and the
+	// brick walk need whole-field passes, so they take the separate passes
+	if (m_bFusedStep && uItVisc == 0 && m_advection == ADVECT_SEMI_LAGRANGIAN && !m_bSparse)
+	{
+		advectFused(fDeltaTime, vForceDens, vImLoc);
+		project(fDeltaTime, false);
+	}
+	else
+	{
+		advect(fDeltaTime);
+		diffuse(uItVisc);
+		impulse(fDeltaTime, vForceDens, vImLoc);
+		project(fDeltaTime);
+	}
+
+	buildOccupancy();
+	m_bLightDirty = true;
+}
+
+void HostFluid3D::SetPressureTolerance(cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval)
+{
+	// A non-positive tolerance restores the fixed iteration count
+	m_fPressTolerance = fTolerance;
+	m_uPressMaxIteration = uMaxIteration;
+	m_uPressCheckInterval = uCheckInterval;
+}
+
+void HostFluid3D::SetFusedStep(const bool bFused)
+{
+	m_bFusedStep = bFused;
+}
+
+void HostFluid3D::SetAdvection(const AdvectionScheme advection)
+{
+	m_advection = advection;
+}
+
+void HostFluid3D::SetLightVolume(const bool bLightVolume)
+{
+	m_bLightVolume = bLightVolume;
+	m_bLightDirty = true;
+}
+
+void HostFluid3D::SetSparse(const bool bSparse)
+{
+	// Restart from a fully live map; the next step frees and clears the empty bricks
+	if (bSparse && !m_bSparse && m_pSrcDensity)
+	{
+		const auto &vExtent = m_pSrcDensity->GetExtent();
+		m_bricks.Init(vExtent.x, vExtent.y, vExtent.z);
+	}
+	m_bSparse = bSparse;
+
+	// The divergence and the pressure solve follow the same bricks
+	m_pressure.SetBricks(bSparse ? &m_bricks : nullptr);
+}
+
+void HostFluid3D::updateBricks(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
+{
+	TRACE_SCOPE("HostFluid3D::updateBricks");
+
+	const auto &txVelocity = *m_pSrcVelocity;
+	const auto &txDensity = *m_pSrcDensity;
+	const auto &vExtent = txDensity.GetExtent();
+	const auto uGridX = m_bricks.GetGridX(), uGridY = m_bricks.GetGridY();
+	const auto fMaxSize = max(m_vSimSize.x, max(m_vSimSize.y, m_vSimSize.z));
+
+	// Per-brick maxima of the density and the distance travelled in cells
+	m_brickOccupancy.resize(m_bricks.GetNumBricks());
+	m_brickReach.resize(m_bricks.GetNumBricks());
+	m_threadPool.ParallelFor(0, static_cast<int32_t>(m_bricks.GetNumBricks()), [&](const int32_t i)
+	{
+		const auto vOrigin = BrickOrigin(BrickMap::Pack(i % uGridX, (i / uGridX) % uGridY, i / (uGridX * uGridY)));
+		const auto vEnd = int3(min(vOrigin.x + BRICK_SIZE, vExtent.x), min(vOrigin.y + BRICK_SIZE, vExtent.y),
+			min(vOrigin.z + BRICK_SIZE, vExtent.z));
+
+		auto fMaxDens = 0.0f, fMaxSpeed = 0.0f;
+		for (auto z = vOrigin.z; z < vEnd.z; ++z)
+			for (auto y = vOrigin.y; y < vEnd.y; ++y)
+				for (auto x = vOrigin.x; x < vEnd.x; ++x)
+				{
+					const auto vLoc = int3(x, y, z);
+					fMaxDens = max(fMaxDens, fabs(txDensity(vLoc)));
+					fMaxSpeed = max(fMaxSpeed, length(txVelocity(vLoc).xyz()));
+				}
+
+		// Smoke keeps a brick live; the speed sets how far it may spread in this step
+		m_brickOccupancy[i] = fMaxDens;
+		m_brickReach[i] = fMaxSpeed * fDeltaTime * fMaxSize;
+	});
+	m_bricks.Mark(m_brickOccupancy, m_brickReach);
+
+	// Bricks about to receive the impulse, cut where its basis drops below the threshold
+	if (vForceDens.x != 0.0f || vForceDens.y != 0.0f || vForceDens.z != 0.0f)
+	{
+		const auto fRadius = 0.5f * IMPULSE_RADIUS * sqrt(-log(BRICK_THRESHOLD));
+		const auto vMin = floor((vImLoc - fRadius) * m_vSimSize);
+		const auto vMax = floor((vImLoc + fRadius) * m_vSimSize);
+		const int32_t iMin[] = { int32_t(vMin.x), int32_t(vMin.y), int32_t(vMin.z) };
+		const int32_t iMax[] = { int32_t(vMax.x), int32_t(vMax.y), int32_t(vMax.z) };
+		m_bricks.MarkCells(iMin, iMax);
+	}
+
+	m_bricks.Commit();
+
+	// Clear the freed bricks in every buffer the kernels rotate through
+	ParallelForEachBrick(m_threadPool, vExtent, m_bricks.GetFreed(), [&](cint3 &vLoc)
+	{
+		(*m_diffuse.GetSrc())(vLoc) = (*m_diffuse.GetDst())(vLoc) =
+			(*m_diffuse.GetTmp())(vLoc) = float4(0.0f, 0.0f, 0.0f, 0.0f);
+		(*m_pSrcDensity)(vLoc) = (*m_pDstDensity)(vLoc) = (*m_pTmpDensity)(vLoc) = 0.0f;
+	});
+	m_pressure.UpdateBricks();
+}
+
+void HostFluid3D::Render(upHostTexture2D<unorm4> &pDst, const HostTexture2D<float> &txDepth,
+	const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE("HostFluid3D::Render");
+
+	// Light transmittance volume, refreshed when the density or the light has changed
+	if (m_bLightVolume) updateTransmittance(cbPerObj.m_vLocalSpaceLightPt.xyz(), 2.0f * sqrt(3.0f) / NUM_LIGHT_SAMPLES);
+
+	auto &txDst = *pDst;
+	const auto &vExtent = txDst.GetExtent();
+
+	// Constant buffer immutable
+	const auto vLightRad = cbImmutable.m_vDirectional.xyz() * cbImmutable.m_vDirectional.w;
+	const auto vAmbientRad = cbImmutable.m_vAmbient.xyz() * cbImmutable.m_vAmbient.w;
+
+	// Constant buffer per object
+	const auto vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz();
+	const auto vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz();
+	const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto vLoc = float3(float(x), float(y), 0.0f);
+
+			const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+			const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+			auto fNear = 0.0f, fFar = 0.0f;
+			const auto bHit = ComputeRayBounds(vPos, vRayDir, fNear, fFar);
+
+			// Stop at the opaque scene; pixels whose geometry is in front of the volume stay clear
+			const auto vScenePt = ScreenToLocal(float3(vLoc.x, vLoc.y, txDepth(int2(x, y))), mScreenToLocal);
+			fFar = min(fFar, dot(vScenePt - vPos, vRayDir));
+			if (!bHit || fFar <= fNear)
+			{
+				txDst(int2(x, y)) = unorm4(0.0f, 0.0f, 0.0f, 0.0f);
+				continue;
+			}
+
+			const auto vMarch = marchRay(vPos, vRayDir, fNear, fFar, vLocalSpaceLightPt, SAMPLE_RATE, 0.5f);
+
+			// Linear premultiplied color with the opacity in alpha, for Composite
+			const auto fOpacity = 1.0f - vMarch.y;
+			const auto vResult = (vMarch.x * vLightRad + vAmbientRad) * fOpacity;
+
+			txDst(int2(x, y)) = unorm4(vResult.x, vResult.y, vResult.z, fOpacity);
+		}
+	});
+}
+
+void HostFluid3D::Composite(upHostTexture2D<unorm4> &pDst, const HostTexture2D<unorm4> &txScene,
+	const HostTexture2D<unorm4> &txLayer)
+{
+	TRACE_SCOPE("HostFluid3D::Composite");
+
+	auto &txDst = *pDst;
+	const auto &vExtent = txDst.GetExtent();
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto &vLayer = txLayer(int2(x, y));
+			const auto &vScene = txScene(int2(x, y));
+
+			// Blend over the scene in linear space, then encode as the plain overload does
+			const auto vSceneColor = float3(vScene.x, vScene.y, vScene.z);
+			const auto vResult = float3(vLayer.x, vLayer.y, vLayer.z) + vSceneColor * vSceneColor * (1.0f - vLayer.w);
+
+			txDst(int2(x, y)) = unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f);
+		}
+	});
+}
+
+void HostFluid3D::Render(upHostTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE("HostFluid3D::Render");
+
+	// Light transmittance volume, refreshed when the density or the light has changed
+	if (m_bLightVolume) updateTransmittance(cbPerObj.m_vLocalSpaceLightPt.xyz(), 2.0f * sqrt(3.0f) / NUM_LIGHT_SAMPLES);
+
+	// Temporal mode: a jittered fraction of the samples, accumulated over the frames
+	if (m_bTemporal)
+	{
+		marchTemporal(pDst->GetExtent(), cbImmutable, cbPerObj);
+		resolveTemporal(pDst, cbPerObj);
+
+		return;
+	}
+
+	// Reduced resolution: march into the intermediate target, then upsample
+	if (m_uRenderScale > 1)
+	{
+		marchLowRes(pDst->GetExtent(), cbPerObj);
+		upsample(pDst, cbImmutable, cbPerObj);
+
+		return;
+	}
+
+	auto &txDst = *pDst;
+	const auto &vExtent = txDst.GetExtent();
+
+	const auto vCornflowerBlue = float3(0.392156899f, 0.584313750f, 0.929411829f);
+	const auto vClear = vCornflowerBlue * vCornflowerBlue;
+
+	// Constant buffer immutable
+	const auto vLightRad = cbImmutable.m_vDirectional.xyz() * cbImmutable.m_vDirectional.w;
+	const auto vAmbientRad = cbImmutable.m_vAmbient.xyz() * cbImmutable.m_vAmbient.w;
+
+	// Constant buffer per object
+	const auto vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz();
+	const auto vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz();
+	const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto vLoc = float3(float(x), float(y), 0.0f);
+
+			const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+			const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+			auto fNear = 0.0f, fFar = 0.0f;
+			if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar)) continue;
+
+			const auto vMarch = marchRay(vPos, vRayDir, fNear, fFar, vLocalSpaceLightPt, SAMPLE_RATE, 0.5f);
+
+			auto vResult = vMarch.x * vLightRad + vAmbientRad;
+			vResult = lerp(vResult, vClear, vMarch.y);
+
+			txDst(int2(x, y)) = unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f);
+		}
+	});
+}
+
+void HostFluid3D::SetRenderScale(const uint8_t uScale)
+{
+	m_uRenderScale = uScale > 1 ? uScale : 1;
+}
+
+void HostFluid3D::SetExactExtinction(const bool bExact)
+{
+	m_bExactExtinction = bExact;
+	m_bHistoryValid = false;
+}
+
+void HostFluid3D::SetTemporal(const bool bTemporal)
+{
+	m_bTemporal = bTemporal;
+	m_bHistoryValid = false;
+}
+
+bool HostFluid3D::SaveCheckpoint(const char *szFileName, const uint64_t uStep, cfloat fDeltaTime) const
+{
+	TRACE_SCOPE("HostFluid3D::SaveCheckpoint");
+
+	vector<float> fields[NUM_CHECKPOINT_FIELDS];
+	GatherBricks(m_threadPool, *m_pSrcVelocity, fields[CHECKPOINT_VELOCITY]);
+	GatherBricks(m_threadPool, *m_pSrcDensity, fields[CHECKPOINT_DENSITY]);
+	GatherBricks(m_threadPool, *m_pressure.GetSrc(), fields[CHECKPOINT_PRESSURE]);
+
+	const auto &vExtent = m_pSrcDensity->GetExtent();
+
+	return WriteCheckpoint(szFileName, vExtent.x, vExtent.y, vExtent.z, uStep, fDeltaTime, fields);
+}
+
+bool HostFluid3D::LoadCheckpoint(const char *szFileName, CheckpointHeader *pHeader)
+{
+	TRACE_SCOPE("HostFluid3D::LoadCheckpoint");
+
+	CheckpointReader reader;
+	if (!reader.Open(szFileName)) return false;
+
+	// Take the size of the checkpoint
+	const auto &header = reader.GetHeader();
+	const auto vExtent = m_pSrcDensity ? m_pSrcDensity->GetExtent() : int3(0, 0, 0);
+	if (vExtent.x != header.iWidth || vExtent.y != header.iHeight || vExtent.z != header.iDepth)
+		Init(header.iWidth, header.iHeight, header.iDepth);
+
+	ScatterBricks(m_threadPool, reader, CHECKPOINT_VELOCITY, *m_pSrcVelocity);
+	ScatterBricks(m_threadPool, reader, CHECKPOINT_DENSITY, *m_pSrcDensity);
+	ScatterBricks(m_threadPool, reader, CHECKPOINT_PRESSURE, *m_pressure.GetSrc());
+
+	// Every brick goes live again, so the next step frees and clears the empty ones in all buffers
+	m_bricks.Init(header.iWidth, header.iHeight, header.iDepth);
+	buildOccupancy();
+	m_bLightDirty = true;
+	m_bHistoryValid = false;
+
+	if (pHeader) *pHeader = header;
+
+	return true;
+}
+
+float3 HostFluid3D::marchRay(float3 vPos, cfloat3 &vRayDir, cfloat fNear, cfloat fFar, cfloat3 &vLocalSpaceLightPt,
+	cfloat fSampleRate, cfloat fJitter) const
+{
+	const auto &txDensity = *m_pSrcDensity;
+	const auto &txTransmit = *m_pTransmittance;
+
+	const auto fMaxDist = 2.0f * sqrt(3.0f);
+	const auto fLStepScale = fMaxDist / NUM_LIGHT_SAMPLES;
+
+	// Step count from the chord length in texels, so that the samples track the voxels
+	const auto fChord = fFar - fNear;
+	const auto fSamples = ceil(fChord * length(vRayDir * m_vSimSize * 0.5f) * fSampleRate);
+	const auto uNumSamples = uint(min(max(fSamples, 1.0f), float(MAX_SAMPLES)));
+	const auto fStepScale = fChord / uNumSamples;
+
+	const auto vStep = vRayDir * fStepScale;
+	const auto vTexStep = float3(0.5f, -0.5f, 0.5f) * vStep;
+	vPos += vRayDir * (fNear + fJitter * fStepScale);		// fJitter places the samples within each step
+
+#ifndef _POINT_LIGHT_
+	const auto vLRStep = normalize(vLocalSpaceLightPt) * fLStepScale;
+#endif
+
+	// Transmittance
+	auto fTransmit = 1.0f;
+	// In-scattered radiance
+	auto fScatter = 0.0f;
+	// Opacity-weighted depth along the ray
+	auto fDepth = 0.0f;
+
+	for (uint i = 0; i < uNumSamples; ++i)
+	{
+		const auto vTex = float3(0.5f, -0.5f, 0.5f) * vPos + 0.5f;
+
+		// Leap over empty macro-cells in whole steps, so the samples keep their positions
+		const auto uSkip = min(emptySteps(vTex, vTexStep), uNumSamples - i);
+		if (uSkip > 0)
+		{
+			for (auto k = 0u; k < uSkip; ++k) vPos += vStep;
+			i += uSkip - 1;
+			continue;
+		}
+
+		// Get a sample
+		const auto fDens = fmin(txDensity.Sample(vTex), 16.0f);
+
+		// Skip empty space
+		if (fDens > ZERO_THRESHOLD)
+		{
+			// Attenuate ray-throughput
+			const auto fScaledDens = fDens * fStepScale;
+			const auto fAttenuation = m_bExactExtinction ? exp(-fScaledDens * ABSORPTION) :
+				saturate(1.0f - fScaledDens * ABSORPTION);
+			const auto fOpacity = fTransmit * (1.0f - fAttenuation);
+			fDepth += (fNear + (i + fJitter) * fStepScale) * fOpacity;
+			fTransmit *= fAttenuation;
+			if (fTransmit < ZERO_THRESHOLD) break;
+
+			// Point light direction in texture space
+#ifdef _POINT_LIGHT_
+			const auto vLRStep = normalize(vLocalSpaceLightPt - vPos) * fLStepScale;
+#endif
+
+			// Sample light
+			const auto fLRTrans = m_bLightVolume ? txTransmit.Sample(vTex) :	// Transmittance along light ray
+				LightTransmittance(txDensity, vPos, vLRStep, fLStepScale);
+
+			fScatter += m_bExactExtinction ? fLRTrans * fOpacity / ABSORPTION : fLRTrans * fTransmit * fScaledDens;
+		}
+
+		vPos += vStep;
+	}
+
+	// Rays that stay clear are placed at the middle of the volume
+	fDepth = fTransmit < 1.0f ? fDepth / (1.0f - fTransmit) : 0.5f * (fNear + fFar);
+
+	return float3(fScatter, fTransmit, fDepth);
+}
+
+void HostFluid3D::marchLowRes(cint2 &vDstExtent, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE("HostFluid3D::marchLowRes");
+
+	const auto iScale = int32_t(m_uRenderScale);
+	const auto vExtent = int2((vDstExtent.x + iScale - 1) / iScale, (vDstExtent.y + iScale - 1) / iScale);
+	if (!m_pLowRes || m_pLowRes->GetExtent().x != vExtent.x || m_pLowRes->GetExtent().y != vExtent.y)
+		m_pLowRes = make_unique<HostTexture2D<float4>>(vExtent.y, vExtent.x);
+	auto &txLowRes = *m_pLowRes;
+	const auto fScale = float(iScale);
+
+	// Constant buffer per object
+	const auto vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz();
+	const auto vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz();
+	const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			// Ray through the center of the covered back-buffer pixels
+			const auto vLoc = float3((x + 0.5f) * fScale - 0.5f, (y + 0.5f) * fScale - 0.5f, 0.0f);
+
+			const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+			const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+			auto fNear = 0.0f, fFar = 0.0f;
+			if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar))
+			{
+				txLowRes(int2(x, y)) = float4(0.0f, 1.0f, 0.0f, 0.0f);
+				continue;
+			}
+
+			const auto vMarch = marchRay(vPos, vRayDir, fNear, fFar, vLocalSpaceLightPt, SAMPLE_RATE, 0.5f);
+
+			// Opacity-premultiplied radiance and transmittance interpolate linearly; the ray
+			// bounds guide the upsampling
+			txLowRes(int2(x, y)) = float4(vMarch.x * (1.0f - vMarch.y), vMarch.y, fNear, fFar);
+		}
+	});
+}
+
+void HostFluid3D::upsample(upHostTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE("HostFluid3D::upsample");
+
+	auto &txDst = *pDst;
+	const auto &txLowRes = *m_pLowRes;
+	const auto &vExtent = txDst.GetExtent();
+	const auto &vLowResExtent = txLowRes.GetExtent();
+	const auto fScale = float(m_uRenderScale);
+
+	const auto vCornflowerBlue = float3(0.392156899f, 0.584313750f, 0.929411829f);
+	const auto vClear = vCornflowerBlue * vCornflowerBlue;
+
+	// Constant buffer immutable
+	const auto vLightRad = cbImmutable.m_vDirectional.xyz() * cbImmutable.m_vDirectional.w;
+	const auto vAmbientRad = cbImmutable.m_vAmbient.xyz() * cbImmutable.m_vAmbient.w;
+
+	// Constant buffer per object
+	const auto vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz();
+	const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto vLoc = float3(float(x), float(y), 0.0f);
+
+			// The pixel's own ray bounds are cheap and exact
+			const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+			const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+			auto fNear = 0.0f, fFar = 0.0f;
+			if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar)) continue;
+
+			// Bilinear footprint on the low-resolution target
+			const auto fX = min(max((vLoc.x + 0.5f) / fScale - 0.5f, 0.0f), float(vLowResExtent.x - 1));
+			const auto fY = min(max((vLoc.y + 0.5f) / fScale - 0.5f, 0.0f), float(vLowResExtent.y - 1));
+			const auto x0 = int32_t(fX), y0 = int32_t(fY);
+			const int32_t aX[] = { x0, min(x0 + 1, vLowResExtent.x - 1) };
+			const int32_t aY[] = { y0, min(y0 + 1, vLowResExtent.y - 1) };
+			const float aWX[] = { 1.0f - (fX - x0), fX - x0 };
+			const float aWY[] = { 1.0f - (fY - y0), fY - y0 };
+
+			// Taps whose rays cross the volume differently lie across an edge and fade out
+			auto fWeight = 0.0f, fLit = 0.0f, fTransmit = 0.0f;
+			for (auto j = 0; j < 2; ++j)
+			{
+				for (auto i = 0; i < 2; ++i)
+				{
+					const auto &vTap = txLowRes(int2(aX[i], aY[j]));
+					const auto fDiff = fabs(vTap.z - fNear) + fabs(vTap.w - fFar);
+					const auto fW = aWX[i] * aWY[j] * UPSAMPLE_EPSILON / (UPSAMPLE_EPSILON + fDiff);
+					fLit += fW * vTap.x;
+					fTransmit += fW * vTap.y;
+					fWeight += fW;
+				}
+			}
+			fLit /= fWeight;
+			fTransmit /= fWeight;
+
+			const auto vResult = fLit * vLightRad + (1.0f - fTransmit) * vAmbientRad + fTransmit * vClear;
+
+			txDst(int2(x, y)) = unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f);
+		}
+	});
+}
+
+void HostFluid3D::marchTemporal(cint2 &vExtent, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE("HostFluid3D::marchTemporal");
+
+	if (!m_pCurrent || m_pCurrent->GetExtent().x != vExtent.x || m_pCurrent->GetExtent().y != vExtent.y)
+	{
+		m_pCurrent = make_unique<HostTexture2D<float4>>(vExtent.y, vExtent.x);
+		m_pHistory = make_unique<HostTexture2D<float4>>(vExtent.y, vExtent.x);
+		m_pPrevHistory = make_unique<HostTexture2D<float4>>(vExtent.y, vExtent.x);
+		m_bHistoryValid = false;
+	}
+	auto &txCurrent = *m_pCurrent;
+
+	// Golden-ratio sequence over the frames, decorrelated across the pixels by
+	// interleaved gradient noise
+	const auto fFrameJitter = 0.5f + 0.618034f * float(m_uFrame % 1024);
+
+	const auto vCornflowerBlue = float3(0.392156899f, 0.584313750f, 0.929411829f);
+	const auto vClear = vCornflowerBlue * vCornflowerBlue;
+
+	// Constant buffer immutable
+	const auto vLightRad = cbImmutable.m_vDirectional.xyz() * cbImmutable.m_vDirectional.w;
+	const auto vAmbientRad = cbImmutable.m_vAmbient.xyz() * cbImmutable.m_vAmbient.w;
+
+	// Constant buffer per object
+	const auto vLocalSpaceLightPt = cbPerObj.m_vLocalSpaceLightPt.xyz();
+	const auto vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz();
+	const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto vLoc = float3(float(x), float(y), 0.0f);
+
+			const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+			const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+			auto fNear = 0.0f, fFar = 0.0f;
+			if (!ComputeRayBounds(vPos, vRayDir, fNear, fFar))
+			{
+				txCurrent(int2(x, y)) = float4(vClear.x, vClear.y, vClear.z, -1.0f);
+				continue;
+			}
+
+			const auto fNoise = 52.9829189f * fmod(0.06711056f * x + 0.00583715f * y, 1.0f);
+			const auto fJitter = fmod(fFrameJitter + fNoise, 1.0f);
+			const auto vMarch = marchRay(vPos, vRayDir, fNear, fFar, vLocalSpaceLightPt,
+				SAMPLE_RATE * TEMPORAL_SAMPLE_RATE, fJitter);
+
+			auto vResult = vMarch.x * vLightRad + vAmbientRad;
+			vResult = lerp(vResult, vClear, vMarch.y);
+
+			// The depth along the ray is kept for the reprojection
+			txCurrent(int2(x, y)) = float4(vResult.x, vResult.y, vResult.z, vMarch.z);
+		}
+	});
+}
+
+void HostFluid3D::resolveTemporal(upHostTexture2D<unorm4> &pDst, const CBPerObject &cbPerObj)
+{
+	TRACE_SCOPE("HostFluid3D::resolveTemporal");
+
+	auto &txDst = *pDst;
+	auto &txHistory = *m_pHistory;
+	const auto &txPrevHistory = *m_pPrevHistory;
+	const auto &txCurrent = *m_pCurrent;
+	const auto &vExtent = txDst.GetExtent();
+	const auto bHistoryValid = m_bHistoryValid;
+
+	// Constant buffer per object
+	const auto vLocalSpaceEyePt = cbPerObj.m_vLocalSpaceEyePt.xyz();
+	const auto &mScreenToLocal = cbPerObj.m_mScreenToLocal;
+
+	// Local space to the previous frame's screen
+	const auto mPrevLocalToScreen = inverse(m_cbPrevPerObj.m_mScreenToLocal);
+
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto &vCurrent = txCurrent(int2(x, y));
+			const auto vColor = vCurrent.xyz();
+			if (vCurrent.w < 0.0f)
+			{
+				txHistory(int2(x, y)) = vCurrent;
+				continue;
+			}
+
+			// Neighborhood statistics of the current frame
+			auto vMean = float3(0.0f, 0.0f, 0.0f), vMeanSq = float3(0.0f, 0.0f, 0.0f);
+			for (auto j = -1; j <= 1; ++j)
+			{
+				for (auto i = -1; i <= 1; ++i)
+				{
+					const auto vTap = txCurrent(int2(min(max(x + i, 0), vExtent.x - 1),
+						min(max(y + j, 0), vExtent.y - 1))).xyz();
+					vMean += vTap;
+					vMeanSq += vTap * vTap;
+				}
+			}
+			vMean = vMean / 9.0f;
+			const auto vVar = vMeanSq / 9.0f - vMean * vMean;
+			const auto vSigma = float3(sqrt(max(vVar.x, 0.0f)), sqrt(max(vVar.y, 0.0f)), sqrt(max(vVar.z, 0.0f)));
+
+			// Reproject the opacity-weighted point of the ray into the previous frame
+			const auto vLoc = float3(float(x), float(y), 0.0f);
+			const auto vPos = ScreenToLocal(vLoc, mScreenToLocal);			// The point on the near plane
+			const auto vRayDir = normalize(vPos - vLocalSpaceEyePt);
+			const auto vPoint = vPos + vRayDir * vCurrent.w;
+			const auto vPrev = mul(mPrevLocalToScreen, float4(vPoint.x, vPoint.y, vPoint.z, 1.0f));
+			const auto fPrevX = vPrev.x / vPrev.w, fPrevY = vPrev.y / vPrev.w;
+
+			auto vResult = vColor;
+			if (bHistoryValid && vPrev.w > 0.0f && fPrevX >= -0.5f && fPrevY >= -0.5f &&
+				fPrevX <= vExtent.x - 0.5f && fPrevY <= vExtent.y - 0.5f)
+			{
+				// Variance clipping rejects the history that the current frame cannot explain
+				const auto vTex = float2((fPrevX + 0.5f) / vExtent.x, (fPrevY + 0.5f) / vExtent.y);
+				const auto vLo = vMean - vSigma * TEMPORAL_GAMMA, vHi = vMean + vSigma * TEMPORAL_GAMMA;
+				auto vHistory = txPrevHistory.Sample(vTex).xyz();
+				vHistory = float3(clamp(vHistory.x, vLo.x, vHi.x), clamp(vHistory.y, vLo.y, vHi.y),
+					clamp(vHistory.z, vLo.z, vHi.z));
+				vResult = lerp(vHistory, vColor, TEMPORAL_BLEND);
+			}
+
+			txHistory(int2(x, y)) = float4(vResult.x, vResult.y, vResult.z, vCurrent.w);
+			txDst(int2(x, y)) = unorm4(sqrt(vResult.x), sqrt(vResult.y), sqrt(vResult.z), 1.0f);
+		}
+	});
+
+	// Swap buffers
+	m_pHistory.swap(m_pPrevHistory);
+	m_cbPrevPerObj = cbPerObj;
+	m_bHistoryValid = true;
+	++m_uFrame;
+}
+
+void HostFluid3D::buildOccupancy()
+{
+	TRACE_SCOPE("HostFluid3D::buildOccupancy");
+
+	const auto &txDensity = *m_pSrcDensity;
+	const auto &vExtent = txDensity.GetExtent();
+	const auto &pyramid = m_occupancyPyramid;
+
+	// Level 0: maximum over each macro-cell and its one-texel border
+	const auto &iDims0 = pyramid.iDims[0];
+	ParallelForEach(m_threadPool, int3(iDims0[0], iDims0[1], iDims0[2]), [&](cint3 &vCell)
+	{
+		const auto vLo = int3(max(vCell.x * OCCUPANCY_CELL - 1, 0), max(vCell.y * OCCUPANCY_CELL - 1, 0),
+			max(vCell.z * OCCUPANCY_CELL - 1, 0));
+		const auto vHi = int3(min((vCell.x + 1) * OCCUPANCY_CELL, vExtent.x - 1),
+			min((vCell.y + 1) * OCCUPANCY_CELL, vExtent.y - 1), min((vCell.z + 1) * OCCUPANCY_CELL, vExtent.z - 1));
+
+		auto fMaxDens = 0.0f;
+		for (auto z = vLo.z; z <= vHi.z; ++z)
+			for (auto y = vLo.y; y <= vHi.y; ++y)
+				for (auto x = vLo.x; x <= vHi.x; ++x)
+					fMaxDens = max(fMaxDens, txDensity(int3(x, y, z)));
+
+		m_occupancy[(vCell.z * iDims0[1] + vCell.y) * iDims0[0] + vCell.x] = fMaxDens;
+	});
+
+	// Coarser levels: maximum over the 2^3 children
+	for (auto l = 1; l < pyramid.iNumLevels; ++l)
+	{
+		const auto &iDims = pyramid.iDims[l];
+		const auto &iFineDims = pyramid.iDims[l - 1];
+		const auto pFine = &m_occupancy[pyramid.iOffsets[l - 1]];
+		const auto pCoarse = &m_occupancy[pyramid.iOffsets[l]];
+
+		ParallelForEach(m_threadPool, int3(iDims[0], iDims[1], iDims[2]), [&](cint3 &vCell)
+		{
+			auto fMaxDens = 0.0f;
+			for (auto z = vCell.z * 2; z < min(vCell.z * 2 + 2, iFineDims[2]); ++z)
+				for (auto y = vCell.y * 2; y < min(vCell.y * 2 + 2, iFineDims[1]); ++y)
+					for (auto x = vCell.x * 2; x < min(vCell.x * 2 + 2, iFineDims[0]); ++x)
+						fMaxDens = max(fMaxDens, pFine[(z * iFineDims[1] + y) * iFineDims[0] + x]);
+
+			pCoarse[(vCell.z * iDims[1] + vCell.y) * iDims[0] + vCell.x] = fMaxDens;
+		});
+	}
+}
+
+void HostFluid3D::updateTransmittance(cfloat3 &vLightPt, cfloat fLStepScale)
+{
+	TRACE_SCOPE("HostFluid3D::updateTransmittance");
+
+	if (!m_bLightDirty && vLightPt.x == m_vLightPt.x && vLightPt.y == m_vLightPt.y &&
+		vLightPt.z == m_vLightPt.z) return;
+	m_bLightDirty = false;
+	m_vLightPt = vLightPt;
+
+	const auto &txDensity = *m_pSrcDensity;
+	auto &txTransmit = *m_pTransmittance;
+	const auto &vExtent = txTransmit.GetExtent();
+	const auto &vDensExtent = txDensity.GetExtent();
+
+	// Sweep slice by slice away from the light along its dominant axis: each texel takes the
+	// transmittance on the previous slice where its light ray enters, attenuated over the step
+	// by the mean density of the cells the texel covers. The step is the distance between
+	// slices rather than fLStepScale.
+#ifndef _POINT_LIGHT_
+	static_cast<void>(fLStepScale);
+#endif
+	const int32_t aExtent[] = { vExtent.x, vExtent.y, vExtent.z };
+	const float aScale[] = { 0.5f * vExtent.x, -0.5f * vExtent.y, 0.5f * vExtent.z };	// Texels per local unit
+	const float aUnit[] = { 1.0f / aScale[0], 1.0f / aScale[1], 1.0f / aScale[2] };	// Local units per texel
+	const float aLight[] = { vLightPt.x * aScale[0], vLightPt.y * aScale[1], vLightPt.z * aScale[2] };
+	const auto a = fabs(aLight[0]) >= fabs(aLight[1]) && fabs(aLight[0]) >= fabs(aLight[2]) ? 0 :
+		(fabs(aLight[1]) >= fabs(aLight[2]) ? 1 : 2);
+	const auto b = a > 0 ? 0 : 1, c = 3 - a - b;		// Rows run along the fastest axis left
+	const auto iToLight = aLight[a] > 0.0f ? 1 : -1;
+
+	const int32_t aStride[] = { 1, vExtent.x, vExtent.x * vExtent.y };
+	const int32_t aDensExtent[] = { vDensExtent.x, vDensExtent.y, vDensExtent.z };
+	const int32_t aDensStride[] = { 1, vDensExtent.x, vDensExtent.x * vDensExtent.y };
+	const auto pDensity = txDensity.GetData();
+	const auto pTransmit = txTransmit.GetData();
+
+	// Offsets of the cells under a texel along an axis, clamped to the density grid
+	const auto cells = [&](const int32_t i, const int32_t axis, int32_t &i0, int32_t &i1)
+	{
+		i0 = min(i * LIGHT_VOLUME_SCALE, aDensExtent[axis] - 1) * aDensStride[axis];
+		i1 = min(i * LIGHT_VOLUME_SCALE + 1, aDensExtent[axis] - 1) * aDensStride[axis];
+	};
+
+	for (auto i = 0; i < aExtent[a]; ++i)
+	{
+		const auto iSlice = iToLight > 0 ? aExtent[a] - 1 - i : i;
+		const auto iPrev = iSlice + iToLight;
+		const auto bLit = iPrev < 0 || iPrev >= aExtent[a];
+
+		m_threadPool.ParallelFor(0, aExtent[c], [&](const int32_t k)
+		{
+			const auto pDst = pTransmit + iSlice * aStride[a] + k * aStride[c];
+			if (bLit)
+			{
+				for (auto j = 0; j < aExtent[b]; ++j) pDst[j * aStride[b]] = 1.0f;
+				return;
+			}
+
+			int32_t iA0, iA1, iC0, iC1;
+			cells(iSlice, a, iA0, iA1);
+			cells(k, c, iC0, iC1);
+
+			// Texels toward the light along the slice axis and across the rows, in the grid frame
+			// centered on the volume; only the step along the row varies within a row
+#ifdef _POINT_LIGHT_
+			const auto fDirA = aLight[a] - (iSlice + 0.5f - 0.5f * aExtent[a]);
+			const auto fDirC = aLight[c] - (k + 0.5f - 0.5f * aExtent[c]);
+			if (fDirA * iToLight < 1.0f)
+			{
+				// The light lies within the previous slice, so no slice sees it first
+				for (auto j = 0; j < aExtent[b]; ++j)
+				{
+					float aLoc[3];
+					aLoc[a] = iSlice + 0.5f - 0.5f * aExtent[a];
+					aLoc[b] = j + 0.5f - 0.5f * aExtent[b];
+					aLoc[c] = k + 0.5f - 0.5f * aExtent[c];
+					const auto vPos = float3(aLoc[0] * aUnit[0], aLoc[1] * aUnit[1], aLoc[2] * aUnit[2]);
+					pDst[j * aStride[b]] = LightTransmittance(txDensity, vPos,
+						normalize(vLightPt - vPos) * fLStepScale, fLStepScale);
+				}
+
+				return;
+			}
+#else
+			const auto fDirA = aLight[a], fDirC = aLight[c];
+#endif
+			// Step to the previous slice, and its squared length in local units but along the row
+			const auto fSlices = 1.0f / fabs(fDirA);
+			const auto fStepC = fDirC * fSlices;
+			const auto fSegmentAC = aUnit[a] * aUnit[a] + fStepC * fStepC * aUnit[c] * aUnit[c];
+
+			for (auto j = 0; j < aExtent[b]; ++j)
+			{
+#ifdef _POINT_LIGHT_
+				const auto fStepB = (aLight[b] - (j + 0.5f - 0.5f * aExtent[b])) * fSlices;
+#else
+				const auto fStepB = aLight[b] * fSlices;
+#endif
+				const auto fSegment = sqrt(fSegmentAC + fStepB * fStepB * aUnit[b] * aUnit[b]);
+
+				// Bilinear transmittance where the ray enters, clamped to the grid
+				const auto fB = j + fStepB, fC = k + fStepC;
+				const auto fFloorB = floor(fB), fFloorC = floor(fC);
+				const auto iCol0 = min(max(int32_t(fFloorB), 0), aExtent[b] - 1) * aStride[b];
+				const auto iCol1 = min(max(int32_t(fFloorB) + 1, 0), aExtent[b] - 1) * aStride[b];
+				const auto pRow0 = pTransmit + iPrev * aStride[a] + min(max(int32_t(fFloorC), 0), aExtent[c] - 1) * aStride[c];
+				const auto pRow1 = pTransmit + iPrev * aStride[a] + min(max(int32_t(fFloorC) + 1, 0), aExtent[c] - 1) * aStride[c];
+				const auto fLRTrans = lerp(lerp(pRow0[iCol0], pRow0[iCol1], fB - fFloorB),
+					lerp(pRow1[iCol0], pRow1[iCol1], fB - fFloorB), fC - fFloorC);
+
+				// Mean density of the cells under the texel
+				int32_t iB0, iB1;
+				cells(j, b, iB0, iB1);
+				const auto fLRDens = fmin(0.125f * (
+					pDensity[iA0 + iB0 + iC0] + pDensity[iA0 + iB1 + iC0] + pDensity[iA0 + iB0 + iC1] + pDensity[iA0 + iB1 + iC1] +
+					pDensity[iA1 + iB0 + iC0] + pDensity[iA1 + iB1 + iC0] + pDensity[iA1 + iB0 + iC1] + pDensity[iA1 + iB1 + iC1]),
+					16.0f);
+
+				pDst[j * aStride[b]] = fLRTrans * saturate(1.0f - ABSORPTION * fSegment * fLRDens);
+			}
+		});
+	}
+}
+
+uint32_t HostFluid3D::emptySteps(cfloat3 &vTex, cfloat3 &vTexStep) const
+{
+	const auto &pyramid = m_occupancyPyramid;
+	const auto vCell = vTex * m_vSimSize;
+	const auto vStep = vTexStep * m_vSimSize;
+
+	// Climb while the macro-cells stay empty; each level contains the one below
+	auto fSteps = 0.0f;
+	for (auto l = 0; l < pyramid.iNumLevels; ++l)
+	{
+		const auto &iDims = pyramid.iDims[l];
+		const auto fSize = float(OCCUPANCY_CELL << l);
+		const auto x = min(max(int32_t(vCell.x / fSize), 0), iDims[0] - 1);
+		const auto y = min(max(int32_t(vCell.y / fSize), 0), iDims[1] - 1);
+		const auto z = min(max(int32_t(vCell.z / fSize), 0), iDims[2] - 1);
+		if (m_occupancy[pyramid.iOffsets[l] + (z * iDims[1] + y) * iDims[0] + x] > ZERO_THRESHOLD) break;
+
+		// Steps until the ray leaves the macro-cell
+		const auto vLo = float3(float(x), float(y), float(z)) * fSize;
+		const auto vHi = vLo + fSize;
+		const auto exit = [](cfloat fPos, cfloat fStep, cfloat fLo, cfloat fHi)
+		{
+			return fStep > 0.0f ? (fHi - fPos) / fStep : (fStep < 0.0f ? (fLo - fPos) / fStep : FLT_MAX);
+		};
+		fSteps = min(exit(vCell.x, vStep.x, vLo.x, vHi.x), min(exit(vCell.y, vStep.y, vLo.y, vHi.y),
+			exit(vCell.z, vStep.z, vLo.z, vHi.z)));
+	}
+
+	return uint32_t(min(ceil(fSteps), float(MAX_SAMPLES)));
+}
+
+void HostFluid3D::advect(cfloat fDeltaTime)
+{
+	TRACE_SCOPE("HostFluid3D::advect");
+
+	if (m_advection == ADVECT_SEMI_LAGRANGIAN) advect(fDeltaTime, *m_pSrcVelocity);
+	else advectCorrected(fDeltaTime);
+}
+
+void HostFluid3D::advect(cfloat fDeltaTime, const HostTexture3D<float4> &txVelocity)
+{
+	static const auto fDecay = 0.996f;
+
+	auto &txPhiVelRW = *m_pDstVelocity;
+	auto &txPhiDenRW = *m_pDstDensity;
+	const auto &txPhiVelRO = *m_pSrcVelocity;
+	const auto &txPhiDenRO = *m_pSrcDensity;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+
+	// Trace back along the velocity, then update velocity and density
+	forEachRow(txPhiVelRW.GetExtent(), [&](cint3 &vLoc, const int32_t iWidth)
+	{
+		AdvectRow(txVelocity, txPhiVelRO, txPhiDenRO, vTexel, fDeltaTime, fDecay, txPhiVelRW, txPhiDenRW,
+			vLoc, iWidth);
+	});
+
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void HostFluid3D::advectCorrected(cfloat fDeltaTime)
+{
+	static const auto fDecay = 0.996f;
+
+	const auto &txVelocity = *m_pSrcVelocity;
+	const auto &txPhiVelN = *m_pSrcVelocity;
+	const auto &txPhiDenN = *m_pSrcDensity;
+	auto &txPhiVelHat = *m_pDstVelocity;
+	auto &txPhiDenHat = *m_pDstDensity;
+	auto &txPhiVelTmp = *m_diffuse.GetTmp();
+	auto &txPhiDenTmp = *m_pTmpDensity;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+
+	// Forward pass: semi-Lagrangian prediction without decay
+	forEachCell(txPhiVelHat.GetExtent(), [&](cint3 &vLoc)
+	{
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z));
+		const auto vTex = (vPos + 0.5f) * vTexel - txVelocity(vLoc).xyz() * fDeltaTime;
+
+		txPhiVelHat(vLoc) = txPhiVelN.Sample(vTex);
+		txPhiDenHat(vLoc) = txPhiDenN.Sample(vTex);
+	});
+
+	// Backward pass: trace the prediction forward again and take half of the round-trip error.
+	// MacCormack applies it to the prediction and limits here; BFECC applies it to the source.
+	const auto bMacCormack = m_advection == ADVECT_MACCORMACK;
+	forEachCell(txPhiVelTmp.GetExtent(), [&](cint3 &vLoc)
+	{
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z));
+		const auto vU = txVelocity(vLoc).xyz() * fDeltaTime;
+		const auto vTex = (vPos + 0.5f) * vTexel;
+
+		const auto vVelErr = 0.5f * (txPhiVelN(vLoc) - txPhiVelHat.Sample(vTex + vU));
+		const auto fDenErr = 0.5f * (txPhiDenN(vLoc) - txPhiDenHat.Sample(vTex + vU));
+
+		if (bMacCormack)
+		{
+			txPhiVelTmp(vLoc) = ClampToStencil3D(txPhiVelN, vTex - vU, txPhiVelHat(vLoc) + vVelErr);
+			txPhiDenTmp(vLoc) = ClampToStencil3D(txPhiDenN, vTex - vU, txPhiDenHat(vLoc) + fDenErr) * fDecay;
+		}
+		else
+		{
+			txPhiVelTmp(vLoc) = txPhiVelN(vLoc) + vVelErr;
+			txPhiDenTmp(vLoc) = txPhiDenN(vLoc) + fDenErr;
+		}
+	});
+
+	if (bMacCormack)
+	{
+		// Swap buffers: the corrected fields become the sources
+		m_diffuse.SwapTextures(true);
+		m_pTmpDensity.swap(m_pDstDensity);
+	}
+	else
+	{
+		// BFECC: advect the compensated source with the original velocity, limited
+		// by the uncompensated source
+		forEachCell(txPhiVelHat.GetExtent(), [&](cint3 &vLoc)
+		{
+			const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z));
+			const auto vTex = (vPos + 0.5f) * vTexel - txVelocity(vLoc).xyz() * fDeltaTime;
+
+			txPhiVelHat(vLoc) = ClampToStencil3D(txPhiVelN, vTex, txPhiVelTmp.Sample(vTex));
+			txPhiDenHat(vLoc) = ClampToStencil3D(txPhiDenN, vTex, txPhiDenTmp.Sample(vTex)) * fDecay;
+		});
+	}
+
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void HostFluid3D::diffuse(const uint8_t uIteration)
+{
+	TRACE_SCOPE("HostFluid3D::diffuse");
+
+	if (uIteration > 0)
+	{
+		m_diffuse.SolvePoisson(float2(1.0f, 7.0f), uIteration);
+		m_pSrcVelocity = m_diffuse.GetSrc();
+		m_pDstVelocity = m_diffuse.GetDst();
+	}
+}
+
+void HostFluid3D::impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
+{
+	TRACE_SCOPE("HostFluid3D::impulse");
+
+	auto &txVelocityRW = *m_pDstVelocity;
+	auto &txDensityRW = *m_pDstDensity;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+	const auto &txDensityRO = *m_pSrcDensity;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+
+	forEachCell(txVelocityRW.GetExtent(), [&](cint3 &vLoc)
+	{
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z));
+		Impulse3D(txVelocityRO, txDensityRO, vPos * vTexel, fDeltaTime, vForceDens, vImLoc, IMPULSE_RADIUS,
+			txVelocityRW, txDensityRW, vLoc);
+	});
+
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void HostFluid3D::advectFused(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
+{
+	TRACE_SCOPE("HostFluid3D::advectFused");
+
+	static const auto fDecay = 0.996f;
+
+	auto &txPhiVelRW = *m_pDstVelocity;
+	auto &txPhiDenRW = *m_pDstDensity;
+	auto &txDivergenceRW = *m_pressure.GetDst();
+	const auto &txPhiVelRO = *m_pSrcVelocity;
+	const auto &txPhiDenRO = *m_pSrcDensity;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+	const auto &vExtent = txPhiVelRW.GetExtent();
+	const auto iNumSlabs = (vExtent.z + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z;
+	const auto divergence = [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y) DivergenceRow(txPhiVelRW, txDivergenceRW, int3(0, y, z), vExtent.x);
+	};
+
+	// Slabs of THREAD_BLOCK_Z planes advect each cell once, straight into the destination,
+	// and take the divergence of a plane as soon as both of its neighbors are written. The
+	// planes on the faces of a slab need the next slab's, so they wait for a second pass.
+	m_threadPool.ParallelFor(0, iNumSlabs, [&](const int32_t iSlab)
+	{
+		const auto iBegin = iSlab * THREAD_BLOCK_Z, iEnd = min(iBegin + THREAD_BLOCK_Z, vExtent.z);
+		for (auto z = iBegin; z < iEnd; ++z)
+		{
+			for (auto y = 0; y < vExtent.y; ++y)
+			{
+				// Trace back along the velocity, then add the impulse in place
+				AdvectRow(txPhiVelRO, txPhiVelRO, txPhiDenRO, vTexel, fDeltaTime, fDecay, txPhiVelRW, txPhiDenRW,
+					int3(0, y, z), vExtent.x);
+				for (auto x = 0; x < vExtent.x; ++x)
+				{
+					const auto vLoc = int3(x, y, z);
+					const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z));
+					Impulse3D(txPhiVelRW, txPhiDenRW, vPos * vTexel, fDeltaTime, vForceDens, vImLoc, IMPULSE_RADIUS,
+						txPhiVelRW, txPhiDenRW, vLoc);
+				}
+			}
+
+			if (z - 1 > iBegin) divergence(z - 1);
+		}
+	});
+
+	m_threadPool.ParallelFor(0, iNumSlabs, [&](const int32_t iSlab)
+	{
+		const auto iBegin = iSlab * THREAD_BLOCK_Z, iEnd = min(iBegin + THREAD_BLOCK_Z, vExtent.z);
+		divergence(iBegin);
+		if (iEnd - 1 > iBegin) divergence(iEnd - 1);
+	});
+
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+	m_pSrcDensity.swap(m_pDstDensity);
+	m_pressure.SwapTextures();
+}
+
+void HostFluid3D::project(cfloat fDeltaTime, const bool bDivergence)
+{
+	TRACE_SCOPE("HostFluid3D::project");
+
+	if (bDivergence) m_pressure.ComputeDivergence(*m_pSrcVelocity);
+	if (m_fPressTolerance > 0.0f) m_pressureStats = m_pressure.SolvePoisson(float2(-1.0f, 6.0f),
+		m_fPressTolerance, m_uPressMaxIteration, m_uPressCheckInterval);
+	else m_pressure.SolvePoisson(float2(-1.0f, 6.0f));
+
+	subtractGradient();
+
+	// Temporal optimization: carry the pressure along to seed the next solve
+	if (m_pressure.GetWarmStart() == WARM_START_ADVECTED) m_pressure.Advect(fDeltaTime, *m_pSrcVelocity);
+}
+
+void HostFluid3D::subtractGradient()
+{
+	TRACE_SCOPE("HostFluid3D::subtractGradient");
+
+	auto &txVelocityRW = *m_pDstVelocity;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+	const auto &txPressureRO = *m_pressure.GetSrc();
+
+	const auto iDepth = txVelocityRW.GetExtent().z;
+	const auto window = SlabWindow{ iDepth, 0, iDepth };
+
+	forEachRow(txVelocityRW.GetExtent(), [&](cint3 &vLoc, const int32_t iWidth)
+	{
+		ProjectRow(txVelocityRO, txPressureRO, float(REST_DENS), txVelocityRW, window, vLoc, iWidth);
+	});
+
+	// Swap buffers
+	m_diffuse.SwapTextures();
+	m_pSrcVelocity = m_diffuse.GetSrc();
+	m_pDstVelocity = m_diffuse.GetDst();
+}
@@ -0,0 +1,160 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HostPoisson3D.h"
+#include "AdvectionScheme.h"
+#include "Checkpoint.h"
+#include "BrickMap.h"
+#include "OccupancyPyramid.h"
+
+#define VISC_ITERATION	0
+
+//--------------------------------------------------------------------------------------
+// Multithreaded CPU implementation of AmpFluid3D for machines without C++ AMP/D3D.
+// Init/Simulate/Render follow the same contract; the thread pool takes the place of
+// the accelerator view.
+//--------------------------------------------------------------------------------------
+
+class HostFluid3D
+{
+public:
+	struct CBImmutable
+	{
+		float4	m_vDirectional;
+		float4	m_vAmbient;
+	};
+
+	struct CBPerObject
+	{
+		float4		m_vLocalSpaceLightPt;
+		float4		m_vLocalSpaceEyePt;
+		float4x4	m_mScreenToLocal;
+	};
+
+	HostFluid3D(HostThreadPool &threadPool);
+
+	void Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth);
+	void Simulate(
+		cfloat fDeltaTime,
+		cfloat4 vForceDens = float4(0.0f, 0.0f, 0.0f, 0.0f),
+		cfloat3 vImLoc = float3(0.0f, 0.0f, 0.0f),
+		const uint8_t uItVisc = VISC_ITERATION
+		);
+	// txDepth holds the scene's hardware depth, i.e. the screen-space z of m_mScreenToLocal.
+	// pDst gets the volume as a layer: linear premultiplied color with the opacity in alpha,
+	// and zero where the scene or nothing is in front; always at full resolution.
+	void Render(upHostTexture2D<unorm4> &pDst, const HostTexture2D<float> &txDepth,
+		const CBImmutable &cbImmutable, const CBPerObject &cbPerObj);
+	void Render(upHostTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable,
+		const CBPerObject &cbPerObj);
+	// Blends a layer of the depth overload over txScene into pDst; the scene and the result
+	// are stored, as the plain overload writes them, as the square root of linear color
+	void Composite(upHostTexture2D<unorm4> &pDst, const HostTexture2D<unorm4> &txScene,
+		const HostTexture2D<unorm4> &txLayer);
+	void SetPressureTolerance(cfloat fTolerance, const uint32_t uMaxIteration = PRESS_ITERATION,
+		const uint32_t uCheckInterval = 4);
+	void SetFusedStep(const bool bFused);
+	void SetAdvection(const AdvectionScheme advection);
+	void SetSparse(const bool bSparse);
+	void SetLightVolume(const bool bLightVolume);
+	void SetRenderScale(const uint8_t uScale);
+	// Exponential extinction per step instead of the linear default; it does not depend on
+	// the step size, so the temporal mode's sparser steps converge to the full-rate image
+	void SetExactExtinction(const bool bExact);
+	void SetTemporal(const bool bTemporal);
+	// Velocity, density and pressure; loading takes the size of the checkpoint
+	bool SaveCheckpoint(const char *szFileName, const uint64_t uStep, cfloat fDeltaTime) const;
+	bool LoadCheckpoint(const char *szFileName, CheckpointHeader *pHeader = nullptr);
+
+	const spHostTexture3D<float4> &GetVelocity() const { return m_pSrcVelocity; }
+	const spHostTexture3D<float> &GetDensity() const { return m_pSrcDensity; }
+	HostPoisson3D<float> &GetPressure() { return m_pressure; }
+	const PoissonStats &GetPressureStats() const { return m_pressureStats; }
+	const BrickMap &GetBricks() const { return m_bricks; }
+	HostThreadPool &GetThreadPool() const { return m_threadPool; }
+
+protected:
+	void advect(cfloat fDeltaTime);
+	void advect(cfloat fDeltaTime, const HostTexture3D<float4> &txVelocity);
+	void advectCorrected(cfloat fDeltaTime);
+	void diffuse(const uint8_t uIteration);
+	void impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
+	void advectFused(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
+	void project(cfloat fDeltaTime, const bool bDivergence = true);
+	void subtractGradient();
+	void updateBricks(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
+	void buildOccupancy();
+	uint32_t emptySteps(cfloat3 &vTex, cfloat3 &vTexStep) const;
+	void updateTransmittance(cfloat3 &vLightPt, cfloat fLStepScale);
+	float3 marchRay(float3 vPos, cfloat3 &vRayDir, cfloat fNear, cfloat fFar, cfloat3 &vLocalSpaceLightPt,
+		cfloat fSampleRate, cfloat fJitter) const;
+	void marchLowRes(cint2 &vDstExtent, const CBPerObject &cbPerObj);
+	void upsample(upHostTexture2D<unorm4> &pDst, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj);
+	void marchTemporal(cint2 &vExtent, const CBImmutable &cbImmutable, const CBPerObject &cbPerObj);
+	void resolveTemporal(upHostTexture2D<unorm4> &pDst, const CBPerObject &cbPerObj);
+	template<typename F>
+	void forEachCell(cint3 &vExtent, const F &func);
+	template<typename F>
+	void forEachRow(cint3 &vExtent, const F &func);
+
+	spHostTexture3D<float4>			m_pSrcVelocity;
+	spHostTexture3D<float4>			m_pDstVelocity;
+	spHostTexture3D<float>			m_pSrcDensity;
+	spHostTexture3D<float>			m_pDstDensity;
+	spHostTexture3D<float>			m_pTmpDensity;
+
+	float3							m_vSimSize;
+
+	HostPoisson3D<float4>			m_diffuse;
+	HostPoisson3D<float>			m_pressure;
+
+	float							m_fPressTolerance;
+	uint32_t						m_uPressMaxIteration;
+	uint32_t						m_uPressCheckInterval;
+	PoissonStats					m_pressureStats;
+
+	bool							m_bFusedStep;
+	AdvectionScheme					m_advection;
+
+	// Sparse mode: kernels only visit the live bricks
+	bool							m_bSparse;
+	BrickMap						m_bricks;
+	std::vector<float>				m_brickOccupancy;
+	std::vector<float>				m_brickReach;
+
+	// Max-density pyramid for empty-space skipping in Render
+	OccupancyPyramid				m_occupancyPyramid;
+	std::vector<float>				m_occupancy;
+
+	// Light transmittance volume, replacing the per-sample shadow rays when enabled
+	bool							m_bLightVolume;
+	bool							m_bLightDirty;
+	float3							m_vLightPt;
+	spHostTexture3D<float>			m_pTransmittance;
+
+	// Reduced-resolution rendering: premultiplied radiance, transmittance and ray bounds
+	uint8_t							m_uRenderScale;
+	upHostTexture2D<float4>			m_pLowRes;
+
+	// Extinction model of the view rays
+	bool							m_bExactExtinction;
+
+	// Temporal mode: linear color and ray depth of this frame, and the accumulated history
+	bool							m_bTemporal;
+	bool							m_bHistoryValid;
+	uint32_t						m_uFrame;
+	CBPerObject						m_cbPrevPerObj;
+	upHostTexture2D<float4>			m_pCurrent;
+	upHostTexture2D<float4>			m_pHistory;
+	upHostTexture2D<float4>			m_pPrevHistory;
+
+	HostThreadPool					&m_threadPool;
+};
+
+using upHostFluid3D = std::unique_ptr<HostFluid3D>;
+using spHostFluid3D = std::shared_ptr<HostFluid3D>;
+using vuHostFluid3D = std::vector<upHostFluid3D>;
+using vpHostFluid3D = std::vector<spHostFluid3D>;
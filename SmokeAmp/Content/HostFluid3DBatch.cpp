@@ -0,0 +1,263 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include <cstring>
+#include "HostFluid3DBatch.h"
+
+#define IMPULSE_RADIUS		0.032f
+
+using namespace std;
+
+static inline int32_t ClampCoord(const int32_t i, const int32_t iSize)
+{
+	return i < 0 ? 0 : (i >= iSize ? iSize - 1 : i);
+}
+
+// HostTexture3D::Sample on the box of an instance, with clamp addressing on its own faces
+template<typename T>
+static inline T SampleInstance(const HostTexture3D<T> &txSrc, const BatchInstance &instance, cfloat3 &vTex)
+{
+	// Texel-center convention: texel i covers [i, i + 1) / size
+	const auto vPos = vTex * float3(float(instance.iWidth), float(instance.iHeight), float(instance.iDepth)) - 0.5f;
+	const auto vBase = floor(vPos);
+	const auto vFrac = vPos - vBase;
+
+	const auto x0 = ClampCoord(int32_t(vBase.x), instance.iWidth);
+	const auto x1 = ClampCoord(int32_t(vBase.x) + 1, instance.iWidth);
+	const auto y0 = ClampCoord(int32_t(vBase.y), instance.iHeight);
+	const auto y1 = ClampCoord(int32_t(vBase.y) + 1, instance.iHeight);
+	const auto z0 = ClampCoord(int32_t(vBase.z), instance.iDepth) + instance.iOrigin;
+	const auto z1 = ClampCoord(int32_t(vBase.z) + 1, instance.iDepth) + instance.iOrigin;
+
+	const auto v00 = lerp(txSrc(int3(x0, y0, z0)), txSrc(int3(x1, y0, z0)), vFrac.x);
+	const auto v10 = lerp(txSrc(int3(x0, y1, z0)), txSrc(int3(x1, y1, z0)), vFrac.x);
+	const auto v01 = lerp(txSrc(int3(x0, y0, z1)), txSrc(int3(x1, y0, z1)), vFrac.x);
+	const auto v11 = lerp(txSrc(int3(x0, y1, z1)), txSrc(int3(x1, y1, z1)), vFrac.x);
+
+	return lerp(lerp(v00, v10, vFrac.y), lerp(v01, v11, vFrac.y), vFrac.z);
+}
+
+// Visit every cell of every instance; the gaps and the padding are left untouched
+template<typename F>
+void HostFluid3DBatch::forEachCell(const F &func)
+{
+	const auto &slices = m_layout.GetSlices();
+	m_threadPool.ParallelFor(0, m_layout.GetDepth(), [&](const int32_t z)
+	{
+		if (slices[z] == BATCH_NONE) return;
+
+		const auto &instance = m_layout.GetInstance(slices[z]);
+		for (auto y = 0; y < instance.iHeight; ++y)
+			for (auto x = 0; x < instance.iWidth; ++x)
+				func(int3(x, y, z), instance);
+	});
+}
+
+HostFluid3DBatch::HostFluid3DBatch(HostThreadPool &threadPool) :
+	m_threadPool(threadPool)
+{
+}
+
+uint32_t HostFluid3DBatch::AddInstance(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+{
+	return m_layout.Add(iWidth, iHeight, iDepth);
+}
+
+void HostFluid3DBatch::Init()
+{
+	m_layout.Commit();
+	const auto iWidth = m_layout.GetWidth();
+	const auto iHeight = m_layout.GetHeight();
+	const auto iDepth = m_layout.GetDepth();
+
+	// Create the atlas textures
+	m_pSrcVelocity = make_shared<HostTexture3D<float4>>(iDepth, iHeight, iWidth);
+	m_pDstVelocity = make_shared<HostTexture3D<float4>>(iDepth, iHeight, iWidth);
+	m_pSrcDensity = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pDstDensity = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pPressure = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pDivergence = make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+
+	// Each instance is blocked from its own origin, as HostPoisson3D blocks a single grid,
+	// so that every instance sees the same update order as on its own
+	for (auto &blocks : m_pressureBlocks) blocks.clear();
+	for (const auto &instance : m_layout.GetInstances())
+	{
+		for (auto iBlock = 0; iBlock * THREAD_BLOCK_Z < instance.iDepth; ++iBlock)
+		{
+			const auto iBegin = instance.iOrigin + iBlock * THREAD_BLOCK_Z;
+			const auto iEnd = min(iBegin + THREAD_BLOCK_Z, instance.iOrigin + instance.iDepth);
+			m_pressureBlocks[iBlock % 2].push_back(int2(iBegin, iEnd));
+		}
+	}
+}
+
+void HostFluid3DBatch::SetInstance(const uint32_t i, cfloat fDeltaTime, cfloat4 vForceDens, cfloat3 vImLoc)
+{
+	const float vForceDensArray[] = { vForceDens.x, vForceDens.y, vForceDens.z, vForceDens.w };
+	const float vImLocArray[] = { vImLoc.x, vImLoc.y, vImLoc.z };
+	m_layout.SetStep(i, fDeltaTime, vForceDensArray, vImLocArray);
+}
+
+void HostFluid3DBatch::Simulate()
+{
+	TRACE_SCOPE("HostFluid3DBatch::Simulate");
+
+	advect();
+	impulse();
+	project();
+}
+
+void HostFluid3DBatch::GetVelocity(const uint32_t i, HostTexture3D<float4> &txDst) const
+{
+	copyInstance(i, *m_pSrcVelocity, txDst);
+}
+
+void HostFluid3DBatch::GetDensity(const uint32_t i, HostTexture3D<float> &txDst) const
+{
+	copyInstance(i, *m_pSrcDensity, txDst);
+}
+
+template<typename T>
+void HostFluid3DBatch::copyInstance(const uint32_t i, const HostTexture3D<T> &txSrc, HostTexture3D<T> &txDst) const
+{
+	// txDst has the size of the instance
+	const auto &instance = m_layout.GetInstance(i);
+	m_threadPool.ParallelFor(0, instance.iDepth, [&](const int32_t z)
+	{
+		for (auto y = 0; y < instance.iHeight; ++y)
+			memcpy(static_cast<void*>(&txDst(int3(0, y, z))), &txSrc(int3(0, y, instance.iOrigin + z)),
+				sizeof(T) * instance.iWidth);
+	});
+}
+
+void HostFluid3DBatch::advect()
+{
+	TRACE_SCOPE("HostFluid3DBatch::advect");
+
+	static const auto fDecay = 0.996f;
+
+	auto &txPhiVelRW = *m_pDstVelocity;
+	auto &txPhiDenRW = *m_pDstDensity;
+	const auto &txPhiVelRO = *m_pSrcVelocity;
+	const auto &txPhiDenRO = *m_pSrcDensity;
+
+	forEachCell([&](cint3 &vLoc, const BatchInstance &instance)
+	{
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z - instance.iOrigin));
+		const auto vTexel = 1.0f / float3(float(instance.iWidth), float(instance.iHeight), float(instance.iDepth));
+
+		// Velocity tracing
+		const auto vU = txPhiVelRO(vLoc).xyz();
+		const auto vTex = (vPos + 0.5f) * vTexel - vU * instance.fDeltaTime;
+
+		// Update velocity and density
+		txPhiVelRW(vLoc) = SampleInstance(txPhiVelRO, instance, vTex);
+		txPhiDenRW(vLoc) = SampleInstance(txPhiDenRO, instance, vTex) * fDecay;
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void HostFluid3DBatch::impulse()
+{
+	TRACE_SCOPE("HostFluid3DBatch::impulse");
+
+	auto &txVelocityRW = *m_pDstVelocity;
+	auto &txDensityRW = *m_pDstDensity;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+	const auto &txDensityRO = *m_pSrcDensity;
+
+	forEachCell([&](cint3 &vLoc, const BatchInstance &instance)
+	{
+		const auto vForceDens = float4(instance.fForceX, instance.fForceY, instance.fForceZ, instance.fDensity);
+		const auto vImLoc = float3(instance.fImLocX, instance.fImLocY, instance.fImLocZ);
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z - instance.iOrigin));
+		const auto vTexel = 1.0f / float3(float(instance.iWidth), float(instance.iHeight), float(instance.iDepth));
+		Impulse3D(txVelocityRO, txDensityRO, vPos * vTexel, instance.fDeltaTime, vForceDens, vImLoc, IMPULSE_RADIUS,
+			txVelocityRW, txDensityRW, vLoc);
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void HostFluid3DBatch::project()
+{
+	TRACE_SCOPE("HostFluid3DBatch::project");
+
+	auto &txPressure = *m_pPressure;
+	auto &txDivergence = *m_pDivergence;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+
+	forEachCell([&](cint3 &vLoc, const BatchInstance &)
+	{
+		txDivergence(vLoc) = Divergence3D(txVelocityRO, vLoc);
+	});
+
+	// Block Gauss-Seidel over the slabs of all the instances at once, in place on the
+	// pressure of the last step; the gaps stay zero, so no instance sees another
+	const auto &slices = m_layout.GetSlices();
+	for (auto i = 0; i < PRESS_ITERATION; ++i)
+	{
+		for (const auto &blocks : m_pressureBlocks)
+		{
+			m_threadPool.ParallelFor(0, static_cast<int32_t>(blocks.size()), [&](const int32_t iBlock)
+			{
+				const auto &vBlock = blocks[iBlock];
+				const auto &instance = m_layout.GetInstance(slices[vBlock.x]);
+
+				for (auto z = vBlock.x; z < vBlock.y; ++z)
+					for (auto y = 0; y < instance.iHeight; ++y)
+						for (auto x = 0; x < instance.iWidth; ++x)
+						{
+							const auto vLoc = int3(x, y, z);
+							auto fq = -txDivergence(vLoc);
+							fq += txPressure.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+							fq += txPressure.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+							fq += txPressure.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+							fq += txPressure.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+							fq += txPressure.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+							fq += txPressure.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+							txPressure(vLoc) = fq / 6.0f;
+						}
+			});
+		}
+	}
+
+	subtractGradient();
+}
+
+void HostFluid3DBatch::subtractGradient()
+{
+	TRACE_SCOPE("HostFluid3DBatch::subtractGradient");
+
+	auto &txVelocityRW = *m_pDstVelocity;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+	const auto &txPressureRO = *m_pPressure;
+
+	forEachCell([&](cint3 &vLoc, const BatchInstance &instance)
+	{
+		// Cells on the instance faces mirror their inward neighbor with the opposite sign
+		const auto iZ = vLoc.z - instance.iOrigin;
+		const auto vOffset = int3
+		(
+			vLoc.x >= instance.iWidth - 1 ? -1 : (vLoc.x <= 0 ? 1 : 0),
+			vLoc.y >= instance.iHeight - 1 ? -1 : (vLoc.y <= 0 ? 1 : 0),
+			iZ >= instance.iDepth - 1 ? -1 : (iZ <= 0 ? 1 : 0)
+		);
+		const auto vSrc = int3(vLoc.x + vOffset.x, vLoc.y + vOffset.y, vLoc.z + vOffset.z);
+
+		// Project the velocity onto its divergence-free component
+		auto vVelocity = txVelocityRO(vSrc).xyz() - Gradient3D(txPressureRO, vSrc) / float(REST_DENS);
+		if (vOffset.x || vOffset.y || vOffset.z) vVelocity = -vVelocity;
+		txVelocityRW(vLoc) = float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f);
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+}
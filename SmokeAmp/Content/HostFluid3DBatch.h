@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HostPoisson3D.h"
+#include "BatchLayout.h"
+
+//--------------------------------------------------------------------------------------
+// Many small HostFluid3D simulations in one atlas (see BatchLayout). A step runs each
+// stage once over every instance, so the dispatch cost is paid per stage rather than
+// per instance. Each instance has its own size, time step and emitter, and follows the
+// default path of HostFluid3D: semi-Lagrangian advection, impulse, and a fixed
+// PRESS_ITERATION block Gauss-Seidel pressure solve warm-started from the last step.
+//--------------------------------------------------------------------------------------
+
+class HostFluid3DBatch
+{
+public:
+	HostFluid3DBatch(HostThreadPool &threadPool);
+
+	// Instances are added before Init, which packs them and clears every field
+	uint32_t AddInstance(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth);
+	void Init();
+	void SetInstance(
+		const uint32_t i,
+		cfloat fDeltaTime,
+		cfloat4 vForceDens = float4(0.0f, 0.0f, 0.0f, 0.0f),
+		cfloat3 vImLoc = float3(0.0f, 0.0f, 0.0f)
+		);
+	void Simulate();
+
+	// Copies an instance out of the atlas, e.g. to render or record it
+	void GetVelocity(const uint32_t i, HostTexture3D<float4> &txDst) const;
+	void GetDensity(const uint32_t i, HostTexture3D<float> &txDst) const;
+
+	const spHostTexture3D<float4> &GetVelocity() const { return m_pSrcVelocity; }
+	const spHostTexture3D<float> &GetDensity() const { return m_pSrcDensity; }
+	const BatchLayout &GetLayout() const { return m_layout; }
+	HostThreadPool &GetThreadPool() const { return m_threadPool; }
+
+protected:
+	void advect();
+	void impulse();
+	void project();
+	void subtractGradient();
+	template<typename F>
+	void forEachCell(const F &func);
+	template<typename T>
+	void copyInstance(const uint32_t i, const HostTexture3D<T> &txSrc, HostTexture3D<T> &txDst) const;
+
+	spHostTexture3D<float4>			m_pSrcVelocity;
+	spHostTexture3D<float4>			m_pDstVelocity;
+	spHostTexture3D<float>			m_pSrcDensity;
+	spHostTexture3D<float>			m_pDstDensity;
+	spHostTexture3D<float>			m_pPressure;
+	spHostTexture3D<float>			m_pDivergence;
+
+	BatchLayout						m_layout;
+
+	// Atlas slabs of the block Gauss-Seidel iteration, split by parity: [begin, end) slices
+	std::vector<int2>				m_pressureBlocks[2];
+
+	HostThreadPool					&m_threadPool;
+};
+
+using upHostFluid3DBatch = std::unique_ptr<HostFluid3DBatch>;
+using spHostFluid3DBatch = std::shared_ptr<HostFluid3DBatch>;
@@ -0,0 +1,199 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include "HostFluid3DSlab.h"
+
+#define IMPULSE_RADIUS		0.032f
+
+using namespace std;
+
+HostFluid3DSlab::HostFluid3DSlab(HostThreadPool &threadPool, Transport &transport) :
+	m_vRange(0, 0),
+	m_iHalo(0),
+	m_fPressTolerance(0.0f),
+	m_uPressMaxIteration(PRESS_ITERATION),
+	m_uPressCheckInterval(4),
+	m_pressureStats(),
+	m_uHaloOverflows(0),
+	m_threadPool(threadPool),
+	m_transport(transport)
+{
+}
+
+bool HostFluid3DSlab::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth, const int32_t iHalo)
+{
+	const auto fWidth = static_cast<float>(iWidth);
+	const auto fHeight = static_cast<float>(iHeight);
+	const auto fDepth = static_cast<float>(iDepth);
+	m_vSimSize = float3(fWidth, fHeight, fDepth);
+	m_iHalo = iHalo;
+	m_uHaloOverflows = 0;
+
+	if (!m_pressure.Init(iWidth, iHeight, iDepth, iHalo, m_threadPool, m_transport)) return false;
+	m_vRange = m_pressure.GetRange();
+
+	// Create 3D textures, halos included
+	const auto iSlabDepth = m_vRange.y - m_vRange.x + 2 * iHalo;
+	m_pSrcVelocity = make_shared<HostTexture3D<float4>>(iSlabDepth, iHeight, iWidth);
+	m_pDstVelocity = make_shared<HostTexture3D<float4>>(iSlabDepth, iHeight, iWidth);
+	m_pSrcDensity = make_shared<HostTexture3D<float>>(iSlabDepth, iHeight, iWidth);
+	m_pDstDensity = make_shared<HostTexture3D<float>>(iSlabDepth, iHeight, iWidth);
+
+	return true;
+}
+
+bool HostFluid3DSlab::Simulate(cfloat fDeltaTime, cfloat4 vForceDens, cfloat3 vImLoc)
+{
+	TRACE_SCOPE("HostFluid3DSlab::Simulate");
+
+	// Advection samples anywhere within the halo
+	if (!ExchangeHalos(m_transport, *m_pSrcVelocity, m_iHalo, m_iHalo) ||
+		!ExchangeHalos(m_transport, *m_pSrcDensity, m_iHalo, m_iHalo)) return false;
+
+	advect(fDeltaTime);
+	impulse(fDeltaTime, vForceDens, vImLoc);
+
+	return project();
+}
+
+void HostFluid3DSlab::SetPressureTolerance(cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval)
+{
+	m_fPressTolerance = fTolerance;
+	m_uPressMaxIteration = uMaxIteration;
+	m_uPressCheckInterval = uCheckInterval;
+}
+
+bool HostFluid3DSlab::GatherVelocity(HostTexture3D<float4> *pDst) const
+{
+	return GatherSlabs(m_transport, *m_pSrcVelocity, m_iHalo, pDst);
+}
+
+bool HostFluid3DSlab::GatherDensity(HostTexture3D<float> *pDst) const
+{
+	return GatherSlabs(m_transport, *m_pSrcDensity, m_iHalo, pDst);
+}
+
+// Visit the cells of this rank's slices, in slab coordinates
+template<typename F>
+void HostFluid3DSlab::forEachCell(const F &func)
+{
+	const auto &vExtent = m_pSrcVelocity->GetExtent();
+
+	m_threadPool.ParallelFor(m_iHalo, vExtent.z - m_iHalo, [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y)
+			for (auto x = 0; x < vExtent.x; ++x)
+				func(int3(x, y, z));
+	});
+}
+
+// The same over whole rows along x for the row kernels, func(vLoc, iWidth)
+template<typename F>
+void HostFluid3DSlab::forEachRow(const F &func)
+{
+	const auto &vExtent = m_pSrcVelocity->GetExtent();
+
+	m_threadPool.ParallelFor(m_iHalo, vExtent.z - m_iHalo, [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y) func(int3(0, y, z), vExtent.x);
+	});
+}
+
+// The slices the slab holds, halos included
+SlabWindow HostFluid3DSlab::window() const
+{
+	return SlabWindow{ static_cast<int32_t>(m_vSimSize.z), m_vRange.x - m_iHalo, m_vRange.y + m_iHalo };
+}
+
+void HostFluid3DSlab::advect(cfloat fDeltaTime)
+{
+	TRACE_SCOPE("HostFluid3DSlab::advect");
+
+	static const auto fDecay = 0.996f;
+
+	auto &txPhiVelRW = *m_pDstVelocity;
+	auto &txPhiDenRW = *m_pDstDensity;
+	const auto &txPhiVelRO = *m_pSrcVelocity;
+	const auto &txPhiDenRO = *m_pSrcDensity;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+	const auto slab = window();
+	auto vOverflows = vector<uint32_t>(txPhiVelRW.GetExtent().z);
+
+	// Trace back along the velocity, then update velocity and density; the rows of a slice
+	// run on one thread, which counts its overflows
+	forEachRow([&](cint3 &vLoc, const int32_t iWidth)
+	{
+		vOverflows[vLoc.z] += AdvectRow(txPhiVelRO, txPhiVelRO, txPhiDenRO, vTexel, fDeltaTime, fDecay,
+			txPhiVelRW, txPhiDenRW, slab, vLoc, iWidth);
+	});
+
+	for (const auto &uOverflows : vOverflows) m_uHaloOverflows += uOverflows;
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+void HostFluid3DSlab::impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc)
+{
+	TRACE_SCOPE("HostFluid3DSlab::impulse");
+
+	auto &txVelocityRW = *m_pDstVelocity;
+	auto &txDensityRW = *m_pDstDensity;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+	const auto &txDensityRO = *m_pSrcDensity;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+	const auto iOffset = m_vRange.x - m_iHalo;
+
+	forEachCell([&](cint3 &vLoc)
+	{
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z + iOffset));
+		Impulse3D(txVelocityRO, txDensityRO, vPos * vTexel, fDeltaTime, vForceDens, vImLoc, IMPULSE_RADIUS,
+			txVelocityRW, txDensityRW, vLoc);
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+	m_pSrcDensity.swap(m_pDstDensity);
+}
+
+bool HostFluid3DSlab::project()
+{
+	TRACE_SCOPE("HostFluid3DSlab::project");
+
+	// The divergence and the mirrored faces read one slice across
+	if (!ExchangeHalos(m_transport, *m_pSrcVelocity, m_iHalo, 1)) return false;
+
+	m_pressure.ComputeDivergence(*m_pSrcVelocity);
+	const auto bSolved = m_fPressTolerance > 0.0f ? m_pressure.SolvePoisson(float2(-1.0f, 6.0f),
+		m_fPressTolerance, m_uPressMaxIteration, m_uPressCheckInterval, m_pressureStats) :
+		m_pressure.SolvePoisson(float2(-1.0f, 6.0f));
+	if (!bSolved) return false;
+
+	subtractGradient();
+
+	return true;
+}
+
+void HostFluid3DSlab::subtractGradient()
+{
+	TRACE_SCOPE("HostFluid3DSlab::subtractGradient");
+
+	auto &txVelocityRW = *m_pDstVelocity;
+	const auto &txVelocityRO = *m_pSrcVelocity;
+	const auto &txPressureRO = *m_pressure.GetSrc();
+
+	const auto slab = window();
+
+	forEachRow([&](cint3 &vLoc, const int32_t iWidth)
+	{
+		ProjectRow(txVelocityRO, txPressureRO, float(REST_DENS), txVelocityRW, slab, vLoc, iWidth);
+	});
+
+	// Swap buffers
+	m_pSrcVelocity.swap(m_pDstVelocity);
+}
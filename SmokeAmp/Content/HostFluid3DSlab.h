@@ -0,0 +1,86 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "HostPoisson3DSlab.h"
+
+// Halo slices of velocity and density: how far back along z a cell may trace in one step
+#define SLAB_HALO	4
+
+//--------------------------------------------------------------------------------------
+// HostFluid3D over a grid split into z-slabs across ranks (processes or nodes), which
+// talk through a Transport. Each rank holds its slices plus SLAB_HALO halo slices on
+// either side, refreshed from the neighbors before every stage that reads across the
+// slab faces. The step is the default path of HostFluid3D (semi-Lagrangian advection,
+// impulse, projection with the Gauss-Seidel or PCG solve) on the same row and cell
+// kernels, and it matches HostFluid3D bit for bit as long as no backtrace leaves the
+// halo; one that does is clamped to it and counted by GetHaloOverflows(), and a deeper
+// halo fixes it.
+//--------------------------------------------------------------------------------------
+
+class HostFluid3DSlab
+{
+public:
+	HostFluid3DSlab(HostThreadPool &threadPool, Transport &transport);
+
+	// Takes the size of the whole grid; this rank simulates the slices GetRange(), and
+	// fails if there are more ranks than THREAD_BLOCK_Z blocks along z
+	bool Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth, const int32_t iHalo = SLAB_HALO);
+	bool Simulate(
+		cfloat fDeltaTime,
+		cfloat4 vForceDens = float4(0.0f, 0.0f, 0.0f, 0.0f),
+		cfloat3 vImLoc = float3(0.0f, 0.0f, 0.0f)
+		);
+	void SetPressureTolerance(cfloat fTolerance, const uint32_t uMaxIteration = PRESS_ITERATION,
+		const uint32_t uCheckInterval = 4);
+	// Assembles the whole grid on rank 0, e.g. to record it; the other ranks pass nullptr
+	bool GatherVelocity(HostTexture3D<float4> *pDst) const;
+	bool GatherDensity(HostTexture3D<float> *pDst) const;
+
+	// This rank's slab, halos included
+	const spHostTexture3D<float4> &GetVelocity() const { return m_pSrcVelocity; }
+	const spHostTexture3D<float> &GetDensity() const { return m_pSrcDensity; }
+	HostPoisson3DSlab &GetPressure() { return m_pressure; }
+	const PoissonStats &GetPressureStats() const { return m_pressureStats; }
+	const int2 &GetRange() const { return m_vRange; }
+	uint64_t GetHaloOverflows() const { return m_uHaloOverflows; }
+	Transport &GetTransport() const { return m_transport; }
+	HostThreadPool &GetThreadPool() const { return m_threadPool; }
+
+protected:
+	void advect(cfloat fDeltaTime);
+	void impulse(cfloat fDeltaTime, cfloat4 &vForceDens, cfloat3 &vImLoc);
+	bool project();
+	void subtractGradient();
+	SlabWindow window() const;
+	template<typename F>
+	void forEachCell(const F &func);
+	template<typename F>
+	void forEachRow(const F &func);
+
+	spHostTexture3D<float4>			m_pSrcVelocity;
+	spHostTexture3D<float4>			m_pDstVelocity;
+	spHostTexture3D<float>			m_pSrcDensity;
+	spHostTexture3D<float>			m_pDstDensity;
+
+	float3							m_vSimSize;
+	int2							m_vRange;
+	int32_t							m_iHalo;
+
+	HostPoisson3DSlab				m_pressure;
+
+	float							m_fPressTolerance;
+	uint32_t						m_uPressMaxIteration;
+	uint32_t						m_uPressCheckInterval;
+	PoissonStats					m_pressureStats;
+
+	uint64_t						m_uHaloOverflows;
+
+	HostThreadPool					&m_threadPool;
+	Transport						&m_transport;
+};
+
+using upHostFluid3DSlab = std::unique_ptr<HostFluid3DSlab>;
+using spHostFluid3DSlab = std::shared_ptr<HostFluid3DSlab>;
@@ -0,0 +1,497 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include "HostFieldMath.h"
+#include "HostKernels.h"
+#if SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+//--------------------------------------------------------------------------------------
+// Per-cell code: the reference of the vectorized kernels, and their edges and tails
+//--------------------------------------------------------------------------------------
+
+static inline float Laplacian3D(const HostTexture3D<float> &txSource, cfloat fDiag, cint3 &vLoc)
+{
+	auto fq = fDiag * txSource(vLoc);
+	fq -= txSource.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+	fq -= txSource.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+	fq -= txSource.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+	fq -= txSource.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+	fq -= txSource.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+	fq -= txSource.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+	return fq;
+}
+
+static inline float4 SubtractGradient3D(const HostTexture3D<float4> &txVelocity,
+	const HostTexture3D<float> &txPressure, cfloat fDensity, cint3 &vLoc)
+{
+	const auto vVelocity = txVelocity(vLoc).xyz() - Gradient3D(txPressure, vLoc) / fDensity;
+
+	return float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f);
+}
+
+static inline int32_t ClampCoord(const int32_t i, const int32_t iBegin, const int32_t iEnd)
+{
+	return i < iBegin ? iBegin : (i >= iEnd ? iEnd - 1 : i);
+}
+
+// HostTexture3D::Sample of the whole grid, read from the window; z is clamped to the grid
+// as Sample does, and then to the window, which sets bOverflow
+template<typename T>
+static inline T SampleWindow(const HostTexture3D<T> &txSource, cfloat3 &vTex, const SlabWindow &window,
+	bool &bOverflow)
+{
+	const auto &vExtent = txSource.GetExtent();
+
+	// Texel-center convention: texel i covers [i, i + 1) / size
+	const auto vPos = vTex * float3(float(vExtent.x), float(vExtent.y), float(window.iDepth)) - 0.5f;
+	const auto vBase = floor(vPos);
+	const auto vFrac = vPos - vBase;
+
+	auto z0 = ClampCoord(int32_t(vBase.z), 0, window.iDepth), z1 = ClampCoord(int32_t(vBase.z) + 1, 0, window.iDepth);
+	bOverflow = z0 < window.iBegin || z1 >= window.iEnd;
+
+	const auto x0 = ClampCoord(int32_t(vBase.x), 0, vExtent.x), x1 = ClampCoord(int32_t(vBase.x) + 1, 0, vExtent.x);
+	const auto y0 = ClampCoord(int32_t(vBase.y), 0, vExtent.y), y1 = ClampCoord(int32_t(vBase.y) + 1, 0, vExtent.y);
+	z0 = ClampCoord(z0, window.iBegin, window.iEnd) - window.iBegin;
+	z1 = ClampCoord(z1, window.iBegin, window.iEnd) - window.iBegin;
+
+	const auto v00 = lerp(txSource(int3(x0, y0, z0)), txSource(int3(x1, y0, z0)), vFrac.x);
+	const auto v10 = lerp(txSource(int3(x0, y1, z0)), txSource(int3(x1, y1, z0)), vFrac.x);
+	const auto v01 = lerp(txSource(int3(x0, y0, z1)), txSource(int3(x1, y0, z1)), vFrac.x);
+	const auto v11 = lerp(txSource(int3(x0, y1, z1)), txSource(int3(x1, y1, z1)), vFrac.x);
+
+	return lerp(lerp(v00, v10, vFrac.y), lerp(v01, v11, vFrac.y), vFrac.z);
+}
+
+// Returns whether the trace left the window
+static inline bool Advect3D(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+	const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+	HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, const SlabWindow &window, cint3 &vLoc)
+{
+	const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z + window.iBegin));
+
+	// Velocity tracing
+	const auto vU = txVelocity(vLoc).xyz();
+	const auto vTex = (vPos + 0.5f) * vTexel - vU * fDeltaTime;
+
+	// Update velocity and density
+	auto bOverflow = false;
+	txPhiVelDst(vLoc) = SampleWindow(txPhiVel, vTex, window, bOverflow);
+	txPhiDenDst(vLoc) = SampleWindow(txPhiDen, vTex, window, bOverflow) * fDecay;
+
+	return bOverflow;
+}
+
+namespace Scalar
+{
+	static void laplacianRow(const HostTexture3D<float> &txSource, HostTexture3D<float> &txDst, cfloat fDiag,
+		cint3 &vLoc, const int32_t iWidth)
+	{
+		for (auto x = vLoc.x; x < vLoc.x + iWidth; ++x)
+		{
+			const auto vCell = int3(x, vLoc.y, vLoc.z);
+			txDst(vCell) = Laplacian3D(txSource, fDiag, vCell);
+		}
+	}
+
+	static void divergenceRow(const HostTexture3D<float4> &txSource, HostTexture3D<float> &txDst,
+		cint3 &vLoc, const int32_t iWidth)
+	{
+		for (auto x = vLoc.x; x < vLoc.x + iWidth; ++x)
+		{
+			const auto vCell = int3(x, vLoc.y, vLoc.z);
+			txDst(vCell) = Divergence3D(txSource, vCell);
+		}
+	}
+
+	static void subtractGradientRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txPressure,
+		cfloat fDensity, HostTexture3D<float4> &txDst, cint3 &vLoc, const int32_t iWidth)
+	{
+		for (auto x = vLoc.x; x < vLoc.x + iWidth; ++x)
+		{
+			const auto vCell = int3(x, vLoc.y, vLoc.z);
+			txDst(vCell) = SubtractGradient3D(txVelocity, txPressure, fDensity, vCell);
+		}
+	}
+
+	static uint32_t advectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+		const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+		HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, const SlabWindow &window,
+		cint3 &vLoc, const int32_t iWidth)
+	{
+		auto uOverflows = 0u;
+		for (auto x = vLoc.x; x < vLoc.x + iWidth; ++x)
+			uOverflows += Advect3D(txVelocity, txPhiVel, txPhiDen, vTexel, fDeltaTime, fDecay,
+				txPhiVelDst, txPhiDenDst, window, int3(x, vLoc.y, vLoc.z)) ? 1 : 0;
+
+		return uOverflows;
+	}
+}
+
+#if SIMD_X86
+
+//--------------------------------------------------------------------------------------
+// AVX2: 8 cells, and 2 float4 texels, per register. GCC and Clang compile this section
+// for AVX2 without raising the target of the rest; MSVC emits intrinsics as they are.
+// No FMA is enabled, so that products and sums round as in the per-cell code.
+//--------------------------------------------------------------------------------------
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace Avx2
+{
+	using vfloat = __m256;
+	using vint = __m256i;
+	static const int32_t N = 8;
+
+	static inline vfloat load(const float *p) { return _mm256_loadu_ps(p); }
+	static inline void store(float *p, const vfloat &v) { _mm256_storeu_ps(p, v); }
+	static inline vfloat splat(cfloat f) { return _mm256_set1_ps(f); }
+	static inline vfloat zero() { return _mm256_setzero_ps(); }
+	static inline vfloat add(const vfloat &a, const vfloat &b) { return _mm256_add_ps(a, b); }
+	static inline vfloat sub(const vfloat &a, const vfloat &b) { return _mm256_sub_ps(a, b); }
+	static inline vfloat mul(const vfloat &a, const vfloat &b) { return _mm256_mul_ps(a, b); }
+	static inline vfloat div(const vfloat &a, const vfloat &b) { return _mm256_div_ps(a, b); }
+	static inline vfloat roundDown(const vfloat &v) { return _mm256_floor_ps(v); }
+	static inline vfloat lerp(const vfloat &a, const vfloat &b, const vfloat &t)
+	{
+		return add(mul(sub(splat(1.0f), t), a), mul(t, b));
+	}
+
+	static inline vint splatInt(const int32_t i) { return _mm256_set1_epi32(i); }
+	static inline vint iota() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+	static inline vint addInt(const vint &a, const vint &b) { return _mm256_add_epi32(a, b); }
+	static inline vint mulInt(const vint &a, const vint &b) { return _mm256_mullo_epi32(a, b); }
+	static inline vint clampInt(const vint &v, const vint &vMax)
+	{
+		return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), vMax);
+	}
+	static inline vint toInt(const vfloat &v) { return _mm256_cvttps_epi32(v); }
+	static inline vfloat toFloat(const vint &v) { return _mm256_cvtepi32_ps(v); }
+	static inline void storeInt(int32_t *p, const vint &v) { _mm256_store_si256(reinterpret_cast<vint*>(p), v); }
+	static inline vfloat gather(const float *p, const vint &vIndices) { return _mm256_i32gather_ps(p, vIndices, 4); }
+
+	// The 2 texels at piTexels[0] and piTexels[1]
+	static inline vfloat load4(const float4 *pTexels, const int32_t *piTexels)
+	{
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&pTexels[piTexels[0]].x)),
+			_mm_loadu_ps(&pTexels[piTexels[1]].x), 1);
+	}
+
+	// 4 x 4 transpose within each 128-bit lane
+	static inline void transpose(const vfloat vIn[4], vfloat vOut[4])
+	{
+		const auto t0 = _mm256_unpacklo_ps(vIn[0], vIn[1]), t1 = _mm256_unpacklo_ps(vIn[2], vIn[3]);
+		const auto t2 = _mm256_unpackhi_ps(vIn[0], vIn[1]), t3 = _mm256_unpackhi_ps(vIn[2], vIn[3]);
+		vOut[0] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+		vOut[1] = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+		vOut[2] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		vOut[3] = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	}
+
+	// Texels 0-7, 2 per register, to x, y, z and w of texels 0-7
+	static inline void toSoA(const vfloat vTexels[4], vfloat vComps[4])
+	{
+		const vfloat vPairs[] =
+		{
+			_mm256_permute2f128_ps(vTexels[0], vTexels[2], 0x20),	// Texels 0 and 4
+			_mm256_permute2f128_ps(vTexels[0], vTexels[2], 0x31),	// 1 and 5
+			_mm256_permute2f128_ps(vTexels[1], vTexels[3], 0x20),	// 2 and 6
+			_mm256_permute2f128_ps(vTexels[1], vTexels[3], 0x31)	// 3 and 7
+		};
+		transpose(vPairs, vComps);
+	}
+
+	static inline void toAoS(const vfloat vComps[4], vfloat vTexels[4])
+	{
+		vfloat vPairs[4];
+		transpose(vComps, vPairs);
+		vTexels[0] = _mm256_permute2f128_ps(vPairs[0], vPairs[1], 0x20);
+		vTexels[1] = _mm256_permute2f128_ps(vPairs[2], vPairs[3], 0x20);
+		vTexels[2] = _mm256_permute2f128_ps(vPairs[0], vPairs[1], 0x31);
+		vTexels[3] = _mm256_permute2f128_ps(vPairs[2], vPairs[3], 0x31);
+	}
+
+	// Component c of texels 0-7, 2 per register
+	template<uint32_t c>
+	static inline vfloat component(const vfloat vTexels[4])
+	{
+		// Texels (0, 2 | 1, 3) and (4, 6 | 5, 7), then (0, 2, 4, 6 | 1, 3, 5, 7)
+		const auto t0 = _mm256_shuffle_ps(vTexels[0], vTexels[1], _MM_SHUFFLE(c, c, c, c));
+		const auto t1 = _mm256_shuffle_ps(vTexels[2], vTexels[3], _MM_SHUFFLE(c, c, c, c));
+		const auto t = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+
+		return _mm256_permutevar8x32_ps(t, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+	}
+
+#include "HostKernels.inl"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+//--------------------------------------------------------------------------------------
+// AVX-512F: 16 cells, and 4 float4 texels, per register. AVX-512F brings FMA along,
+// and GCC may fuse the intrinsics in its GNU modes, so contraction is turned off.
+//--------------------------------------------------------------------------------------
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#pragma GCC optimize("fp-contract=off")
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"		// _mm512_undefined_ps() in the headers of GCC 12
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace Avx512
+{
+	using vfloat = __m512;
+	using vint = __m512i;
+	static const int32_t N = 16;
+
+	static inline vfloat load(const float *p) { return _mm512_loadu_ps(p); }
+	static inline void store(float *p, const vfloat &v) { _mm512_storeu_ps(p, v); }
+	static inline vfloat splat(cfloat f) { return _mm512_set1_ps(f); }
+	static inline vfloat zero() { return _mm512_setzero_ps(); }
+	static inline vfloat add(const vfloat &a, const vfloat &b) { return _mm512_add_ps(a, b); }
+	static inline vfloat sub(const vfloat &a, const vfloat &b) { return _mm512_sub_ps(a, b); }
+	static inline vfloat mul(const vfloat &a, const vfloat &b) { return _mm512_mul_ps(a, b); }
+	static inline vfloat div(const vfloat &a, const vfloat &b) { return _mm512_div_ps(a, b); }
+	static inline vfloat roundDown(const vfloat &v)
+	{
+		return _mm512_roundscale_ps(v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+	}
+	static inline vfloat lerp(const vfloat &a, const vfloat &b, const vfloat &t)
+	{
+		return add(mul(sub(splat(1.0f), t), a), mul(t, b));
+	}
+
+	static inline vint splatInt(const int32_t i) { return _mm512_set1_epi32(i); }
+	static inline vint iota() { return _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15); }
+	static inline vint addInt(const vint &a, const vint &b) { return _mm512_add_epi32(a, b); }
+	static inline vint mulInt(const vint &a, const vint &b) { return _mm512_mullo_epi32(a, b); }
+	static inline vint clampInt(const vint &v, const vint &vMax)
+	{
+		return _mm512_min_epi32(_mm512_max_epi32(v, _mm512_setzero_si512()), vMax);
+	}
+	static inline vint toInt(const vfloat &v) { return _mm512_cvttps_epi32(v); }
+	static inline vfloat toFloat(const vint &v) { return _mm512_cvtepi32_ps(v); }
+	static inline void storeInt(int32_t *p, const vint &v) { _mm512_store_si512(p, v); }
+	static inline vfloat gather(const float *p, const vint &vIndices) { return _mm512_i32gather_ps(vIndices, p, 4); }
+
+	// The 4 texels at piTexels[0] to piTexels[3]
+	static inline vfloat load4(const float4 *pTexels, const int32_t *piTexels)
+	{
+		auto v = _mm512_castps128_ps512(_mm_loadu_ps(&pTexels[piTexels[0]].x));
+		v = _mm512_insertf32x4(v, _mm_loadu_ps(&pTexels[piTexels[1]].x), 1);
+		v = _mm512_insertf32x4(v, _mm_loadu_ps(&pTexels[piTexels[2]].x), 2);
+
+		return _mm512_insertf32x4(v, _mm_loadu_ps(&pTexels[piTexels[3]].x), 3);
+	}
+
+	// 4 x 4 transpose within each 128-bit lane
+	static inline void transpose(const vfloat vIn[4], vfloat vOut[4])
+	{
+		const auto t0 = _mm512_unpacklo_ps(vIn[0], vIn[1]), t1 = _mm512_unpacklo_ps(vIn[2], vIn[3]);
+		const auto t2 = _mm512_unpackhi_ps(vIn[0], vIn[1]), t3 = _mm512_unpackhi_ps(vIn[2], vIn[3]);
+		vOut[0] = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+		vOut[1] = _mm512_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+		vOut[2] = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		vOut[3] = _mm512_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	}
+
+	// 4 x 4 transpose of the 128-bit lanes: lane j of register i goes to lane i of register j
+	static inline void transposeLanes(const vfloat vIn[4], vfloat vOut[4])
+	{
+		const auto t0 = _mm512_shuffle_f32x4(vIn[0], vIn[1], _MM_SHUFFLE(2, 0, 2, 0));
+		const auto t1 = _mm512_shuffle_f32x4(vIn[0], vIn[1], _MM_SHUFFLE(3, 1, 3, 1));
+		const auto t2 = _mm512_shuffle_f32x4(vIn[2], vIn[3], _MM_SHUFFLE(2, 0, 2, 0));
+		const auto t3 = _mm512_shuffle_f32x4(vIn[2], vIn[3], _MM_SHUFFLE(3, 1, 3, 1));
+		vOut[0] = _mm512_shuffle_f32x4(t0, t2, _MM_SHUFFLE(2, 0, 2, 0));
+		vOut[1] = _mm512_shuffle_f32x4(t1, t3, _MM_SHUFFLE(2, 0, 2, 0));
+		vOut[2] = _mm512_shuffle_f32x4(t0, t2, _MM_SHUFFLE(3, 1, 3, 1));
+		vOut[3] = _mm512_shuffle_f32x4(t1, t3, _MM_SHUFFLE(3, 1, 3, 1));
+	}
+
+	// Texels 0-15, 4 per register, to x, y, z and w of texels 0-15
+	static inline void toSoA(const vfloat vTexels[4], vfloat vComps[4])
+	{
+		vfloat vQuads[4];
+		transposeLanes(vTexels, vQuads);
+		transpose(vQuads, vComps);
+	}
+
+	static inline void toAoS(const vfloat vComps[4], vfloat vTexels[4])
+	{
+		vfloat vQuads[4];
+		transpose(vComps, vQuads);
+		transposeLanes(vQuads, vTexels);
+	}
+
+	// Component c of texels 0-15, 4 per register
+	template<uint32_t c>
+	static inline vfloat component(const vfloat vTexels[4])
+	{
+		// Every fourth float of 2 registers goes to the lower half, or the upper half
+		const auto viLow = _mm512_setr_epi32(c, c + 4, c + 8, c + 12, c + 16, c + 20, c + 24, c + 28,
+			0, 0, 0, 0, 0, 0, 0, 0);
+		const auto viHigh = _mm512_setr_epi32(0, 0, 0, 0, 0, 0, 0, 0,
+			c, c + 4, c + 8, c + 12, c + 16, c + 20, c + 24, c + 28);
+
+		return _mm512_mask_blend_ps(0xff00, _mm512_permutex2var_ps(vTexels[0], viLow, vTexels[1]),
+			_mm512_permutex2var_ps(vTexels[2], viHigh, vTexels[3]));
+	}
+
+#include "HostKernels.inl"
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+#endif
+
+//--------------------------------------------------------------------------------------
+// Dispatch
+//--------------------------------------------------------------------------------------
+
+struct KernelTable
+{
+	int32_t									iLanes;
+	decltype(&Scalar::laplacianRow)			pLaplacianRow;
+	decltype(&Scalar::divergenceRow)		pDivergenceRow;
+	decltype(&Scalar::subtractGradientRow)	pSubtractGradientRow;
+	decltype(&Scalar::advectRow)			pAdvectRow;
+};
+
+static const KernelTable g_kernelTables[] =
+{
+	{ 1, Scalar::laplacianRow, Scalar::divergenceRow, Scalar::subtractGradientRow, Scalar::advectRow },
+#if SIMD_X86
+	{ Avx2::N, Avx2::laplacianRow, Avx2::divergenceRow, Avx2::subtractGradientRow, Avx2::advectRow },
+	{ Avx512::N, Avx512::laplacianRow, Avx512::divergenceRow, Avx512::subtractGradientRow, Avx512::advectRow }
+#endif
+};
+
+static const auto g_supportedSimdLevel = DetectSimdLevel();
+static auto g_simdLevel = g_supportedSimdLevel;
+
+// The kernels of the current level, or the scalar ones for a row shorter than a vector,
+// which the vector kernels would do cell by cell anyway, at the cost of a state transition
+static const KernelTable &kernels(const int32_t iWidth)
+{
+	const auto &table = g_kernelTables[g_simdLevel];
+
+	return iWidth < table.iLanes ? g_kernelTables[SIMD_SCALAR] : table;
+}
+
+void LaplacianRow(const HostTexture3D<float> &txSource, HostTexture3D<float> &txDst, cfloat fDiag,
+	cint3 &vLoc, const int32_t iWidth)
+{
+	kernels(iWidth).pLaplacianRow(txSource, txDst, fDiag, vLoc, iWidth);
+}
+
+void DivergenceRow(const HostTexture3D<float4> &txSource, HostTexture3D<float> &txDst,
+	cint3 &vLoc, const int32_t iWidth)
+{
+	kernels(iWidth).pDivergenceRow(txSource, txDst, vLoc, iWidth);
+}
+
+void SubtractGradientRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txPressure,
+	cfloat fDensity, HostTexture3D<float4> &txDst, cint3 &vLoc, const int32_t iWidth)
+{
+	kernels(iWidth).pSubtractGradientRow(txVelocity, txPressure, fDensity, txDst, vLoc, iWidth);
+}
+
+void ProjectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txPressure,
+	cfloat fDensity, HostTexture3D<float4> &txDst, const SlabWindow &window, cint3 &vLoc, const int32_t iWidth)
+{
+	const auto &vExtent = txDst.GetExtent();
+	const auto vMax = int3(vExtent.x - 1, vExtent.y - 1, window.iDepth - 1);
+	const auto iZ = vLoc.z + window.iBegin;
+
+	const auto subtract = [&](cint3 &vCell)
+	{
+		// Cells on the domain faces mirror their inward neighbor with the opposite sign
+		const auto vOffset = int3
+		(
+			vCell.x >= vMax.x ? -1 : (vCell.x <= 0 ? 1 : 0),
+			vCell.y >= vMax.y ? -1 : (vCell.y <= 0 ? 1 : 0),
+			iZ >= vMax.z ? -1 : (iZ <= 0 ? 1 : 0)
+		);
+		const auto vSrc = int3(vCell.x + vOffset.x, vCell.y + vOffset.y, vCell.z + vOffset.z);
+
+		// Project the velocity onto its divergence-free component
+		auto vVelocity = txVelocity(vSrc).xyz() - Gradient3D(txPressure, vSrc) / fDensity;
+		if (vOffset.x || vOffset.y || vOffset.z) vVelocity = -vVelocity;
+		txDst(vCell) = float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f);
+	};
+
+	// The interior of the row goes to the row kernel, the faces take the mirror
+	const auto bInterior = vLoc.y > 0 && vLoc.y < vMax.y && iZ > 0 && iZ < vMax.z;
+	const auto iEnd = vLoc.x + iWidth;
+	const auto iBegin = bInterior ? min(max(vLoc.x, 1), iEnd) : iEnd;
+	const auto iInterior = max(min(iEnd, vMax.x) - iBegin, 0);
+
+	for (auto x = vLoc.x; x < iBegin; ++x) subtract(int3(x, vLoc.y, vLoc.z));
+	if (iInterior > 0) SubtractGradientRow(txVelocity, txPressure, fDensity, txDst,
+		int3(iBegin, vLoc.y, vLoc.z), iInterior);
+	for (auto x = iBegin + iInterior; x < iEnd; ++x) subtract(int3(x, vLoc.y, vLoc.z));
+}
+
+void AdvectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+	const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+	HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, cint3 &vLoc, const int32_t iWidth)
+{
+	// Both fields are sampled on the grid of txPhiVel
+	const auto iDepth = txPhiVel.GetExtent().z;
+	kernels(iWidth).pAdvectRow(txVelocity, txPhiVel, txPhiDen, vTexel, fDeltaTime, fDecay,
+		txPhiVelDst, txPhiDenDst, SlabWindow{ iDepth, 0, iDepth }, vLoc, iWidth);
+}
+
+uint32_t AdvectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+	const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+	HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, const SlabWindow &window,
+	cint3 &vLoc, const int32_t iWidth)
+{
+	return kernels(iWidth).pAdvectRow(txVelocity, txPhiVel, txPhiDen, vTexel, fDeltaTime, fDecay,
+		txPhiVelDst, txPhiDenDst, window, vLoc, iWidth);
+}
+
+SimdLevel GetSupportedSimdLevel()
+{
+	return g_supportedSimdLevel;
+}
+
+SimdLevel GetSimdLevel()
+{
+	return g_simdLevel;
+}
+
+bool SetSimdLevel(const SimdLevel level)
+{
+	if (level > g_supportedSimdLevel) return false;
+	g_simdLevel = level;
+
+	return true;
+}
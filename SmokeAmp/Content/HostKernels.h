@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Common/HostSimd.h"
+#include "HostTexture.h"
+
+//--------------------------------------------------------------------------------------
+// Vectorized host kernels of the stencils and the semi-Lagrangian sampling. Each runs
+// iWidth cells of a row along x, from vLoc on, 8 cells per instruction with AVX2 or 16
+// with AVX-512, and falls back to the per-cell code on other CPUs and at the grid edges.
+// The arithmetic is that of HostFieldMath.h and HostTexture3D, lane by lane in the same
+// order, so every level gives the same bits as long as the compiler does not contract
+// multiply-adds (MSVC's /fp:precise and GCC's ISO modes do not); only NaNs, once a
+// simulation has blown up, may differ in sign or payload. The destinations must not be
+// the sources, since cells may be written twice. The level is detected once;
+// SetSimdLevel() picks a lower one, e.g. to compare them.
+//--------------------------------------------------------------------------------------
+
+// The slices of a grid iDepth deep that the textures of a kernel hold: [iBegin, iEnd), with
+// iBegin at vLoc.z = 0, e.g. a slab of HostFluid3DSlab with its halos; or the whole grid
+struct SlabWindow
+{
+	int32_t	iDepth;
+	int32_t	iBegin;
+	int32_t	iEnd;
+};
+
+// The 7-point Laplacian of the PCG operator product: fDiag * p minus the 6 neighbors,
+// which are zero beyond the grid
+void LaplacianRow(const HostTexture3D<float> &txSource, HostTexture3D<float> &txDst, cfloat fDiag,
+	cint3 &vLoc, const int32_t iWidth);
+
+// Divergence3D
+void DivergenceRow(const HostTexture3D<float4> &txSource, HostTexture3D<float> &txDst,
+	cint3 &vLoc, const int32_t iWidth);
+
+// The velocity minus Gradient3D of the pressure over fDensity, with w = 0. Only for cells
+// whose 6 neighbors are all in the grid; the faces mirror their neighbors instead.
+void SubtractGradientRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txPressure,
+	cfloat fDensity, HostTexture3D<float4> &txDst, cint3 &vLoc, const int32_t iWidth);
+
+// SubtractGradientRow for any row of the window, with the wall boundary: the cells on the
+// faces of the grid mirror their inward neighbor with the opposite sign
+void ProjectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txPressure,
+	cfloat fDensity, HostTexture3D<float4> &txDst, const SlabWindow &window, cint3 &vLoc, const int32_t iWidth);
+
+// Semi-Lagrangian advection: traces each cell back along txVelocity over fDeltaTime and
+// samples velocity and density there, the density scaled by fDecay
+void AdvectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+	const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+	HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, cint3 &vLoc, const int32_t iWidth);
+// The same within a window; traces that leave it are clamped to it, and counted in the result
+uint32_t AdvectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+	const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+	HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, const SlabWindow &window,
+	cint3 &vLoc, const int32_t iWidth);
+
+// The level the CPU supports, and the one the kernels run at (the former by default)
+SimdLevel GetSupportedSimdLevel();
+SimdLevel GetSimdLevel();
+// Fails if the CPU lacks the level
+bool SetSimdLevel(const SimdLevel level);
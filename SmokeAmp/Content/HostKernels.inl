@@ -0,0 +1,276 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// The vectorized row kernels, written once against the lane type vfloat of N cells and
+// its primitives. HostKernels.cpp includes this file inside the namespace of each
+// instruction set, where the compiler targets that set. A row that does not split into
+// whole vectors ends with one overlapping the one before it, so the kernels must not
+// write their sources; only the cells at the grid edges and rows shorter than a vector
+// go through the per-cell code.
+//--------------------------------------------------------------------------------------
+
+// Runs block(x) for vectors from iX on up to iEnd, the last one ending at iEnd, and
+// leaves iX past the cells done
+template<typename F>
+static inline void forEachVector(int32_t &iX, const int32_t iEnd, const F &block)
+{
+	if (iEnd - iX < N) return;
+
+	for (; iX + N <= iEnd; iX += N) block(iX);
+	if (iX < iEnd) block(iEnd - N);
+	iX = iEnd;
+}
+
+// Component c of N consecutive texels
+template<uint32_t c>
+static inline vfloat loadComponent(const float4 *pTexels)
+{
+	vfloat vTexels[4];
+	for (auto i = 0; i < 4; ++i) vTexels[i] = load(&pTexels[i * N / 4].x);
+
+	return component<c>(vTexels);
+}
+
+// N texels at the indices in piTexels, as x, y, z and w vectors
+static inline void loadTexels(const float4 *pTexels, const int32_t *piTexels, vfloat vComps[4])
+{
+	vfloat vTexels[4];
+	for (auto i = 0; i < 4; ++i) vTexels[i] = load4(pTexels, &piTexels[i * N / 4]);
+	toSoA(vTexels, vComps);
+}
+
+// Texels at the indices of two corners along x, interpolated per component
+static inline void lerpTexels(const float4 *pTexels, const int32_t *piTexels0, const int32_t *piTexels1,
+	const vfloat &vFrac, vfloat vComps[4])
+{
+	vfloat vTexels0[4], vTexels1[4];
+	loadTexels(pTexels, piTexels0, vTexels0);
+	loadTexels(pTexels, piTexels1, vTexels1);
+	for (auto i = 0; i < 4; ++i) vComps[i] = lerp(vTexels0[i], vTexels1[i], vFrac);
+}
+
+static void laplacianRow(const HostTexture3D<float> &txSource, HostTexture3D<float> &txDst, cfloat fDiag,
+	cint3 &vLoc, const int32_t iWidth)
+{
+	const auto &vExtent = txSource.GetExtent();
+	const auto uRow = (static_cast<size_t>(vLoc.z) * vExtent.y + vLoc.y) * vExtent.x;
+	const auto uSlice = static_cast<size_t>(vExtent.x) * vExtent.y;
+
+	// Neighbor rows, or none beyond the grid
+	const auto pCenter = &txSource.GetData()[uRow];
+	const auto pUp = vLoc.y > 0 ? pCenter - vExtent.x : nullptr;
+	const auto pDown = vLoc.y + 1 < vExtent.y ? pCenter + vExtent.x : nullptr;
+	const auto pFront = vLoc.z > 0 ? pCenter - uSlice : nullptr;
+	const auto pBack = vLoc.z + 1 < vExtent.z ? pCenter + uSlice : nullptr;
+	const auto pDst = &txDst.GetData()[uRow];
+
+	const auto iEnd = vLoc.x + iWidth;
+	auto iX = vLoc.x;
+	for (; iX < iEnd && iX < 1; ++iX) pDst[iX] = Laplacian3D(txSource, fDiag, int3(iX, vLoc.y, vLoc.z));
+
+	const auto vDiag = splat(fDiag);
+	forEachVector(iX, min(iEnd, vExtent.x - 1), [&](const int32_t x)
+	{
+		auto vq = mul(vDiag, load(&pCenter[x]));
+		vq = sub(vq, load(&pCenter[x - 1]));
+		vq = sub(vq, load(&pCenter[x + 1]));
+		vq = sub(vq, pUp ? load(&pUp[x]) : zero());
+		vq = sub(vq, pDown ? load(&pDown[x]) : zero());
+		vq = sub(vq, pFront ? load(&pFront[x]) : zero());
+		vq = sub(vq, pBack ? load(&pBack[x]) : zero());
+		store(&pDst[x], vq);
+	});
+
+	for (; iX < iEnd; ++iX) pDst[iX] = Laplacian3D(txSource, fDiag, int3(iX, vLoc.y, vLoc.z));
+}
+
+static void divergenceRow(const HostTexture3D<float4> &txSource, HostTexture3D<float> &txDst,
+	cint3 &vLoc, const int32_t iWidth)
+{
+	const auto &vExtent = txSource.GetExtent();
+	const auto uRow = (static_cast<size_t>(vLoc.z) * vExtent.y + vLoc.y) * vExtent.x;
+	const auto uSlice = static_cast<size_t>(vExtent.x) * vExtent.y;
+
+	const auto pCenter = &txSource.GetData()[uRow];
+	const auto pUp = vLoc.y > 0 ? pCenter - vExtent.x : nullptr;
+	const auto pDown = vLoc.y + 1 < vExtent.y ? pCenter + vExtent.x : nullptr;
+	const auto pFront = vLoc.z > 0 ? pCenter - uSlice : nullptr;
+	const auto pBack = vLoc.z + 1 < vExtent.z ? pCenter + uSlice : nullptr;
+	const auto pDst = &txDst.GetData()[uRow];
+
+	const auto iEnd = vLoc.x + iWidth;
+	auto iX = vLoc.x;
+	for (; iX < iEnd && iX < 1; ++iX) pDst[iX] = Divergence3D(txSource, int3(iX, vLoc.y, vLoc.z));
+
+	forEachVector(iX, min(iEnd, vExtent.x - 1), [&](const int32_t x)
+	{
+		const auto vxL = loadComponent<0>(&pCenter[x - 1]);
+		const auto vxR = loadComponent<0>(&pCenter[x + 1]);
+		const auto vyU = pUp ? loadComponent<1>(&pUp[x]) : zero();
+		const auto vyD = pDown ? loadComponent<1>(&pDown[x]) : zero();
+		const auto vzF = pFront ? loadComponent<2>(&pFront[x]) : zero();
+		const auto vzB = pBack ? loadComponent<2>(&pBack[x]) : zero();
+
+		// Take central differences of neighboring values
+		const auto vSum = sub(add(sub(add(sub(vxR, vxL), vyD), vyU), vzB), vzF);
+		store(&pDst[x], mul(splat(0.5f), vSum));
+	});
+
+	for (; iX < iEnd; ++iX) pDst[iX] = Divergence3D(txSource, int3(iX, vLoc.y, vLoc.z));
+}
+
+static void subtractGradientRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float> &txPressure,
+	cfloat fDensity, HostTexture3D<float4> &txDst, cint3 &vLoc, const int32_t iWidth)
+{
+	const auto &vExtent = txPressure.GetExtent();
+	const auto uRow = (static_cast<size_t>(vLoc.z) * vExtent.y + vLoc.y) * vExtent.x;
+	const auto uSlice = static_cast<size_t>(vExtent.x) * vExtent.y;
+
+	// The cells are interior, so every neighbor row exists
+	const auto pVelocity = &txVelocity.GetData()[uRow];
+	const auto pCenter = &txPressure.GetData()[uRow];
+	const auto pUp = pCenter - vExtent.x, pDown = pCenter + vExtent.x;
+	const auto pFront = pCenter - uSlice, pBack = pCenter + uSlice;
+	const auto pDst = &txDst.GetData()[uRow];
+
+	const auto iEnd = vLoc.x + iWidth;
+	const auto vHalf = splat(0.5f);
+	const auto vDensity = splat(fDensity);
+	auto iX = vLoc.x;
+	forEachVector(iX, iEnd, [&](const int32_t x)
+	{
+		const auto vGradX = mul(vHalf, sub(load(&pCenter[x + 1]), load(&pCenter[x - 1])));
+		const auto vGradY = mul(vHalf, sub(load(&pDown[x]), load(&pUp[x])));
+		const auto vGradZ = mul(vHalf, sub(load(&pBack[x]), load(&pFront[x])));
+
+		vfloat vTexels[4], vComps[4];
+		for (auto i = 0; i < 4; ++i) vTexels[i] = load(&pVelocity[x + i * N / 4].x);
+		toSoA(vTexels, vComps);
+
+		// Project the velocity onto its divergence-free component
+		vComps[0] = sub(vComps[0], div(vGradX, vDensity));
+		vComps[1] = sub(vComps[1], div(vGradY, vDensity));
+		vComps[2] = sub(vComps[2], div(vGradZ, vDensity));
+		vComps[3] = zero();
+
+		toAoS(vComps, vTexels);
+		for (auto i = 0; i < 4; ++i) store(&pDst[x + i * N / 4].x, vTexels[i]);
+	});
+
+	for (; iX < iEnd; ++iX) pDst[iX] = SubtractGradient3D(txVelocity, txPressure, fDensity, int3(iX, vLoc.y, vLoc.z));
+}
+
+static uint32_t advectRow(const HostTexture3D<float4> &txVelocity, const HostTexture3D<float4> &txPhiVel,
+	const HostTexture3D<float> &txPhiDen, cfloat3 &vTexel, cfloat fDeltaTime, cfloat fDecay,
+	HostTexture3D<float4> &txPhiVelDst, HostTexture3D<float> &txPhiDenDst, const SlabWindow &window,
+	cint3 &vLoc, const int32_t iWidth)
+{
+	const auto &vExtent = txVelocity.GetExtent();
+	const auto uRow = (static_cast<size_t>(vLoc.z) * vExtent.y + vLoc.y) * vExtent.x;
+	const auto pVelocity = &txVelocity.GetData()[uRow];
+	const auto pPhiVel = txPhiVel.GetData();
+	const auto pPhiDen = txPhiDen.GetData();
+	const auto pPhiVelDst = &txPhiVelDst.GetData()[uRow];
+	const auto pPhiDenDst = &txPhiDenDst.GetData()[uRow];
+
+	// Both fields are sampled on the grid of txPhiVel, z on the whole grid and then in the window
+	const auto &vSize = txPhiVel.GetExtent();
+	const auto vSizeX = splat(float(vSize.x)), vSizeY = splat(float(vSize.y)), vSizeZ = splat(float(window.iDepth));
+	const auto viMaxX = splatInt(vSize.x - 1), viMaxY = splatInt(vSize.y - 1), viMaxZ = splatInt(window.iDepth - 1);
+	const auto viSizeX = splatInt(vSize.x), viSizeY = splatInt(vSize.y);
+	const auto viBegin = splatInt(-window.iBegin), viMaxWindow = splatInt(window.iEnd - 1 - window.iBegin);
+	const auto bWindow = window.iBegin > 0 || window.iEnd < window.iDepth;
+
+	// The trace starts at the texel center, the same for the whole row along y and z
+	const auto vStartY = splat((float(vLoc.y) + 0.5f) * vTexel.y);
+	const auto vStartZ = splat((float(vLoc.z + window.iBegin) + 0.5f) * vTexel.z);
+	const auto vDeltaTime = splat(fDeltaTime);
+	const auto vHalf = splat(0.5f);
+
+	const auto iEnd = vLoc.x + iWidth;
+	auto iX = vLoc.x, iCounted = vLoc.x;
+	auto uOverflows = 0u;
+	forEachVector(iX, iEnd, [&](const int32_t x)
+	{
+		// Velocity tracing
+		vfloat vTexels[4], vU[4];
+		for (auto i = 0; i < 4; ++i) vTexels[i] = load(&pVelocity[x + i * N / 4].x);
+		toSoA(vTexels, vU);
+
+		const auto vPosX = toFloat(addInt(splatInt(x), iota()));
+		const auto vTexX = sub(mul(add(vPosX, vHalf), splat(vTexel.x)), mul(vU[0], vDeltaTime));
+		const auto vTexY = sub(vStartY, mul(vU[1], vDeltaTime));
+		const auto vTexZ = sub(vStartZ, mul(vU[2], vDeltaTime));
+
+		// HostTexture3D::Sample: texel-center convention, clamp addressing
+		const auto vSamX = sub(mul(vTexX, vSizeX), vHalf);
+		const auto vSamY = sub(mul(vTexY, vSizeY), vHalf);
+		const auto vSamZ = sub(mul(vTexZ, vSizeZ), vHalf);
+		const auto vBaseX = roundDown(vSamX), vBaseY = roundDown(vSamY), vBaseZ = roundDown(vSamZ);
+		const auto vFracX = sub(vSamX, vBaseX), vFracY = sub(vSamY, vBaseY), vFracZ = sub(vSamZ, vBaseZ);
+
+		const auto viBaseX = toInt(vBaseX), viBaseY = toInt(vBaseY), viBaseZ = toInt(vBaseZ);
+		const auto viX0 = clampInt(viBaseX, viMaxX), viX1 = clampInt(addInt(viBaseX, splatInt(1)), viMaxX);
+		const auto viY0 = clampInt(viBaseY, viMaxY), viY1 = clampInt(addInt(viBaseY, splatInt(1)), viMaxY);
+		auto viZ0 = clampInt(viBaseZ, viMaxZ), viZ1 = clampInt(addInt(viBaseZ, splatInt(1)), viMaxZ);
+
+		// Count the traces the window clamps, each cell once though the last vector overlaps
+		if (bWindow)
+		{
+			alignas(64) int32_t iZ0[N], iZ1[N];
+			storeInt(iZ0, viZ0);
+			storeInt(iZ1, viZ1);
+			for (auto i = max(iCounted - x, 0); i < N; ++i)
+				uOverflows += iZ0[i] < window.iBegin || iZ1[i] >= window.iEnd ? 1 : 0;
+			iCounted = x + N;
+		}
+		viZ0 = clampInt(addInt(viZ0, viBegin), viMaxWindow);
+		viZ1 = clampInt(addInt(viZ1, viBegin), viMaxWindow);
+
+		// Texel indices of the 8 corners, in the order x, then y, then z
+		const vint viRows[] =
+		{
+			mulInt(addInt(mulInt(viZ0, viSizeY), viY0), viSizeX),
+			mulInt(addInt(mulInt(viZ0, viSizeY), viY1), viSizeX),
+			mulInt(addInt(mulInt(viZ1, viSizeY), viY0), viSizeX),
+			mulInt(addInt(mulInt(viZ1, viSizeY), viY1), viSizeX)
+		};
+		vint viCorners[8];
+		alignas(64) int32_t iCorners[8][N];
+		for (auto i = 0; i < 4; ++i)
+		{
+			viCorners[2 * i] = addInt(viRows[i], viX0);
+			viCorners[2 * i + 1] = addInt(viRows[i], viX1);
+			storeInt(iCorners[2 * i], viCorners[2 * i]);
+			storeInt(iCorners[2 * i + 1], viCorners[2 * i + 1]);
+		}
+
+		// Velocity: v00, v10, v01 and v11 along x, then along y and z
+		vfloat v00[4], v10[4], v01[4], v11[4];
+		lerpTexels(pPhiVel, iCorners[0], iCorners[1], vFracX, v00);
+		lerpTexels(pPhiVel, iCorners[2], iCorners[3], vFracX, v10);
+		lerpTexels(pPhiVel, iCorners[4], iCorners[5], vFracX, v01);
+		lerpTexels(pPhiVel, iCorners[6], iCorners[7], vFracX, v11);
+		for (auto i = 0; i < 4; ++i)
+			vTexels[i] = lerp(lerp(v00[i], v10[i], vFracY), lerp(v01[i], v11[i], vFracY), vFracZ);
+
+		vfloat vPhiVel[4];
+		toAoS(vTexels, vPhiVel);
+		for (auto i = 0; i < 4; ++i) store(&pPhiVelDst[x + i * N / 4].x, vPhiVel[i]);
+
+		// Density
+		const auto vDen00 = lerp(gather(pPhiDen, viCorners[0]), gather(pPhiDen, viCorners[1]), vFracX);
+		const auto vDen10 = lerp(gather(pPhiDen, viCorners[2]), gather(pPhiDen, viCorners[3]), vFracX);
+		const auto vDen01 = lerp(gather(pPhiDen, viCorners[4]), gather(pPhiDen, viCorners[5]), vFracX);
+		const auto vDen11 = lerp(gather(pPhiDen, viCorners[6]), gather(pPhiDen, viCorners[7]), vFracX);
+		const auto vDen = lerp(lerp(vDen00, vDen10, vFracY), lerp(vDen01, vDen11, vFracY), vFracZ);
+		store(&pPhiDenDst[x], mul(vDen, splat(fDecay)));
+	});
+
+	for (; iX < iEnd; ++iX) uOverflows += Advect3D(txVelocity, txPhiVel, txPhiDen, vTexel, fDeltaTime, fDecay,
+		txPhiVelDst, txPhiDenDst, window, int3(iX, vLoc.y, vLoc.z)) ? 1 : 0;
+
+	return uOverflows;
+}
@@ -0,0 +1,202 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include "Common/HostThreadPool.h"
+#include "Common/Trace.h"
+#include "HostFieldMath.h"
+#include "HostKernels.h"
+#include "BrickMap.h"
+#include "PoissonSolver.h"
+
+// Host counterpart of parallel_for_each over a 3D extent, distributing z-slabs to the pool
+template<typename F>
+inline void ParallelForEach(HostThreadPool &threadPool, cint3 &vExtent, const F &func)
+{
+	threadPool.ParallelFor(0, vExtent.z, [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y)
+			for (auto x = 0; x < vExtent.x; ++x)
+				func(int3(x, y, z));
+	});
+}
+
+// The same over whole rows along x, for the row kernels: func(vLoc, iWidth) from x = 0
+template<typename F>
+inline void ParallelForEachRow(HostThreadPool &threadPool, cint3 &vExtent, const F &func)
+{
+	threadPool.ParallelFor(0, vExtent.z, [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y) func(int3(0, y, z), vExtent.x);
+	});
+}
+
+// First cell of a packed brick
+inline int3 BrickOrigin(const uint32_t uBrick)
+{
+	return int3((uBrick & BRICK_MASK) * BRICK_SIZE, ((uBrick >> BRICK_BITS) & BRICK_MASK) * BRICK_SIZE,
+		(uBrick >> 2 * BRICK_BITS) * BRICK_SIZE);
+}
+
+// The same over the cells of the listed bricks, a brick per task, clipped to the grid
+template<typename F>
+inline void ParallelForEachBrick(HostThreadPool &threadPool, cint3 &vExtent, const std::vector<uint32_t> &bricks,
+	const F &func)
+{
+	threadPool.ParallelFor(0, static_cast<int32_t>(bricks.size()), [&](const int32_t i)
+	{
+		const auto vOrigin = BrickOrigin(bricks[i]);
+		const auto vEnd = int3((std::min)(vOrigin.x + BRICK_SIZE, vExtent.x),
+			(std::min)(vOrigin.y + BRICK_SIZE, vExtent.y), (std::min)(vOrigin.z + BRICK_SIZE, vExtent.z));
+
+		for (auto z = vOrigin.z; z < vEnd.z; ++z)
+			for (auto y = vOrigin.y; y < vEnd.y; ++y)
+				for (auto x = vOrigin.x; x < vEnd.x; ++x)
+					func(int3(x, y, z));
+	});
+}
+
+// And over the rows along x of runs of live bricks, a run per task: func(vLoc, iWidth) from
+// the run's first x. Rows as long as the runs keep the row kernels in their vector loops.
+template<typename F>
+inline void ParallelForEachBrickRow(HostThreadPool &threadPool, cint3 &vExtent, const std::vector<BrickRun> &runs,
+	const F &func)
+{
+	threadPool.ParallelFor(0, static_cast<int32_t>(runs.size()), [&](const int32_t i)
+	{
+		const auto vOrigin = BrickOrigin(runs[i].uBrick);
+		const auto vEnd = int3((std::min)(vOrigin.x + static_cast<int32_t>(runs[i].uLength) * BRICK_SIZE, vExtent.x),
+			(std::min)(vOrigin.y + BRICK_SIZE, vExtent.y), (std::min)(vOrigin.z + BRICK_SIZE, vExtent.z));
+
+		for (auto z = vOrigin.z; z < vEnd.z; ++z)
+			for (auto y = vOrigin.y; y < vEnd.y; ++y)
+				func(int3(vOrigin.x, y, z), vEnd.x - vOrigin.x);
+	});
+}
+
+template<typename T>
+class HostPoisson3D
+{
+public:
+	HostPoisson3D();
+
+	void Init(cuint3 &vSimSize, HostThreadPool &threadPool);
+	void Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth,
+		HostThreadPool &threadPool);
+	template<typename U>
+	void ComputeDivergence(const HostTexture3D<U> &txSource);
+	void SolvePoisson(cfloat2 &vf, const uint8_t uIteration = 1);
+	PoissonStats SolvePoisson(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+		const uint32_t uCheckInterval = 4);
+	template<typename U>
+	void Advect(cfloat fDeltaTime, const HostTexture3D<U> &txSource);
+	void SwapTextures(const bool bUnknown = false);
+
+	void SetSolver(const PoissonSolver solver);
+	void SetMultigrid(const uint8_t uNumLevels, const MultigridCycle cycle = MULTIGRID_V_CYCLE,
+		const uint8_t uNumSmooth = 2);
+	void SetPreconditioner(const PCGPreconditioner preconditioner);
+	void SetTolerance(cfloat fTolerance);
+	void SetWarmStart(const WarmStart warmStart);
+	// Jacobi and smoothing iterations fused per pass over the grid, 1 for a pass per iteration
+	void SetTemporalDepth(const uint8_t uDepth);
+	// Sparse mode: the finest grid only visits the live bricks of pBricks and treats the others
+	// as lying outside the grid; nullptr for the whole grid. UpdateBricks() follows each commit.
+	void SetBricks(const BrickMap *pBricks);
+	void UpdateBricks();
+
+	WarmStart GetWarmStart() const { return m_warmStart; }
+
+	const spHostTexture3D<T>	&GetSrc() const { return m_pSrcKnown; }
+	const spHostTexture3D<T>	&GetDst() const { return m_pDstUnknown; }
+	const spHostTexture3D<T>	&GetTmp() const { return m_pSrcUnknown; }
+
+protected:
+	static float gaussSeidel(const HostTexture3D<float> &txUnknown, const HostTexture3D<float> &txKnown,
+		cfloat2 &vf, cint3 &vLoc);
+	static float residual(const HostTexture3D<float> &txUnknown, const HostTexture3D<float> &txKnown,
+		cfloat3 &vf, cfloat3 &vHighGhost, cint3 &vLoc);
+	static float diagonal(cint3 &vExtent, cfloat3 &vf, cfloat3 &vHighGhost, cint3 &vLoc);
+	static float ghostFactor(const uint8_t uLevel);
+	static float ghostFactor(const uint8_t uLevel, cfloat fDistance);
+	float3 highGhost(const uint8_t uLevel) const;
+	bool isLive(cint3 &vLoc) const;
+	template<typename F>
+	void forEachCell(cint3 &vExtent, const F &func);
+	template<typename F>
+	void forEachRow(cint3 &vExtent, const F &func);
+	template<typename F>
+	void forEachBlockCell(const int32_t iBlock, cint3 &vExtent, const bool bReverse, const F &func);
+	void gaussSeidel(cfloat2 &vf, const uint32_t uIteration);
+	void jacobi(cfloat2 &vf, const uint32_t uIteration);
+	void redBlack(cfloat2 &vf, const uint32_t uSweeps);
+
+	void initSolver();
+	void initGuess();
+	void multigrid(cfloat3 &vf, const uint8_t uLevel, const MultigridCycle cycle);
+	void smooth(cfloat3 &vf, const uint8_t uLevel, const uint8_t uIteration);
+	void restrictResidual(cfloat3 &vf, const uint8_t uLevel);
+	void prolongate(const uint8_t uLevel);
+	template<typename S, typename F>
+	void sweep(spHostTexture3D<T> &pUnknownRO, spHostTexture3D<T> &pUnknownRW, const uint32_t uIteration,
+		const bool bKeepPrevious, const S &seed, const F &update, const bool bBricks = false);
+	template<typename S, typename F>
+	void sweepTiled(const HostTexture3D<T> &txUnknownRO, HostTexture3D<T> &txUnknownRW, const int32_t iDepth,
+		const S &seed, const F &update, const bool bBricks);
+
+	PoissonStats pcg(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration, const uint32_t uCheckInterval);
+	void precondition(cfloat2 &vf);
+	void initMIC(cfloat2 &vf);
+
+	double dotProduct(const HostTexture3D<float> &txA, const HostTexture3D<float> &txB);
+	double residualNorm(cfloat3 &vf);
+	double rhsNorm(cfloat2 &vf);
+	template<typename F>
+	double reduce(const F &func);
+
+	struct MultigridLevel
+	{
+		spHostTexture3D<T>	pKnown;
+		spHostTexture3D<T>	pUnknown;
+		spHostTexture3D<T>	pTmp;
+		float3				vHighGhost;	// Ghost factors of the faces at the far end of each axis
+	};
+
+	spHostTexture3D<T>	m_pSrcKnown;
+	spHostTexture3D<T>	m_pSrcUnknown;
+	spHostTexture3D<T>	m_pDstUnknown;
+
+	float3				m_vSimSize;
+
+	PoissonSolver		m_solver;
+	MultigridCycle		m_mgCycle;
+	uint8_t				m_uMGLevels;
+	uint8_t				m_uMGSmooth;
+
+	// Coarse levels only; level 0 is the finest grid held above
+	std::vector<MultigridLevel>	m_mgLevels;
+
+	WarmStart			m_warmStart;
+	uint8_t				m_uTemporalDepth;
+
+	PCGPreconditioner	m_preconditioner;
+	float				m_fTolerance;
+	float				m_fMICDiagonal;
+
+	// Conjugate gradient workspace: residual, search direction, and a scratch field shared by
+	// the operator product and the preconditioned residual
+	spHostTexture3D<T>	m_pResidual;
+	spHostTexture3D<T>	m_pDirection;
+	spHostTexture3D<T>	m_pScratch;
+	spHostTexture3D<T>	m_pMICPrecond;
+
+	// Live bricks of the sparse mode, or nullptr
+	const BrickMap		*m_pBricks;
+
+	HostThreadPool		*m_pThreadPool;
+};
+
+#include "HostPoisson3D.inl"
@@ -0,0 +1,1150 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#define THREAD_BLOCK_X	8
+#define THREAD_BLOCK_Y	8
+#define THREAD_BLOCK_Z	8
+
+#define REST_DENS		0.8
+
+#define PRESS_ITERATION	48
+
+#define MG_COARSE_ITERATION	16
+#define MG_MIN_SIZE			4
+#define JACOBI_WEIGHT		(6.0f / 7.0f)
+
+#define JACOBI_TEMPORAL		4		// Jacobi iterations fused per pass over the grid
+#define JACOBI_TILE			32		// Edge of the tiles the fused iterations run on
+
+#define PCG_TOLERANCE		1e-3f
+#define MIC_TUNING			0.97f
+#define MIC_SAFETY			0.25f
+
+#define RB_SWEEPS			2
+#define RB_HALO				(2 * RB_SWEEPS)
+#define RB_REGION			(THREAD_BLOCK_X + 2 * RB_HALO)
+
+// The slab blocks of the Gauss-Seidel and MIC(0) passes and the red-black tiles are whole bricks
+static_assert(THREAD_BLOCK_X == BRICK_SIZE && THREAD_BLOCK_Y == BRICK_SIZE && THREAD_BLOCK_Z == BRICK_SIZE,
+	"The sparse mode walks the bricks as thread blocks");
+
+template<typename T>
+inline HostPoisson3D<T>::HostPoisson3D() :
+	m_solver(POISSON_GAUSS_SEIDEL),
+	m_mgCycle(MULTIGRID_V_CYCLE),
+	m_uMGLevels(8),
+	m_uMGSmooth(2),
+	m_warmStart(WARM_START_PREVIOUS),
+	m_uTemporalDepth(JACOBI_TEMPORAL),
+	m_preconditioner(PCG_MIC0),
+	m_fTolerance(PCG_TOLERANCE),
+	m_fMICDiagonal(0.0f),
+	m_pBricks(nullptr),
+	m_pThreadPool(nullptr)
+{
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::initSolver()
+{
+	// Red-black, multigrid and PCG only serve the scalar pressure solve
+}
+
+template<>
+inline void HostPoisson3D<float>::initSolver()
+{
+	m_mgLevels.clear();
+	m_pResidual = m_pDirection = m_pScratch = m_pMICPrecond = nullptr;
+	if (m_solver == POISSON_GAUSS_SEIDEL || !m_pSrcKnown) return;
+
+	auto iWidth = static_cast<int32_t>(m_vSimSize.x);
+	auto iHeight = static_cast<int32_t>(m_vSimSize.y);
+	auto iDepth = static_cast<int32_t>(m_vSimSize.z);
+
+	if (m_solver == POISSON_PCG)
+	{
+		m_pResidual = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+		m_pDirection = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+		m_pScratch = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+
+		// The factorization depends on the diagonal, so it is built by the first solve
+		if (m_preconditioner == PCG_MIC0) m_pMICPrecond = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+		m_fMICDiagonal = 0.0f;
+
+		return;
+	}
+
+	// Ping-pong partner of the finest unknown for the red-black and smoother passes
+	if (!m_pSrcUnknown) m_pSrcUnknown = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+
+	if (m_solver != POISSON_MULTIGRID) return;
+
+	// Halve the grid per level until a dimension gets too small to coarsen
+	for (auto i = 1u; i < m_uMGLevels; ++i)
+	{
+		if (iWidth < MG_MIN_SIZE || iHeight < MG_MIN_SIZE || iDepth < MG_MIN_SIZE) break;
+		iWidth = (iWidth + 1) / 2;
+		iHeight = (iHeight + 1) / 2;
+		iDepth = (iDepth + 1) / 2;
+
+		// Odd sizes round the coarse grid up, which moves its last center toward the fine
+		// grid's far boundary, or past it
+		const auto uLevel = static_cast<uint8_t>(i);
+		const auto distance = [uLevel](cfloat fSize, const int32_t iSize)
+		{
+			return fSize + 0.5f - static_cast<float>(1 << uLevel) * (static_cast<float>(iSize) - 0.5f);
+		};
+
+		auto level = MultigridLevel();
+		level.pKnown = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+		level.pUnknown = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+		level.pTmp = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+		level.vHighGhost = float3(ghostFactor(uLevel, distance(m_vSimSize.x, iWidth)),
+			ghostFactor(uLevel, distance(m_vSimSize.y, iHeight)), ghostFactor(uLevel, distance(m_vSimSize.z, iDepth)));
+		m_mgLevels.push_back(level);
+	}
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::Init(cuint3 &vSimSize, HostThreadPool &threadPool)
+{
+	Init(vSimSize.x, vSimSize.y, vSimSize.z, threadPool);
+}
+
+template<>
+inline void HostPoisson3D<float>::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth,
+	HostThreadPool &threadPool)
+{
+	const auto fWidth = static_cast<float>(iWidth);
+	const auto fHeight = static_cast<float>(iHeight);
+	const auto fDepth = static_cast<float>(iDepth);
+	m_vSimSize = float3(fWidth, fHeight, fDepth);
+	m_pThreadPool = &threadPool;
+
+	// Create 3D textures (zero initialized)
+	m_pSrcKnown = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pDstUnknown = std::make_shared<HostTexture3D<float>>(iDepth, iHeight, iWidth);
+	m_pSrcUnknown = nullptr;
+
+	initSolver();
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth,
+	HostThreadPool &threadPool)
+{
+	const auto fWidth = static_cast<float>(iWidth);
+	const auto fHeight = static_cast<float>(iHeight);
+	const auto fDepth = static_cast<float>(iDepth);
+	m_vSimSize = float3(fWidth, fHeight, fDepth);
+	m_pThreadPool = &threadPool;
+
+	// Create 3D textures (zero initialized)
+	m_pSrcKnown = std::make_shared<HostTexture3D<T>>(iDepth, iHeight, iWidth);
+	m_pDstUnknown = std::make_shared<HostTexture3D<T>>(iDepth, iHeight, iWidth);
+	m_pSrcUnknown = std::make_shared<HostTexture3D<T>>(iDepth, iHeight, iWidth);
+}
+
+template<typename T>
+template<typename U>
+inline void HostPoisson3D<T>::ComputeDivergence(const HostTexture3D<U> &txSource)
+{
+	TRACE_SCOPE("HostPoisson3D::ComputeDivergence");
+
+	auto &txDst = *m_pDstUnknown;
+
+	forEachRow(txDst.GetExtent(), [&](cint3 &vLoc, const int32_t iWidth)
+	{
+		DivergenceRow(txSource, txDst, vLoc, iWidth);
+	});
+
+	// Swap buffers
+	SwapTextures();
+}
+
+template<>
+inline void HostPoisson3D<float>::SolvePoisson(cfloat2 &vf, const uint8_t uIteration)
+{
+	TRACE_SCOPE("HostPoisson3D::SolvePoisson");
+
+	initGuess();
+
+	if (m_solver == POISSON_MULTIGRID)
+	{
+		// Each iteration is one full cycle
+		for (auto i = 0u; i < uIteration; ++i) multigrid(float3(vf.x, vf.y, 0.0f), 0, m_mgCycle);
+
+		// Swap buffers
+		SwapTextures();
+
+		return;
+	}
+
+	if (m_solver == POISSON_PCG)
+	{
+		// Runs until the relative residual drops below the tolerance
+		pcg(vf, m_fTolerance, PRESS_ITERATION, 1);
+
+		// Swap buffers
+		SwapTextures();
+
+		return;
+	}
+
+	if (m_solver == POISSON_RED_BLACK)
+	{
+		// Each pass advances RB_SWEEPS full sweeps
+		for (auto i = 0; i < PRESS_ITERATION; i += RB_SWEEPS) redBlack(vf, RB_SWEEPS);
+
+		// Swap buffers
+		SwapTextures();
+
+		return;
+	}
+
+	gaussSeidel(vf, PRESS_ITERATION);
+
+	// Swap buffers
+	SwapTextures();
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SolvePoisson(cfloat2 &vf, const uint8_t uIteration)
+{
+	TRACE_SCOPE("HostPoisson3D::SolvePoisson");
+
+	// Start from the known field
+	*m_pSrcUnknown = *m_pSrcKnown;
+
+	jacobi(vf, uIteration);
+
+	// The latest iterate becomes the source
+	m_pSrcKnown.swap(m_pSrcUnknown);
+}
+
+template<>
+inline PoissonStats HostPoisson3D<float>::SolvePoisson(cfloat2 &vf, cfloat fTolerance,
+	const uint32_t uMaxIteration, const uint32_t uCheckInterval)
+{
+	TRACE_SCOPE("HostPoisson3D::SolvePoisson");
+
+	const auto start = std::chrono::steady_clock::now();
+	initGuess();
+
+	const auto uInterval = (std::max)(uCheckInterval, 1u);
+	auto stats = PoissonStats();
+
+	if (m_solver == POISSON_PCG) stats = pcg(vf, fTolerance, uMaxIteration, uInterval);
+	else
+	{
+		const auto vfResidual = float3(vf.x, vf.y, 0.0f);
+		const auto fNorm = rhsNorm(vf);
+
+		// Relax in chunks of uInterval iterations, checking the residual in between
+		stats.fResidual = static_cast<float>(residualNorm(vfResidual) / fNorm);
+		while (stats.uIterations < uMaxIteration && stats.fResidual > fTolerance)
+		{
+			const auto uIteration = (std::min)(uInterval, uMaxIteration - stats.uIterations);
+			switch (m_solver)
+			{
+			case POISSON_MULTIGRID:
+				for (auto i = 0u; i < uIteration; ++i) multigrid(vfResidual, 0, m_mgCycle);
+				stats.uIterations += uIteration;
+				break;
+			case POISSON_RED_BLACK:
+				// The last dispatch of a chunk stops at the budget, as the halo covers fewer sweeps
+				for (auto i = 0u; i < uIteration; i += RB_SWEEPS)
+				{
+					const auto uSweeps = (std::min)(static_cast<uint32_t>(RB_SWEEPS), uIteration - i);
+					redBlack(vf, uSweeps);
+					stats.uIterations += uSweeps;
+				}
+				break;
+			default:
+				gaussSeidel(vf, uIteration);
+				stats.uIterations += uIteration;
+			}
+
+			stats.fResidual = static_cast<float>(residualNorm(vfResidual) / fNorm);
+		}
+	}
+
+	stats.bConverged = stats.fResidual <= fTolerance;
+	stats.fTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// Swap buffers
+	SwapTextures();
+
+	return stats;
+}
+
+template<typename T>
+template<typename U>
+inline void HostPoisson3D<T>::Advect(cfloat fDeltaTime, const HostTexture3D<U> &txSource)
+{
+	TRACE_SCOPE("HostPoisson3D::Advect");
+
+	auto &txUnknown = *m_pDstUnknown;
+	const auto &txKnown = *m_pSrcKnown;
+
+	const auto vTexel = 1.0f / m_vSimSize;
+
+	forEachCell(txUnknown.GetExtent(), [&](cint3 &vLoc)
+	{
+		const auto vPos = float3(float(vLoc.x), float(vLoc.y), float(vLoc.z));
+
+		// Velocity tracing
+		const auto vU = txSource(vLoc).xyz();
+		const auto vTex = (vPos + 0.5f) * vTexel - vU * fDeltaTime;
+
+		// Update
+		txUnknown(vLoc) = txKnown.Sample(vTex);
+	});
+
+	// Swap buffers
+	SwapTextures();
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SwapTextures(const bool bUnknown)
+{
+	if (bUnknown) m_pSrcUnknown.swap(m_pDstUnknown);
+	else m_pSrcKnown.swap(m_pDstUnknown);
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetSolver(const PoissonSolver solver)
+{
+	m_solver = solver;
+	initSolver();
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetMultigrid(const uint8_t uNumLevels, const MultigridCycle cycle,
+	const uint8_t uNumSmooth)
+{
+	m_uMGLevels = uNumLevels;
+	m_mgCycle = cycle;
+	m_uMGSmooth = uNumSmooth;
+	initSolver();
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetPreconditioner(const PCGPreconditioner preconditioner)
+{
+	m_preconditioner = preconditioner;
+	initSolver();
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetTolerance(cfloat fTolerance)
+{
+	m_fTolerance = fTolerance;
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetWarmStart(const WarmStart warmStart)
+{
+	m_warmStart = warmStart;
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetTemporalDepth(const uint8_t uDepth)
+{
+	m_uTemporalDepth = (std::max)(uDepth, uint8_t(1));
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::SetBricks(const BrickMap *pBricks)
+{
+	m_pBricks = pBricks;
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::UpdateBricks()
+{
+	if (!m_pBricks) return;
+
+	// Clear the freed bricks in the finest-grid buffers, so they read as zero like the cells
+	// beyond the grid; the MIC(0) factors are built once for the whole grid and stay
+	const spHostTexture3D<T> buffers[] = { m_pSrcKnown, m_pSrcUnknown, m_pDstUnknown, m_pResidual, m_pDirection, m_pScratch };
+	for (const auto &pBuffer : buffers)
+	{
+		if (!pBuffer) continue;
+
+		auto &txBuffer = *pBuffer;
+		ParallelForEachBrick(*m_pThreadPool, txBuffer.GetExtent(), m_pBricks->GetFreed(),
+			[&](cint3 &vLoc) { txBuffer(vLoc) = T(); });
+	}
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::initGuess()
+{
+	// The unknown holds the previous (possibly advected) solution after ComputeDivergence
+	if (m_warmStart == WARM_START_NONE) m_pDstUnknown->Fill(0.0f);
+}
+
+template<typename T>
+inline float HostPoisson3D<T>::gaussSeidel(const HostTexture3D<float> &txUnknown,
+	const HostTexture3D<float> &txKnown, cfloat2 &vf, cint3 &vLoc)
+{
+	auto fq = vf.x * txKnown(vLoc);
+	fq += txUnknown.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+	return fq / vf.y;
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::jacobi(cfloat2 &vf, const uint32_t uIteration)
+{
+	const auto &txKnownRO = *m_pSrcKnown;
+
+	// The destination keeps the iterate before the last, as the velocity buffers expect
+	sweep(m_pSrcUnknown, m_pDstUnknown, uIteration, true,
+		[&](cint3 &vLoc) { return vf.x * txKnownRO(vLoc); },
+		[&](cint3 &, const T &fq, const T &) { return fq / vf.y; });
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::gaussSeidel(cfloat2 &vf, const uint32_t uIteration)
+{
+	auto &txUnknown = *m_pDstUnknown;
+	const auto &txKnown = *m_pSrcKnown;
+	const auto &vExtent = txUnknown.GetExtent();
+	const auto iNumBlocks = (vExtent.z + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z;
+
+	// Block Gauss-Seidel iteration: slab blocks of the same parity never touch each other,
+	// so each half-pass updates its blocks in place without racing on shared faces.
+	for (auto i = 0u; i < uIteration; ++i)
+	{
+		for (auto iParity = 0; iParity < 2; ++iParity)
+		{
+			m_pThreadPool->ParallelFor(0, (iNumBlocks + 1 - iParity) / 2, [&](const int32_t iBlock)
+			{
+				forEachBlockCell(iBlock * 2 + iParity, vExtent, false, [&](cint3 &vLoc)
+				{
+					txUnknown(vLoc) = gaussSeidel(txUnknown, txKnown, vf, vLoc);
+				});
+			});
+		}
+	}
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::redBlack(cfloat2 &vf, const uint32_t uSweeps)
+{
+	auto &txUnknownRW = *m_pSrcUnknown;
+	const auto &txUnknownRO = *m_pDstUnknown;
+	const auto &txKnownRO = *m_pSrcKnown;
+	const auto &vExtent = txUnknownRW.GetExtent();
+	const auto vNumTiles = int3((vExtent.x + THREAD_BLOCK_X - 1) / THREAD_BLOCK_X,
+		(vExtent.y + THREAD_BLOCK_Y - 1) / THREAD_BLOCK_Y, (vExtent.z + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z);
+
+	const auto iNumTiles = m_pBricks ? static_cast<int32_t>(m_pBricks->GetActive().size()) :
+		vNumTiles.x * vNumTiles.y * vNumTiles.z;
+
+	// Same tiling as the accelerator kernel: every tile relaxes a private copy of itself
+	// plus a halo of one cell per half-sweep, then writes back only its centre. In sparse
+	// mode the tiles are the live bricks, and the halo cells of other bricks stay at zero.
+	m_pThreadPool->ParallelFor(0, iNumTiles, [&](const int32_t iTile)
+	{
+		const auto vTile = int3(iTile % vNumTiles.x, (iTile / vNumTiles.x) % vNumTiles.y,
+			iTile / (vNumTiles.x * vNumTiles.y));
+		const auto vTileOrigin = m_pBricks ? BrickOrigin(m_pBricks->GetActive()[iTile]) :
+			int3(vTile.x * THREAD_BLOCK_X, vTile.y * THREAD_BLOCK_Y, vTile.z * THREAD_BLOCK_Z);
+		const auto vOrigin = int3(vTileOrigin.x - RB_HALO, vTileOrigin.y - RB_HALO, vTileOrigin.z - RB_HALO);
+		const auto iNumCells = RB_REGION * RB_REGION * RB_REGION;
+		const auto region = [](const int32_t x, const int32_t y, const int32_t z)
+		{
+			return (z * RB_REGION + y) * RB_REGION + x;
+		};
+
+		// Load the region; cells outside the grid read as zero
+		auto vRegion = std::vector<float>(iNumCells);
+		for (auto i = 0; i < iNumCells; ++i)
+		{
+			const auto z = i / (RB_REGION * RB_REGION), y = (i / RB_REGION) % RB_REGION, x = i % RB_REGION;
+			vRegion[i] = txUnknownRO.Load(int3(vOrigin.x + x, vOrigin.y + y, vOrigin.z + z));
+		}
+
+		// Each half-sweep updates one colour from the other
+		for (auto iPass = 0; iPass < 2 * static_cast<int32_t>(uSweeps); ++iPass)
+		{
+			for (auto z = 1; z < RB_REGION - 1; ++z)
+				for (auto y = 1; y < RB_REGION - 1; ++y)
+				{
+					const auto vLoc = int3(vOrigin.x, vOrigin.y + y, vOrigin.z + z);
+					if (vLoc.y < 0 || vLoc.y >= vExtent.y || vLoc.z < 0 || vLoc.z >= vExtent.z) continue;
+
+					// First x of this row with the current colour
+					const auto iFirst = 1 + ((vLoc.x + 1 + vLoc.y + vLoc.z + iPass) & 1);
+					for (auto x = iFirst; x < RB_REGION - 1; x += 2)
+					{
+						if (vLoc.x + x < 0 || vLoc.x + x >= vExtent.x) continue;
+						if (!isLive(int3(vLoc.x + x, vLoc.y, vLoc.z))) continue;
+
+						auto fq = vf.x * txKnownRO(int3(vLoc.x + x, vLoc.y, vLoc.z));
+						fq += vRegion[region(x - 1, y, z)];
+						fq += vRegion[region(x + 1, y, z)];
+						fq += vRegion[region(x, y - 1, z)];
+						fq += vRegion[region(x, y + 1, z)];
+						fq += vRegion[region(x, y, z - 1)];
+						fq += vRegion[region(x, y, z + 1)];
+						vRegion[region(x, y, z)] = fq / vf.y;
+					}
+				}
+		}
+
+		for (auto z = 0; z < THREAD_BLOCK_Z; ++z)
+			for (auto y = 0; y < THREAD_BLOCK_Y; ++y)
+				for (auto x = 0; x < THREAD_BLOCK_X; ++x)
+				{
+					const auto vLoc = int3(vOrigin.x + RB_HALO + x, vOrigin.y + RB_HALO + y, vOrigin.z + RB_HALO + z);
+					if (vLoc.x >= vExtent.x || vLoc.y >= vExtent.y || vLoc.z >= vExtent.z) continue;
+					txUnknownRW(vLoc) = vRegion[region(x + RB_HALO, y + RB_HALO, z + RB_HALO)];
+				}
+	});
+
+	// Swap buffers
+	m_pSrcUnknown.swap(m_pDstUnknown);
+}
+
+template<typename T>
+inline float HostPoisson3D<T>::residual(const HostTexture3D<float> &txUnknown,
+	const HostTexture3D<float> &txKnown, cfloat3 &vf, cfloat3 &vHighGhost, cint3 &vLoc)
+{
+	auto fq = vf.x * txKnown(vLoc);
+	fq += txUnknown.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+	fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+	return fq - diagonal(txUnknown.GetExtent(), vf, vHighGhost, vLoc) * txUnknown(vLoc);
+}
+
+template<typename T>
+inline float HostPoisson3D<T>::diagonal(cint3 &vExtent, cfloat3 &vf, cfloat3 &vHighGhost, cint3 &vLoc)
+{
+	// Faces on the domain boundary see the ghost value vf.z * u, or vHighGhost * u at the
+	// far end of each axis, instead of zero
+	auto fBound = 0.0f;
+	fBound += vLoc.x <= 0 ? 1.0f : 0.0f;
+	fBound += vLoc.y <= 0 ? 1.0f : 0.0f;
+	fBound += vLoc.z <= 0 ? 1.0f : 0.0f;
+
+	auto fHighBound = 0.0f;
+	fHighBound += vLoc.x >= vExtent.x - 1 ? vHighGhost.x : 0.0f;
+	fHighBound += vLoc.y >= vExtent.y - 1 ? vHighGhost.y : 0.0f;
+	fHighBound += vLoc.z >= vExtent.z - 1 ? vHighGhost.z : 0.0f;
+
+	return vf.y - vf.z * fBound - fHighBound;
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::multigrid(cfloat3 &vf, const uint8_t uLevel, const MultigridCycle cycle)
+{
+	// Coarsest level: relax until the remaining error is resolved
+	if (uLevel >= m_mgLevels.size())
+	{
+		smooth(vf, uLevel, MG_COARSE_ITERATION);
+		return;
+	}
+
+	// Pre-smoothing, then hand the residual down
+	smooth(vf, uLevel, m_uMGSmooth);
+	restrictResidual(vf, uLevel);
+
+	// The coarse operator keeps the 7-point stencil; its diagonal excess scales with the
+	// squared grid spacing, and the residual is rescaled by the restriction
+	const auto uCoarse = static_cast<uint8_t>(uLevel + 1);
+	const auto vfCoarse = float3(1.0f, 6.0f + 4.0f * (vf.y - 6.0f), ghostFactor(uCoarse));
+	switch (cycle)
+	{
+	case MULTIGRID_W_CYCLE:
+		multigrid(vfCoarse, uCoarse, MULTIGRID_W_CYCLE);
+		multigrid(vfCoarse, uCoarse, MULTIGRID_W_CYCLE);
+		break;
+	case MULTIGRID_F_CYCLE:
+		multigrid(vfCoarse, uCoarse, MULTIGRID_F_CYCLE);
+		multigrid(vfCoarse, uCoarse, MULTIGRID_V_CYCLE);
+		break;
+	default:
+		multigrid(vfCoarse, uCoarse, MULTIGRID_V_CYCLE);
+	}
+
+	// Coarse-grid correction and post-smoothing
+	prolongate(uLevel);
+	smooth(vf, uLevel, m_uMGSmooth);
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::smooth(cfloat3 &vf, const uint8_t uLevel, const uint8_t uIteration)
+{
+	auto &pUnknown = uLevel > 0 ? m_mgLevels[uLevel - 1].pUnknown : m_pDstUnknown;
+	auto &pTmp = uLevel > 0 ? m_mgLevels[uLevel - 1].pTmp : m_pSrcUnknown;
+	const auto &txKnown = uLevel > 0 ? *m_mgLevels[uLevel - 1].pKnown : *m_pSrcKnown;
+	const auto &vExtent = txKnown.GetExtent();
+	const auto vHighGhost = highGhost(uLevel);
+
+	// Weighted Jacobi damps the high frequencies for the coarse grids; the update is
+	// residual() and diagonal() taken apart around the neighbor sum
+	sweep(pUnknown, pTmp, uIteration, false,
+		[&](cint3 &vLoc) { return vf.x * txKnown(vLoc); },
+		[&](cint3 &vLoc, cfloat fq, cfloat fUnknown)
+		{
+			// The cells of the finest grid outside the live bricks stay at zero
+			if (uLevel == 0 && !isLive(vLoc)) return 0.0f;
+
+			const auto fDiagonal = diagonal(vExtent, vf, vHighGhost, vLoc);
+			const auto fResidual = fq - fDiagonal * fUnknown;
+
+			return fUnknown + JACOBI_WEIGHT * fResidual / fDiagonal;
+		}, uLevel == 0);
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::restrictResidual(cfloat3 &vf, const uint8_t uLevel)
+{
+	auto &coarse = m_mgLevels[uLevel];
+	const auto &txUnknown = uLevel > 0 ? *m_mgLevels[uLevel - 1].pUnknown : *m_pDstUnknown;
+	const auto &txKnown = uLevel > 0 ? *m_mgLevels[uLevel - 1].pKnown : *m_pSrcKnown;
+	const auto &vExtent = txUnknown.GetExtent();
+	const auto vHighGhost = highGhost(uLevel);
+	auto &txCoarseKnown = *coarse.pKnown;
+	auto &txCoarseUnknown = *coarse.pUnknown;
+
+	ParallelForEach(*m_pThreadPool, txCoarseKnown.GetExtent(), [&](cint3 &vLoc)
+	{
+		// Average the residuals of the (up to) 8 fine children
+		auto fResidual = 0.0f;
+		auto fCount = 0.0f;
+		for (auto i = 0; i < 8; ++i)
+		{
+			const auto vFine = int3(vLoc.x * 2 + (i & 1), vLoc.y * 2 + ((i >> 1) & 1), vLoc.z * 2 + (i >> 2));
+			if (vFine.x >= vExtent.x || vFine.y >= vExtent.y || vFine.z >= vExtent.z) continue;
+
+			// Cells outside the live bricks have no equation, so no residual
+			if (uLevel > 0 || isLive(vFine)) fResidual += residual(txUnknown, txKnown, vf, vHighGhost, vFine);
+			fCount += 1.0f;
+		}
+
+		// Rescale to the coarse grid spacing and start the correction from zero
+		txCoarseKnown(vLoc) = 4.0f * fResidual / fCount;
+		txCoarseUnknown(vLoc) = 0.0f;
+	});
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::prolongate(const uint8_t uLevel)
+{
+	auto &txUnknown = uLevel > 0 ? *m_mgLevels[uLevel - 1].pUnknown : *m_pDstUnknown;
+	const auto &txCoarse = *m_mgLevels[uLevel].pUnknown;
+	const auto &vCoarseExtent = txCoarse.GetExtent();
+
+	const auto fGhost = ghostFactor(uLevel + 1);
+	const auto &vHighGhost = m_mgLevels[uLevel].vHighGhost;
+
+	const auto prolongateCell = [&](cint3 &vLoc)
+	{
+		// Trilinear interpolation of the coarse correction at the fine cell center,
+		// taking the same ghost values as the coarse operator beyond the boundary
+		const auto vPos = (float3(float(vLoc.x), float(vLoc.y), float(vLoc.z)) + 0.5f) * 0.5f - 0.5f;
+		const auto vBase = floor(vPos);
+		const auto vFrac = vPos - vBase;
+		const auto vLo = int3(int32_t(vBase.x), int32_t(vBase.y), int32_t(vBase.z));
+
+		auto fCorrection = 0.0f;
+		for (auto i = 0; i < 8; ++i)
+		{
+			auto vTap = int3(vLo.x + (i & 1), vLo.y + ((i >> 1) & 1), vLo.z + (i >> 2));
+			auto fWeight = ((i & 1) ? vFrac.x : 1.0f - vFrac.x) * (((i >> 1) & 1) ? vFrac.y : 1.0f - vFrac.y) *
+				((i >> 2) ? vFrac.z : 1.0f - vFrac.z);
+			if (vTap.x < 0) fWeight *= fGhost;
+			else if (vTap.x >= vCoarseExtent.x) fWeight *= vHighGhost.x;
+			if (vTap.y < 0) fWeight *= fGhost;
+			else if (vTap.y >= vCoarseExtent.y) fWeight *= vHighGhost.y;
+			if (vTap.z < 0) fWeight *= fGhost;
+			else if (vTap.z >= vCoarseExtent.z) fWeight *= vHighGhost.z;
+			vTap.x = (std::min)((std::max)(vTap.x, 0), vCoarseExtent.x - 1);
+			vTap.y = (std::min)((std::max)(vTap.y, 0), vCoarseExtent.y - 1);
+			vTap.z = (std::min)((std::max)(vTap.z, 0), vCoarseExtent.z - 1);
+			fCorrection += fWeight * txCoarse(vTap);
+		}
+
+		txUnknown(vLoc) += fCorrection;
+	};
+
+	// Only the finest grid has bricks
+	if (uLevel > 0) ParallelForEach(*m_pThreadPool, txUnknown.GetExtent(), prolongateCell);
+	else forEachCell(txUnknown.GetExtent(), prolongateCell);
+}
+
+// Runs uIteration Jacobi-type iterations u' = update(vLoc, seed(vLoc) + sum of the 6 neighbors
+// of u (zero beyond the grid), u(vLoc)), swapping the buffers as separate passes would. Up to
+// m_uTemporalDepth iterations share one pass, so the grid streams through memory once per
+// pass instead of once per iteration; the arithmetic is that of the separate passes, and so
+// is the result, bit for bit. Fused passes leave the pass input in the other buffer, which
+// bKeepPrevious replaces with the iterate before the last by running the last one alone.
+template<typename T>
+template<typename S, typename F>
+inline void HostPoisson3D<T>::sweep(spHostTexture3D<T> &pUnknownRO, spHostTexture3D<T> &pUnknownRW,
+	const uint32_t uIteration, const bool bKeepPrevious, const S &seed, const F &update, const bool bBricks)
+{
+	for (auto uLeft = uIteration; uLeft > 0;)
+	{
+		const auto uDepth = (std::min)(bKeepPrevious && uLeft > 1 ? uLeft - 1 : uLeft, uint32_t(m_uTemporalDepth));
+		sweepTiled(*pUnknownRO, *pUnknownRW, static_cast<int32_t>(uDepth), seed, update, bBricks);
+		uLeft -= uDepth;
+
+		// Swap buffers
+		pUnknownRO.swap(pUnknownRW);
+	}
+}
+
+// One pass of iDepth iterations. Every tile of JACOBI_TILE cubed cells advances a wavefront
+// along z: at each step, iterate i computes the slice behind the one iterate i - 1 just did.
+// The intermediate iterates only live in rings of 3 slices per tile, widened by one cell
+// on every side per iterate still to come, so that the tile needs no data of its neighbors
+// but the input; the widening is computed redundantly by the neighboring tiles.
+template<typename T>
+template<typename S, typename F>
+inline void HostPoisson3D<T>::sweepTiled(const HostTexture3D<T> &txUnknownRO, HostTexture3D<T> &txUnknownRW,
+	const int32_t iDepth, const S &seed, const F &update, const bool bBricks)
+{
+	const auto &vExtent = txUnknownRW.GetExtent();
+	const auto vNumTiles = int3((vExtent.x + JACOBI_TILE - 1) / JACOBI_TILE,
+		(vExtent.y + JACOBI_TILE - 1) / JACOBI_TILE, (vExtent.z + JACOBI_TILE - 1) / JACOBI_TILE);
+
+	m_pThreadPool->ParallelFor(0, vNumTiles.x * vNumTiles.y * vNumTiles.z, [&](const int32_t iTile)
+	{
+		const auto vTile = int3(iTile % vNumTiles.x, iTile / vNumTiles.x % vNumTiles.y,
+			iTile / (vNumTiles.x * vNumTiles.y));
+		const auto vBegin = int3(vTile.x * JACOBI_TILE, vTile.y * JACOBI_TILE, vTile.z * JACOBI_TILE);
+		const auto vEnd = int3((std::min)(vBegin.x + JACOBI_TILE, vExtent.x),
+			(std::min)(vBegin.y + JACOBI_TILE, vExtent.y), (std::min)(vBegin.z + JACOBI_TILE, vExtent.z));
+
+		// Sparse mode: update() keeps the cells outside the live bricks at zero, so a tile
+		// without a live brick has nothing to do
+		if (bBricks && m_pBricks)
+		{
+			auto bLive = false;
+			for (auto z = vBegin.z / BRICK_SIZE; z <= (vEnd.z - 1) / BRICK_SIZE && !bLive; ++z)
+				for (auto y = vBegin.y / BRICK_SIZE; y <= (vEnd.y - 1) / BRICK_SIZE && !bLive; ++y)
+					for (auto x = vBegin.x / BRICK_SIZE; x <= (vEnd.x - 1) / BRICK_SIZE && !bLive; ++x)
+						bLive = m_pBricks->IsActive(x, y, z);
+			if (!bLive) return;
+		}
+
+		// Bounds of iterate i (1-based) and its ring; the last iterate goes to the destination
+		auto vMins = std::vector<int3>(iDepth + 1);
+		auto vMaxs = std::vector<int3>(iDepth + 1);
+		auto rings = std::vector<std::vector<T>>(iDepth);
+		for (auto i = 1; i <= iDepth; ++i)
+		{
+			const auto iMargin = iDepth - i;
+			vMins[i] = int3((std::max)(vBegin.x - iMargin, 0), (std::max)(vBegin.y - iMargin, 0),
+				(std::max)(vBegin.z - iMargin, 0));
+			vMaxs[i] = int3((std::min)(vEnd.x + iMargin, vExtent.x), (std::min)(vEnd.y + iMargin, vExtent.y),
+				(std::min)(vEnd.z + iMargin, vExtent.z));
+			if (i < iDepth) rings[i].resize(3 * static_cast<size_t>(vMaxs[i].x - vMins[i].x) * (vMaxs[i].y - vMins[i].y));
+		}
+
+		// Row y, z of iterate i - 1 from x = vMins[i].x on, or zeros beyond the grid as Load() returns
+		const auto zeros = std::vector<T>(vExtent.x);
+		const auto row = [&](const int32_t i, const int32_t y, const int32_t z) -> const T*
+		{
+			if (y < 0 || z < 0 || y >= vExtent.y || z >= vExtent.z) return zeros.data();
+			if (i == 1) return &txUnknownRO(int3(vMins[i].x, y, z));
+
+			const auto &vMin = vMins[i - 1];
+			const auto &vMax = vMaxs[i - 1];
+			return &rings[i - 1][(static_cast<size_t>(z % 3) * (vMax.y - vMin.y) + (y - vMin.y)) *
+				(vMax.x - vMin.x) + (vMins[i].x - vMin.x)];
+		};
+
+		for (auto iStep = vMins[1].z; iStep < vMaxs[1].z + iDepth - 1; ++iStep)
+		{
+			for (auto i = 1; i <= iDepth; ++i)
+			{
+				const auto z = iStep - (i - 1);
+				if (z < vMins[i].z || z >= vMaxs[i].z) continue;
+
+				const auto &vMin = vMins[i];
+				const auto &vMax = vMaxs[i];
+				for (auto y = vMin.y; y < vMax.y; ++y)
+				{
+					const auto pCenter = row(i, y, z);
+					const auto pDown = row(i, y - 1, z), pUp = row(i, y + 1, z);
+					const auto pFront = row(i, y, z - 1), pBack = row(i, y, z + 1);
+					const auto pDst = i < iDepth ? &rings[i][(static_cast<size_t>(z % 3) * (vMax.y - vMin.y) +
+						(y - vMin.y)) * (vMax.x - vMin.x)] : &txUnknownRW(int3(vMin.x, y, z));
+
+					for (auto j = 0; j < vMax.x - vMin.x; ++j)
+					{
+						const auto x = vMin.x + j;
+
+						auto fq = seed(int3(x, y, z));
+						fq += x > 0 ? pCenter[j - 1] : T();
+						fq += x + 1 < vExtent.x ? pCenter[j + 1] : T();
+						fq += pDown[j];
+						fq += pUp[j];
+						fq += pFront[j];
+						fq += pBack[j];
+
+						pDst[j] = update(int3(x, y, z), fq, pCenter[j]);
+					}
+				}
+			}
+		}
+	});
+}
+
+template<typename T>
+inline float HostPoisson3D<T>::ghostFactor(const uint8_t uLevel)
+{
+	// The first coarse center is half a coarse cell in, the zero half a fine cell out
+	return ghostFactor(uLevel, 0.5f * (static_cast<float>(1 << uLevel) + 1.0f));
+}
+
+template<typename T>
+inline float HostPoisson3D<T>::ghostFactor(const uint8_t uLevel, cfloat fDistance)
+{
+	// The fine grid is zero one fine cell beyond its outermost centers. Coarse level l places
+	// its ghost value one coarse cell out, so extrapolate linearly to keep the zero in place;
+	// fDistance is the zero's from the outermost coarse center, in fine cells. A center at or
+	// past the zero would turn the extrapolation around, so it keeps half a fine cell.
+	const auto fScale = static_cast<float>(1 << uLevel);
+
+	return 1.0f - fScale / (std::max)(fDistance, 0.5f);
+}
+
+template<typename T>
+inline float3 HostPoisson3D<T>::highGhost(const uint8_t uLevel) const
+{
+	// The finest grid is zero right beyond its faces
+	return uLevel > 0 ? m_mgLevels[uLevel - 1].vHighGhost : float3(0.0f, 0.0f, 0.0f);
+}
+
+template<typename T>
+inline PoissonStats HostPoisson3D<T>::pcg(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval)
+{
+	auto &txUnknown = *m_pDstUnknown;
+	auto &txResidual = *m_pResidual;
+	auto &txDirection = *m_pDirection;
+	auto &txScratch = *m_pScratch;
+	const auto &txKnown = *m_pSrcKnown;
+	const auto &vExtent = txUnknown.GetExtent();
+	const auto vfResidual = float3(vf.x, vf.y, 0.0f);
+	const auto fNorm = rhsNorm(vf);
+	auto stats = PoissonStats();
+
+	// Start from the current unknown
+	forEachCell(vExtent, [&](cint3 &vLoc)
+	{
+		txResidual(vLoc) = residual(txUnknown, txKnown, vfResidual, highGhost(0), vLoc);
+	});
+	stats.fResidual = static_cast<float>(std::sqrt(dotProduct(txResidual, txResidual)) / fNorm);
+	if (stats.fResidual <= fTolerance) return stats;
+
+	precondition(vf);
+	txDirection = txScratch;
+	auto fRZ = dotProduct(txResidual, txScratch);
+
+	while (stats.uIterations < uMaxIteration)
+	{
+		// Operator product q = A p, with zero beyond the boundary
+		forEachRow(vExtent, [&](cint3 &vLoc, const int32_t iWidth)
+		{
+			LaplacianRow(txDirection, txScratch, vf.y, vLoc, iWidth);
+		});
+
+		// The direction vanished: the residual is as small as float precision allows, though
+		// the last check may have been intervals ago
+		const auto fPQ = dotProduct(txDirection, txScratch);
+		if (fPQ <= 0.0)
+		{
+			stats.fResidual = static_cast<float>(std::sqrt(dotProduct(txResidual, txResidual)) / fNorm);
+			break;
+		}
+
+		const auto fAlpha = static_cast<float>(fRZ / fPQ);
+		forEachCell(vExtent, [&](cint3 &vLoc)
+		{
+			txUnknown(vLoc) += fAlpha * txDirection(vLoc);
+			txResidual(vLoc) -= fAlpha * txScratch(vLoc);
+		});
+
+		// Early exit on the relative residual, checked every uCheckInterval iterations
+		if (++stats.uIterations % uCheckInterval == 0 || stats.uIterations >= uMaxIteration)
+		{
+			stats.fResidual = static_cast<float>(std::sqrt(dotProduct(txResidual, txResidual)) / fNorm);
+			if (stats.fResidual <= fTolerance) break;
+		}
+
+		precondition(vf);
+		const auto fRZNew = dotProduct(txResidual, txScratch);
+		const auto fBeta = static_cast<float>(fRZNew / fRZ);
+		fRZ = fRZNew;
+
+		forEachCell(vExtent, [&](cint3 &vLoc)
+		{
+			txDirection(vLoc) = txScratch(vLoc) + fBeta * txDirection(vLoc);
+		});
+	}
+
+	return stats;
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::precondition(cfloat2 &vf)
+{
+	auto &txScratch = *m_pScratch;
+	const auto &txResidual = *m_pResidual;
+	const auto &vExtent = txScratch.GetExtent();
+
+	if (m_preconditioner != PCG_MIC0)
+	{
+		// Jacobi: divide by the diagonal
+		forEachCell(vExtent, [&](cint3 &vLoc)
+		{
+			txScratch(vLoc) = txResidual(vLoc) / vf.y;
+		});
+
+		return;
+	}
+
+	if (m_fMICDiagonal != vf.y) initMIC(vf);
+	const auto &txPrecond = *m_pMICPrecond;
+	const auto iNumBlocks = (vExtent.z + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z;
+
+	// Each slab block is factorized on its own, so the triangular solves run in parallel
+	// and the result does not depend on the thread count.
+	// In sparse mode the substitutions only visit the live cells; the others hold zero in the
+	// scratch field, so they drop out of the neighbor terms.
+	m_pThreadPool->ParallelFor(0, iNumBlocks, [&](const int32_t iBlock)
+	{
+		const auto iBegin = iBlock * THREAD_BLOCK_Z;
+		const auto iEnd = (std::min)(iBegin + THREAD_BLOCK_Z, vExtent.z);
+
+		// Forward substitution L q = r
+		forEachBlockCell(iBlock, vExtent, false, [&](cint3 &vLoc)
+		{
+			const auto x = vLoc.x, y = vLoc.y, z = vLoc.z;
+			auto ft = txResidual(vLoc);
+			if (x > 0) ft += txPrecond(int3(x - 1, y, z)) * txScratch(int3(x - 1, y, z));
+			if (y > 0) ft += txPrecond(int3(x, y - 1, z)) * txScratch(int3(x, y - 1, z));
+			if (z > iBegin) ft += txPrecond(int3(x, y, z - 1)) * txScratch(int3(x, y, z - 1));
+			txScratch(vLoc) = ft * txPrecond(vLoc);
+		});
+
+		// Backward substitution L^T z = q, in place
+		forEachBlockCell(iBlock, vExtent, true, [&](cint3 &vLoc)
+		{
+			const auto x = vLoc.x, y = vLoc.y, z = vLoc.z;
+			const auto fPrecond = txPrecond(vLoc);
+			auto ft = txScratch(vLoc);
+			if (x + 1 < vExtent.x) ft += fPrecond * txScratch(int3(x + 1, y, z));
+			if (y + 1 < vExtent.y) ft += fPrecond * txScratch(int3(x, y + 1, z));
+			if (z + 1 < iEnd) ft += fPrecond * txScratch(int3(x, y, z + 1));
+			txScratch(vLoc) = ft * fPrecond;
+		});
+	});
+}
+
+template<typename T>
+inline void HostPoisson3D<T>::initMIC(cfloat2 &vf)
+{
+	auto &txPrecond = *m_pMICPrecond;
+	const auto &vExtent = txPrecond.GetExtent();
+	const auto iNumBlocks = (vExtent.z + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z;
+
+	// MIC(0) of the 7-point operator (off-diagonals -1, diagonal vf.y), storing 1 / sqrt(e)
+	m_pThreadPool->ParallelFor(0, iNumBlocks, [&](const int32_t iBlock)
+	{
+		const auto iBegin = iBlock * THREAD_BLOCK_Z;
+		const auto iEnd = (std::min)(iBegin + THREAD_BLOCK_Z, vExtent.z);
+
+		for (auto z = iBegin; z < iEnd; ++z)
+			for (auto y = 0; y < vExtent.y; ++y)
+				for (auto x = 0; x < vExtent.x; ++x)
+				{
+					auto fe = vf.y;
+					if (x > 0)
+					{
+						const auto fp = txPrecond(int3(x - 1, y, z));
+						const auto fCouple = (y + 1 < vExtent.y ? 1.0f : 0.0f) + (z + 1 < iEnd ? 1.0f : 0.0f);
+						fe -= fp * fp * (1.0f + MIC_TUNING * fCouple);
+					}
+					if (y > 0)
+					{
+						const auto fp = txPrecond(int3(x, y - 1, z));
+						const auto fCouple = (x + 1 < vExtent.x ? 1.0f : 0.0f) + (z + 1 < iEnd ? 1.0f : 0.0f);
+						fe -= fp * fp * (1.0f + MIC_TUNING * fCouple);
+					}
+					if (z > iBegin)
+					{
+						const auto fp = txPrecond(int3(x, y, z - 1));
+						const auto fCouple = (x + 1 < vExtent.x ? 1.0f : 0.0f) + (y + 1 < vExtent.y ? 1.0f : 0.0f);
+						fe -= fp * fp * (1.0f + MIC_TUNING * fCouple);
+					}
+
+					// Fall back to the diagonal where the factorization loses too much
+					if (fe < MIC_SAFETY * vf.y) fe = vf.y;
+					txPrecond(int3(x, y, z)) = 1.0f / std::sqrt(fe);
+				}
+	});
+
+	m_fMICDiagonal = vf.y;
+}
+
+template<typename T>
+inline double HostPoisson3D<T>::dotProduct(const HostTexture3D<float> &txA, const HostTexture3D<float> &txB)
+{
+	return reduce([&](cint3 &vLoc) { return static_cast<double>(txA(vLoc)) * txB(vLoc); });
+}
+
+template<typename T>
+inline double HostPoisson3D<T>::residualNorm(cfloat3 &vf)
+{
+	const auto &txUnknown = *m_pDstUnknown;
+	const auto &txKnown = *m_pSrcKnown;
+
+	return std::sqrt(reduce([&](cint3 &vLoc)
+	{
+		const auto fResidual = static_cast<double>(residual(txUnknown, txKnown, vf, highGhost(0), vLoc));
+		return fResidual * fResidual;
+	}));
+}
+
+template<typename T>
+inline double HostPoisson3D<T>::rhsNorm(cfloat2 &vf)
+{
+	// Norm of vf.x * b; an empty right-hand side falls back to absolute residuals
+	const auto fNorm = std::abs(vf.x) * std::sqrt(dotProduct(*m_pSrcKnown, *m_pSrcKnown));
+
+	return fNorm > 0.0 ? fNorm : 1.0;
+}
+
+template<typename T>
+template<typename F>
+inline double HostPoisson3D<T>::reduce(const F &func)
+{
+	const auto &vExtent = m_pDstUnknown->GetExtent();
+	auto vPartial = std::vector<double>();
+
+	// One partial sum per slice, or per live brick in sparse mode, added up in order so the
+	// result does not depend on the thread count
+	if (m_pBricks)
+	{
+		const auto &activeBricks = m_pBricks->GetActive();
+		vPartial.resize(activeBricks.size());
+		m_pThreadPool->ParallelFor(0, static_cast<int32_t>(activeBricks.size()), [&](const int32_t i)
+		{
+			const auto vOrigin = BrickOrigin(activeBricks[i]);
+			const auto vEnd = int3((std::min)(vOrigin.x + BRICK_SIZE, vExtent.x),
+				(std::min)(vOrigin.y + BRICK_SIZE, vExtent.y), (std::min)(vOrigin.z + BRICK_SIZE, vExtent.z));
+
+			auto fSum = 0.0;
+			for (auto z = vOrigin.z; z < vEnd.z; ++z)
+				for (auto y = vOrigin.y; y < vEnd.y; ++y)
+					for (auto x = vOrigin.x; x < vEnd.x; ++x)
+						fSum += func(int3(x, y, z));
+			vPartial[i] = fSum;
+		});
+	}
+	else
+	{
+		vPartial.resize(vExtent.z);
+		m_pThreadPool->ParallelFor(0, vExtent.z, [&](const int32_t z)
+		{
+			auto fSum = 0.0;
+			for (auto y = 0; y < vExtent.y; ++y)
+				for (auto x = 0; x < vExtent.x; ++x)
+					fSum += func(int3(x, y, z));
+			vPartial[z] = fSum;
+		});
+	}
+
+	auto fSum = 0.0;
+	for (const auto &fPartial : vPartial) fSum += fPartial;
+
+	return fSum;
+}
+
+template<typename T>
+inline bool HostPoisson3D<T>::isLive(cint3 &vLoc) const
+{
+	return !m_pBricks || m_pBricks->IsActive(vLoc.x / BRICK_SIZE, vLoc.y / BRICK_SIZE, vLoc.z / BRICK_SIZE);
+}
+
+// Visit every cell of the finest grid, or only the cells of the live bricks in sparse mode
+template<typename T>
+template<typename F>
+inline void HostPoisson3D<T>::forEachCell(cint3 &vExtent, const F &func)
+{
+	if (m_pBricks) ParallelForEachBrick(*m_pThreadPool, vExtent, m_pBricks->GetActive(), func);
+	else ParallelForEach(*m_pThreadPool, vExtent, func);
+}
+
+// The same over rows along x for the row kernels, func(vLoc, iWidth)
+template<typename T>
+template<typename F>
+inline void HostPoisson3D<T>::forEachRow(cint3 &vExtent, const F &func)
+{
+	if (m_pBricks) ParallelForEachBrickRow(*m_pThreadPool, vExtent, m_pBricks->GetRuns(), func);
+	else ParallelForEachRow(*m_pThreadPool, vExtent, func);
+}
+
+// Visits the cells of slab block iBlock in order, or in reverse: slice by slice, or in sparse
+// mode brick by brick over its live bricks. Either order reaches the lower x, y and z
+// neighbors of a cell within the block before the cell itself.
+template<typename T>
+template<typename F>
+inline void HostPoisson3D<T>::forEachBlockCell(const int32_t iBlock, cint3 &vExtent, const bool bReverse,
+	const F &func)
+{
+	const auto visit = [&](cint3 &vBegin, cint3 &vEnd)
+	{
+		if (bReverse)
+		{
+			for (auto z = vEnd.z - 1; z >= vBegin.z; --z)
+				for (auto y = vEnd.y - 1; y >= vBegin.y; --y)
+					for (auto x = vEnd.x - 1; x >= vBegin.x; --x)
+						func(int3(x, y, z));
+		}
+		else
+		{
+			for (auto z = vBegin.z; z < vEnd.z; ++z)
+				for (auto y = vBegin.y; y < vEnd.y; ++y)
+					for (auto x = vBegin.x; x < vEnd.x; ++x)
+						func(int3(x, y, z));
+		}
+	};
+
+	const auto iBegin = iBlock * THREAD_BLOCK_Z;
+	const auto iEnd = (std::min)(iBegin + THREAD_BLOCK_Z, vExtent.z);
+	if (!m_pBricks) return visit(int3(0, 0, iBegin), int3(vExtent.x, vExtent.y, iEnd));
+
+	// The live list is sorted by the brick's z, y, x, so the block is a run of it
+	const auto &activeBricks = m_pBricks->GetActive();
+	const auto first = std::lower_bound(activeBricks.cbegin(), activeBricks.cend(),
+		BrickMap::Pack(0, 0, static_cast<uint32_t>(iBlock)));
+	const auto last = std::lower_bound(first, activeBricks.cend(), BrickMap::Pack(0, 0, static_cast<uint32_t>(iBlock + 1)));
+	const auto iNumBricks = static_cast<int32_t>(last - first);
+	for (auto i = 0; i < iNumBricks; ++i)
+	{
+		const auto vOrigin = BrickOrigin(first[bReverse ? iNumBricks - 1 - i : i]);
+		visit(vOrigin, int3((std::min)(vOrigin.x + BRICK_SIZE, vExtent.x), (std::min)(vOrigin.y + BRICK_SIZE, vExtent.y),
+			iEnd));
+	}
+}
@@ -0,0 +1,396 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include "HostPoisson3DSlab.h"
+
+using namespace std;
+
+HostPoisson3DSlab::HostPoisson3DSlab() :
+	m_iDepth(0),
+	m_vRange(0, 0),
+	m_iHalo(0),
+	m_solver(POISSON_GAUSS_SEIDEL),
+	m_warmStart(WARM_START_PREVIOUS),
+	m_fTolerance(PCG_TOLERANCE),
+	m_pThreadPool(nullptr),
+	m_pTransport(nullptr)
+{
+}
+
+bool HostPoisson3DSlab::Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth,
+	const int32_t iHalo, HostThreadPool &threadPool, Transport &transport)
+{
+	m_pThreadPool = &threadPool;
+	m_pTransport = &transport;
+	m_iDepth = iDepth;
+	m_iHalo = iHalo;
+	m_vRange = SlabRange(iDepth, transport.GetNumRanks(), transport.GetRank());
+
+	// Every rank needs a block of its own, and the halos have to hold what the solve refreshes
+	if (m_vRange.y <= m_vRange.x || iHalo < SLAB_SOLUTION_HALO) return false;
+
+	// Create 3D textures (zero initialized), halos included
+	const auto iSlabDepth = m_vRange.y - m_vRange.x + 2 * iHalo;
+	m_pSrcKnown = make_shared<HostTexture3D<float>>(iSlabDepth, iHeight, iWidth);
+	m_pDstUnknown = make_shared<HostTexture3D<float>>(iSlabDepth, iHeight, iWidth);
+
+	initSolver();
+
+	return true;
+}
+
+void HostPoisson3DSlab::ComputeDivergence(const HostTexture3D<float4> &txSource)
+{
+	TRACE_SCOPE("HostPoisson3DSlab::ComputeDivergence");
+
+	auto &txDst = *m_pDstUnknown;
+
+	forEachRow([&](cint3 &vLoc, const int32_t iWidth)
+	{
+		DivergenceRow(txSource, txDst, vLoc, iWidth);
+	});
+
+	// Swap buffers
+	SwapTextures();
+}
+
+bool HostPoisson3DSlab::SolvePoisson(cfloat2 &vf)
+{
+	TRACE_SCOPE("HostPoisson3DSlab::SolvePoisson");
+
+	if (m_warmStart == WARM_START_NONE) m_pDstUnknown->Fill(0.0f);
+
+	auto stats = PoissonStats();
+	if (!(m_solver == POISSON_PCG ? pcg(vf, m_fTolerance, PRESS_ITERATION, 1, stats) :
+		gaussSeidel(vf, PRESS_ITERATION))) return false;
+
+	// Swap buffers
+	SwapTextures();
+
+	return ExchangeHalos(*m_pTransport, *m_pSrcKnown, m_iHalo, SLAB_SOLUTION_HALO);
+}
+
+bool HostPoisson3DSlab::SolvePoisson(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval, PoissonStats &stats)
+{
+	TRACE_SCOPE("HostPoisson3DSlab::SolvePoisson");
+
+	const auto start = chrono::steady_clock::now();
+	if (m_warmStart == WARM_START_NONE) m_pDstUnknown->Fill(0.0f);
+
+	const auto uInterval = (max)(uCheckInterval, 1u);
+	stats = PoissonStats();
+
+	if (m_solver == POISSON_PCG)
+	{
+		if (!pcg(vf, fTolerance, uMaxIteration, uInterval, stats)) return false;
+	}
+	else
+	{
+		auto fNorm = 0.0, fResidual = 0.0;
+		if (!rhsNorm(vf, fNorm) || !residualNorm(vf, fResidual)) return false;
+
+		// Relax in chunks of uInterval iterations, checking the residual in between
+		stats.fResidual = static_cast<float>(fResidual / fNorm);
+		while (stats.uIterations < uMaxIteration && stats.fResidual > fTolerance)
+		{
+			const auto uIteration = (min)(uInterval, uMaxIteration - stats.uIterations);
+			if (!gaussSeidel(vf, uIteration)) return false;
+			stats.uIterations += uIteration;
+
+			if (!residualNorm(vf, fResidual)) return false;
+			stats.fResidual = static_cast<float>(fResidual / fNorm);
+		}
+	}
+
+	stats.bConverged = stats.fResidual <= fTolerance;
+	stats.fTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	// Swap buffers
+	SwapTextures();
+
+	return ExchangeHalos(*m_pTransport, *m_pSrcKnown, m_iHalo, SLAB_SOLUTION_HALO);
+}
+
+void HostPoisson3DSlab::SwapTextures()
+{
+	m_pSrcKnown.swap(m_pDstUnknown);
+}
+
+bool HostPoisson3DSlab::SetSolver(const PoissonSolver solver)
+{
+	if (solver != POISSON_GAUSS_SEIDEL && solver != POISSON_PCG) return false;
+
+	m_solver = solver;
+	initSolver();
+
+	return true;
+}
+
+void HostPoisson3DSlab::SetTolerance(cfloat fTolerance)
+{
+	m_fTolerance = fTolerance;
+}
+
+bool HostPoisson3DSlab::SetWarmStart(const WarmStart warmStart)
+{
+	// Advecting the pressure would need halos as deep as the advection reach
+	if (warmStart == WARM_START_ADVECTED) return false;
+
+	m_warmStart = warmStart;
+
+	return true;
+}
+
+void HostPoisson3DSlab::initSolver()
+{
+	m_pResidual = m_pDirection = m_pScratch = nullptr;
+	if (m_solver != POISSON_PCG || !m_pSrcKnown) return;
+
+	const auto &vExtent = m_pSrcKnown->GetExtent();
+	m_pResidual = make_shared<HostTexture3D<float>>(vExtent.z, vExtent.y, vExtent.x);
+	m_pDirection = make_shared<HostTexture3D<float>>(vExtent.z, vExtent.y, vExtent.x);
+	m_pScratch = make_shared<HostTexture3D<float>>(vExtent.z, vExtent.y, vExtent.x);
+}
+
+bool HostPoisson3DSlab::gaussSeidel(cfloat2 &vf, const uint32_t uIteration)
+{
+	auto &txUnknown = *m_pDstUnknown;
+	const auto &txKnown = *m_pSrcKnown;
+	const auto &vExtent = txUnknown.GetExtent();
+	const auto iEnd = vExtent.z - m_iHalo;
+	const auto iNumBlocks = (m_vRange.y - m_vRange.x + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z;
+	const auto iFirstBlock = m_vRange.x / THREAD_BLOCK_Z;
+
+	// Block Gauss-Seidel iteration of HostPoisson3D, with the parity of the global block index.
+	// The halos are refreshed before each half-pass, when the neighbors' blocks of the other
+	// parity have their latest values.
+	for (auto i = 0u; i < uIteration; ++i)
+	{
+		for (auto iParity = 0; iParity < 2; ++iParity)
+		{
+			if (!ExchangeHalos(*m_pTransport, txUnknown, m_iHalo, 1)) return false;
+
+			const auto iOffset = (iFirstBlock + iParity) & 1;
+			m_pThreadPool->ParallelFor(0, (iNumBlocks + 1 - iOffset) / 2, [&](const int32_t iBlock)
+			{
+				const auto iBegin = m_iHalo + (iBlock * 2 + iOffset) * THREAD_BLOCK_Z;
+				const auto iBlockEnd = (min)(iBegin + THREAD_BLOCK_Z, iEnd);
+
+				for (auto z = iBegin; z < iBlockEnd; ++z)
+					for (auto y = 0; y < vExtent.y; ++y)
+						for (auto x = 0; x < vExtent.x; ++x)
+						{
+							const auto vLoc = int3(x, y, z);
+
+							auto fq = vf.x * txKnown(vLoc);
+							fq += txUnknown.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+							fq += txUnknown.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+							fq += txUnknown.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+							fq += txUnknown.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+							fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+							fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+							txUnknown(vLoc) = fq / vf.y;
+						}
+			});
+		}
+	}
+
+	return true;
+}
+
+bool HostPoisson3DSlab::pcg(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+	const uint32_t uCheckInterval, PoissonStats &stats)
+{
+	auto &txUnknown = *m_pDstUnknown;
+	auto &txResidual = *m_pResidual;
+	auto &txDirection = *m_pDirection;
+	auto &txScratch = *m_pScratch;
+	const auto &txKnown = *m_pSrcKnown;
+
+	auto fNorm = 0.0, fDot = 0.0;
+	if (!rhsNorm(vf, fNorm)) return false;
+
+	// Start from the current unknown
+	if (!ExchangeHalos(*m_pTransport, txUnknown, m_iHalo, 1)) return false;
+	forEachCell([&](cint3 &vLoc)
+	{
+		auto fq = vf.x * txKnown(vLoc);
+		fq += txUnknown.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+		txResidual(vLoc) = fq - vf.y * txUnknown(vLoc);
+	});
+	if (!dotProduct(txResidual, txResidual, fDot)) return false;
+	stats.fResidual = static_cast<float>(sqrt(fDot) / fNorm);
+	if (stats.fResidual <= fTolerance) return true;
+
+	// Jacobi preconditioner: divide by the diagonal
+	const auto precondition = [&]()
+	{
+		forEachCell([&](cint3 &vLoc) { txScratch(vLoc) = txResidual(vLoc) / vf.y; });
+	};
+
+	precondition();
+	txDirection = txScratch;
+	auto fRZ = 0.0;
+	if (!dotProduct(txResidual, txScratch, fRZ)) return false;
+
+	while (stats.uIterations < uMaxIteration)
+	{
+		// Operator product q = A p, with zero beyond the boundary
+		if (!ExchangeHalos(*m_pTransport, txDirection, m_iHalo, 1)) return false;
+		forEachRow([&](cint3 &vLoc, const int32_t iWidth)
+		{
+			LaplacianRow(txDirection, txScratch, vf.y, vLoc, iWidth);
+		});
+
+		// The direction vanished: the residual is as small as float precision allows, though
+		// the last check may have been intervals ago
+		auto fPQ = 0.0;
+		if (!dotProduct(txDirection, txScratch, fPQ)) return false;
+		if (fPQ <= 0.0)
+		{
+			if (!dotProduct(txResidual, txResidual, fDot)) return false;
+			stats.fResidual = static_cast<float>(sqrt(fDot) / fNorm);
+			break;
+		}
+
+		const auto fAlpha = static_cast<float>(fRZ / fPQ);
+		forEachCell([&](cint3 &vLoc)
+		{
+			txUnknown(vLoc) += fAlpha * txDirection(vLoc);
+			txResidual(vLoc) -= fAlpha * txScratch(vLoc);
+		});
+
+		// Early exit on the relative residual, checked every uCheckInterval iterations
+		if (++stats.uIterations % uCheckInterval == 0 || stats.uIterations >= uMaxIteration)
+		{
+			if (!dotProduct(txResidual, txResidual, fDot)) return false;
+			stats.fResidual = static_cast<float>(sqrt(fDot) / fNorm);
+			if (stats.fResidual <= fTolerance) break;
+		}
+
+		precondition();
+		auto fRZNew = 0.0;
+		if (!dotProduct(txResidual, txScratch, fRZNew)) return false;
+		const auto fBeta = static_cast<float>(fRZNew / fRZ);
+		fRZ = fRZNew;
+
+		forEachCell([&](cint3 &vLoc)
+		{
+			txDirection(vLoc) = txScratch(vLoc) + fBeta * txDirection(vLoc);
+		});
+	}
+
+	return true;
+}
+
+bool HostPoisson3DSlab::dotProduct(const HostTexture3D<float> &txA, const HostTexture3D<float> &txB, double &fDot)
+{
+	return reduce([&](cint3 &vLoc) { return static_cast<double>(txA(vLoc)) * txB(vLoc); }, fDot);
+}
+
+bool HostPoisson3DSlab::residualNorm(cfloat2 &vf, double &fNorm)
+{
+	auto &txUnknown = *m_pDstUnknown;
+	const auto &txKnown = *m_pSrcKnown;
+	if (!ExchangeHalos(*m_pTransport, txUnknown, m_iHalo, 1)) return false;
+
+	const auto bReduced = reduce([&](cint3 &vLoc)
+	{
+		auto fq = vf.x * txKnown(vLoc);
+		fq += txUnknown.Load(int3(vLoc.x - 1, vLoc.y, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x + 1, vLoc.y, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y - 1, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y + 1, vLoc.z));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z - 1));
+		fq += txUnknown.Load(int3(vLoc.x, vLoc.y, vLoc.z + 1));
+
+		const auto fResidual = static_cast<double>(fq - vf.y * txUnknown(vLoc));
+		return fResidual * fResidual;
+	}, fNorm);
+	fNorm = sqrt(fNorm);
+
+	return bReduced;
+}
+
+bool HostPoisson3DSlab::rhsNorm(cfloat2 &vf, double &fNorm)
+{
+	// Norm of vf.x * b; an empty right-hand side falls back to absolute residuals
+	if (!dotProduct(*m_pSrcKnown, *m_pSrcKnown, fNorm)) return false;
+	fNorm = abs(vf.x) * sqrt(fNorm);
+	if (!(fNorm > 0.0)) fNorm = 1.0;
+
+	return true;
+}
+
+template<typename F>
+bool HostPoisson3DSlab::reduce(const F &func, double &fSum)
+{
+	const auto &vExtent = m_pDstUnknown->GetExtent();
+	const auto uNumRanks = m_pTransport->GetNumRanks();
+	auto vPartial = vector<double>(m_pTransport->GetRank() > 0 ? m_vRange.y - m_vRange.x : m_iDepth);
+
+	// One partial sum per slice; rank 0 collects them all and adds them up in slice order,
+	// so the result depends on neither the thread count nor the number of ranks
+	m_pThreadPool->ParallelFor(m_vRange.x, m_vRange.y, [&](const int32_t z)
+	{
+		auto fSum = 0.0;
+		for (auto y = 0; y < vExtent.y; ++y)
+			for (auto x = 0; x < vExtent.x; ++x)
+				fSum += func(int3(x, y, z - m_vRange.x + m_iHalo));
+		vPartial[m_pTransport->GetRank() > 0 ? z - m_vRange.x : z] = fSum;
+	});
+
+	if (m_pTransport->GetRank() > 0)
+	{
+		if (!m_pTransport->Send(0, vPartial.data(), sizeof(double) * vPartial.size())) return false;
+	}
+	else
+	{
+		for (auto i = 1u; i < uNumRanks; ++i)
+		{
+			const auto vRange = SlabRange(m_iDepth, uNumRanks, i);
+			if (!m_pTransport->Receive(i, &vPartial[vRange.x], sizeof(double) * (vRange.y - vRange.x)))
+				return false;
+		}
+
+		fSum = 0.0;
+		for (const auto &fPartial : vPartial) fSum += fPartial;
+	}
+
+	return m_pTransport->Broadcast(&fSum, sizeof(fSum));
+}
+
+// Visit the cells of this rank's slices, in slab coordinates
+template<typename F>
+void HostPoisson3DSlab::forEachCell(const F &func)
+{
+	const auto &vExtent = m_pDstUnknown->GetExtent();
+
+	m_pThreadPool->ParallelFor(m_iHalo, vExtent.z - m_iHalo, [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y)
+			for (auto x = 0; x < vExtent.x; ++x)
+				func(int3(x, y, z));
+	});
+}
+
+// The same over whole rows along x for the row kernels, func(vLoc, iWidth)
+template<typename F>
+void HostPoisson3DSlab::forEachRow(const F &func)
+{
+	const auto &vExtent = m_pDstUnknown->GetExtent();
+
+	m_pThreadPool->ParallelFor(m_iHalo, vExtent.z - m_iHalo, [&](const int32_t z)
+	{
+		for (auto y = 0; y < vExtent.y; ++y) func(int3(0, y, z), vExtent.x);
+	});
+}
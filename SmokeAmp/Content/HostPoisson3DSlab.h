@@ -0,0 +1,156 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstring>
+#include "Common/Transport.h"
+#include "HostPoisson3D.h"
+
+// Halo slices of the pressure refreshed after a solve: the gradient at the mirrored cells
+// of a one-slice slab on the domain face reaches two slices out
+#define SLAB_SOLUTION_HALO	2
+
+// The slices [x, y) of rank uRank: whole THREAD_BLOCK_Z blocks, spread evenly over the ranks
+inline int2 SlabRange(const int32_t iDepth, const uint32_t uNumRanks, const uint32_t uRank)
+{
+	const auto iNumBlocks = (iDepth + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z;
+	const auto iBegin = iNumBlocks * static_cast<int32_t>(uRank) / static_cast<int32_t>(uNumRanks);
+	const auto iEnd = iNumBlocks * static_cast<int32_t>(uRank + 1) / static_cast<int32_t>(uNumRanks);
+
+	return int2((std::min)(iBegin * THREAD_BLOCK_Z, iDepth), (std::min)(iEnd * THREAD_BLOCK_Z, iDepth));
+}
+
+// A slab holds iHalo extra slices below and above its own. This fills the iWidth slices
+// next to each face with the neighbors' data; the halos on the domain faces stay zero,
+// as Load() returns beyond the whole grid.
+template<typename T>
+inline bool ExchangeHalos(Transport &transport, HostTexture3D<T> &txSlab, const int32_t iHalo, const int32_t iWidth)
+{
+	const auto &vExtent = txSlab.GetExtent();
+	const auto uSlice = static_cast<size_t>(vExtent.x) * vExtent.y;
+	const auto uSize = sizeof(T) * uSlice * iWidth;
+	const auto iTop = vExtent.z - iHalo;
+	const auto uRank = transport.GetRank();
+	const auto pData = txSlab.GetData();
+
+	// Phase 0 pairs the ranks (2k, 2k + 1), phase 1 the ranks (2k + 1, 2k + 2); the lower rank
+	// of a pair sends first, so no pair waits on another even if sending blocks.
+	for (auto uPhase = 0u; uPhase < 2; ++uPhase)
+	{
+		if ((uRank & 1) == uPhase)
+		{
+			if (uRank + 1 < transport.GetNumRanks() &&
+				(!transport.Send(uRank + 1, &pData[(iTop - iWidth) * uSlice], uSize) ||
+				!transport.Receive(uRank + 1, &pData[iTop * uSlice], uSize))) return false;
+		}
+		else if (uRank > 0 &&
+			(!transport.Receive(uRank - 1, &pData[(iHalo - iWidth) * uSlice], uSize) ||
+			!transport.Send(uRank - 1, &pData[iHalo * uSlice], uSize))) return false;
+	}
+
+	return true;
+}
+
+// Assembles the slabs of every rank into the whole grid *pDst on rank 0; the others pass nullptr
+template<typename T>
+inline bool GatherSlabs(Transport &transport, const HostTexture3D<T> &txSlab, const int32_t iHalo,
+	HostTexture3D<T> *pDst)
+{
+	const auto &vExtent = txSlab.GetExtent();
+	const auto uSlice = static_cast<size_t>(vExtent.x) * vExtent.y;
+	const auto pInterior = &txSlab.GetData()[iHalo * uSlice];
+
+	if (transport.GetRank() > 0)
+		return transport.Send(0, pInterior, sizeof(T) * uSlice * (vExtent.z - 2 * iHalo));
+
+	const auto iDepth = pDst->GetExtent().z;
+	for (auto i = 0u; i < transport.GetNumRanks(); ++i)
+	{
+		const auto vRange = SlabRange(iDepth, transport.GetNumRanks(), i);
+		const auto pSlab = &pDst->GetData()[vRange.x * uSlice];
+		const auto uSize = sizeof(T) * uSlice * (vRange.y - vRange.x);
+		if (i == 0) memcpy(static_cast<void*>(pSlab), pInterior, uSize);
+		else if (!transport.Receive(i, pSlab, uSize)) return false;
+	}
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// The scalar pressure solve of HostPoisson3D over a grid split into z-slabs, one per
+// rank. Slabs start on THREAD_BLOCK_Z boundaries, so the block Gauss-Seidel iteration
+// visits the same blocks in the same order as on one machine once every half-pass has
+// refreshed the one-slice halos. Sums are reduced per slice and added up on rank 0 in
+// slice order, so residuals and conjugate gradient coefficients match HostPoisson3D
+// exactly. Gauss-Seidel and PCG with the Jacobi preconditioner are supported; the
+// multigrid and red-black solvers and the MIC(0) preconditioner are not distributed.
+// Transport failures return false and leave the solve unfinished.
+//--------------------------------------------------------------------------------------
+
+class HostPoisson3DSlab
+{
+public:
+	HostPoisson3DSlab();
+
+	// Takes the size of the whole grid; this rank solves the slices GetRange()
+	bool Init(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth, const int32_t iHalo,
+		HostThreadPool &threadPool, Transport &transport);
+	// The source needs one current halo slice on either side
+	void ComputeDivergence(const HostTexture3D<float4> &txSource);
+	bool SolvePoisson(cfloat2 &vf);
+	bool SolvePoisson(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration,
+		const uint32_t uCheckInterval, PoissonStats &stats);
+	void SwapTextures();
+
+	bool SetSolver(const PoissonSolver solver);
+	void SetTolerance(cfloat fTolerance);
+	bool SetWarmStart(const WarmStart warmStart);
+
+	WarmStart GetWarmStart() const { return m_warmStart; }
+	const int2 &GetRange() const { return m_vRange; }
+	int32_t GetHalo() const { return m_iHalo; }
+
+	// After a solve, the source is the pressure with SLAB_SOLUTION_HALO current halo slices
+	const spHostTexture3D<float>	&GetSrc() const { return m_pSrcKnown; }
+	const spHostTexture3D<float>	&GetDst() const { return m_pDstUnknown; }
+
+protected:
+	bool gaussSeidel(cfloat2 &vf, const uint32_t uIteration);
+	bool pcg(cfloat2 &vf, cfloat fTolerance, const uint32_t uMaxIteration, const uint32_t uCheckInterval,
+		PoissonStats &stats);
+	void initSolver();
+
+	bool dotProduct(const HostTexture3D<float> &txA, const HostTexture3D<float> &txB, double &fDot);
+	bool residualNorm(cfloat2 &vf, double &fNorm);
+	bool rhsNorm(cfloat2 &vf, double &fNorm);
+	template<typename F>
+	bool reduce(const F &func, double &fSum);
+	template<typename F>
+	void forEachCell(const F &func);
+	template<typename F>
+	void forEachRow(const F &func);
+
+	spHostTexture3D<float>	m_pSrcKnown;
+	spHostTexture3D<float>	m_pDstUnknown;
+
+	int32_t				m_iDepth;
+	int2				m_vRange;
+	int32_t				m_iHalo;
+
+	PoissonSolver		m_solver;
+	WarmStart			m_warmStart;
+	float				m_fTolerance;
+
+	// Conjugate gradient workspace, as in HostPoisson3D
+	spHostTexture3D<float>	m_pResidual;
+	spHostTexture3D<float>	m_pDirection;
+	spHostTexture3D<float>	m_pScratch;
+
+	HostThreadPool		*m_pThreadPool;
+	Transport			*m_pTransport;
+};
+
+using upHostPoisson3DSlab = std::unique_ptr<HostPoisson3DSlab>;
+using spHostPoisson3DSlab = std::shared_ptr<HostPoisson3DSlab>;
@@ -0,0 +1,114 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstring>
+#include "Common/HostThreadPool.h"
+#include "Common/WriterPool.h"
+#include "HostTexture.h"
+#include "RecordFormat.h"
+
+//--------------------------------------------------------------------------------------
+// Host counterpart of AmpRecorder. The readback is a parallel copy into one of the
+// rotating buffers; serializing it to disk is left to the writer threads, so the
+// simulation loop only waits when all the buffers are still being written.
+//--------------------------------------------------------------------------------------
+
+class HostRecorder
+{
+public:
+	HostRecorder(HostThreadPool &threadPool, const uint32_t uNumBuffers = 3, const uint32_t uNumWriters = 2);
+
+	void Record(const HostTexture3D<float> &txField, const std::string &fileName);
+	void Record(const HostTexture3D<float4> &txField, const std::string &fileName);
+	void Record(const HostTexture2D<unorm4> &txFrame, const std::string &fileName);
+	void Flush() { m_writers.Flush(); }
+
+	WriterStats GetStats() { return m_writers.GetStats(); }
+
+protected:
+	template<typename T>
+	void recordField(const HostTexture3D<T> &txField, const std::string &fileName);
+
+	HostThreadPool						&m_threadPool;
+
+	// Declared before the writers, which finish with them on destruction
+	std::vector<std::vector<uint8_t>>	m_buffers;
+	WriterPool							m_writers;
+};
+
+using upHostRecorder = std::unique_ptr<HostRecorder>;
+using spHostRecorder = std::shared_ptr<HostRecorder>;
+
+inline HostRecorder::HostRecorder(HostThreadPool &threadPool, const uint32_t uNumBuffers,
+	const uint32_t uNumWriters) :
+	m_threadPool(threadPool),
+	m_buffers(uNumBuffers > 1 ? uNumBuffers : 1),
+	m_writers(uNumBuffers, uNumWriters)
+{
+}
+
+inline void HostRecorder::Record(const HostTexture3D<float> &txField, const std::string &fileName)
+{
+	recordField(txField, fileName);
+}
+
+inline void HostRecorder::Record(const HostTexture3D<float4> &txField, const std::string &fileName)
+{
+	recordField(txField, fileName);
+}
+
+inline void HostRecorder::Record(const HostTexture2D<unorm4> &txFrame, const std::string &fileName)
+{
+	TRACE_SCOPE("HostRecorder::Record");
+
+	const auto &vExtent = txFrame.GetExtent();
+	const auto uBuffer = m_writers.Acquire();
+	auto &buffer = m_buffers[uBuffer];
+	buffer.resize(sizeof(uint32_t) * vExtent.x * vExtent.y);
+
+	// Pack to RGBA8, as the accelerator reads a unorm4 back buffer
+	const auto pPixels = reinterpret_cast<uint32_t*>(buffer.data());
+	m_threadPool.ParallelFor(0, vExtent.y, [&](const int32_t y)
+	{
+		for (auto x = 0; x < vExtent.x; ++x)
+		{
+			const auto &vColor = txFrame(int2(x, y));
+			pPixels[y * vExtent.x + x] = static_cast<uint32_t>(vColor.x * 255.0f + 0.5f) |
+				(static_cast<uint32_t>(vColor.y * 255.0f + 0.5f) << 8) |
+				(static_cast<uint32_t>(vColor.z * 255.0f + 0.5f) << 16) |
+				(static_cast<uint32_t>(vColor.w * 255.0f + 0.5f) << 24);
+		}
+	});
+
+	m_writers.Submit(uBuffer, [fileName, pPixels, vExtent]()
+	{
+		return WritePPMFile(fileName, pPixels, vExtent.x, vExtent.y);
+	});
+}
+
+template<typename T>
+inline void HostRecorder::recordField(const HostTexture3D<T> &txField, const std::string &fileName)
+{
+	TRACE_SCOPE("HostRecorder::Record");
+
+	const auto &vExtent = txField.GetExtent();
+	const auto uSlice = sizeof(T) * vExtent.x * vExtent.y;
+	const auto uBuffer = m_writers.Acquire();
+	auto &buffer = m_buffers[uBuffer];
+	buffer.resize(uSlice * vExtent.z);
+
+	const auto pData = buffer.data();
+	m_threadPool.ParallelFor(0, vExtent.z, [&](const int32_t z)
+	{
+		memcpy(&pData[uSlice * z], &txField.GetData()[static_cast<size_t>(vExtent.x) * vExtent.y * z], uSlice);
+	});
+
+	const auto uSize = buffer.size();
+	m_writers.Submit(uBuffer, [fileName, pData, uSize]()
+	{
+		return WriteRawFile(fileName, pData, uSize);
+	});
+}
@@ -0,0 +1,127 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "Common/host_vector_math.h"
+
+//--------------------------------------------------------------------------------------
+// Linear host storage for 2D and 3D fields. Load() follows the D3D rule that
+// out-of-bounds reads return zero, and Sample() replaces texture_view::sample
+// with bi/trilinear filtering and clamp addressing on texel centers.
+//--------------------------------------------------------------------------------------
+
+template<typename T>
+class HostTexture2D
+{
+public:
+	HostTexture2D(const int32_t iHeight, const int32_t iWidth) :
+		m_vExtent(iWidth, iHeight), m_data(static_cast<size_t>(iWidth) * iHeight) {}
+
+	T &operator()(cint2 &vLoc) { return m_data[index(vLoc)]; }
+	const T &operator()(cint2 &vLoc) const { return m_data[index(vLoc)]; }
+
+	T Sample(cfloat2 &vTex) const
+	{
+		// Texel-center convention: texel i covers [i, i + 1) / size
+		const auto fX = vTex.x * float(m_vExtent.x) - 0.5f, fY = vTex.y * float(m_vExtent.y) - 0.5f;
+		const auto fBaseX = std::floor(fX), fBaseY = std::floor(fY);
+		const auto fFracX = fX - fBaseX, fFracY = fY - fBaseY;
+
+		const auto x0 = clampCoord(int32_t(fBaseX), m_vExtent.x), x1 = clampCoord(int32_t(fBaseX) + 1, m_vExtent.x);
+		const auto y0 = clampCoord(int32_t(fBaseY), m_vExtent.y), y1 = clampCoord(int32_t(fBaseY) + 1, m_vExtent.y);
+
+		return lerp(lerp((*this)(int2(x0, y0)), (*this)(int2(x1, y0)), fFracX),
+			lerp((*this)(int2(x0, y1)), (*this)(int2(x1, y1)), fFracX), fFracY);
+	}
+
+	void Fill(const T &value) { std::fill(m_data.begin(), m_data.end(), value); }
+
+	const int2 &GetExtent() const { return m_vExtent; }
+	T *GetData() { return m_data.data(); }
+	const T *GetData() const { return m_data.data(); }
+
+protected:
+	size_t index(cint2 &vLoc) const { return static_cast<size_t>(vLoc.y) * m_vExtent.x + vLoc.x; }
+
+	static int32_t clampCoord(const int32_t i, const int32_t iSize)
+	{
+		return i < 0 ? 0 : (i >= iSize ? iSize - 1 : i);
+	}
+
+	int2			m_vExtent;
+	std::vector<T>	m_data;
+};
+
+template<typename T>
+class HostTexture3D
+{
+public:
+	HostTexture3D(const int32_t iDepth, const int32_t iHeight, const int32_t iWidth) :
+		m_vExtent(iWidth, iHeight, iDepth), m_data(static_cast<size_t>(iWidth) * iHeight * iDepth) {}
+
+	T &operator()(cint3 &vLoc) { return m_data[index(vLoc)]; }
+	const T &operator()(cint3 &vLoc) const { return m_data[index(vLoc)]; }
+
+	T Load(cint3 &vLoc) const
+	{
+		if (vLoc.x < 0 || vLoc.y < 0 || vLoc.z < 0 ||
+			vLoc.x >= m_vExtent.x || vLoc.y >= m_vExtent.y || vLoc.z >= m_vExtent.z)
+			return T();
+
+		return m_data[index(vLoc)];
+	}
+
+	T Sample(cfloat3 &vTex) const
+	{
+		// Texel-center convention: texel i covers [i, i + 1) / size
+		const auto vPos = vTex * float3(float(m_vExtent.x), float(m_vExtent.y), float(m_vExtent.z)) - 0.5f;
+		const auto vBase = floor(vPos);
+		const auto vFrac = vPos - vBase;
+
+		const auto x0 = clampCoord(int32_t(vBase.x), m_vExtent.x), x1 = clampCoord(int32_t(vBase.x) + 1, m_vExtent.x);
+		const auto y0 = clampCoord(int32_t(vBase.y), m_vExtent.y), y1 = clampCoord(int32_t(vBase.y) + 1, m_vExtent.y);
+		const auto z0 = clampCoord(int32_t(vBase.z), m_vExtent.z), z1 = clampCoord(int32_t(vBase.z) + 1, m_vExtent.z);
+
+		const auto v00 = lerp((*this)(int3(x0, y0, z0)), (*this)(int3(x1, y0, z0)), vFrac.x);
+		const auto v10 = lerp((*this)(int3(x0, y1, z0)), (*this)(int3(x1, y1, z0)), vFrac.x);
+		const auto v01 = lerp((*this)(int3(x0, y0, z1)), (*this)(int3(x1, y0, z1)), vFrac.x);
+		const auto v11 = lerp((*this)(int3(x0, y1, z1)), (*this)(int3(x1, y1, z1)), vFrac.x);
+
+		return lerp(lerp(v00, v10, vFrac.y), lerp(v01, v11, vFrac.y), vFrac.z);
+	}
+
+	void Fill(const T &value) { std::fill(m_data.begin(), m_data.end(), value); }
+
+	const int3 &GetExtent() const { return m_vExtent; }
+	T *GetData() { return m_data.data(); }
+	const T *GetData() const { return m_data.data(); }
+	size_t GetNumTexels() const { return m_data.size(); }
+
+protected:
+	size_t index(cint3 &vLoc) const
+	{
+		return (static_cast<size_t>(vLoc.z) * m_vExtent.y + vLoc.y) * m_vExtent.x + vLoc.x;
+	}
+
+	static int32_t clampCoord(const int32_t i, const int32_t iSize)
+	{
+		return i < 0 ? 0 : (i >= iSize ? iSize - 1 : i);
+	}
+
+	int3			m_vExtent;
+	std::vector<T>	m_data;
+};
+
+template<typename T>
+using upHostTexture2D = std::unique_ptr<HostTexture2D<T>>;
+template<typename T>
+using spHostTexture2D = std::shared_ptr<HostTexture2D<T>>;
+
+template<typename T>
+using upHostTexture3D = std::unique_ptr<HostTexture3D<T>>;
+template<typename T>
+using spHostTexture3D = std::shared_ptr<HostTexture3D<T>>;
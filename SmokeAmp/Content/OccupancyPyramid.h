@@ -0,0 +1,49 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+#define OCCUPANCY_CELL		4
+#define OCCUPANCY_LEVELS	8
+
+//--------------------------------------------------------------------------------------
+// Layout of the max-density pyramid used for empty-space skipping. Level 0 holds one
+// value per OCCUPANCY_CELL^3 macro-cell, taken over the cell and a one-texel border so
+// that it bounds every trilinear sample inside the cell; each further level halves the
+// previous one. All levels are stored back to back in one buffer.
+//--------------------------------------------------------------------------------------
+
+struct OccupancyPyramid
+{
+	int32_t	iNumLevels;
+	int32_t	iNumCells;
+	int32_t	iDims[OCCUPANCY_LEVELS][3];		// Width, height, depth of each level
+	int32_t	iOffsets[OCCUPANCY_LEVELS];
+};
+
+inline OccupancyPyramid MakeOccupancyPyramid(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+{
+	OccupancyPyramid pyramid = {};
+	int32_t iDims[] =
+	{
+		(iWidth + OCCUPANCY_CELL - 1) / OCCUPANCY_CELL,
+		(iHeight + OCCUPANCY_CELL - 1) / OCCUPANCY_CELL,
+		(iDepth + OCCUPANCY_CELL - 1) / OCCUPANCY_CELL
+	};
+
+	while (pyramid.iNumLevels < OCCUPANCY_LEVELS)
+	{
+		auto &iLevelDims = pyramid.iDims[pyramid.iNumLevels];
+		for (auto i = 0; i < 3; ++i) iLevelDims[i] = iDims[i];
+		pyramid.iOffsets[pyramid.iNumLevels++] = pyramid.iNumCells;
+		pyramid.iNumCells += iDims[0] * iDims[1] * iDims[2];
+
+		if (iDims[0] == 1 && iDims[1] == 1 && iDims[2] == 1) break;
+		for (auto i = 0; i < 3; ++i) iDims[i] = (iDims[i] + 1) / 2;
+	}
+
+	return pyramid;
+}
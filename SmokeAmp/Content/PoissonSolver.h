@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+
+// Solver options shared by AmpPoisson3D and HostPoisson3D
+enum PoissonSolver : uint8_t
+{
+	POISSON_GAUSS_SEIDEL,		// Fixed number of relaxation sweeps
+	POISSON_RED_BLACK,			// Deterministic two-colour Gauss-Seidel sweeps
+	POISSON_MULTIGRID,			// Geometric multigrid cycles
+	POISSON_PCG					// Preconditioned conjugate gradient to a relative tolerance
+};
+
+enum MultigridCycle : uint8_t
+{
+	MULTIGRID_V_CYCLE,
+	MULTIGRID_W_CYCLE,
+	MULTIGRID_F_CYCLE
+};
+
+enum PCGPreconditioner : uint8_t
+{
+	PCG_JACOBI,					// Diagonal scaling
+	PCG_MIC0					// Modified incomplete Cholesky per slab block (host only)
+};
+
+// Initial guess of the pressure solve in successive time steps
+enum WarmStart : uint8_t
+{
+	WARM_START_NONE,			// Start every solve from zero
+	WARM_START_PREVIOUS,		// Start from the previous step's pressure
+	WARM_START_ADVECTED			// Start from the previous pressure carried along the velocity
+};
+
+// Convergence telemetry of a tolerance-driven solve
+struct PoissonStats
+{
+	uint32_t	uIterations;	// Sweeps, multigrid cycles or CG iterations spent
+	float		fResidual;		// Final residual norm relative to the right-hand side
+	double		fTime;			// Wall-clock milliseconds, including waiting for the accelerator
+	bool		bConverged;		// Whether fResidual reached the tolerance within the budget
+};
@@ -0,0 +1,51 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------------------------------------
+// The files written by AmpRecorder and HostRecorder: fields as raw float32 arrays in
+// x-fastest order, and frames, read back as packed RGBA8, as binary PPM.
+//--------------------------------------------------------------------------------------
+
+inline bool WriteRawFile(const std::string &fileName, const void *pData, const size_t uSize)
+{
+	std::ofstream file(fileName, std::ios::binary);
+	if (!file) return false;
+
+	file.write(static_cast<const char*>(pData), uSize);
+	file.close();
+
+	return !file.fail();
+}
+
+inline bool WritePPMFile(const std::string &fileName, const uint32_t *pPixels, const uint32_t uWidth,
+	const uint32_t uHeight)
+{
+	std::ofstream file(fileName, std::ios::binary);
+	if (!file) return false;
+
+	file << "P6\n" << uWidth << " " << uHeight << "\n255\n";
+
+	std::vector<uint8_t> row(uWidth * 3);
+	for (auto y = 0u; y < uHeight && file; ++y)
+	{
+		const auto pRow = &pPixels[static_cast<size_t>(y) * uWidth];
+		for (auto x = 0u; x < uWidth; ++x)
+		{
+			row[x * 3] = static_cast<uint8_t>(pRow[x]);
+			row[x * 3 + 1] = static_cast<uint8_t>(pRow[x] >> 8);
+			row[x * 3 + 2] = static_cast<uint8_t>(pRow[x] >> 16);
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+	file.close();
+
+	return !file.fail();
+}
@@ -29,11 +29,18 @@ CDXUTDialog						g_SampleUI;					// dialog for sample specific controls
 bool							g_bShowHelp = false;		// If true, it renders the UI control text
 bool							g_bShowFPS = false;			// If true, it shows the FPS
 bool							g_bViscous = false;
+uint8_t							g_uRenderScale = 1;			// Ray-march resolution divisor: 1, 2 or 4
+bool							g_bTemporal = false;		// If true, accumulates jittered frames
+bool							g_bExactExtinction = false;	// If true, attenuates the view rays exponentially
+bool							g_bTracing = false;			// If true, records the trace markers
+bool							g_bRecording = false;		// If true, writes the frames and the density
+uint32_t						g_uRecordFrame = 0;
 bool							g_bLoadingComplete = false;
 
 upCDXUTTextHelper				g_pTxtHelper;
 
 upAmpFluid3D					g_pFluid;
+upAmpRecorder					g_pRecorder;
 
 CPDXBuffer						g_pCBImmutable;
 CPDXBuffer						g_pCBMatrices;
@@ -42,6 +49,12 @@ CPDXBuffer						g_pCBPerObject;
 
 IDXGISwapChain					*g_pSwapChain = nullptr;
 
+// Copies of the scene for the volume: its depth, and its color to be blended over
+CPDXTexture2D					g_pSceneDepth;
+upAmpTexture2D<float>			g_pAmpSceneDepth;
+upAmpTexture2D<unorm4>			g_pAmpSceneColor;
+upAmpTexture2D<unorm4>			g_pVolumeLayer;
+
 AmpFluid3D::CBImmutable			g_cbImmutable;
 
 float2							g_vViewport;
@@ -136,7 +149,8 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance,
 	deviceSettings.d3d11.sd.BufferDesc.Width = 1280;
 	deviceSettings.d3d11.sd.BufferDesc.Height = 960;
 	deviceSettings.d3d11.sd.Windowed = true;
-	deviceSettings.d3d11.AutoCreateDepthStencil = false;
+	deviceSettings.d3d11.AutoCreateDepthStencil = true;
+	deviceSettings.d3d11.AutoDepthStencilFormat = DXGI_FORMAT_D32_FLOAT;
 	deviceSettings.d3d11.sd.BufferUsage |= DXGI_USAGE_UNORDERED_ACCESS;
 
 	DXUTCreateDeviceFromSettings(&deviceSettings);
@@ -194,21 +208,27 @@ void RenderText()
 	// Draw help
 	if (g_bShowHelp)
 	{
-		g_pTxtHelper->SetInsertionPos(2, nBackBufferHeight - 20 * 4);
+		g_pTxtHelper->SetInsertionPos(2, nBackBufferHeight - 20 * 6);
 		g_pTxtHelper->SetForegroundColor(Colors::Red);
 		g_pTxtHelper->DrawTextLine(L"Controls:");
 
-		g_pTxtHelper->SetInsertionPos(20, nBackBufferHeight - 20 * 3);
+		g_pTxtHelper->SetInsertionPos(20, nBackBufferHeight - 20 * 5);
 		g_pTxtHelper->DrawTextLine(L"Free impulese: Left mouse button\n"
-			L"Vertical jit: J\n");
+			L"Vertical jit: J\n"
+			L"Render scale: R\n"
+			L"Record: F\n");
 
-		g_pTxtHelper->SetInsertionPos(285, nBackBufferHeight - 20 * 3);
+		g_pTxtHelper->SetInsertionPos(285, nBackBufferHeight - 20 * 5);
 		g_pTxtHelper->DrawTextLine(L"Rotate camera: Right mouse button\n"
-			L"Zoom camera: Mouse wheel scroll\n");
+			L"Zoom camera: Mouse wheel scroll\n"
+			L"Exact extinction: E\n");
 
-		g_pTxtHelper->SetInsertionPos(550, nBackBufferHeight - 20 * 3);
+		g_pTxtHelper->SetInsertionPos(550, nBackBufferHeight - 20 * 5);
 		g_pTxtHelper->DrawTextLine(L"Hide help: F1\n"
-			L"Quit: ESC\n");
+			L"Quit: ESC\n"
+			L"Temporal: T\n"
+			L"Trace capture: C\n"
+			L"Save/load state: K/L\n");
 	}
 	else
 	{
@@ -304,9 +324,38 @@ void CALLBACK OnKeyboard(UINT nChar, bool bKeyDown, bool bAltDown, void* pUserCo
 			g_bShowFPS = !g_bShowFPS; break;
 		case 'V':
 			g_bViscous = !g_bViscous; break;
+		case 'R':
+			g_uRenderScale = g_uRenderScale < 4 ? g_uRenderScale * 2 : 1;
+			if (g_pFluid) g_pFluid->SetRenderScale(g_uRenderScale);
+			break;
+		case 'T':
+			g_bTemporal = !g_bTemporal;
+			if (g_pFluid) g_pFluid->SetTemporal(g_bTemporal);
+			break;
+		case 'E':
+			g_bExactExtinction = !g_bExactExtinction;
+			if (g_pFluid) g_pFluid->SetExactExtinction(g_bExactExtinction);
+			break;
 		case 'J':
 			g_vForceDens = float4(0.0f, g_fGravity - 300.0f, 0.0f, 0.25f);
 			break;
+		case 'C':
+			// Waits for the accelerator in each marker while capturing, so the GPU time is attributed
+			g_bTracing = !g_bTracing;
+			Trace::SetSynchronous(g_bTracing);
+			Trace::Enable(g_bTracing);
+			Trace::DumpAtExit(g_bTracing ? "SmokeAmp.trace.json" : nullptr);
+			if (!g_bTracing) Trace::Dump("SmokeAmp.trace.json");
+			break;
+		case 'F':
+			g_bRecording = !g_bRecording;
+			break;
+		case 'K':
+			if (g_pFluid) g_pFluid->SaveCheckpoint("SmokeAmp.ckp", 0, DELTA_TIME);
+			break;
+		case 'L':
+			if (g_pFluid) g_pFluid->LoadCheckpoint("SmokeAmp.ckp");
+			break;
 		}
 	}
 	else {
@@ -348,6 +397,10 @@ HRESULT CALLBACK OnD3D11CreateDevice(ID3D11Device* pd3dDevice, const DXGI_SURFAC
 
 	g_pFluid = make_unique<AmpFluid3D>(create_accelerator_view(pd3dDevice));
 	g_pFluid->Init(64, 64, 64);
+	g_pFluid->SetRenderScale(g_uRenderScale);
+	g_pFluid->SetTemporal(g_bTemporal);
+	g_pFluid->SetExactExtinction(g_bExactExtinction);
+	g_pRecorder = make_unique<AmpRecorder>(g_pFluid->GetAcceleratorView());
 
 	const auto createConstTask = create_task([pd3dDevice, pd3dImmediateContext]() {
 		// Setup constant buffers
@@ -396,6 +449,16 @@ HRESULT CALLBACK OnD3D11ResizedSwapChain(ID3D11Device* pd3dDevice, IDXGISwapChai
 	g_vViewport = float2(static_cast<float>(pBackBufferSurfaceDesc->Width), static_cast<float>(pBackBufferSurfaceDesc->Height));
 	g_pSwapChain = pSwapChain;
 
+	// The depth buffer is copied into an R32_FLOAT texture, which C++ AMP can read
+	const auto &acclView = g_pFluid->GetAcceleratorView();
+	const auto frameExtent = concurrency::extent<2>(pBackBufferSurfaceDesc->Height, pBackBufferSurfaceDesc->Width);
+	const auto depthDesc = CD3D11_TEXTURE2D_DESC(DXGI_FORMAT_R32_FLOAT, pBackBufferSurfaceDesc->Width,
+		pBackBufferSurfaceDesc->Height, 1, 1, D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS);
+	V_RETURN(pd3dDevice->CreateTexture2D(&depthDesc, nullptr, &g_pSceneDepth));
+	g_pAmpSceneDepth = make_unique<AmpTexture2D<float>>(make_texture<float, 2>(acclView, g_pSceneDepth.Get()));
+	g_pAmpSceneColor = make_unique<AmpTexture2D<unorm4>>(frameExtent, 8, acclView);
+	g_pVolumeLayer = make_unique<AmpTexture2D<unorm4>>(frameExtent, 8, acclView);
+
 	//g_HUD.SetLocation(pBackBufferSurfaceDesc->Width - 170, 0);
 	//g_HUD.SetSize(170, 170);
 	g_SampleUI.SetLocation(pBackBufferSurfaceDesc->Width - 170, pBackBufferSurfaceDesc->Height - 300);
@@ -412,6 +475,7 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 {
 	// Loading is asynchronous. Only draw geometry after it's loaded.
 	if (!g_bLoadingComplete || !g_pSwapChain) return;
+	TRACE_SCOPE("SmokeAmp::OnD3D11FrameRender");
 
 	// Get the back buffer
 	auto pBackBuffer = CPDXTexture2D();
@@ -420,9 +484,17 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 
 	// Set render targets to the screen.
 	const auto pRTV = DXUTGetD3D11RenderTargetView();
+	const auto pDSV = DXUTGetD3D11DepthStencilView();
 	pd3dImmediateContext->ClearRenderTargetView(pRTV, DirectX::Colors::CornflowerBlue);
+	pd3dImmediateContext->ClearDepthStencilView(pDSV, D3D11_CLEAR_DEPTH, 1.0f, 0);
+	// Opaque scene geometry would be drawn here, into pRTV and pDSV
 	pd3dImmediateContext->OMSetRenderTargets(0, nullptr, nullptr);
 
+	// The volume stops at the scene's depth
+	auto pDepthStencil = CPDXResource();
+	pDSV->GetResource(&pDepthStencil);
+	pd3dImmediateContext->CopyResource(g_pSceneDepth.Get(), pDepthStencil.Get());
+
 	// Prepare the constant buffer to send it to the graphics device.
 	// Get the projection & view matrix from the camera class
 	const auto mWorldI = XMMatrixInverse(nullptr, g_mWorld);
@@ -451,7 +523,26 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 
 	// Simulate and render
 	g_pFluid->Simulate(max(fElapsedTime, DELTA_TIME), g_vForceDens, g_vImLoc, g_bViscous ? 10 : 0);
-	g_pFluid->Render(pAmpBackBuffer, g_cbImmutable, cbPerObject);
+	if (g_uRenderScale > 1 || g_bTemporal) g_pFluid->Render(pAmpBackBuffer, g_cbImmutable, cbPerObject);
+	else
+	{
+		// The scene-depth overload marches at full resolution only, so the reduced scales and
+		// the temporal mode take the plain overload over the clear color above
+		concurrency::graphics::copy(*pAmpBackBuffer, *g_pAmpSceneColor);
+		g_pFluid->Render(g_pVolumeLayer, AmpTexture2DView<float>(*g_pAmpSceneDepth), g_cbImmutable, cbPerObject);
+		g_pFluid->Composite(pAmpBackBuffer, *g_pAmpSceneColor, *g_pVolumeLayer);
+	}
+
+	// The readbacks queue up behind the frame, and the writer threads wait for them
+	if (g_bRecording)
+	{
+		char szFrame[32], szDensity[32];
+		snprintf(szFrame, sizeof(szFrame), "frame_%05u.ppm", g_uRecordFrame);
+		snprintf(szDensity, sizeof(szDensity), "density_%05u.raw", g_uRecordFrame);
+		g_pRecorder->Record(*pAmpBackBuffer, szFrame);
+		g_pRecorder->Record(*g_pFluid->GetDensity(), szDensity);
+		++g_uRecordFrame;
+	}
 
 	pd3dImmediateContext->OMSetRenderTargets(1, &pRTV, nullptr);
 	DXUT_BeginPerfEvent(DXUT_PERFEVENTCOLOR, L"HUD / Stats");
@@ -468,6 +559,11 @@ void CALLBACK OnD3D11FrameRender(ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 void CALLBACK OnD3D11ReleasingSwapChain(void* pUserContext)
 {
 	g_DialogResourceManager.OnD3D11ReleasingSwapChain();
+
+	g_pVolumeLayer.reset();
+	g_pAmpSceneColor.reset();
+	g_pAmpSceneDepth.reset();
+	g_pSceneDepth.Reset();
 }
 
 //--------------------------------------------------------------------------------------
@@ -484,5 +580,6 @@ void CALLBACK OnD3D11DestroyDevice(void* pUserContext)
 	g_pCBMatrices.Reset();
 	g_pCBImmutable.Reset();
 	g_pTxtHelper.reset();
+	g_pRecorder.reset();
 	g_pFluid.reset();
 }
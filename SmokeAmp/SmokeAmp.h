@@ -2,3 +2,4 @@
 
 #include "resource.h"
 #include "Content\AmpFluid3D.h"
+#include "Content\AmpRecorder.h"
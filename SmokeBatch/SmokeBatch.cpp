@@ -0,0 +1,633 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Common/SocketTransport.h"
+#include "HostCamera.h"
+#include "HostFluid3DSlab.h"
+#include "HostRecorder.h"
+
+//--------------------------------------------------------------------------------------
+// Headless batch runner: steps HostFluid3D at a fixed time step as fast as it can,
+// optionally writing the fields and rendered frames every few steps. Arguments use the
+// DXUT style of SmokeAmp.exe, e.g. SmokeBatch -Width:128 -Steps:500 -Output:bake
+// With -Ranks or -Peers, the grid is split into z-slabs over several ranks instead
+// (HostFluid3DSlab), as threads of this process or as processes on several nodes.
+//--------------------------------------------------------------------------------------
+
+#define DELTA_TIME				0.03f
+
+using namespace std;
+
+// A scripted source, active on the steps [uBegin, uEnd)
+struct Emitter
+{
+	uint32_t	uBegin;
+	uint32_t	uEnd;
+	float4		vForceDens;
+	float3		vImLoc;
+};
+
+struct BatchDesc
+{
+	int32_t					iWidth;
+	int32_t					iHeight;
+	int32_t					iDepth;
+	uint32_t				uSteps;
+	float					fDeltaTime;
+	uint32_t				uThreads;
+	SimdLevel				simd;
+
+	PoissonSolver			solver;
+	PCGPreconditioner		preconditioner;
+	float					fTolerance;
+	uint32_t				uMaxIteration;
+	WarmStart				warmStart;
+	AdvectionScheme			advection;
+	bool					bFused;
+	bool					bSparse;
+	uint8_t					uItVisc;
+
+	vector<Emitter>			emitters;
+
+	string					output;
+	uint32_t				uInterval;
+	uint32_t				uBuffers;
+	uint32_t				uWriters;
+	bool					bDensity;
+	bool					bVelocity;
+	int32_t					iFrameWidth;
+	int32_t					iFrameHeight;
+	uint32_t				uCheckpoint;
+	string					resume;
+
+	string					trace;
+
+	// Distributed mode: in-process ranks, or this process's rank among the peers' endpoints
+	uint32_t				uRanks;
+	uint32_t				uRank;
+	vector<string>			peers;
+	int32_t					iHalo;
+};
+
+//--------------------------------------------------------------------------------------
+// Command line
+//--------------------------------------------------------------------------------------
+
+// Matches -Name:value or -Name case-insensitively, as DXUT does
+static bool GetArg(const char *szArg, const char *szName, const char *&szValue)
+{
+	if (*szArg != '-' && *szArg != '/') return false;
+	++szArg;
+
+	const auto uLen = strlen(szName);
+	for (auto i = 0u; i < uLen; ++i)
+		if (tolower(szArg[i]) != tolower(szName[i])) return false;
+
+	if (szArg[uLen] == ':') szValue = szArg + uLen + 1;
+	else if (szArg[uLen] == '\0') szValue = "";
+	else return false;
+
+	return true;
+}
+
+static bool IsName(const char *szValue, const char *szName)
+{
+	for (; *szValue && *szName; ++szValue, ++szName)
+		if (tolower(*szValue) != tolower(*szName)) return false;
+
+	return *szValue == *szName;
+}
+
+// One emitter per line: begin end force.x force.y force.z density loc.x loc.y loc.z
+static bool LoadEmitters(const char *szFileName, vector<Emitter> &emitters)
+{
+	const auto pFile = fopen(szFileName, "r");
+	if (!pFile) return false;
+
+	char szLine[256];
+	while (fgets(szLine, sizeof(szLine), pFile))
+	{
+		if (szLine[0] == '#') continue;
+
+		Emitter emitter;
+		const auto iRead = sscanf(szLine, "%u %u %f %f %f %f %f %f %f", &emitter.uBegin, &emitter.uEnd,
+			&emitter.vForceDens.x, &emitter.vForceDens.y, &emitter.vForceDens.z, &emitter.vForceDens.w,
+			&emitter.vImLoc.x, &emitter.vImLoc.y, &emitter.vImLoc.z);
+		if (iRead == 9) emitters.push_back(emitter);
+	}
+	fclose(pFile);
+
+	return true;
+}
+
+static bool ParseArgs(const int argc, char *argv[], BatchDesc &desc)
+{
+	desc.iWidth = desc.iHeight = desc.iDepth = 64;
+	desc.uSteps = 300;
+	desc.fDeltaTime = DELTA_TIME;
+	desc.uThreads = 0;
+	desc.simd = GetSupportedSimdLevel();
+	desc.solver = POISSON_GAUSS_SEIDEL;
+	desc.preconditioner = PCG_MIC0;
+	desc.fTolerance = 0.0f;
+	desc.uMaxIteration = PRESS_ITERATION;
+	desc.warmStart = WARM_START_PREVIOUS;
+	desc.advection = ADVECT_SEMI_LAGRANGIAN;
+	desc.bFused = false;
+	desc.bSparse = false;
+	desc.uItVisc = 0;
+	desc.uInterval = 0;
+	desc.uBuffers = 3;
+	desc.uWriters = 2;
+	desc.bDensity = true;
+	desc.bVelocity = false;
+	desc.iFrameWidth = desc.iFrameHeight = 0;
+	desc.uCheckpoint = 0;
+	desc.uRanks = 1;
+	desc.uRank = 0;
+	desc.iHalo = SLAB_HALO;
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		const char *szValue = nullptr;
+		const auto szArg = argv[i];
+
+		if (GetArg(szArg, "Width", szValue)) desc.iWidth = atoi(szValue);
+		else if (GetArg(szArg, "Height", szValue)) desc.iHeight = atoi(szValue);
+		else if (GetArg(szArg, "Depth", szValue)) desc.iDepth = atoi(szValue);
+		else if (GetArg(szArg, "Size", szValue)) desc.iWidth = desc.iHeight = desc.iDepth = atoi(szValue);
+		else if (GetArg(szArg, "Steps", szValue)) desc.uSteps = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "DeltaTime", szValue)) desc.fDeltaTime = strtof(szValue, nullptr);
+		else if (GetArg(szArg, "Threads", szValue)) desc.uThreads = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Simd", szValue))
+		{
+			if (IsName(szValue, "Scalar")) desc.simd = SIMD_SCALAR;
+			else if (IsName(szValue, "AVX2")) desc.simd = SIMD_AVX2;
+			else if (IsName(szValue, "AVX512")) desc.simd = SIMD_AVX512;
+			else return false;
+
+			if (desc.simd > GetSupportedSimdLevel())
+			{
+				fprintf(stderr, "This CPU does not support %s\n", szValue);
+				return false;
+			}
+		}
+		else if (GetArg(szArg, "Solver", szValue))
+		{
+			if (IsName(szValue, "GaussSeidel")) desc.solver = POISSON_GAUSS_SEIDEL;
+			else if (IsName(szValue, "RedBlack")) desc.solver = POISSON_RED_BLACK;
+			else if (IsName(szValue, "Multigrid")) desc.solver = POISSON_MULTIGRID;
+			else if (IsName(szValue, "PCG")) desc.solver = POISSON_PCG;
+			else return false;
+		}
+		else if (GetArg(szArg, "Preconditioner", szValue))
+		{
+			if (IsName(szValue, "Jacobi")) desc.preconditioner = PCG_JACOBI;
+			else if (IsName(szValue, "MIC0")) desc.preconditioner = PCG_MIC0;
+			else return false;
+		}
+		else if (GetArg(szArg, "Tolerance", szValue)) desc.fTolerance = strtof(szValue, nullptr);
+		else if (GetArg(szArg, "MaxIterations", szValue)) desc.uMaxIteration = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "WarmStart", szValue))
+		{
+			if (IsName(szValue, "None")) desc.warmStart = WARM_START_NONE;
+			else if (IsName(szValue, "Previous")) desc.warmStart = WARM_START_PREVIOUS;
+			else if (IsName(szValue, "Advected")) desc.warmStart = WARM_START_ADVECTED;
+			else return false;
+		}
+		else if (GetArg(szArg, "Advection", szValue))
+		{
+			if (IsName(szValue, "SemiLagrangian")) desc.advection = ADVECT_SEMI_LAGRANGIAN;
+			else if (IsName(szValue, "MacCormack")) desc.advection = ADVECT_MACCORMACK;
+			else if (IsName(szValue, "BFECC")) desc.advection = ADVECT_BFECC;
+			else return false;
+		}
+		else if (GetArg(szArg, "Fused", szValue)) desc.bFused = true;
+		else if (GetArg(szArg, "Sparse", szValue)) desc.bSparse = true;
+		else if (GetArg(szArg, "Viscous", szValue)) desc.uItVisc = static_cast<uint8_t>(*szValue ? atoi(szValue) : 10);
+		else if (GetArg(szArg, "Emitters", szValue))
+		{
+			if (!LoadEmitters(szValue, desc.emitters))
+			{
+				fprintf(stderr, "Cannot open the emitter script %s\n", szValue);
+				return false;
+			}
+		}
+		else if (GetArg(szArg, "Output", szValue)) desc.output = szValue;
+		else if (GetArg(szArg, "Interval", szValue)) desc.uInterval = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Buffers", szValue)) desc.uBuffers = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Writers", szValue)) desc.uWriters = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Fields", szValue))
+		{
+			desc.bDensity = IsName(szValue, "Density") || IsName(szValue, "All");
+			desc.bVelocity = IsName(szValue, "Velocity") || IsName(szValue, "All");
+			if (!desc.bDensity && !desc.bVelocity && !IsName(szValue, "None")) return false;
+		}
+		else if (GetArg(szArg, "FrameWidth", szValue)) desc.iFrameWidth = atoi(szValue);
+		else if (GetArg(szArg, "FrameHeight", szValue)) desc.iFrameHeight = atoi(szValue);
+		else if (GetArg(szArg, "Checkpoint", szValue)) desc.uCheckpoint = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Resume", szValue)) desc.resume = szValue;
+		else if (GetArg(szArg, "Trace", szValue)) desc.trace = *szValue ? szValue : "SmokeBatch.trace.json";
+		else if (GetArg(szArg, "Ranks", szValue)) desc.uRanks = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Rank", szValue)) desc.uRank = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Peers", szValue))
+		{
+			// Comma-separated endpoints, one per rank in rank order
+			for (auto szEnd = szValue; *szValue; szValue = *szEnd ? szEnd + 1 : szEnd)
+			{
+				szEnd = strchr(szValue, ',');
+				if (!szEnd) szEnd = szValue + strlen(szValue);
+				desc.peers.emplace_back(szValue, szEnd);
+			}
+		}
+		else if (GetArg(szArg, "Halo", szValue)) desc.iHalo = atoi(szValue);
+		else
+		{
+			fprintf(stderr, "Unknown argument %s\n", szArg);
+			return false;
+		}
+	}
+
+	// The sample's emitter (space bar held) when no script is given
+	if (desc.emitters.empty())
+	{
+		Emitter emitter;
+		emitter.uBegin = 0;
+		emitter.uEnd = UINT32_MAX;
+		emitter.vForceDens = float4(0.0f, -300.0f, 0.0f, 0.25f);
+		emitter.vImLoc = float3(0.5f, 0.9f, 0.5f);
+		desc.emitters.push_back(emitter);
+	}
+
+	if (!desc.peers.empty()) desc.uRanks = static_cast<uint32_t>(desc.peers.size());
+
+	return desc.iWidth > 0 && desc.iHeight > 0 && desc.iDepth > 0 && desc.fDeltaTime > 0.0f &&
+		desc.uRanks > 0 && desc.uRank < desc.uRanks;
+}
+
+// The distributed mode covers the default path of HostFluid3D and the field output
+static bool CheckDistributed(const BatchDesc &desc)
+{
+	const char *szUnsupported = nullptr;
+	if (desc.solver != POISSON_GAUSS_SEIDEL && desc.solver != POISSON_PCG) szUnsupported = "-Solver:RedBlack|Multigrid";
+	else if (desc.solver == POISSON_PCG && desc.preconditioner == PCG_MIC0)
+		szUnsupported = "-Preconditioner:MIC0 (the PCG default)";
+	else if (desc.warmStart == WARM_START_ADVECTED) szUnsupported = "-WarmStart:Advected";
+	else if (desc.advection != ADVECT_SEMI_LAGRANGIAN) szUnsupported = "-Advection:MacCormack|BFECC";
+	else if (desc.bFused) szUnsupported = "-Fused";
+	else if (desc.bSparse) szUnsupported = "-Sparse";
+	else if (desc.uItVisc > 0) szUnsupported = "-Viscous";
+	else if (desc.iFrameWidth > 0 && desc.iFrameHeight > 0) szUnsupported = "-FrameWidth/-FrameHeight";
+	else if (desc.uCheckpoint > 0 || !desc.resume.empty()) szUnsupported = "-Checkpoint/-Resume";
+
+	if (szUnsupported)
+	{
+		fprintf(stderr, "%s is not supported with more than one rank\n", szUnsupported);
+
+		return false;
+	}
+
+	// Every rank needs a whole THREAD_BLOCK_Z block of slices
+	if (desc.uRanks > static_cast<uint32_t>((desc.iDepth + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z))
+	{
+		fprintf(stderr, "A depth of %d takes at most %d ranks\n", desc.iDepth,
+			(desc.iDepth + THREAD_BLOCK_Z - 1) / THREAD_BLOCK_Z);
+
+		return false;
+	}
+
+	if (desc.iHalo < SLAB_SOLUTION_HALO)
+	{
+		fprintf(stderr, "The halo needs at least %d slices\n", SLAB_SOLUTION_HALO);
+
+		return false;
+	}
+
+	return true;
+}
+
+static void PrintUsage()
+{
+	printf(
+		"SmokeBatch [-Name:value ...]\n"
+		"  -Width: -Height: -Depth: -Size:   grid resolution (64)\n"
+		"  -Steps:                           number of time steps (300)\n"
+		"  -DeltaTime:                       fixed time step (0.03)\n"
+		"  -Threads:                         worker threads, 0 for all cores (0)\n"
+		"  -Simd:scalar|avx2|avx512          instruction set of the vectorized kernels (widest)\n"
+		"  -Solver:GaussSeidel|RedBlack|Multigrid|PCG\n"
+		"  -Preconditioner:Jacobi|MIC0       of PCG (MIC0); Jacobi with more than one rank\n"
+		"  -Tolerance: -MaxIterations:       tolerance-driven pressure solve (off)\n"
+		"  -WarmStart:None|Previous|Advected\n"
+		"  -Advection:SemiLagrangian|MacCormack|BFECC\n"
+		"  -Fused -Sparse -Viscous[:n]\n"
+		"  -Emitters:file                    lines of: begin end fx fy fz density x y z\n"
+		"  -Output:dir -Interval:n           write every n steps (0 for none)\n"
+		"  -Buffers: -Writers:               readback buffers (3) and writer threads (2)\n"
+		"  -Fields:Density|Velocity|All|None raw float fields to write (Density)\n"
+		"  -FrameWidth: -FrameHeight:        also render PPM frames of this size\n"
+		"  -Checkpoint:n                     write a checkpoint to the output every n steps\n"
+		"  -Resume:file                      continue from a checkpoint, taking its size and step\n"
+		"  -Trace[:file]                     record the stage markers as trace-event JSON\n"
+		"  -Ranks:n                          split the grid over n ranks in this process\n"
+		"  -Rank:i -Peers:ep0,ep1,...        rank i of a run over processes; an endpoint is\n"
+		"                                    host:port (TCP) or a Unix-domain socket path\n"
+		"  -Halo:n                           halo slices per slab face (%d)\n",
+		SLAB_HALO
+		);
+}
+
+// Later emitters in the script take precedence
+static void GetEmitter(const BatchDesc &desc, const uint32_t uStep, float4 &vForceDens, float3 &vImLoc)
+{
+	vForceDens = float4(0.0f, 0.0f, 0.0f, 0.0f);
+	vImLoc = float3(0.5f, 0.9f, 0.5f);
+	for (const auto &emitter : desc.emitters)
+	{
+		if (uStep < emitter.uBegin || uStep >= emitter.uEnd) continue;
+		vForceDens = emitter.vForceDens;
+		vImLoc = emitter.vImLoc;
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Output
+//--------------------------------------------------------------------------------------
+
+static string OutputName(const string &output, const char *szName, const uint32_t uStep, const char *szExt)
+{
+	char szFileName[64];
+	snprintf(szFileName, sizeof(szFileName), "%s_%05u.%s", szName, uStep, szExt);
+
+	return output.empty() ? string(szFileName) : output + "/" + szFileName;
+}
+
+//--------------------------------------------------------------------------------------
+// Distributed mode
+//--------------------------------------------------------------------------------------
+
+// One rank's run; rank 0 assembles the fields, writes them and reports
+static int RunSlab(const BatchDesc &desc, Transport &transport, const uint32_t uThreads)
+{
+	const auto uRank = transport.GetRank();
+	const auto bRoot = uRank == 0;
+
+	HostThreadPool threadPool(uThreads);
+	HostFluid3DSlab fluid(threadPool, transport);
+	if (!fluid.Init(desc.iWidth, desc.iHeight, desc.iDepth, desc.iHalo)) return 1;
+	fluid.GetPressure().SetSolver(desc.solver);
+	fluid.GetPressure().SetWarmStart(desc.warmStart);
+	if (desc.fTolerance > 0.0f) fluid.SetPressureTolerance(desc.fTolerance, desc.uMaxIteration);
+
+	const auto bOutputs = desc.uInterval > 0;
+	auto pRecorder = bRoot && bOutputs ? make_unique<HostRecorder>(threadPool, desc.uBuffers, desc.uWriters) : nullptr;
+	auto pDensity = bRoot && bOutputs && desc.bDensity ?
+		make_unique<HostTexture3D<float>>(desc.iDepth, desc.iHeight, desc.iWidth) : nullptr;
+	auto pVelocity = bRoot && bOutputs && desc.bVelocity ?
+		make_unique<HostTexture3D<float4>>(desc.iDepth, desc.iHeight, desc.iWidth) : nullptr;
+
+	if (bRoot) printf("Grid %dx%dx%d, %u steps of %g on %u ranks of %u threads (%s), %d halo slices\n",
+		desc.iWidth, desc.iHeight, desc.iDepth, desc.uSteps, desc.fDeltaTime, transport.GetNumRanks(),
+		threadPool.GetNumThreads(), SimdLevelName(GetSimdLevel()), desc.iHalo);
+
+	auto fSimTime = 0.0, fOutputTime = 0.0;
+	auto uPressIterations = 0ull;
+	for (auto i = 0u; i < desc.uSteps; ++i)
+	{
+		auto vForceDens = float4();
+		auto vImLoc = float3();
+		GetEmitter(desc, i, vForceDens, vImLoc);
+
+		const auto tStart = chrono::steady_clock::now();
+		if (!fluid.Simulate(desc.fDeltaTime, vForceDens, vImLoc))
+		{
+			fprintf(stderr, "Rank %u lost its peers at step %u\n", uRank, i);
+
+			return 1;
+		}
+		const auto tSimulated = chrono::steady_clock::now();
+		fSimTime += chrono::duration<double, milli>(tSimulated - tStart).count();
+		uPressIterations += fluid.GetPressureStats().uIterations;
+
+		if (!bOutputs || (i + 1) % desc.uInterval != 0) continue;
+
+		// Every rank takes part in the gathers; rank 0 hands the whole fields to the recorder
+		if ((desc.bDensity && !fluid.GatherDensity(pDensity.get())) ||
+			(desc.bVelocity && !fluid.GatherVelocity(pVelocity.get())))
+		{
+			fprintf(stderr, "Rank %u lost its peers at step %u\n", uRank, i);
+
+			return 1;
+		}
+		if (pDensity) pRecorder->Record(*pDensity, OutputName(desc.output, "density", i + 1, "raw"));
+		if (pVelocity) pRecorder->Record(*pVelocity, OutputName(desc.output, "velocity", i + 1, "raw"));
+		fOutputTime += chrono::duration<double, milli>(chrono::steady_clock::now() - tSimulated).count();
+	}
+
+	if (fluid.GetHaloOverflows() > 0)
+		fprintf(stderr, "Rank %u: %llu backtraces left the halo and were clamped; raise -Halo\n", uRank,
+			static_cast<unsigned long long>(fluid.GetHaloOverflows()));
+
+	if (!bRoot) return 0;
+
+	const auto tFlush = chrono::steady_clock::now();
+	if (pRecorder) pRecorder->Flush();
+	const auto fFlushTime = chrono::duration<double, milli>(chrono::steady_clock::now() - tFlush).count();
+	const auto stats = pRecorder ? pRecorder->GetStats() : WriterStats();
+	if (stats.uFailed > 0)
+	{
+		fprintf(stderr, "Cannot write %u of the %u outputs to %s\n", static_cast<uint32_t>(stats.uFailed),
+			static_cast<uint32_t>(stats.uSubmitted),
+			desc.output.empty() ? "the working directory" : desc.output.c_str());
+
+		return 1;
+	}
+
+	// Rank 0's simulation time, which includes waiting on the other ranks
+	const auto fCells = double(desc.iWidth) * desc.iHeight * desc.iDepth;
+	const auto fStepTime = fSimTime / max(desc.uSteps, 1u);
+	printf("Simulate: %.3f ms/step, %.1f steps/s, %.1f Mcells/s\n", fStepTime,
+		1000.0 / fStepTime, fCells / fStepTime * 1e-3);
+	if (desc.fTolerance > 0.0f) printf("Pressure: %.1f iterations/step\n", double(uPressIterations) / max(desc.uSteps, 1u));
+	if (bOutputs) printf("Output: %.1f ms in the loop (%.1f ms stalled on the writers), "
+		"%.1f ms to flush\n", fOutputTime, stats.fStallTime, fFlushTime);
+
+	return 0;
+}
+
+static int RunDistributed(const BatchDesc &desc)
+{
+	if (!CheckDistributed(desc)) return 1;
+
+	// One process per rank
+	if (!desc.peers.empty())
+	{
+		SocketTransport transport(desc.uRank, desc.peers);
+		if (!transport.Connect())
+		{
+			fprintf(stderr, "Rank %u cannot connect to its peers\n", desc.uRank);
+
+			return 1;
+		}
+
+		return RunSlab(desc, transport, desc.uThreads);
+	}
+
+	// Ranks as threads of this process, sharing out the cores
+	SharedMemoryHub hub(desc.uRanks);
+	const auto uCores = desc.uThreads > 0 ? desc.uThreads : max(thread::hardware_concurrency(), 1u);
+	auto results = vector<int>(desc.uRanks);
+	auto threads = vector<thread>();
+	for (auto i = 0u; i < desc.uRanks; ++i)
+		threads.emplace_back([&, i]()
+		{
+			SharedMemoryTransport transport(hub, i);
+			results[i] = RunSlab(desc, transport, max(uCores / desc.uRanks, 1u));
+		});
+	for (auto &thread : threads) thread.join();
+
+	return *max_element(results.cbegin(), results.cend());
+}
+
+//--------------------------------------------------------------------------------------
+// Entry point
+//--------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	BatchDesc desc;
+	if (!ParseArgs(argc, argv, desc))
+	{
+		PrintUsage();
+
+		return 1;
+	}
+
+	if (!desc.trace.empty())
+	{
+		Trace::Enable(true);
+		Trace::DumpAtExit(desc.trace.c_str());
+	}
+
+	SetSimdLevel(desc.simd);
+
+	if (desc.uRanks > 1 || !desc.peers.empty()) return RunDistributed(desc);
+
+	HostThreadPool threadPool(desc.uThreads);
+	HostFluid3D fluid(threadPool);
+	fluid.Init(desc.iWidth, desc.iHeight, desc.iDepth);
+	fluid.GetPressure().SetSolver(desc.solver);
+	fluid.GetPressure().SetPreconditioner(desc.preconditioner);
+	fluid.GetPressure().SetWarmStart(desc.warmStart);
+	if (desc.fTolerance > 0.0f) fluid.SetPressureTolerance(desc.fTolerance, desc.uMaxIteration);
+	fluid.SetAdvection(desc.advection);
+	fluid.SetFusedStep(desc.bFused);
+	fluid.SetSparse(desc.bSparse);
+
+	// The emitter script and the output keep counting from the step of the checkpoint
+	auto uFirstStep = 0u;
+	if (!desc.resume.empty())
+	{
+		auto header = CheckpointHeader();
+		if (!fluid.LoadCheckpoint(desc.resume.c_str(), &header))
+		{
+			fprintf(stderr, "Cannot load the checkpoint %s\n", desc.resume.c_str());
+
+			return 1;
+		}
+		desc.iWidth = header.iWidth;
+		desc.iHeight = header.iHeight;
+		desc.iDepth = header.iDepth;
+		uFirstStep = static_cast<uint32_t>(header.uStep);
+	}
+
+	const auto bFrames = desc.iFrameWidth > 0 && desc.iFrameHeight > 0;
+	auto cbImmutable = HostFluid3D::CBImmutable();
+	cbImmutable.m_vDirectional = float4(1.0f, 1.0f, 1.0f, 1.6f);
+	cbImmutable.m_vAmbient = float4(1.0f, 1.0f, 1.0f, 0.08f);
+	const auto cbPerObj = bFrames ? DefaultCamera(desc.iFrameWidth, desc.iFrameHeight) : HostFluid3D::CBPerObject();
+	auto pFrame = bFrames ? make_unique<HostTexture2D<unorm4>>(desc.iFrameHeight, desc.iFrameWidth) : nullptr;
+	HostRecorder recorder(threadPool, desc.uBuffers, desc.uWriters);
+
+	printf("Grid %dx%dx%d, %u steps of %g from step %u on %u threads (%s)\n", desc.iWidth, desc.iHeight,
+		desc.iDepth, desc.uSteps, desc.fDeltaTime, uFirstStep, threadPool.GetNumThreads(), SimdLevelName(GetSimdLevel()));
+
+	auto fSimTime = 0.0, fOutputTime = 0.0;
+	auto uPressIterations = 0ull;
+	for (auto i = uFirstStep; i < uFirstStep + desc.uSteps; ++i)
+	{
+		auto vForceDens = float4();
+		auto vImLoc = float3();
+		GetEmitter(desc, i, vForceDens, vImLoc);
+
+		const auto tStart = chrono::steady_clock::now();
+		fluid.Simulate(desc.fDeltaTime, vForceDens, vImLoc, desc.uItVisc);
+		const auto tSimulated = chrono::steady_clock::now();
+		fSimTime += chrono::duration<double, milli>(tSimulated - tStart).count();
+		uPressIterations += fluid.GetPressureStats().uIterations;
+
+		const auto bCheckpoint = desc.uCheckpoint > 0 && (i + 1) % desc.uCheckpoint == 0;
+		const auto bOutput = desc.uInterval > 0 && (i + 1) % desc.uInterval == 0;
+		if (!bCheckpoint && !bOutput) continue;
+
+		// The fields and frames are copied out here and written by the recorder's threads
+		auto bWritten = true;
+		if (bCheckpoint) bWritten &= fluid.SaveCheckpoint(OutputName(desc.output, "checkpoint", i + 1, "ckp").c_str(),
+			i + 1, desc.fDeltaTime);
+		if (bOutput && desc.bDensity) recorder.Record(*fluid.GetDensity(), OutputName(desc.output, "density", i + 1, "raw"));
+		if (bOutput && desc.bVelocity) recorder.Record(*fluid.GetVelocity(), OutputName(desc.output, "velocity", i + 1, "raw"));
+		if (bOutput && bFrames)
+		{
+			// Cornflower blue, as the sample clears its back buffer
+			const auto &vExtent = pFrame->GetExtent();
+			for (auto y = 0; y < vExtent.y; ++y)
+				for (auto x = 0; x < vExtent.x; ++x)
+					(*pFrame)(int2(x, y)) = unorm4(0.392156899f, 0.584313750f, 0.929411829f, 1.0f);
+			fluid.Render(pFrame, cbImmutable, cbPerObj);
+			recorder.Record(*pFrame, OutputName(desc.output, "frame", i + 1, "ppm"));
+		}
+		fOutputTime += chrono::duration<double, milli>(chrono::steady_clock::now() - tSimulated).count();
+
+		if (!bWritten)
+		{
+			fprintf(stderr, "Cannot write the checkpoint of step %u to %s\n", i + 1,
+				desc.output.empty() ? "the working directory" : desc.output.c_str());
+
+			return 1;
+		}
+	}
+
+	const auto tFlush = chrono::steady_clock::now();
+	recorder.Flush();
+	const auto fFlushTime = chrono::duration<double, milli>(chrono::steady_clock::now() - tFlush).count();
+	const auto stats = recorder.GetStats();
+	if (stats.uFailed > 0)
+	{
+		fprintf(stderr, "Cannot write %u of the %u outputs to %s\n", static_cast<uint32_t>(stats.uFailed),
+			static_cast<uint32_t>(stats.uSubmitted),
+			desc.output.empty() ? "the working directory" : desc.output.c_str());
+
+		return 1;
+	}
+
+	// Pure simulation throughput, excluding rendering and file output
+	const auto fCells = double(desc.iWidth) * desc.iHeight * desc.iDepth;
+	const auto fStepTime = fSimTime / max(desc.uSteps, 1u);
+	printf("Simulate: %.3f ms/step, %.1f steps/s, %.1f Mcells/s\n", fStepTime,
+		1000.0 / fStepTime, fCells / fStepTime * 1e-3);
+	if (desc.fTolerance > 0.0f) printf("Pressure: %.1f iterations/step\n", double(uPressIterations) / max(desc.uSteps, 1u));
+	if (desc.uInterval > 0 || desc.uCheckpoint > 0) printf("Output: %.1f ms in the loop (%.1f ms stalled on the writers), "
+		"%.1f ms to flush\n", fOutputTime, stats.fStallTime, fFlushTime);
+
+	return 0;
+}
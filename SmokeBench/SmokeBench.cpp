@@ -0,0 +1,556 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "HostCamera.h"
+#include "HostFluid3DBatch.h"
+
+//--------------------------------------------------------------------------------------
+// Per-stage throughput benchmark of HostFluid3D. Each stage runs alone on grids of the
+// given sizes, with warm-up and repeated trials, and reports the median and 95th
+// percentile times, cells per second and effective bandwidth, optionally as JSON. With
+// -Simd, the stages run once per instruction set of the vectorized kernels and their
+// output is checked against the scalar kernels; with -Batch, it also compares a time
+// step of many instances run one by one and batched.
+//--------------------------------------------------------------------------------------
+
+#define DELTA_TIME				0.03f
+#define VISC_ITERATION_BENCH	10		// The sample's viscous setting
+
+using namespace std;
+
+// Exposes the stages of a time step, which Simulate otherwise runs back to back
+class BenchFluid3D : public HostFluid3D
+{
+public:
+	using HostFluid3D::HostFluid3D;
+	using HostFluid3D::advect;
+	using HostFluid3D::advectFused;
+	using HostFluid3D::diffuse;
+	using HostFluid3D::impulse;
+	using HostFluid3D::project;
+	using HostFluid3D::subtractGradient;
+	using HostFluid3D::buildOccupancy;
+
+	const vector<float> &GetOccupancy() const { return m_occupancy; }
+};
+
+// Compulsory traffic of one pass over a cell: every field read once and written once
+struct Stage
+{
+	const char	*szName;
+	double		fBytesPerCell;
+};
+
+static const SimdLevel g_simdLevels[] = { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+
+static const Stage g_stages[] =
+{
+	{ "advect",		16.0 + 4.0 + 16.0 + 4.0 },									// Velocity and density in and out
+	{ "diffuse",	32.0 + 48.0 * VISC_ITERATION_BENCH },						// Copy, then per Jacobi sweep
+	{ "impulse",	16.0 + 4.0 + 16.0 + 4.0 },									// Velocity and density in and out
+	{ "divergence",	16.0 + 4.0 },												// Velocity in, divergence out
+	{ "unfused",	(16.0 + 4.0) * 4.0 + 16.0 + 4.0 },							// Advect, impulse, then divergence
+	{ "fused",		16.0 + 4.0 + 16.0 + 4.0 + 4.0 },							// Velocity and density in and out, divergence out
+	{ "laplacian",	4.0 + 4.0 },												// The PCG operator product, p in, A p out
+	{ "poisson",	12.0 * PRESS_ITERATION },									// Per sweep: pressure, divergence, pressure out
+	{ "project",	16.0 + 4.0 + 16.0 },										// Velocity and pressure in, velocity out
+	{ "occupancy",	4.0 },														// Density in
+	{ "render",		0.0 }														// Bound by the ray march, not the grid
+};
+
+struct BenchDesc
+{
+	vector<int32_t>		sizes;
+	vector<string>		stages;
+	uint32_t			uTrials;
+	uint32_t			uWarmup;
+	uint32_t			uThreads;
+	PoissonSolver		solver;
+	vector<SimdLevel>	simdLevels;
+	int32_t				iFrameWidth;
+	int32_t				iFrameHeight;
+	uint32_t			uInstances;
+	string				json;
+};
+
+struct Result
+{
+	int32_t		iSize;
+	SimdLevel	simd;
+	const Stage	*pStage;
+	double		fMedian;
+	double		fP95;
+	double		fCellsPerSec;
+	double		fGBPerSec;
+	uint64_t	uChecksum;		// The state the stage leaves behind
+};
+
+struct BatchResult
+{
+	int32_t		iSize;
+	uint32_t	uInstances;
+	double		fSeparate;		// Median milliseconds per step, instance by instance
+	double		fBatched;		// Median milliseconds per step of HostFluid3DBatch
+};
+
+//--------------------------------------------------------------------------------------
+// Command line
+//--------------------------------------------------------------------------------------
+
+// Matches -Name:value or -Name case-insensitively, as DXUT does
+static bool GetArg(const char *szArg, const char *szName, const char *&szValue)
+{
+	if (*szArg != '-' && *szArg != '/') return false;
+	++szArg;
+
+	const auto uLen = strlen(szName);
+	for (auto i = 0u; i < uLen; ++i)
+		if (tolower(szArg[i]) != tolower(szName[i])) return false;
+
+	if (szArg[uLen] == ':') szValue = szArg + uLen + 1;
+	else if (szArg[uLen] == '\0') szValue = "";
+	else return false;
+
+	return true;
+}
+
+static vector<string> SplitList(const char *szValue)
+{
+	vector<string> items;
+	string item;
+	for (; *szValue; ++szValue)
+	{
+		if (*szValue == ',')
+		{
+			if (!item.empty()) items.push_back(item);
+			item.clear();
+		}
+		else item += static_cast<char>(tolower(*szValue));
+	}
+	if (!item.empty()) items.push_back(item);
+
+	return items;
+}
+
+static bool ParseArgs(const int argc, char *argv[], BenchDesc &desc)
+{
+	desc.sizes = { 32, 64, 128, 256 };
+	desc.uTrials = 10;
+	desc.uWarmup = 2;
+	desc.uThreads = 0;
+	desc.solver = POISSON_GAUSS_SEIDEL;
+	desc.iFrameWidth = 640;
+	desc.iFrameHeight = 480;
+	desc.uInstances = 0;
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		const char *szValue = nullptr;
+		const auto szArg = argv[i];
+
+		if (GetArg(szArg, "Sizes", szValue))
+		{
+			desc.sizes.clear();
+			for (const auto &item : SplitList(szValue)) desc.sizes.push_back(atoi(item.c_str()));
+		}
+		else if (GetArg(szArg, "Stages", szValue)) desc.stages = SplitList(szValue);
+		else if (GetArg(szArg, "Trials", szValue)) desc.uTrials = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Warmup", szValue)) desc.uWarmup = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Threads", szValue)) desc.uThreads = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Solver", szValue))
+		{
+			const auto solver = SplitList(szValue);
+			if (solver.size() != 1) return false;
+			if (solver[0] == "gaussseidel") desc.solver = POISSON_GAUSS_SEIDEL;
+			else if (solver[0] == "redblack") desc.solver = POISSON_RED_BLACK;
+			else if (solver[0] == "multigrid") desc.solver = POISSON_MULTIGRID;
+			else if (solver[0] == "pcg") desc.solver = POISSON_PCG;
+			else return false;
+		}
+		else if (GetArg(szArg, "Simd", szValue))
+		{
+			for (const auto &item : SplitList(szValue))
+			{
+				const auto pLevel = find_if(begin(g_simdLevels), end(g_simdLevels),
+					[&](const SimdLevel level) { return item == SimdLevelName(level); });
+				if (pLevel == end(g_simdLevels)) return false;
+				if (*pLevel > GetSupportedSimdLevel())
+				{
+					fprintf(stderr, "This CPU does not support %s\n", item.c_str());
+					return false;
+				}
+				desc.simdLevels.push_back(*pLevel);
+			}
+		}
+		else if (GetArg(szArg, "FrameWidth", szValue)) desc.iFrameWidth = atoi(szValue);
+		else if (GetArg(szArg, "FrameHeight", szValue)) desc.iFrameHeight = atoi(szValue);
+		else if (GetArg(szArg, "Batch", szValue)) desc.uInstances = strtoul(szValue, nullptr, 10);
+		else if (GetArg(szArg, "Json", szValue)) desc.json = szValue;
+		else
+		{
+			fprintf(stderr, "Unknown argument %s\n", szArg);
+			return false;
+		}
+	}
+
+	for (const auto &stage : desc.stages)
+	{
+		const auto pStage = find_if(begin(g_stages), end(g_stages),
+			[&](const Stage &s) { return stage == s.szName; });
+		if (pStage == end(g_stages))
+		{
+			fprintf(stderr, "Unknown stage %s\n", stage.c_str());
+			return false;
+		}
+	}
+
+	// Scalar first, so that the other levels have its output to be checked against
+	if (desc.simdLevels.empty()) desc.simdLevels.push_back(GetSupportedSimdLevel());
+	sort(desc.simdLevels.begin(), desc.simdLevels.end());
+	desc.simdLevels.erase(unique(desc.simdLevels.begin(), desc.simdLevels.end()), desc.simdLevels.end());
+
+	const auto bValidSizes = all_of(desc.sizes.cbegin(), desc.sizes.cend(), [](const int32_t i) { return i > 0; });
+
+	return bValidSizes && !desc.sizes.empty() && desc.uTrials > 0 && desc.iFrameWidth > 0 && desc.iFrameHeight > 0;
+}
+
+static void PrintUsage()
+{
+	printf(
+		"SmokeBench [-Name:value ...]\n"
+		"  -Sizes:32,64,128,256              cubic grid sizes\n"
+		"  -Stages:advect,...                subset of: advect diffuse impulse divergence\n"
+		"                                    unfused fused laplacian poisson project\n"
+		"                                    occupancy render (all)\n"
+		"  -Trials: -Warmup:                 timed and untimed runs per stage (10, 2)\n"
+		"  -Threads:                         worker threads, 0 for all cores (0)\n"
+		"  -Solver:GaussSeidel|RedBlack|Multigrid|PCG\n"
+		"  -Simd:scalar,avx2,avx512          instruction sets to run the stages with, each\n"
+		"                                    in turn, checked against scalar if listed\n"
+		"                                    (the widest the CPU supports)\n"
+		"  -FrameWidth: -FrameHeight:        render target size (640x480)\n"
+		"  -Batch:n                          also time steps of n instances, one by one\n"
+		"                                    and batched (0)\n"
+		"  -Json:file                        also write the results as JSON\n"
+		);
+}
+
+//--------------------------------------------------------------------------------------
+// Measurement
+//--------------------------------------------------------------------------------------
+
+// Times func after an untimed setup on each run; the first uWarmup runs are discarded
+template<typename S, typename F>
+static vector<double> Measure(const BenchDesc &desc, const S &setup, const F &func)
+{
+	vector<double> times;
+	times.reserve(desc.uTrials);
+	for (auto i = 0u; i < desc.uWarmup + desc.uTrials; ++i)
+	{
+		setup();
+		const auto tStart = chrono::steady_clock::now();
+		func();
+		const auto fTime = chrono::duration<double, milli>(chrono::steady_clock::now() - tStart).count();
+		if (i >= desc.uWarmup) times.push_back(fTime);
+	}
+	sort(times.begin(), times.end());
+
+	return times;
+}
+
+static uint64_t Checksum(const void *pData, const size_t uSize, uint64_t uHash = 14695981039346656037ull)
+{
+	const auto pBytes = static_cast<const uint8_t*>(pData);
+	for (auto i = 0u; i < uSize; ++i)
+	{
+		uHash ^= pBytes[i];
+		uHash *= 1099511628211ull;
+	}
+
+	return uHash;
+}
+
+template<typename T>
+static uint64_t Checksum(const HostTexture3D<T> &txField, const uint64_t uHash)
+{
+	return Checksum(txField.GetData(), sizeof(T) * txField.GetNumTexels(), uHash);
+}
+
+// The scalar run of the same size and stage, if there is one to check against
+static const Result *FindScalar(const vector<Result> &results, const Result &result)
+{
+	const auto pScalar = find_if(results.cbegin(), results.cend(), [&](const Result &r)
+	{
+		return r.simd == SIMD_SCALAR && r.iSize == result.iSize && r.pStage == result.pStage;
+	});
+
+	return result.simd != SIMD_SCALAR && pScalar != results.cend() ? &*pScalar : nullptr;
+}
+
+static double Median(const vector<double> &times)
+{
+	const auto uCount = times.size();
+
+	return uCount % 2 ? times[uCount / 2] : 0.5 * (times[uCount / 2 - 1] + times[uCount / 2]);
+}
+
+static Result Summarize(const int32_t iSize, const SimdLevel simd, const Stage &stage, const vector<double> &times)
+{
+	const auto uCount = times.size();
+	const auto fCells = double(iSize) * iSize * iSize;
+
+	Result result;
+	result.iSize = iSize;
+	result.simd = simd;
+	result.pStage = &stage;
+	result.fMedian = Median(times);
+	result.fP95 = times[static_cast<size_t>(ceil(0.95 * uCount)) - 1];			// Nearest rank
+	result.fCellsPerSec = fCells / result.fMedian * 1e3;
+	result.fGBPerSec = fCells * stage.fBytesPerCell / result.fMedian * 1e-6;
+
+	return result;
+}
+
+static void RunSize(const BenchDesc &desc, HostThreadPool &threadPool, const int32_t iSize, vector<Result> &results)
+{
+	BenchFluid3D fluid(threadPool);
+	fluid.Init(iSize, iSize, iSize);
+	fluid.GetPressure().SetSolver(desc.solver);
+
+	// A plume from the sample's emitter, so that the render has something to march through
+	const auto vForceDens = float4(0.0f, -300.0f, 0.0f, 0.25f);
+	const auto vImLoc = float3(0.5f, 0.9f, 0.5f);
+	for (auto i = 0; i < 4; ++i)
+	{
+		fluid.impulse(DELTA_TIME, vForceDens, vImLoc);
+		fluid.advect(DELTA_TIME);
+	}
+	fluid.buildOccupancy();
+
+	auto cbImmutable = HostFluid3D::CBImmutable();
+	cbImmutable.m_vDirectional = float4(1.0f, 1.0f, 1.0f, 1.6f);
+	cbImmutable.m_vAmbient = float4(1.0f, 1.0f, 1.0f, 0.08f);
+	const auto cbPerObj = DefaultCamera(desc.iFrameWidth, desc.iFrameHeight);
+	auto pFrame = make_unique<HostTexture2D<unorm4>>(desc.iFrameHeight, desc.iFrameWidth);
+
+	// Every level starts from the same plume and runs the same passes, so the fields, the
+	// pyramid and the frame must come out bit for bit the same as with the scalar kernels.
+	// The stages carry on from each other, so a stage that diverges marks those after it too.
+	const auto state = [&]()
+	{
+		const auto &occupancy = fluid.GetOccupancy();
+		const auto &vExtent = pFrame->GetExtent();
+		auto uHash = Checksum(occupancy.data(), sizeof(float) * occupancy.size());
+		uHash = Checksum(*fluid.GetVelocity(), uHash);
+		uHash = Checksum(*fluid.GetDensity(), uHash);
+		uHash = Checksum(*fluid.GetPressure().GetSrc(), uHash);
+		uHash = Checksum(*fluid.GetPressure().GetDst(), uHash);
+
+		return Checksum(pFrame->GetData(), sizeof(unorm4) * vExtent.x * vExtent.y, uHash);
+	};
+
+	const auto none = []() {};
+	const auto divergence = [&]() { fluid.GetPressure().ComputeDivergence(*fluid.GetVelocity()); };
+	const auto laplacian = [&]()
+	{
+		const auto &txSource = *fluid.GetPressure().GetSrc();
+		auto &txDst = *fluid.GetPressure().GetDst();
+		ParallelForEachRow(threadPool, txDst.GetExtent(), [&](cint3 &vLoc, const int32_t iWidth)
+		{
+			LaplacianRow(txSource, txDst, 6.0f, vLoc, iWidth);
+		});
+	};
+
+	for (const auto &stage : g_stages)
+	{
+		if (!desc.stages.empty() && find(desc.stages.cbegin(), desc.stages.cend(), stage.szName) == desc.stages.cend())
+			continue;
+
+		const string name = stage.szName;
+		vector<double> times;
+		if (name == "advect") times = Measure(desc, none, [&]() { fluid.advect(DELTA_TIME); });
+		else if (name == "diffuse") times = Measure(desc, none, [&]() { fluid.diffuse(VISC_ITERATION_BENCH); });
+		else if (name == "impulse") times = Measure(desc, none, [&]() { fluid.impulse(DELTA_TIME, vForceDens, vImLoc); });
+		else if (name == "divergence") times = Measure(desc, none, divergence);
+		else if (name == "unfused") times = Measure(desc, none, [&]()
+		{
+			fluid.advect(DELTA_TIME);
+			fluid.impulse(DELTA_TIME, vForceDens, vImLoc);
+			divergence();
+		});
+		else if (name == "fused") times = Measure(desc, none, [&]() { fluid.advectFused(DELTA_TIME, vForceDens, vImLoc); });
+		else if (name == "laplacian") times = Measure(desc, divergence, laplacian);
+		else if (name == "poisson")
+			times = Measure(desc, divergence, [&]() { fluid.GetPressure().SolvePoisson(float2(-1.0f, 6.0f)); });
+		else if (name == "project") times = Measure(desc, none, [&]() { fluid.subtractGradient(); });
+		else if (name == "occupancy") times = Measure(desc, none, [&]() { fluid.buildOccupancy(); });
+		else if (name == "render") times = Measure(desc, none, [&]() { fluid.Render(pFrame, cbImmutable, cbPerObj); });
+
+		results.push_back(Summarize(iSize, GetSimdLevel(), stage, times));
+		results.back().uChecksum = state();
+
+		const auto &result = results.back();
+		const auto pScalar = FindScalar(results, result);
+		printf("%5d  %-7s %-10s %10.3f %10.3f %10.1f", iSize, SimdLevelName(result.simd), stage.szName,
+			result.fMedian, result.fP95, result.fCellsPerSec * 1e-6);
+		if (stage.fBytesPerCell > 0.0) printf(" %8.2f", result.fGBPerSec);
+		else printf("        -");
+		printf("  %s\n", pScalar ? (pScalar->uChecksum == result.uChecksum ? "same" : "DIFFERENT") : "-");
+		fflush(stdout);
+	}
+}
+
+// A time step of desc.uInstances grids of iSize cubed: the default path of Simulate on each
+// HostFluid3D in turn, against the same stages run once over a HostFluid3DBatch
+static void RunBatch(const BenchDesc &desc, HostThreadPool &threadPool, const int32_t iSize,
+	vector<BatchResult> &results)
+{
+	const auto uInstances = desc.uInstances;
+	const auto vForceDens = float4(0.0f, -300.0f, 0.0f, 0.25f);
+	const auto imLoc = [uInstances](const uint32_t i)
+	{
+		// Spread the emitters, so that the instances differ
+		return float3(0.5f, 0.9f, 0.25f + 0.5f * i / max(uInstances - 1, 1u));
+	};
+
+	vector<unique_ptr<BenchFluid3D>> fluids(uInstances);
+	HostFluid3DBatch batch(threadPool);
+	for (auto i = 0u; i < uInstances; ++i)
+	{
+		fluids[i] = make_unique<BenchFluid3D>(threadPool);
+		fluids[i]->Init(iSize, iSize, iSize);
+		batch.AddInstance(iSize, iSize, iSize);
+	}
+	batch.Init();
+	for (auto i = 0u; i < uInstances; ++i) batch.SetInstance(i, DELTA_TIME, vForceDens, imLoc(i));
+
+	const auto none = []() {};
+	const auto separate = Measure(desc, none, [&]()
+	{
+		for (auto i = 0u; i < uInstances; ++i)
+		{
+			fluids[i]->advect(DELTA_TIME);
+			fluids[i]->impulse(DELTA_TIME, vForceDens, imLoc(i));
+			fluids[i]->project(DELTA_TIME);
+		}
+	});
+	const auto batched = Measure(desc, none, [&]() { batch.Simulate(); });
+
+	BatchResult result;
+	result.iSize = iSize;
+	result.uInstances = uInstances;
+	result.fSeparate = Median(separate);
+	result.fBatched = Median(batched);
+	results.push_back(result);
+
+	const auto fCells = double(iSize) * iSize * iSize * uInstances;
+	printf("%5d  %9u %11.3f %11.3f %11.1f %11.1f %8.2fx\n", iSize, uInstances, result.fSeparate, result.fBatched,
+		fCells / result.fSeparate * 1e-3, fCells / result.fBatched * 1e-3, result.fSeparate / result.fBatched);
+	fflush(stdout);
+}
+
+static bool WriteJson(const BenchDesc &desc, const uint32_t uThreads, const vector<Result> &results,
+	const vector<BatchResult> &batchResults)
+{
+	const auto pFile = fopen(desc.json.c_str(), "w");
+	if (!pFile) return false;
+
+	fprintf(pFile, "{\n");
+	fprintf(pFile, "  \"backend\": \"host\",\n");
+	fprintf(pFile, "  \"threads\": %u,\n", uThreads);
+	fprintf(pFile, "  \"trials\": %u,\n", desc.uTrials);
+	fprintf(pFile, "  \"warmup\": %u,\n", desc.uWarmup);
+	fprintf(pFile, "  \"frame\": [%d, %d],\n", desc.iFrameWidth, desc.iFrameHeight);
+	fprintf(pFile, "  \"results\": [\n");
+	for (auto i = 0u; i < results.size(); ++i)
+	{
+		const auto &result = results[i];
+		fprintf(pFile, "    { \"size\": %d, \"simd\": \"%s\", \"stage\": \"%s\", \"median_ms\": %.6g, "
+			"\"p95_ms\": %.6g, \"cells_per_s\": %.6g, ", result.iSize, SimdLevelName(result.simd),
+			result.pStage->szName, result.fMedian, result.fP95, result.fCellsPerSec);
+		if (result.pStage->fBytesPerCell > 0.0) fprintf(pFile, "\"gb_per_s\": %.6g, ", result.fGBPerSec);
+		else fprintf(pFile, "\"gb_per_s\": null, ");
+		const auto pScalar = FindScalar(results, result);
+		if (pScalar) fprintf(pFile, "\"same_as_scalar\": %s }", pScalar->uChecksum == result.uChecksum ? "true" : "false");
+		else fprintf(pFile, "\"same_as_scalar\": null }");
+		fprintf(pFile, i + 1 < results.size() ? ",\n" : "\n");
+	}
+	fprintf(pFile, "  ],\n");
+	fprintf(pFile, "  \"batch\": [\n");
+	for (auto i = 0u; i < batchResults.size(); ++i)
+	{
+		const auto &result = batchResults[i];
+		fprintf(pFile, "    { \"size\": %d, \"instances\": %u, \"separate_ms\": %.6g, \"batched_ms\": %.6g }%s\n",
+			result.iSize, result.uInstances, result.fSeparate, result.fBatched, i + 1 < batchResults.size() ? "," : "");
+	}
+	fprintf(pFile, "  ]\n");
+	fprintf(pFile, "}\n");
+
+	return fclose(pFile) == 0;
+}
+
+//--------------------------------------------------------------------------------------
+// Entry point
+//--------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	BenchDesc desc;
+	if (!ParseArgs(argc, argv, desc))
+	{
+		PrintUsage();
+
+		return 1;
+	}
+
+	HostThreadPool threadPool(desc.uThreads);
+	printf("%u threads, %u trials after %u warm-up runs\n", threadPool.GetNumThreads(), desc.uTrials, desc.uWarmup);
+	printf(" size  simd    stage      median ms     p95 ms   Mcells/s     GB/s  vs scalar\n");
+
+	vector<Result> results;
+	for (const auto simd : desc.simdLevels)
+	{
+		SetSimdLevel(simd);
+		for (const auto iSize : desc.sizes) RunSize(desc, threadPool, iSize, results);
+	}
+	SetSimdLevel(GetSupportedSimdLevel());
+
+	const auto uMismatches = count_if(results.cbegin(), results.cend(), [&](const Result &result)
+	{
+		const auto pScalar = FindScalar(results, result);
+
+		return pScalar && pScalar->uChecksum != result.uChecksum;
+	});
+
+	vector<BatchResult> batchResults;
+	if (desc.uInstances > 0)
+	{
+		printf("\n size  instances  separate ms  batched ms  Mcells/s sep  Mcells/s bat  speedup\n");
+		for (const auto iSize : desc.sizes) RunBatch(desc, threadPool, iSize, batchResults);
+	}
+
+	if (!desc.json.empty() && !WriteJson(desc, threadPool.GetNumThreads(), results, batchResults))
+	{
+		fprintf(stderr, "Cannot write %s\n", desc.json.c_str());
+
+		return 1;
+	}
+
+	if (uMismatches > 0)
+	{
+		fprintf(stderr, "%d stage(s) differ from the scalar kernels\n", static_cast<int>(uMismatches));
+
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1358 @@
+//--------------------------------------------------------------------------------------
+// By Stars XU Tianchen
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "HostCamera.h"
+#include "HostFluid3DSlab.h"
+
+//--------------------------------------------------------------------------------------
+// Headless checks of the host simulation and renderer. Each case runs the code paths
+// that are meant to agree, on small grids, and compares their results: bit for bit
+// where the paths promise it, against a bound where they approximate. The exit code is
+// the number of failed cases, so that a build script can run it after building.
+//--------------------------------------------------------------------------------------
+
+#define DELTA_TIME		0.03f
+
+using namespace std;
+
+struct TestCase
+{
+	const char	*szName;
+	bool		(*pTest)(HostThreadPool &threadPool);
+};
+
+struct TestDesc
+{
+	vector<string>		tests;
+	uint32_t			uThreads;
+};
+
+//--------------------------------------------------------------------------------------
+// Helpers
+//--------------------------------------------------------------------------------------
+
+// 64-bit FNV-1a over raw bytes
+static uint64_t Checksum(const void *pData, const size_t uSize, uint64_t uHash = 14695981039346656037ull)
+{
+	const auto pBytes = static_cast<const uint8_t*>(pData);
+	for (auto i = 0u; i < uSize; ++i)
+	{
+		uHash ^= pBytes[i];
+		uHash *= 1099511628211ull;
+	}
+
+	return uHash;
+}
+
+template<typename T>
+static uint64_t Checksum(const HostTexture3D<T> &txField)
+{
+	return Checksum(txField.GetData(), sizeof(T) * txField.GetNumTexels());
+}
+
+static uint64_t Checksum(const HostTexture2D<unorm4> &txFrame)
+{
+	const auto &vExtent = txFrame.GetExtent();
+
+	return Checksum(txFrame.GetData(), sizeof(unorm4) * vExtent.x * vExtent.y);
+}
+
+// Mean absolute difference of the color channels
+static double MeanError(const HostTexture2D<unorm4> &txA, const HostTexture2D<unorm4> &txB)
+{
+	const auto &vExtent = txA.GetExtent();
+	const auto uNumPixels = static_cast<size_t>(vExtent.x) * vExtent.y;
+	const auto pA = txA.GetData(), pB = txB.GetData();
+
+	auto fError = 0.0;
+	for (auto i = 0u; i < uNumPixels; ++i)
+		fError += fabs(pA[i].x - pB[i].x) + fabs(pA[i].y - pB[i].y) + fabs(pA[i].z - pB[i].z);
+
+	return fError / (3.0 * uNumPixels);
+}
+
+// Sum of the absolute differences of every component over the sum of the magnitudes in txA
+template<typename T>
+static double RelativeError(const HostTexture3D<T> &txA, const HostTexture3D<T> &txB)
+{
+	const auto uNumValues = txA.GetNumTexels() * sizeof(T) / sizeof(float);
+	const auto pA = reinterpret_cast<const float*>(txA.GetData());
+	const auto pB = reinterpret_cast<const float*>(txB.GetData());
+
+	auto fError = 0.0, fNorm = 0.0;
+	for (auto i = 0u; i < uNumValues; ++i)
+	{
+		fError += fabs(pA[i] - pB[i]);
+		fNorm += fabs(pA[i]);
+	}
+
+	return fNorm > 0.0 ? fError / fNorm : fError;
+}
+
+// A plume from the sample's emitter
+static void Plume(HostFluid3D &fluid, const uint32_t uSteps)
+{
+	const auto vForceDens = float4(0.0f, -300.0f, 0.0f, 0.5f);
+	const auto vImLoc = float3(0.5f, 0.9f, 0.5f);
+	for (auto i = 0u; i < uSteps; ++i) fluid.Simulate(DELTA_TIME, vForceDens, vImLoc);
+}
+
+// A smooth swirl plus hashed noise, the same on every run
+static HostTexture3D<float4> TestVelocity(const int32_t iWidth, const int32_t iHeight, const int32_t iDepth)
+{
+	HostTexture3D<float4> txVelocity(iDepth, iHeight, iWidth);
+	for (auto z = 0; z < iDepth; ++z)
+		for (auto y = 0; y < iHeight; ++y)
+			for (auto x = 0; x < iWidth; ++x)
+			{
+				auto uHash = static_cast<uint32_t>(((z * iHeight + y) * iWidth + x) * 2654435761u);
+				const auto noise = [&uHash]()
+				{
+					uHash ^= uHash >> 15;
+					uHash *= 2246822519u;
+					uHash ^= uHash >> 13;
+
+					return float(uHash & 0xffff) / 65535.0f - 0.5f;
+				};
+
+				const auto vPos = float3(float(x) / iWidth, float(y) / iHeight, float(z) / iDepth) - 0.5f;
+				txVelocity(int3(x, y, z)) = float4(-vPos.y + noise(), vPos.x + noise(), vPos.z * 0.5f + noise(), 0.0f);
+			}
+
+	return txVelocity;
+}
+
+// Takes the divergence of txVelocity as the right-hand side of a solve from zero;
+// configure picks the solver first
+template<typename F>
+static void InitPressure(HostPoisson3D<float> &pressure, HostThreadPool &threadPool,
+	const HostTexture3D<float4> &txVelocity, const F &configure)
+{
+	const auto &vExtent = txVelocity.GetExtent();
+	pressure.Init(vExtent.x, vExtent.y, vExtent.z, threadPool);
+	pressure.SetWarmStart(WARM_START_NONE);
+	configure(pressure);
+	pressure.ComputeDivergence(txVelocity);
+}
+
+static HostFluid3D::CBImmutable SampleLights()
+{
+	auto cbImmutable = HostFluid3D::CBImmutable();
+	cbImmutable.m_vDirectional = float4(1.0f, 1.0f, 1.0f, 1.6f);
+	cbImmutable.m_vAmbient = float4(1.0f, 1.0f, 1.0f, 0.08f);
+
+	return cbImmutable;
+}
+
+//--------------------------------------------------------------------------------------
+// Pressure solvers
+//--------------------------------------------------------------------------------------
+
+#define DIFFUSE_ITERATION	10
+#define MG_TOLERANCE	1e-4f
+#define MG_MAX_CYCLES	8
+#define PCG_TEST_TOLERANCE	1e-5f
+#define PCG_MAX_ITERATION	400
+#define PCG_RESIDUAL_SLACK	2.0f	// Bound on the recomputed residual, in tolerances
+#define RB_RESIDUAL_RATIO	2.0f	// Bound on the ratio of the red-black and Gauss-Seidel residuals
+#define TOL_MAX_ITERATION	45		// Odd, as is the check interval, so chunks end mid-dispatch
+#define TOL_CHECK_INTERVAL	3
+#define TOL_BUDGET			7		// Iterations of the runs that cannot converge
+#define TOL_RESIDUAL_MATCH	1e-3	// Bound on the relative difference of the reported and recomputed residuals,
+#define TOL_RESIDUAL_FLOOR	1e-6	// plus the float rounding of a residual relative to the right-hand side
+
+// Every cycle type brings the residual below MG_TOLERANCE within MG_MAX_CYCLES cycles,
+// on grids that halve evenly and on ones that do not
+static bool TestMultigrid(HostThreadPool &threadPool)
+{
+	static const char *const szCycles[] = { "V", "W", "F" };
+
+	auto bPassed = true;
+	for (const auto &vSize : { int3(48, 48, 48), int3(37, 21, 19) })
+	{
+		const auto txVelocity = TestVelocity(vSize.x, vSize.y, vSize.z);
+		for (const auto cycle : { MULTIGRID_V_CYCLE, MULTIGRID_W_CYCLE, MULTIGRID_F_CYCLE })
+		{
+			HostPoisson3D<float> pressure;
+			InitPressure(pressure, threadPool, txVelocity, [cycle](HostPoisson3D<float> &solver)
+			{
+				solver.SetSolver(POISSON_MULTIGRID);
+				solver.SetMultigrid(8, cycle);
+			});
+
+			const auto stats = pressure.SolvePoisson(float2(-1.0f, 6.0f), MG_TOLERANCE, MG_MAX_CYCLES, 1);
+			printf("    %dx%dx%d %s-cycle: residual %.2e after %u cycles\n", vSize.x, vSize.y, vSize.z,
+				szCycles[cycle], stats.fResidual, stats.uIterations);
+			bPassed = bPassed && stats.bConverged;
+		}
+	}
+
+	return bPassed;
+}
+
+// A global red-black Gauss-Seidel over txKnown, sweep by sweep in one thread: each
+// half-sweep updates the cells of one parity of x + y + z from the others
+static HostTexture3D<float> RedBlackReference(const HostTexture3D<float> &txKnown, cfloat2 &vf,
+	const int32_t iSweeps)
+{
+	const auto &vExtent = txKnown.GetExtent();
+	HostTexture3D<float> txUnknown(vExtent.z, vExtent.y, vExtent.x);
+
+	for (auto i = 0; i < 2 * iSweeps; ++i)
+		for (auto z = 0; z < vExtent.z; ++z)
+			for (auto y = 0; y < vExtent.y; ++y)
+				for (auto x = (y + z + i) & 1; x < vExtent.x; x += 2)
+				{
+					auto fq = vf.x * txKnown(int3(x, y, z));
+					fq += txUnknown.Load(int3(x - 1, y, z));
+					fq += txUnknown.Load(int3(x + 1, y, z));
+					fq += txUnknown.Load(int3(x, y - 1, z));
+					fq += txUnknown.Load(int3(x, y + 1, z));
+					fq += txUnknown.Load(int3(x, y, z - 1));
+					fq += txUnknown.Load(int3(x, y, z + 1));
+					txUnknown(int3(x, y, z)) = fq / vf.y;
+				}
+
+	return txUnknown;
+}
+
+// Red-black sweeps give the same bits as the sequential reference on any number of
+// threads, including sizes that are not multiples of the tile; the block Gauss-Seidel
+// sweeps agree across thread counts and reach a residual of the same order
+static bool TestRedBlack(HostThreadPool &threadPool)
+{
+	HostThreadPool serial(1);
+
+	auto bPassed = true;
+	for (const auto &vSize : { int3(32, 32, 32), int3(37, 21, 19) })
+	{
+		const auto txVelocity = TestVelocity(vSize.x, vSize.y, vSize.z);
+
+		PoissonStats stats[2];
+		for (const auto solver : { POISSON_RED_BLACK, POISSON_GAUSS_SEIDEL })
+		{
+			uint64_t uChecksums[2];
+			HostTexture3D<float> txReference(0, 0, 0);
+			for (auto i = 0; i < 2; ++i)
+			{
+				HostPoisson3D<float> pressure;
+				InitPressure(pressure, i > 0 ? threadPool : serial, txVelocity,
+					[solver](HostPoisson3D<float> &s) { s.SetSolver(solver); });
+				if (solver == POISSON_RED_BLACK && i == 0)
+					txReference = RedBlackReference(*pressure.GetSrc(), float2(-1.0f, 6.0f), PRESS_ITERATION);
+
+				// Residual checks only after the last sweep, so they do not change the sweeps
+				stats[solver == POISSON_GAUSS_SEIDEL] = pressure.SolvePoisson(float2(-1.0f, 6.0f), 0.0f,
+					PRESS_ITERATION, PRESS_ITERATION);
+				uChecksums[i] = Checksum(*pressure.GetSrc());
+			}
+
+			const auto bSame = uChecksums[0] == uChecksums[1];
+			const auto bReference = solver != POISSON_RED_BLACK || uChecksums[0] == Checksum(txReference);
+			printf("    %dx%dx%d %s: %s on 1 and %u threads%s\n", vSize.x, vSize.y, vSize.z,
+				solver == POISSON_RED_BLACK ? "red-black" : "block Gauss-Seidel", bSame ? "same" : "DIFFERENT",
+				threadPool.GetNumThreads(), solver != POISSON_RED_BLACK ? "" :
+				(bReference ? ", same as the reference" : ", DIFFERENT from the reference"));
+			bPassed = bPassed && bSame && bReference;
+		}
+
+		const auto fRatio = stats[0].fResidual / stats[1].fResidual;
+		printf("    %dx%dx%d residual after %d sweeps: red-black %.3e, block Gauss-Seidel %.3e\n",
+			vSize.x, vSize.y, vSize.z, PRESS_ITERATION, stats[0].fResidual, stats[1].fResidual);
+		bPassed = bPassed && fRatio < RB_RESIDUAL_RATIO && fRatio > 1.0f / RB_RESIDUAL_RATIO;
+	}
+
+	return bPassed;
+}
+
+// The relative residual of txUnknown, recomputed in double precision from the zero
+// boundary, as a check on what the solver reports
+static double Residual(const HostTexture3D<float> &txUnknown, const HostTexture3D<float> &txKnown, cfloat2 &vf)
+{
+	const auto &vExtent = txKnown.GetExtent();
+
+	auto fResidual = 0.0, fNorm = 0.0;
+	for (auto z = 0; z < vExtent.z; ++z)
+		for (auto y = 0; y < vExtent.y; ++y)
+			for (auto x = 0; x < vExtent.x; ++x)
+			{
+				const auto fKnown = static_cast<double>(vf.x) * txKnown(int3(x, y, z));
+				auto fq = fKnown - static_cast<double>(vf.y) * txUnknown(int3(x, y, z));
+				fq += txUnknown.Load(int3(x - 1, y, z));
+				fq += txUnknown.Load(int3(x + 1, y, z));
+				fq += txUnknown.Load(int3(x, y - 1, z));
+				fq += txUnknown.Load(int3(x, y + 1, z));
+				fq += txUnknown.Load(int3(x, y, z - 1));
+				fq += txUnknown.Load(int3(x, y, z + 1));
+				fResidual += fq * fq;
+				fNorm += fKnown * fKnown;
+			}
+
+	return sqrt(fResidual / fNorm);
+}
+
+// Both preconditioners bring the residual below PCG_TEST_TOLERANCE, MIC(0) in fewer
+// iterations, and the reported residual is the solution's own, with the residual checked
+// every iteration or every few; the ordered reductions and the slab-wise MIC(0) give the
+// same bits on any number of threads
+static bool TestPCG(HostThreadPool &threadPool)
+{
+	static const char *const szPreconditioners[] = { "Jacobi", "MIC(0)" };
+	HostThreadPool serial(1);
+
+	auto bPassed = true;
+	for (const auto &vSize : { int3(48, 48, 48), int3(37, 21, 19) })
+	{
+		const auto txVelocity = TestVelocity(vSize.x, vSize.y, vSize.z);
+
+		uint32_t uIterations[2] = {};
+		for (const auto preconditioner : { PCG_JACOBI, PCG_MIC0 })
+		{
+			for (const auto uInterval : { 1u, 4u })
+			{
+				uint64_t uChecksums[2];
+				for (auto i = 0; i < 2; ++i)
+				{
+					HostPoisson3D<float> pressure;
+					InitPressure(pressure, i > 0 ? threadPool : serial, txVelocity,
+						[preconditioner](HostPoisson3D<float> &s)
+					{
+						s.SetSolver(POISSON_PCG);
+						s.SetPreconditioner(preconditioner);
+					});
+
+					const auto txKnown = *pressure.GetSrc();
+					const auto stats = pressure.SolvePoisson(float2(-1.0f, 6.0f), PCG_TEST_TOLERANCE,
+						PCG_MAX_ITERATION, uInterval);
+					const auto fResidual = Residual(*pressure.GetSrc(), txKnown, float2(-1.0f, 6.0f));
+					uChecksums[i] = Checksum(*pressure.GetSrc());
+					if (i > 0) continue;
+
+					printf("    %dx%dx%d %s, checks every %u: %u iterations, residual %.3e (recomputed %.3e)\n",
+						vSize.x, vSize.y, vSize.z, szPreconditioners[preconditioner], uInterval,
+						stats.uIterations, stats.fResidual, fResidual);
+					bPassed = bPassed && stats.bConverged && fResidual <= PCG_RESIDUAL_SLACK * PCG_TEST_TOLERANCE;
+					if (uInterval == 1) uIterations[preconditioner] = stats.uIterations;
+				}
+
+				const auto bSame = uChecksums[0] == uChecksums[1];
+				printf("      %s on 1 and %u threads\n", bSame ? "same" : "DIFFERENT", threadPool.GetNumThreads());
+				bPassed = bPassed && bSame;
+			}
+		}
+
+		bPassed = bPassed && uIterations[PCG_MIC0] < uIterations[PCG_JACOBI];
+	}
+
+	return bPassed;
+}
+
+// Every solver stops within its iteration budget, even where the red-black dispatches
+// advance more than one sweep; it converges to a tolerance it can reach, and reports the
+// residual of the solution it leaves behind
+static bool TestTolerance(HostThreadPool &threadPool)
+{
+	static const struct
+	{
+		PoissonSolver	solver;
+		const char		*szName;
+		float			fTolerance;
+	} solvers[] =
+	{
+		{ POISSON_GAUSS_SEIDEL,	"block Gauss-Seidel",	0.04f },
+		{ POISSON_RED_BLACK,	"red-black",			0.04f },
+		{ POISSON_MULTIGRID,	"multigrid",			MG_TOLERANCE },
+		{ POISSON_PCG,			"PCG",					PCG_TEST_TOLERANCE }
+	};
+
+	const auto vSize = int3(37, 21, 19);
+	const auto txVelocity = TestVelocity(vSize.x, vSize.y, vSize.z);
+
+	auto bPassed = true;
+	for (const auto &s : solvers)
+	{
+		// A reachable tolerance, then none within a short budget
+		for (const auto bBudget : { false, true })
+		{
+			HostPoisson3D<float> pressure;
+			InitPressure(pressure, threadPool, txVelocity, [&s](HostPoisson3D<float> &solver)
+			{
+				solver.SetSolver(s.solver);
+			});
+
+			const auto txKnown = *pressure.GetSrc();
+			const uint32_t uMaxIteration = bBudget ? TOL_BUDGET : TOL_MAX_ITERATION;
+			const auto stats = pressure.SolvePoisson(float2(-1.0f, 6.0f), bBudget ? 0.0f : s.fTolerance,
+				uMaxIteration, TOL_CHECK_INTERVAL);
+			const auto fResidual = Residual(*pressure.GetSrc(), txKnown, float2(-1.0f, 6.0f));
+			const auto bMatch = fabs(stats.fResidual - fResidual) <= TOL_RESIDUAL_MATCH * fResidual + TOL_RESIDUAL_FLOOR;
+
+			printf("    %s, %s %u: %u iterations, residual %.3e (recomputed %.3e)%s\n", s.szName,
+				bBudget ? "budget" : "at most", uMaxIteration, stats.uIterations, stats.fResidual, fResidual,
+				bMatch ? "" : ", DIFFERENT");
+			bPassed = bPassed && stats.uIterations <= uMaxIteration && bMatch;
+			bPassed = bPassed && (bBudget ? !stats.bConverged && stats.uIterations == uMaxIteration : stats.bConverged);
+		}
+	}
+
+	return bPassed;
+}
+
+// Jacobi iterations fused per pass give the same bits as a pass per iteration: the
+// viscous solve, in both of the buffers it leaves behind, and the multigrid smoother
+static bool TestTemporalDepth(HostThreadPool &threadPool)
+{
+	auto bPassed = true;
+	for (const auto &vSize : { int3(48, 48, 48), int3(37, 21, 19) })
+	{
+		const auto txVelocity = TestVelocity(vSize.x, vSize.y, vSize.z);
+
+		uint64_t uReference[3] = {};
+		for (const auto uDepth : { 1u, 2u, 3u, 4u })
+		{
+			HostPoisson3D<float4> diffuse;
+			diffuse.Init(vSize.x, vSize.y, vSize.z, threadPool);
+			diffuse.SetTemporalDepth(uDepth);
+			*diffuse.GetSrc() = txVelocity;
+			diffuse.SolvePoisson(float2(1.0f, 7.0f), DIFFUSE_ITERATION);
+
+			HostPoisson3D<float> pressure;
+			InitPressure(pressure, threadPool, txVelocity, [uDepth](HostPoisson3D<float> &s)
+			{
+				s.SetSolver(POISSON_MULTIGRID);
+				s.SetTemporalDepth(uDepth);
+			});
+			pressure.SolvePoisson(float2(-1.0f, 6.0f), 2);
+
+			const uint64_t uChecksums[] =
+			{
+				Checksum(*diffuse.GetSrc()), Checksum(*diffuse.GetDst()), Checksum(*pressure.GetSrc())
+			};
+			if (uDepth == 1)
+			{
+				copy(begin(uChecksums), end(uChecksums), uReference);
+				continue;
+			}
+
+			const auto bSame = equal(begin(uChecksums), end(uChecksums), uReference);
+			printf("    %dx%dx%d depth %u: %s as depth 1\n", vSize.x, vSize.y, vSize.z, uDepth,
+				bSame ? "same" : "DIFFERENT");
+			bPassed = bPassed && bSame;
+		}
+	}
+
+	return bPassed;
+}
+
+//--------------------------------------------------------------------------------------
+// Simulation
+//--------------------------------------------------------------------------------------
+
+#define PLUME_STEPS		20
+
+// Reaches the stages of HostFluid3D that the cases run on their own
+class ProbeFluid3D : public HostFluid3D
+{
+public:
+	ProbeFluid3D(HostThreadPool &threadPool) : HostFluid3D(threadPool) {}
+
+	using HostFluid3D::advect;
+	using HostFluid3D::subtractGradient;
+
+	// Marks every macro-cell occupied, so that the ray march skips nothing
+	void FillOccupancy() { fill(m_occupancy.begin(), m_occupancy.end(), FLT_MAX); }
+};
+
+// The fused advect, impulse and divergence pass gives the same velocity and density as
+// the separate passes, bit for bit, on a cube and on a size that is no multiple of a tile
+static bool TestFused(HostThreadPool &threadPool)
+{
+	auto bPassed = true;
+	for (const auto &vSize : { int3(40, 40, 40), int3(37, 21, 19) })
+	{
+		uint64_t uVelocity[2], uDensity[2];
+		for (auto i = 0; i < 2; ++i)
+		{
+			HostFluid3D fluid(threadPool);
+			fluid.Init(vSize.x, vSize.y, vSize.z);
+			fluid.SetFusedStep(i > 0);
+			Plume(fluid, PLUME_STEPS);
+			uVelocity[i] = Checksum(*fluid.GetVelocity());
+			uDensity[i] = Checksum(*fluid.GetDensity());
+		}
+
+		const auto bSame = uVelocity[0] == uVelocity[1] && uDensity[0] == uDensity[1];
+		printf("    %dx%dx%d after %d steps: velocity %016llx, density %016llx, %s fused\n",
+			vSize.x, vSize.y, vSize.z, PLUME_STEPS, static_cast<unsigned long long>(uVelocity[0]),
+			static_cast<unsigned long long>(uDensity[0]), bSame ? "same" : "DIFFERENT");
+		bPassed = bPassed && bSame;
+	}
+
+	return bPassed;
+}
+
+// The projection with the wall boundary folded in gives the velocity of projecting every
+// cell and then mirroring the faces as a separate pass did: each face cell takes its
+// inward neighbor, negated. The x, y and z must match bit for bit, and w is zero.
+static bool TestMirror(HostThreadPool &threadPool)
+{
+	auto bPassed = true;
+	for (const auto &vSize : { int3(40, 48, 32), int3(37, 21, 19) })
+	{
+		ProbeFluid3D fluid(threadPool);
+		fluid.Init(vSize.x, vSize.y, vSize.z);
+		Plume(fluid, PLUME_STEPS);
+
+		auto &pressure = fluid.GetPressure();
+		pressure.ComputeDivergence(*fluid.GetVelocity());
+		pressure.SolvePoisson(float2(-1.0f, 6.0f));
+
+		const auto &txVelocity = *fluid.GetVelocity();
+		const auto &txPressure = *pressure.GetSrc();
+		HostTexture3D<float4> txProjected(vSize.z, vSize.y, vSize.x), txReference(vSize.z, vSize.y, vSize.x);
+		for (auto z = 0; z < vSize.z; ++z)
+			for (auto y = 0; y < vSize.y; ++y)
+				for (auto x = 0; x < vSize.x; ++x)
+				{
+					const auto vLoc = int3(x, y, z);
+					const auto vVelocity = txVelocity(vLoc).xyz() - Gradient3D(txPressure, vLoc) / float(REST_DENS);
+					txProjected(vLoc) = float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f);
+				}
+
+		for (auto z = 0; z < vSize.z; ++z)
+			for (auto y = 0; y < vSize.y; ++y)
+				for (auto x = 0; x < vSize.x; ++x)
+				{
+					const auto vOffset = int3
+					(
+						x >= vSize.x - 1 ? -1 : (x <= 0 ? 1 : 0),
+						y >= vSize.y - 1 ? -1 : (y <= 0 ? 1 : 0),
+						z >= vSize.z - 1 ? -1 : (z <= 0 ? 1 : 0)
+					);
+					const auto &vProjected = txProjected(int3(x + vOffset.x, y + vOffset.y, z + vOffset.z));
+					txReference(int3(x, y, z)) = vOffset.x || vOffset.y || vOffset.z ? -vProjected : vProjected;
+				}
+
+		fluid.subtractGradient();
+
+		auto uMismatches = 0u;
+		const auto pVelocity = fluid.GetVelocity()->GetData();
+		const auto pReference = txReference.GetData();
+		for (auto i = 0u; i < txReference.GetNumTexels(); ++i)
+			if (memcmp(&pVelocity[i], &pReference[i], sizeof(float) * 3) || pVelocity[i].w != 0.0f) ++uMismatches;
+
+		printf("    %dx%dx%d: %u of %u cells differ from projecting and mirroring apart\n", vSize.x, vSize.y, vSize.z,
+			uMismatches, static_cast<uint32_t>(txReference.GetNumTexels()));
+		bPassed = bPassed && uMismatches == 0;
+	}
+
+	return bPassed;
+}
+
+#define BLOB_STEPS		24
+#define BLOB_SIGMA		3.0f	// Width of the smooth blob in cells
+#define BLOB_SHIFT		float3(0.37f, 0.23f, 0.13f)		// Cells the blob moves per step, off the grid lines
+
+// Density of the blob centered at vCenter, in cells: a Gaussian, or a cube of 2 sigma when
+// bSharp, whose edges are what the limiter is for
+static HostTexture3D<float> Blob(cint3 &vSize, cfloat3 &vCenter, const bool bSharp)
+{
+	HostTexture3D<float> txDensity(vSize.z, vSize.y, vSize.x);
+	for (auto z = 0; z < vSize.z; ++z)
+		for (auto y = 0; y < vSize.y; ++y)
+			for (auto x = 0; x < vSize.x; ++x)
+			{
+				const auto vDist = float3(float(x), float(y), float(z)) - vCenter;
+				txDensity(int3(x, y, z)) = bSharp ?
+					(fabs(vDist.x) < BLOB_SIGMA && fabs(vDist.y) < BLOB_SIGMA && fabs(vDist.z) < BLOB_SIGMA ? 1.0f : 0.0f) :
+					exp(-dot(vDist, vDist) / (2.0f * BLOB_SIGMA * BLOB_SIGMA));
+			}
+
+	return txDensity;
+}
+
+// A blob carried by a constant velocity for BLOB_STEPS: MacCormack and BFECC must stay
+// closer to the exactly moved blob than semi-Lagrangian advection, which smears it, and
+// with a sharp-edged blob their limited corrections must stay within the range of the
+// initial density. ClampToStencil3D itself must return values within the 8 texels that
+// Sample() reads at random points.
+static bool TestAdvection(HostThreadPool &threadPool)
+{
+	static const char *const szSchemes[] = { "semi-Lagrangian", "MacCormack", "BFECC" };
+
+	const auto vSize = int3(48, 32, 32);
+	const auto vStart = float3(18.0f, 13.0f, 14.0f);
+	const auto vVelocity = BLOB_SHIFT / float3(float(vSize.x), float(vSize.y), float(vSize.z)) / DELTA_TIME;
+	const auto fDecay = pow(0.996f, float(BLOB_STEPS));
+	const auto txExact = Blob(vSize, vStart + BLOB_SHIFT * float(BLOB_STEPS), false);
+
+	auto bPassed = true;
+	double fErrors[3];
+	for (const auto advection : { ADVECT_SEMI_LAGRANGIAN, ADVECT_MACCORMACK, ADVECT_BFECC })
+	{
+		float fRange[2][2];
+		for (const auto bSharp : { false, true })
+		{
+			ProbeFluid3D fluid(threadPool);
+			fluid.Init(vSize.x, vSize.y, vSize.z);
+			fluid.SetAdvection(advection);
+			fluid.GetVelocity()->Fill(float4(vVelocity.x, vVelocity.y, vVelocity.z, 0.0f));
+			*fluid.GetDensity() = Blob(vSize, vStart, bSharp);
+			for (auto i = 0; i < BLOB_STEPS; ++i) fluid.advect(DELTA_TIME);
+
+			const auto &txDensity = *fluid.GetDensity();
+			const auto pDensity = txDensity.GetData();
+			const auto uNumTexels = txDensity.GetNumTexels();
+			const auto minMax = minmax_element(pDensity, pDensity + uNumTexels);
+			fRange[bSharp][0] = *minMax.first;
+			fRange[bSharp][1] = *minMax.second / fDecay;
+
+			if (bSharp) continue;
+			auto fError = 0.0, fNorm = 0.0;
+			for (auto i = 0u; i < uNumTexels; ++i)
+			{
+				fError += fabs(pDensity[i] / fDecay - txExact.GetData()[i]);
+				fNorm += txExact.GetData()[i];
+			}
+			fErrors[advection] = fError / fNorm;
+		}
+
+		const auto bInRange = fRange[1][0] >= 0.0f && fRange[1][1] <= 1.0f + FLT_EPSILON;
+		const auto bSharper = advection == ADVECT_SEMI_LAGRANGIAN || fErrors[advection] < fErrors[ADVECT_SEMI_LAGRANGIAN];
+		printf("    %s: relative error %.3f against the moved blob, peak %.3f of 1; sharp blob within [%g, %g]%s\n",
+			szSchemes[advection], fErrors[advection], fRange[0][1], fRange[1][0], fRange[1][1],
+			bInRange ? "" : ", OUT OF RANGE");
+		bPassed = bPassed && bInRange && bSharper;
+	}
+
+	// The limiter on its own, at random points around the edges of the sharp blob
+	const auto txSharp = Blob(vSize, vStart, true);
+	const auto vSizeF = float3(float(vSize.x), float(vSize.y), float(vSize.z));
+	auto uHash = 12345u;
+	auto uOutside = 0u;
+	for (auto i = 0; i < 4096; ++i)
+	{
+		const auto random = [&uHash]()
+		{
+			uHash = uHash * 1664525u + 1013904223u;
+
+			return float(uHash >> 8) / float(1u << 24);
+		};
+		const auto vTex = (vStart + (float3(random(), random(), random()) - 0.5f) * 4.0f * BLOB_SIGMA) / vSizeF;
+		const auto fValue = random() * 3.0f - 1.0f;
+		const auto fClamped = ClampToStencil3D(txSharp, vTex, fValue);
+
+		auto fMin = FLT_MAX, fMax = -FLT_MAX;
+		const auto vBase = floor(vTex * vSizeF - 0.5f);
+		for (auto j = 0; j < 8; ++j)
+		{
+			const auto vLoc = int3(int32_t(vBase.x) + (j & 1), int32_t(vBase.y) + (j >> 1 & 1), int32_t(vBase.z) + (j >> 2));
+			const auto fTexel = txSharp(int3(min(max(vLoc.x, 0), vSize.x - 1), min(max(vLoc.y, 0), vSize.y - 1),
+				min(max(vLoc.z, 0), vSize.z - 1)));
+			fMin = min(fMin, fTexel);
+			fMax = max(fMax, fTexel);
+		}
+		if (fClamped < fMin || fClamped > fMax || (fValue >= fMin && fValue <= fMax && fClamped != fValue)) ++uOutside;
+	}
+
+	printf("    ClampToStencil3D: %u of 4096 values outside their 8 texels or moved within them\n", uOutside);
+
+	return bPassed && uOutside == 0;
+}
+
+#define CHECKPOINT_FILE		"SmokeTest.ckp"
+#define CHECKPOINT_RESUME	12		// Steps after the checkpoint, so the resumed run solves with its pressure
+
+static vector<char> ReadFile(const char *szFileName)
+{
+	ifstream file(szFileName, ios::binary);
+
+	return vector<char>(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static bool WriteFile(const char *szFileName, const vector<char> &data)
+{
+	ofstream file(szFileName, ios::binary);
+	file.write(data.data(), data.size());
+	file.close();
+
+	return !file.fail();
+}
+
+// Saving after PLUME_STEPS, loading into a fresh fluid and stepping on gives the velocity,
+// density and pressure of an uninterrupted run, bit for bit, dense and sparse. A file cut
+// short, or with a byte of the header, the brick table or a field flipped, is refused.
+static bool TestCheckpoint(HostThreadPool &threadPool)
+{
+	auto bPassed = true;
+	for (const auto &vSize : { int3(40, 40, 40), int3(37, 21, 19) })
+		for (const auto bSparse : { false, true })
+		{
+			HostFluid3D straight(threadPool), saved(threadPool), resumed(threadPool);
+			for (auto pFluid : { &straight, &saved })
+			{
+				pFluid->Init(vSize.x, vSize.y, vSize.z);
+				pFluid->SetSparse(bSparse);
+			}
+			Plume(straight, PLUME_STEPS + CHECKPOINT_RESUME);
+			Plume(saved, PLUME_STEPS);
+
+			auto header = CheckpointHeader();
+			resumed.SetSparse(bSparse);
+			const auto bLoaded = saved.SaveCheckpoint(CHECKPOINT_FILE, PLUME_STEPS, DELTA_TIME) &&
+				resumed.LoadCheckpoint(CHECKPOINT_FILE, &header) && header.uStep == PLUME_STEPS;
+			if (bLoaded) Plume(resumed, CHECKPOINT_RESUME);
+
+			const auto bSame = bLoaded && Checksum(*straight.GetVelocity()) == Checksum(*resumed.GetVelocity()) &&
+				Checksum(*straight.GetDensity()) == Checksum(*resumed.GetDensity()) &&
+				Checksum(*straight.GetPressure().GetSrc()) == Checksum(*resumed.GetPressure().GetSrc());
+			printf("    %dx%dx%d%s, saved after %d steps and run %d more: %s\n", vSize.x, vSize.y, vSize.z,
+				bSparse ? " sparse" : "", PLUME_STEPS, CHECKPOINT_RESUME,
+				bLoaded ? (bSame ? "same as uninterrupted" : "DIFFERENT") : "NOT LOADED");
+			bPassed = bPassed && bSame;
+		}
+
+	// Damage the last file written
+	const auto data = ReadFile(CHECKPOINT_FILE);
+	auto header = CheckpointHeader();
+	if (data.size() >= sizeof(CheckpointHeader)) memcpy(&header, data.data(), sizeof(CheckpointHeader));
+
+	struct Damage
+	{
+		const char	*szName;
+		size_t		uSize;		// Bytes kept
+		uint64_t	uFlip;		// Byte flipped, or the size for none
+	};
+	const Damage damages[] =
+	{
+		{ "cut in the header",		sizeof(CheckpointHeader) / 2,					data.size() },
+		{ "cut in the brick table",	sizeof(CheckpointHeader) + sizeof(uint32_t),	data.size() },
+		{ "cut by one byte",		data.size() - 1,								data.size() },
+		{ "flipped step",			data.size(),	offsetof(CheckpointHeader, uStep) },
+		{ "flipped brick",			data.size(),	header.uBrickOffset },
+		{ "flipped velocity",		data.size(),	header.uFieldOffsets[CHECKPOINT_VELOCITY] + 5 },
+		{ "flipped density",		data.size(),	header.uFieldOffsets[CHECKPOINT_DENSITY] + 7 },
+		{ "flipped pressure",		data.size(),	data.size() - 2 }
+	};
+
+	for (const auto &damage : damages)
+	{
+		auto damaged = data;
+		damaged.resize(damage.uSize);
+		if (damage.uFlip < damaged.size()) damaged[damage.uFlip] ^= 0x10;
+
+		HostFluid3D fluid(threadPool);
+		const auto bRefused = !data.empty() && WriteFile(CHECKPOINT_FILE, damaged) && !fluid.LoadCheckpoint(CHECKPOINT_FILE);
+		printf("    %s: %s\n", damage.szName, bRefused ? "refused" : "LOADED");
+		bPassed = bPassed && bRefused;
+	}
+
+	remove(CHECKPOINT_FILE);
+
+	return bPassed;
+}
+
+#define WARM_STEPS			24
+#define WARM_TOLERANCE		1e-2f	// A real-time budget: the seed matters most where few iterations are spent
+#define WARM_MAX_ITERATION	200
+
+// The plume under a PCG solve to WARM_TOLERANCE, from the step uFirst on; returns the
+// iterations of each step
+static vector<uint32_t> WarmPlume(HostFluid3D &fluid, const uint32_t uFirst, const uint32_t uSteps)
+{
+	vector<uint32_t> iterations;
+	for (auto i = uFirst; i < uSteps; ++i)
+	{
+		Plume(fluid, 1);
+		iterations.push_back(fluid.GetPressureStats().uIterations);
+	}
+
+	return iterations;
+}
+
+// Seeding the pressure solve with the previous or the advected pressure reaches the
+// tolerance in fewer iterations over WARM_STEPS plume steps than starting from zero. The
+// seed rides on the buffer rotation of the solver, so the fused step must spend the same
+// iterations per step as the separate passes, and resuming from a checkpoint saved halfway
+// must spend the iterations of the uninterrupted run.
+static bool TestWarmStart(HostThreadPool &threadPool)
+{
+	static const char *const szWarmStarts[] = { "none", "previous", "advected" };
+
+	const auto vSize = int3(48, 48, 48);
+	const auto configure = [&vSize](HostFluid3D &fluid, const WarmStart warmStart, const bool bFused)
+	{
+		fluid.Init(vSize.x, vSize.y, vSize.z);
+		fluid.SetFusedStep(bFused);
+		fluid.GetPressure().SetSolver(POISSON_PCG);
+		fluid.GetPressure().SetWarmStart(warmStart);
+		fluid.SetPressureTolerance(WARM_TOLERANCE, WARM_MAX_ITERATION, 1);
+	};
+
+	auto bPassed = true;
+	uint32_t uTotals[3];
+	for (const auto warmStart : { WARM_START_NONE, WARM_START_PREVIOUS, WARM_START_ADVECTED })
+	{
+		vector<uint32_t> iterations[2];
+		for (const auto bFused : { false, true })
+		{
+			HostFluid3D fluid(threadPool);
+			configure(fluid, warmStart, bFused);
+			iterations[bFused] = WarmPlume(fluid, 0, WARM_STEPS);
+		}
+
+		// Save halfway, resume in a fresh fluid
+		HostFluid3D saved(threadPool), resumed(threadPool);
+		configure(saved, warmStart, false);
+		configure(resumed, warmStart, false);
+		WarmPlume(saved, 0, WARM_STEPS / 2);
+		const auto bLoaded = saved.SaveCheckpoint(CHECKPOINT_FILE, WARM_STEPS / 2, DELTA_TIME) &&
+			resumed.LoadCheckpoint(CHECKPOINT_FILE);
+		const auto resumedIterations = bLoaded ? WarmPlume(resumed, WARM_STEPS / 2, WARM_STEPS) : vector<uint32_t>();
+		remove(CHECKPOINT_FILE);
+
+		uTotals[warmStart] = 0;
+		for (const auto &uIterations : iterations[0]) uTotals[warmStart] += uIterations;
+		const auto bFusedSame = iterations[1] == iterations[0];
+		const auto bResumedSame = resumedIterations == vector<uint32_t>(iterations[0].cbegin() + WARM_STEPS / 2,
+			iterations[0].cend());
+		const auto bFewer = warmStart == WARM_START_NONE || uTotals[warmStart] < uTotals[WARM_START_NONE];
+		printf("    %s: %u iterations over %d steps, %s fused, %s resumed%s\n", szWarmStarts[warmStart],
+			uTotals[warmStart], WARM_STEPS, bFusedSame ? "same" : "DIFFERENT", bResumedSame ? "same" : "DIFFERENT",
+			bFewer ? "" : ", NO FEWER THAN FROM ZERO");
+		bPassed = bPassed && bFusedSame && bResumedSame && bFewer;
+	}
+
+	return bPassed;
+}
+
+#define SPARSE_STEPS			4
+#define SPARSE_DENSITY_ERROR	5e-3	// Bounds on the relative L1 error against the dense grid
+#define SPARSE_VELOCITY_ERROR	0.15
+
+// The sparse mode follows the dense grid while the plume is young. Its pressure solve treats
+// the dead bricks as lying outside the grid, where the dense solve carries on, so the
+// velocity departs by several percent with the solvers that reach far, and the density much
+// less. Every cell of a dead brick must hold zero velocity, density and pressure, and some
+// bricks must be dead.
+static bool TestSparse(HostThreadPool &threadPool)
+{
+	static const char *const szSolvers[] = { "Gauss-Seidel", "red-black", "multigrid", "PCG" };
+
+	const auto vSize = int3(48, 48, 48);
+	auto bPassed = true;
+	for (const auto solver : { POISSON_GAUSS_SEIDEL, POISSON_RED_BLACK, POISSON_MULTIGRID, POISSON_PCG })
+	{
+		HostFluid3D dense(threadPool), sparse(threadPool);
+		for (auto pFluid : { &dense, &sparse })
+		{
+			pFluid->Init(vSize.x, vSize.y, vSize.z);
+			pFluid->GetPressure().SetSolver(solver);
+			pFluid->SetSparse(pFluid == &sparse);
+			Plume(*pFluid, SPARSE_STEPS);
+		}
+
+		const auto &bricks = sparse.GetBricks();
+		const auto &txVelocity = *sparse.GetVelocity();
+		const auto &txDensity = *sparse.GetDensity();
+		const auto &txPressure = *sparse.GetPressure().GetSrc();
+		auto uDirty = 0u;
+		for (auto z = 0; z < vSize.z; ++z)
+			for (auto y = 0; y < vSize.y; ++y)
+				for (auto x = 0; x < vSize.x; ++x)
+				{
+					const auto vLoc = int3(x, y, z);
+					if (bricks.IsActive(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE)) continue;
+					const auto &vVelocity = txVelocity(vLoc);
+					if (vVelocity.x || vVelocity.y || vVelocity.z || txDensity(vLoc) || txPressure(vLoc)) ++uDirty;
+				}
+
+		const auto uNumLive = static_cast<uint32_t>(bricks.GetActive().size());
+		const auto fDensityError = RelativeError(*dense.GetDensity(), txDensity);
+		const auto fVelocityError = RelativeError(*dense.GetVelocity(), txVelocity);
+		printf("    %s: %u of %u bricks live, %u dead cells written, relative error %.2e density, %.2e velocity\n",
+			szSolvers[solver], uNumLive, bricks.GetNumBricks(), uDirty, fDensityError, fVelocityError);
+		bPassed = bPassed && uNumLive < bricks.GetNumBricks() && uDirty == 0 &&
+			fDensityError <= SPARSE_DENSITY_ERROR && fVelocityError <= SPARSE_VELOCITY_ERROR;
+	}
+
+	return bPassed;
+}
+
+#define SLAB_ERROR	0.0		// Bound on the relative L1 error against HostFluid3D: none, the slabs promise the bits
+
+// Ranks as threads over a SharedMemoryHub step the plume as z-slabs, and the fields gathered
+// on rank 0 match HostFluid3D within SLAB_ERROR, with Gauss-Seidel and Jacobi PCG, on 2 to 4
+// ranks; on 37x21x19 the last slab is short of a whole block. No backtrace may leave the halo.
+static bool TestSlab(HostThreadPool &threadPool)
+{
+	static const char *const szSolvers[] = { "Gauss-Seidel", "red-black", "multigrid", "PCG" };
+
+	struct SlabCase
+	{
+		int3		vSize;
+		uint32_t	uRanks;
+	};
+	const SlabCase cases[] = { { int3(40, 40, 40), 2 }, { int3(40, 40, 40), 4 }, { int3(37, 21, 19), 3 } };
+
+	auto bPassed = true;
+	for (const auto &slabCase : cases)
+		for (const auto solver : { POISSON_GAUSS_SEIDEL, POISSON_PCG })
+		{
+			const auto &vSize = slabCase.vSize;
+			HostFluid3D fluid(threadPool);
+			fluid.Init(vSize.x, vSize.y, vSize.z);
+			fluid.GetPressure().SetSolver(solver);
+			fluid.GetPressure().SetPreconditioner(PCG_JACOBI);
+			fluid.GetPressure().SetWarmStart(WARM_START_PREVIOUS);
+			Plume(fluid, PLUME_STEPS);
+
+			SharedMemoryHub hub(slabCase.uRanks);
+			HostTexture3D<float4> txVelocity(vSize.z, vSize.y, vSize.x);
+			HostTexture3D<float> txDensity(vSize.z, vSize.y, vSize.x);
+			auto results = vector<uint8_t>(slabCase.uRanks);
+			auto overflows = vector<uint64_t>(slabCase.uRanks);
+			auto threads = vector<thread>();
+			for (auto i = 0u; i < slabCase.uRanks; ++i)
+				threads.emplace_back([&, i]()
+				{
+					SharedMemoryTransport transport(hub, i);
+					HostThreadPool rankPool(1);
+					HostFluid3DSlab slab(rankPool, transport);
+					auto bOk = slab.Init(vSize.x, vSize.y, vSize.z);
+					slab.GetPressure().SetSolver(solver);
+					slab.GetPressure().SetWarmStart(WARM_START_PREVIOUS);
+					for (auto j = 0u; bOk && j < PLUME_STEPS; ++j)
+						bOk = slab.Simulate(DELTA_TIME, float4(0.0f, -300.0f, 0.0f, 0.5f), float3(0.5f, 0.9f, 0.5f));
+					bOk = bOk && slab.GatherVelocity(i ? nullptr : &txVelocity) &&
+						slab.GatherDensity(i ? nullptr : &txDensity);
+					results[i] = bOk;
+					overflows[i] = slab.GetHaloOverflows();
+				});
+			for (auto &thread : threads) thread.join();
+
+			const auto bRun = all_of(results.cbegin(), results.cend(), [](const uint8_t bOk) { return bOk != 0; });
+			auto uOverflows = 0ull;
+			for (const auto &uOverflow : overflows) uOverflows += uOverflow;
+			const auto fVelocityError = RelativeError(*fluid.GetVelocity(), txVelocity);
+			const auto fDensityError = RelativeError(*fluid.GetDensity(), txDensity);
+			printf("    %dx%dx%d on %u ranks, %s: relative error %.2e velocity, %.2e density, %llu halo overflows%s\n",
+				vSize.x, vSize.y, vSize.z, slabCase.uRanks, szSolvers[solver], fVelocityError, fDensityError,
+				uOverflows, bRun ? "" : ", FAILED");
+			bPassed = bPassed && bRun && uOverflows == 0 && fVelocityError <= SLAB_ERROR && fDensityError <= SLAB_ERROR;
+		}
+
+	return bPassed;
+}
+
+//--------------------------------------------------------------------------------------
+// Vectorized kernels
+//--------------------------------------------------------------------------------------
+
+#define KERNEL_TRACE	2.0f	// Time step of the advection, long enough to leave the grid
+
+// Runs every row kernel over a whole grid at the current level, and returns the
+// checksum of each output
+static vector<uint64_t> RunKernels(HostThreadPool &threadPool, const HostTexture3D<float4> &txVelocity,
+	const HostTexture3D<float> &txScalar)
+{
+	const auto &vExtent = txVelocity.GetExtent();
+	const auto vTexel = 1.0f / float3(float(vExtent.x), float(vExtent.y), float(vExtent.z));
+	HostTexture3D<float> txLaplacian(vExtent.z, vExtent.y, vExtent.x), txDivergence(vExtent.z, vExtent.y, vExtent.x);
+	HostTexture3D<float> txDensity(vExtent.z, vExtent.y, vExtent.x);
+	HostTexture3D<float4> txProjected(vExtent.z, vExtent.y, vExtent.x), txAdvected(vExtent.z, vExtent.y, vExtent.x);
+
+	ParallelForEachRow(threadPool, vExtent, [&](cint3 &vLoc, const int32_t iWidth)
+	{
+		LaplacianRow(txScalar, txLaplacian, 6.0f, vLoc, iWidth);
+		DivergenceRow(txVelocity, txDivergence, vLoc, iWidth);
+		AdvectRow(txVelocity, txVelocity, txScalar, vTexel, KERNEL_TRACE, 0.99f, txAdvected, txDensity, vLoc, iWidth);
+
+		// The gradient takes the interior only
+		if (vLoc.y > 0 && vLoc.y < vExtent.y - 1 && vLoc.z > 0 && vLoc.z < vExtent.z - 1)
+			SubtractGradientRow(txVelocity, txScalar, float(REST_DENS), txProjected, int3(1, vLoc.y, vLoc.z),
+				iWidth - 2);
+	});
+
+	return { Checksum(txLaplacian), Checksum(txDivergence), Checksum(txProjected), Checksum(txAdvected),
+		Checksum(txDensity) };
+}
+
+// Every instruction set the CPU supports gives the scalar kernels' bits, on rows that
+// are a multiple of the vector width and on ones that end with a partial vector
+static bool TestSimd(HostThreadPool &threadPool)
+{
+	static const char *const szOutputs[] = { "laplacian", "divergence", "gradient", "advected velocity",
+		"advected density" };
+
+	auto bPassed = true;
+	for (const auto &vSize : { int3(64, 20, 18), int3(37, 21, 19) })
+	{
+		const auto txVelocity = TestVelocity(vSize.x, vSize.y, vSize.z);
+		HostTexture3D<float> txScalar(vSize.z, vSize.y, vSize.x);
+		for (auto i = 0u; i < txScalar.GetNumTexels(); ++i)
+			txScalar.GetData()[i] = txVelocity.GetData()[i].x * txVelocity.GetData()[i].y;
+
+		vector<uint64_t> reference;
+		for (auto level = SIMD_SCALAR; level <= GetSupportedSimdLevel(); level = SimdLevel(level + 1))
+		{
+			SetSimdLevel(level);
+			const auto checksums = RunKernels(threadPool, txVelocity, txScalar);
+			if (level == SIMD_SCALAR)
+			{
+				reference = checksums;
+				continue;
+			}
+
+			string mismatches;
+			for (auto i = 0u; i < checksums.size(); ++i)
+				if (checksums[i] != reference[i]) mismatches += string(" ") + szOutputs[i];
+			printf("    %dx%dx%d %s: %s\n", vSize.x, vSize.y, vSize.z, SimdLevelName(level),
+				mismatches.empty() ? "same as scalar" : ("DIFFERENT" + mismatches).c_str());
+			bPassed = bPassed && mismatches.empty();
+		}
+	}
+	SetSimdLevel(GetSupportedSimdLevel());
+
+	if (GetSupportedSimdLevel() == SIMD_SCALAR) printf("    no vector instruction set to compare\n");
+
+	return bPassed;
+}
+
+//--------------------------------------------------------------------------------------
+// Rendering
+//--------------------------------------------------------------------------------------
+
+#define FRAME_WIDTH		160
+#define FRAME_HEIGHT	120
+#define FRAME_COUNT		24
+#define FRAME_ORBIT		0.01f	// Radians the camera turns per frame
+#define TEMPORAL_WARMUP	8		// Frames before the history has converged
+#define TEMPORAL_ERROR	2e-3	// Bound on the mean error of a converged temporal frame
+#define SCALE2_ERROR	1e-3	// Bounds on the mean error of the reduced resolutions
+#define SCALE4_ERROR	2e-3
+#define DEPTH_ERROR		1e-5	// Bound on the mean error of the composited frame
+
+// Renders FRAME_COUNT frames of an orbiting camera while the plume simulates, and
+// returns the checksum of each
+static vector<uint64_t> RenderSequence(HostThreadPool &threadPool, const bool bTemporal)
+{
+	HostFluid3D fluid(threadPool);
+	fluid.Init(40, 40, 40);
+	fluid.SetTemporal(bTemporal);
+	fluid.SetExactExtinction(true);
+	Plume(fluid, 24);
+
+	const auto cbImmutable = SampleLights();
+	auto pFrame = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+
+	vector<uint64_t> checksums;
+	for (auto i = 0; i < FRAME_COUNT; ++i)
+	{
+		Plume(fluid, 1);
+		fluid.Render(pFrame, cbImmutable, DefaultCamera(FRAME_WIDTH, FRAME_HEIGHT, FRAME_ORBIT * i));
+		checksums.push_back(Checksum(*pFrame));
+	}
+
+	return checksums;
+}
+
+// A fixed frame sequence renders to the same checksums on any number of threads, in
+// the plain and the temporal mode, and the temporal mode converges to the full-rate image
+static bool TestRender(HostThreadPool &threadPool)
+{
+	HostThreadPool serial(1);
+
+	auto bPassed = true;
+	for (const auto bTemporal : { false, true })
+	{
+		const auto checksums = RenderSequence(threadPool, bTemporal);
+		const auto serialChecksums = RenderSequence(serial, bTemporal);
+		const auto bSame = checksums == serialChecksums;
+		printf("    %-8s %d frames, last checksum %016llx, %s on 1 and %u threads\n", bTemporal ? "temporal" : "plain",
+			FRAME_COUNT, static_cast<unsigned long long>(checksums.back()), bSame ? "same" : "DIFFERENT",
+			threadPool.GetNumThreads());
+		bPassed = bPassed && bSame;
+	}
+
+	// The temporal mode against full-rate frames of the same views
+	HostFluid3D fluid(threadPool), reference(threadPool);
+	fluid.Init(40, 40, 40);
+	reference.Init(40, 40, 40);
+	fluid.SetTemporal(true);
+	fluid.SetExactExtinction(true);
+	reference.SetExactExtinction(true);
+	Plume(fluid, 24);
+	Plume(reference, 24);
+
+	const auto cbImmutable = SampleLights();
+	auto pFrame = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+	auto pReference = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+
+	auto fMaxError = 0.0;
+	for (auto i = 0; i < FRAME_COUNT; ++i)
+	{
+		const auto cbPerObj = DefaultCamera(FRAME_WIDTH, FRAME_HEIGHT, FRAME_ORBIT * i);
+		fluid.Render(pFrame, cbImmutable, cbPerObj);
+		reference.Render(pReference, cbImmutable, cbPerObj);
+		if (i >= TEMPORAL_WARMUP) fMaxError = max(fMaxError, MeanError(*pFrame, *pReference));
+	}
+	printf("    temporal mean error after %d frames at most %.2e (bound %.0e)\n", TEMPORAL_WARMUP, fMaxError,
+		TEMPORAL_ERROR);
+
+	return bPassed && fMaxError <= TEMPORAL_ERROR;
+}
+
+// With the scene at the far plane, the layer of the scene-depth overload composited
+// over the clear color gives the plain frame; with the scene on the near plane the
+// layer is clear everywhere
+static bool TestDepth(HostThreadPool &threadPool)
+{
+	HostFluid3D fluid(threadPool);
+	fluid.Init(48, 48, 48);
+	Plume(fluid, PLUME_STEPS);
+
+	const auto cbImmutable = SampleLights();
+	const auto cbPerObj = DefaultCamera(FRAME_WIDTH, FRAME_HEIGHT);
+	const auto vCornflowerBlue = unorm4(0.392156899f, 0.584313750f, 0.929411829f, 1.0f);
+	auto pFrame = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+	auto pReference = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+	auto pLayer = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+	HostTexture2D<unorm4> txScene(FRAME_HEIGHT, FRAME_WIDTH);
+	HostTexture2D<float> txDepth(FRAME_HEIGHT, FRAME_WIDTH);
+
+	// The plain overload leaves the pixels outside the volume as they were
+	txScene.Fill(vCornflowerBlue);
+	pReference->Fill(vCornflowerBlue);
+	fluid.Render(pReference, cbImmutable, cbPerObj);
+
+	// Stale content in the layer must be overwritten
+	txDepth.Fill(1.0f);
+	pLayer->Fill(unorm4(1.0f, 1.0f, 1.0f, 1.0f));
+	fluid.Render(pLayer, txDepth, cbImmutable, cbPerObj);
+	fluid.Composite(pFrame, txScene, *pLayer);
+	const auto fError = MeanError(*pFrame, *pReference);
+
+	txDepth.Fill(0.0f);
+	fluid.Render(pLayer, txDepth, cbImmutable, cbPerObj);
+	const auto pData = pLayer->GetData();
+	const auto bClear = all_of(pData, pData + FRAME_WIDTH * FRAME_HEIGHT,
+		[](const unorm4 &v) { return v.x == 0.0f && v.y == 0.0f && v.z == 0.0f && v.w == 0.0f; });
+
+	printf("    far plane: mean error %.2e against the plain frame (bound %.0e)\n", fError, DEPTH_ERROR);
+	printf("    near plane: layer %s\n", bClear ? "clear" : "NOT CLEAR");
+
+	return fError <= DEPTH_ERROR && bClear;
+}
+
+// Skipping the empty macro-cells renders the same image as marching every step, with
+// and without the light volume
+static bool TestOccupancy(HostThreadPool &threadPool)
+{
+	ProbeFluid3D fluid(threadPool);
+	fluid.Init(48, 48, 48);
+	Plume(fluid, PLUME_STEPS);
+
+	const auto cbImmutable = SampleLights();
+	const auto cbPerObj = DefaultCamera(FRAME_WIDTH, FRAME_HEIGHT);
+	auto pFrame = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+
+	auto bPassed = true;
+	for (const auto bLightVolume : { false, true })
+	{
+		fluid.SetLightVolume(bLightVolume);
+		fluid.Simulate(DELTA_TIME);
+		fluid.Render(pFrame, cbImmutable, cbPerObj);
+		const auto uSkipped = Checksum(*pFrame);
+
+		fluid.FillOccupancy();
+		fluid.Render(pFrame, cbImmutable, cbPerObj);
+		const auto uFull = Checksum(*pFrame);
+
+		printf("    %s: %016llx skipping, %s marching every step\n", bLightVolume ? "light volume" : "shadow rays ",
+			static_cast<unsigned long long>(uSkipped), uSkipped == uFull ? "same" : "DIFFERENT");
+		bPassed = bPassed && uSkipped == uFull;
+	}
+
+	return bPassed;
+}
+
+// Reduced-resolution rendering stays within a mean error of the full-resolution frame
+static bool TestRenderScale(HostThreadPool &threadPool)
+{
+	static const double fBounds[] = { SCALE2_ERROR, SCALE4_ERROR };
+
+	HostFluid3D fluid(threadPool);
+	fluid.Init(48, 48, 48);
+	Plume(fluid, PLUME_STEPS);
+
+	const auto cbImmutable = SampleLights();
+	const auto cbPerObj = DefaultCamera(FRAME_WIDTH, FRAME_HEIGHT);
+	auto pFrame = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+	auto pReference = make_unique<HostTexture2D<unorm4>>(FRAME_HEIGHT, FRAME_WIDTH);
+	fluid.Render(pReference, cbImmutable, cbPerObj);
+
+	auto bPassed = true;
+	for (auto i = 0; i < 2; ++i)
+	{
+		const auto uScale = static_cast<uint8_t>(2 << i);
+		fluid.SetRenderScale(uScale);
+		fluid.Render(pFrame, cbImmutable, cbPerObj);
+
+		const auto fError = MeanError(*pFrame, *pReference);
+		printf("    scale %u: mean error %.2e (bound %.0e)\n", uScale, fError, fBounds[i]);
+		bPassed = bPassed && fError <= fBounds[i];
+	}
+
+	return bPassed;
+}
+
+//--------------------------------------------------------------------------------------
+// Command line
+//--------------------------------------------------------------------------------------
+
+static const TestCase g_tests[] =
+{
+	{ "fused",		TestFused },
+	{ "mirror",		TestMirror },
+	{ "advection",	TestAdvection },
+	{ "sparse",		TestSparse },
+	{ "checkpoint",	TestCheckpoint },
+	{ "warmstart",	TestWarmStart },
+	{ "slab",		TestSlab },
+	{ "multigrid",	TestMultigrid },
+	{ "pcg",		TestPCG },
+	{ "redblack",	TestRedBlack },
+	{ "tolerance",	TestTolerance },
+	{ "depth",		TestDepth },
+	{ "occupancy",	TestOccupancy },
+	{ "render",		TestRender },
+	{ "renderscale",	TestRenderScale },
+	{ "simd",		TestSimd },
+	{ "temporaldepth",	TestTemporalDepth }
+};
+
+// Matches -Name:value or -Name case-insensitively, as DXUT does
+static bool GetArg(const char *szArg, const char *szName, const char *&szValue)
+{
+	if (*szArg != '-' && *szArg != '/') return false;
+	++szArg;
+
+	const auto uLen = strlen(szName);
+	for (auto i = 0u; i < uLen; ++i)
+		if (tolower(szArg[i]) != tolower(szName[i])) return false;
+
+	if (szArg[uLen] == ':') szValue = szArg + uLen + 1;
+	else if (szArg[uLen] == '\0') szValue = "";
+	else return false;
+
+	return true;
+}
+
+static vector<string> SplitList(const char *szValue)
+{
+	vector<string> items;
+	string item;
+	for (; *szValue; ++szValue)
+	{
+		if (*szValue == ',')
+		{
+			if (!item.empty()) items.push_back(item);
+			item.clear();
+		}
+		else item += static_cast<char>(tolower(*szValue));
+	}
+	if (!item.empty()) items.push_back(item);
+
+	return items;
+}
+
+static bool ParseArgs(const int argc, char *argv[], TestDesc &desc)
+{
+	desc.uThreads = 4;
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		const char *szValue = nullptr;
+		const auto szArg = argv[i];
+
+		if (GetArg(szArg, "Tests", szValue)) desc.tests = SplitList(szValue);
+		else if (GetArg(szArg, "Threads", szValue)) desc.uThreads = strtoul(szValue, nullptr, 10);
+		else
+		{
+			fprintf(stderr, "Unknown argument %s\n", szArg);
+			return false;
+		}
+	}
+
+	for (const auto &test : desc.tests)
+	{
+		const auto pTest = find_if(begin(g_tests), end(g_tests),
+			[&](const TestCase &t) { return test == t.szName; });
+		if (pTest == end(g_tests))
+		{
+			fprintf(stderr, "Unknown test %s\n", test.c_str());
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void PrintUsage()
+{
+	string names;
+	for (const auto &test : g_tests) names += string(" ") + test.szName;
+
+	printf(
+		"SmokeTest [-Name:value ...]\n"
+		"  -Tests:render,...                 subset of:%s (all)\n"
+		"  -Threads:                         worker threads of the parallel runs, which the\n"
+		"                                    cases compare with 1 thread; 0 for all cores (4)\n",
+		names.c_str());
+}
+
+//--------------------------------------------------------------------------------------
+// Entry point
+//--------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	TestDesc desc;
+	if (!ParseArgs(argc, argv, desc))
+	{
+		PrintUsage();
+
+		return -1;
+	}
+
+	HostThreadPool threadPool(desc.uThreads);
+
+	auto iFailed = 0, iRun = 0;
+	for (const auto &test : g_tests)
+	{
+		if (!desc.tests.empty() && find(desc.tests.cbegin(), desc.tests.cend(), test.szName) == desc.tests.cend())
+			continue;
+
+		printf("%s\n", test.szName);
+		const auto bPassed = test.pTest(threadPool);
+		printf("  %s\n", bPassed ? "ok" : "FAILED");
+		iFailed += bPassed ? 0 : 1;
+		++iRun;
+	}
+	printf("%d of %d passed\n", iRun - iFailed, iRun);
+
+	return iFailed;
+}